@@ -0,0 +1,403 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "access_token.h"
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern "C" {
+#include <src/core/lib/json/json.h>
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "json_util.h"
+#include "log.h"
+#include "metrics.h"
+
+namespace {
+
+const char kGoogleTokenUri[] = "https://oauth2.googleapis.com/token";
+// A token this close to expiry is not handed out, it may run out before
+// the call that carries it starts.
+const std::chrono::seconds kExpirySlack(10);
+
+Counter* RefreshCounter(const char* result) {
+  return MetricsRegistry::Global().GetCounter(
+      "assistant_oauth_refreshes_total",
+      "Access token requests to the token endpoint, by outcome.",
+      std::string("result=\"") + result + "\"");
+}
+
+Counter* const kRefreshesOk = RefreshCounter("ok");
+Counter* const kRefreshesError = RefreshCounter("error");
+Histogram* const kRefreshSeconds = MetricsRegistry::Global().GetHistogram(
+    "assistant_oauth_refresh_seconds",
+    "Time to exchange the refresh token for an access token.",
+    {0.05, 0.1, 0.2, 0.5, 1, 2, 5, 10});
+Counter* const kBlockingFetches = MetricsRegistry::Global().GetCounter(
+    "assistant_oauth_blocking_fetches_total",
+    "Access token requests a call had to wait for.");
+
+// Returns the string or number member |key| of the object |root|, or "".
+std::string JsonMember(grpc_json* root, const char* key) {
+  grpc_json* node = GetJsonValueOrNullFromDict(root, key);
+  JsonStringView value;
+  if (node == nullptr || !GetJsonString(node, &value)) {
+    return "";
+  }
+  return value.ToString();
+}
+
+size_t AppendToString(char* data, size_t size, size_t count, void* user) {
+  static_cast<std::string*>(user)->append(data, size * count);
+  return size * count;
+}
+
+// Aborts a transfer once |*stopping| is set.
+int CheckStopping(void* stopping, curl_off_t, curl_off_t, curl_off_t,
+                  curl_off_t) {
+  return static_cast<std::atomic<bool>*>(stopping)->load() ? 1 : 0;
+}
+
+std::string FormEscape(CURL* curl, const std::string& value) {
+  char* escaped = curl_easy_escape(curl, value.data(), value.size());
+  std::string result(escaped);
+  curl_free(escaped);
+  return result;
+}
+
+// FNV-1a, to tell which refresh token a cached token belongs to without
+// writing the refresh token down.
+std::string Fingerprint(const std::string& value) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : value) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return hex;
+}
+
+// Whether |value| can be written into a JSON string without escaping.
+bool IsPlain(const std::string& value) {
+  return std::all_of(value.begin(), value.end(), [](char c) {
+    return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+  });
+}
+
+}  // namespace
+
+std::unique_ptr<AccessTokenSource> AccessTokenSource::Create(
+    const std::string& credentials_json, const Options& options,
+    std::string* error) {
+  std::unique_ptr<JsonDocument> document = JsonDocument::Parse(credentials_json);
+  if (!document) {
+    *error = "Credentials are not valid JSON";
+    return nullptr;
+  }
+  std::string type = JsonMember(document->root(), "type");
+  std::unique_ptr<AccessTokenSource> source(new AccessTokenSource(options));
+  source->client_id_ = JsonMember(document->root(), "client_id");
+  source->client_secret_ = JsonMember(document->root(), "client_secret");
+  source->refresh_token_ = JsonMember(document->root(), "refresh_token");
+  if ((!type.empty() && type != "authorized_user") ||
+      source->client_id_.empty() || source->client_secret_.empty() ||
+      source->refresh_token_.empty()) {
+    *error = "Credentials need a client_id, client_secret and refresh_token";
+    return nullptr;
+  }
+  if (source->options_.token_uri.empty()) {
+    source->options_.token_uri = JsonMember(document->root(), "token_uri");
+  }
+  if (source->options_.token_uri.empty()) {
+    source->options_.token_uri = kGoogleTokenUri;
+  }
+  static std::once_flag curl_initialized;
+  std::call_once(curl_initialized, []() { curl_global_init(CURL_GLOBAL_ALL); });
+  return source;
+}
+
+AccessTokenSource::~AccessTokenSource() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    changed_.notify_all();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool AccessTokenSource::Start(std::string* error) {
+  bool ok;
+  {
+    std::unique_lock<std::mutex> fetch_lock(fetch_mutex_);
+    ok = LoadCache();
+    bool fresh;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      fresh = ok && Clock::now() < RefreshTime();
+    }
+    if (!fresh) {
+      // A cached token that is about to expire still serves while the
+      // endpoint is unreachable.
+      ok = Fetch(error) || ok;
+    }
+  }
+  thread_ = std::thread([this]() { Run(); });
+  return ok;
+}
+
+bool AccessTokenSource::GetToken(std::string* token, std::string* error) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!token_.empty() && Clock::now() + kExpirySlack < expiry_) {
+      *token = token_;
+      return true;
+    }
+  }
+  kBlockingFetches->Increment();
+  std::unique_lock<std::mutex> fetch_lock(fetch_mutex_);
+  {
+    // Another caller may have fetched it meanwhile.
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!token_.empty() && Clock::now() + kExpirySlack < expiry_) {
+      *token = token_;
+      return true;
+    }
+  }
+  if (!Fetch(error)) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  *token = token_;
+  return true;
+}
+
+std::shared_ptr<grpc::CallCredentials> AccessTokenSource::CallCredentials() {
+  return grpc::MetadataCredentialsFromPlugin(
+      std::unique_ptr<grpc::MetadataCredentialsPlugin>(
+          new AccessTokenPlugin(this)));
+}
+
+int AccessTokenSource::Fetches() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return fetches_;
+}
+
+bool AccessTokenSource::Fetch(std::string* error) {
+  CURL* curl = curl_easy_init();
+  if (curl == nullptr) {
+    *error = "Cannot initialize libcurl";
+    return false;
+  }
+  std::string body = "grant_type=refresh_token&client_id=" +
+                     FormEscape(curl, client_id_) + "&client_secret=" +
+                     FormEscape(curl, client_secret_) + "&refresh_token=" +
+                     FormEscape(curl, refresh_token_);
+  std::string response;
+  curl_easy_setopt(curl, CURLOPT_URL, options_.token_uri.c_str());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendToString);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+                   static_cast<long>(options_.request_timeout.count()));
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CheckStopping);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &stopping_);
+
+  Clock::time_point start = Clock::now();
+  std::chrono::system_clock::time_point wall_start =
+      std::chrono::system_clock::now();
+  CURLcode code = curl_easy_perform(curl);
+  long http_status = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+  curl_easy_cleanup(curl);
+  kRefreshSeconds->Observe(
+      std::chrono::duration<double>(Clock::now() - start).count());
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    fetches_++;
+  }
+
+  if (code != CURLE_OK) {
+    kRefreshesError->Increment();
+    *error = std::string("Token request failed: ") + curl_easy_strerror(code);
+    return false;
+  }
+  std::unique_ptr<JsonDocument> document = JsonDocument::Parse(response);
+  std::string token, expires_in;
+  if (document) {
+    token = JsonMember(document->root(), "access_token");
+    expires_in = JsonMember(document->root(), "expires_in");
+  }
+  if (http_status != 200 || token.empty() || atoi(expires_in.c_str()) <= 0) {
+    kRefreshesError->Increment();
+    std::stringstream message;
+    message << "Token endpoint returned HTTP " << http_status;
+    if (document) {
+      std::string reason = JsonMember(document->root(), "error");
+      std::string description =
+          JsonMember(document->root(), "error_description");
+      if (!reason.empty()) {
+        message << ": " << reason;
+      }
+      if (!description.empty()) {
+        message << " (" << description << ")";
+      }
+    }
+    *error = message.str();
+    return false;
+  }
+
+  // The lifetime counts from when the request was sent, to err early.
+  std::chrono::seconds lifetime(atoi(expires_in.c_str()));
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    token_ = token;
+    issued_ = start;
+    expiry_ = start + lifetime;
+    changed_.notify_all();
+  }
+  kRefreshesOk->Increment();
+  LOG(INFO) << "Access token refreshed, valid for " << lifetime.count() << "s";
+  SaveCache(token, wall_start + lifetime);
+  return true;
+}
+
+bool AccessTokenSource::LoadCache() {
+  if (options_.cache_path.empty()) {
+    return false;
+  }
+  std::ifstream file(options_.cache_path);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  std::unique_ptr<JsonDocument> document = JsonDocument::Parse(buffer.str());
+  if (!document ||
+      JsonMember(document->root(), "client_id") != client_id_ ||
+      JsonMember(document->root(), "refresh_token_fingerprint") !=
+          Fingerprint(refresh_token_)) {
+    return false;
+  }
+  std::string token = JsonMember(document->root(), "access_token");
+  // Wall clock time, the only one that survives a restart.
+  std::chrono::system_clock::time_point expiry(std::chrono::seconds(
+      atoll(JsonMember(document->root(), "expires_at").c_str())));
+  Clock::duration remaining = expiry - std::chrono::system_clock::now();
+  if (token.empty() || remaining <= kExpirySlack) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  token_ = token;
+  issued_ = Clock::now();
+  expiry_ = issued_ + remaining;
+  return true;
+}
+
+void AccessTokenSource::SaveCache(
+    const std::string& token, std::chrono::system_clock::time_point expiry) {
+  if (options_.cache_path.empty() || !IsPlain(token) || !IsPlain(client_id_)) {
+    return;
+  }
+  std::stringstream json;
+  json << "{\"client_id\": \"" << client_id_
+       << "\", \"refresh_token_fingerprint\": \"" << Fingerprint(refresh_token_)
+       << "\", \"access_token\": \"" << token << "\", \"expires_at\": "
+       << std::chrono::duration_cast<std::chrono::seconds>(
+              expiry.time_since_epoch()).count()
+       << "}\n";
+  std::string contents = json.str();
+  // Written aside and renamed, so a crash never leaves half a token.
+  std::string temp_path = options_.cache_path + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    LOG(WARNING) << "Cannot write token cache " << temp_path << ": "
+                 << strerror(errno);
+    return;
+  }
+  bool ok = write(fd, contents.data(), contents.size()) ==
+            static_cast<ssize_t>(contents.size());
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), options_.cache_path.c_str()) != 0) {
+    LOG(WARNING) << "Cannot write token cache " << options_.cache_path;
+    unlink(temp_path.c_str());
+  }
+}
+
+grpc::Status AccessTokenPlugin::GetMetadata(
+    grpc::string_ref service_url, grpc::string_ref method_name,
+    const grpc::AuthContext& channel_auth_context,
+    std::multimap<grpc::string, grpc::string>* metadata) {
+  std::string token, error;
+  if (!source_->GetToken(&token, &error)) {
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, error);
+  }
+  metadata->insert(std::make_pair("authorization", "Bearer " + token));
+  return grpc::Status::OK;
+}
+
+AccessTokenSource::Clock::time_point AccessTokenSource::RefreshTime() const {
+  if (token_.empty()) {
+    return Clock::time_point();
+  }
+  Clock::duration margin = std::min<Clock::duration>(
+      options_.refresh_margin, (expiry_ - issued_) / 2);
+  return expiry_ - margin;
+}
+
+void AccessTokenSource::Run() {
+  std::chrono::milliseconds backoff = options_.retry_min;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    Clock::time_point due = RefreshTime();
+    if (Clock::now() < due) {
+      // Also wakes up when a caller fetched a token, to move |due|.
+      changed_.wait_until(lock, due);
+      continue;
+    }
+    lock.unlock();
+    std::string error;
+    bool ok;
+    {
+      std::unique_lock<std::mutex> fetch_lock(fetch_mutex_);
+      lock.lock();
+      // A caller may have fetched it meanwhile.
+      bool fresh = Clock::now() < RefreshTime();
+      lock.unlock();
+      ok = fresh || Fetch(&error);
+    }
+    lock.lock();
+    if (ok) {
+      backoff = options_.retry_min;
+    } else if (!stopping_) {
+      LOG(WARNING) << error << ", retrying in " << backoff.count() << "ms";
+      changed_.wait_for(lock, backoff);
+      backoff = std::min(backoff * 2, options_.retry_max);
+    }
+  }
+}
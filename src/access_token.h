@@ -0,0 +1,134 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef ACCESS_TOKEN_H
+#define ACCESS_TOKEN_H
+
+#include <grpc++/grpc++.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Keeps an OAuth2 access token for the user account of a credentials.json
+// ready before a dialog needs it. The refresh token is exchanged at
+// startup and again in the background well before the access token
+// expires, so no Assist call waits for the token endpoint unless the
+// background refresh kept failing until the token ran out. The token can
+// be kept in a file across restarts.
+//
+// Exported metrics:
+//   assistant_oauth_refreshes_total{result="ok|error"}
+//   assistant_oauth_refresh_seconds, the token endpoint round trip
+//   assistant_oauth_blocking_fetches_total, fetches a call had to wait for
+class AccessTokenSource {
+ public:
+  struct Options {
+    // Where the refresh token is exchanged. Empty for the token_uri of the
+    // credentials, or Google's.
+    std::string token_uri;
+    // A token is refreshed this long before it expires, or at half its
+    // lifetime if that is shorter.
+    std::chrono::seconds refresh_margin{300};
+    // Failed refreshes are retried with exponential backoff between these.
+    std::chrono::milliseconds retry_min{1000};
+    std::chrono::milliseconds retry_max{60000};
+    std::chrono::milliseconds request_timeout{10000};
+    // If set, the token is kept in this file, readable by the owner only.
+    std::string cache_path;
+  };
+
+  // Returns nullptr and sets |*error| if |credentials_json| is not an
+  // authorized_user credentials file with a client id, a client secret and
+  // a refresh token.
+  static std::unique_ptr<AccessTokenSource> Create(
+      const std::string& credentials_json, const Options& options,
+      std::string* error);
+  // Stops the background refresh.
+  ~AccessTokenSource();
+
+  // Loads the cached token, fetches one if it is missing or about to
+  // expire, and starts refreshing in the background. Returns false and sets
+  // |*error| if there is no token yet; the background refresh keeps trying.
+  bool Start(std::string* error);
+
+  // Sets |*token| to a token that has not expired, fetching one if needed.
+  // Thread-safe.
+  bool GetToken(std::string* token, std::string* error);
+
+  // Call credentials that send the token as "authorization: Bearer ...".
+  // The source must outlive them.
+  std::shared_ptr<grpc::CallCredentials> CallCredentials();
+
+  // Token endpoint requests made so far.
+  int Fetches() const;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  explicit AccessTokenSource(const Options& options) : options_(options) {}
+
+  // Exchanges the refresh token. Called with |fetch_mutex_| held.
+  bool Fetch(std::string* error);
+  bool LoadCache();
+  void SaveCache(const std::string& token,
+                 std::chrono::system_clock::time_point expiry);
+  // When the token should be refreshed. Called with |mutex_| held.
+  Clock::time_point RefreshTime() const;
+  void Run();
+
+  Options options_;
+  std::string client_id_;
+  std::string client_secret_;
+  std::string refresh_token_;
+
+  // Serializes requests to the token endpoint.
+  std::mutex fetch_mutex_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  std::string token_;
+  Clock::time_point issued_;
+  Clock::time_point expiry_;
+  int fetches_ = 0;
+  // Also read by transfers, to abort.
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+// Sends the token of an AccessTokenSource as "authorization: Bearer ...".
+// The plugin is blocking, so gRPC calls it off its own threads: the rare
+// call that has to wait for a fetch stalls only itself.
+class AccessTokenPlugin : public grpc::MetadataCredentialsPlugin {
+ public:
+  explicit AccessTokenPlugin(AccessTokenSource* source) : source_(source) {}
+
+  grpc::Status GetMetadata(
+      grpc::string_ref service_url, grpc::string_ref method_name,
+      const grpc::AuthContext& channel_auth_context,
+      std::multimap<grpc::string, grpc::string>* metadata) override;
+
+ private:
+  AccessTokenSource* source_;
+};
+
+#endif
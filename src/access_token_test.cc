@@ -0,0 +1,295 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "access_token.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const char kCredentials[] = R"({
+  "client_id": "client.apps.googleusercontent.com",
+  "client_secret": "secret",
+  "refresh_token": "1/refresh+token",
+  "type": "authorized_user"
+})";
+
+// A token endpoint on a local port. Every request is answered by
+// |reply|, given the request number, with an HTTP status and a JSON body.
+class FakeTokenEndpoint {
+ public:
+  typedef std::function<std::pair<int, std::string>(int)> Reply;
+
+  explicit FakeTokenEndpoint(Reply reply) : reply_(reply) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    socklen_t size = sizeof(address);
+    getsockname(fd_, reinterpret_cast<sockaddr*>(&address), &size);
+    port_ = ntohs(address.sin_port);
+    listen(fd_, 8);
+    thread_ = std::thread([this]() { Serve(); });
+  }
+
+  ~FakeTokenEndpoint() {
+    shutdown(fd_, SHUT_RDWR);
+    close(fd_);
+    thread_.join();
+  }
+
+  std::string Uri() const {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/token";
+  }
+  int Requests() const { return requests_; }
+  std::string LastBody() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return last_body_;
+  }
+  void SetReply(Reply reply) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    reply_ = reply;
+  }
+
+ private:
+  void Serve() {
+    while (true) {
+      int connection = accept(fd_, nullptr, nullptr);
+      if (connection < 0) {
+        return;
+      }
+      std::string request;
+      char buffer[4096];
+      size_t header_end = std::string::npos;
+      size_t content_length = 0;
+      while (true) {
+        ssize_t n = read(connection, buffer, sizeof(buffer));
+        if (n <= 0) {
+          break;
+        }
+        request.append(buffer, n);
+        if (header_end == std::string::npos) {
+          header_end = request.find("\r\n\r\n");
+          size_t length = request.find("Content-Length: ");
+          if (length != std::string::npos) {
+            content_length = atoi(request.c_str() + length + 16);
+          }
+        }
+        if (header_end != std::string::npos &&
+            request.size() >= header_end + 4 + content_length) {
+          break;
+        }
+      }
+      std::pair<int, std::string> reply;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (header_end != std::string::npos) {
+          last_body_ = request.substr(header_end + 4);
+        }
+        reply = reply_(requests_++);
+      }
+      std::string response = "HTTP/1.1 " + std::to_string(reply.first) +
+                             " X\r\nContent-Type: application/json\r\n"
+                             "Content-Length: " +
+                             std::to_string(reply.second.size()) +
+                             "\r\nConnection: close\r\n\r\n" + reply.second;
+      write(connection, response.data(), response.size());
+      close(connection);
+    }
+  }
+
+  Reply reply_;
+  int fd_;
+  int port_;
+  std::atomic<int> requests_{0};
+  std::mutex mutex_;
+  std::string last_body_;
+  std::thread thread_;
+};
+
+FakeTokenEndpoint::Reply Tokens(int expires_in) {
+  return [expires_in](int request) {
+    return std::make_pair(
+        200, "{\"access_token\": \"token-" + std::to_string(request + 1) +
+                 "\", \"expires_in\": " + std::to_string(expires_in) +
+                 ", \"token_type\": \"Bearer\"}");
+  };
+}
+
+// An AuthContext for calling the plugin outside a channel.
+class NoAuthContext : public grpc::AuthContext {
+ public:
+  class Iterator : public grpc::AuthPropertyIterator {};
+
+  bool IsPeerAuthenticated() const override { return false; }
+  std::vector<grpc::string_ref> GetPeerIdentity() const override { return {}; }
+  std::string GetPeerIdentityPropertyName() const override { return ""; }
+  std::vector<grpc::string_ref> FindPropertyValues(
+      const std::string& name) const override {
+    return {};
+  }
+  grpc::AuthPropertyIterator begin() const override { return Iterator(); }
+  grpc::AuthPropertyIterator end() const override { return Iterator(); }
+  void AddProperty(const std::string& key,
+                   const grpc::string_ref& value) override {}
+  bool SetPeerIdentityPropertyName(const std::string& name) override {
+    return false;
+  }
+};
+
+std::unique_ptr<AccessTokenSource> NewSource(
+    const FakeTokenEndpoint& endpoint, AccessTokenSource::Options options) {
+  options.token_uri = endpoint.Uri();
+  std::string error;
+  std::unique_ptr<AccessTokenSource> source =
+      AccessTokenSource::Create(kCredentials, options, &error);
+  if (!source) {
+    std::cerr << "Test failed, " << error << std::endl;
+    exit(1);
+  }
+  return source;
+}
+
+}  // namespace
+
+int main() {
+  // The token is fetched at startup, and calls then get it without a
+  // request of their own.
+  {
+    FakeTokenEndpoint endpoint(Tokens(3600));
+    std::unique_ptr<AccessTokenSource> source =
+        NewSource(endpoint, AccessTokenSource::Options());
+    std::string error;
+    if (!source->Start(&error) || endpoint.Requests() != 1) {
+      std::cerr << "Test failed, start: " << error << std::endl;
+      return 1;
+    }
+    if (endpoint.LastBody() !=
+        "grant_type=refresh_token&client_id=client.apps.googleusercontent.com"
+        "&client_secret=secret&refresh_token=1%2Frefresh%2Btoken") {
+      std::cerr << "Test failed, request " << endpoint.LastBody() << std::endl;
+      return 1;
+    }
+    AccessTokenPlugin plugin(source.get());
+    std::multimap<grpc::string, grpc::string> metadata;
+    grpc::Status status = plugin.GetMetadata(
+        "https://embeddedassistant.googleapis.com",
+        "Assist", NoAuthContext(), &metadata);
+    if (!status.ok() || metadata.size() != 1 ||
+        metadata.begin()->first != "authorization" ||
+        metadata.begin()->second != "Bearer token-1" ||
+        endpoint.Requests() != 1) {
+      std::cerr << "Test failed, metadata " << status.error_message()
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // A short-lived token is replaced in the background at half its lifetime,
+  // before callers see it expire.
+  {
+    FakeTokenEndpoint endpoint(Tokens(2));
+    std::unique_ptr<AccessTokenSource> source =
+        NewSource(endpoint, AccessTokenSource::Options());
+    std::string error, token;
+    source->Start(&error);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    if (endpoint.Requests() != 2 || source->Fetches() != 2) {
+      std::cerr << "Test failed, " << endpoint.Requests()
+                << " requests after 1.5s" << std::endl;
+      return 1;
+    }
+  }
+
+  // A failed refresh reports why, and is retried with backoff until the
+  // endpoint recovers.
+  {
+    FakeTokenEndpoint endpoint([](int) {
+      return std::make_pair(400,
+                            "{\"error\": \"invalid_grant\", "
+                            "\"error_description\": \"Bad Request\"}");
+    });
+    AccessTokenSource::Options options;
+    options.retry_min = std::chrono::milliseconds(20);
+    options.retry_max = std::chrono::milliseconds(80);
+    std::unique_ptr<AccessTokenSource> source = NewSource(endpoint, options);
+    std::string error, token;
+    if (source->Start(&error) ||
+        error != "Token endpoint returned HTTP 400: invalid_grant "
+                 "(Bad Request)") {
+      std::cerr << "Test failed, error " << error << std::endl;
+      return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    int failed = endpoint.Requests();
+    endpoint.SetReply(Tokens(3600));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // 1 + retries after 20, 40, 80, 80... ms. One more may have failed
+    // before the endpoint recovered.
+    if (failed < 3 || failed > 8 || !source->GetToken(&token, &error) ||
+        endpoint.Requests() < failed + 1 || endpoint.Requests() > failed + 2) {
+      std::cerr << "Test failed, " << failed << " failed requests, then "
+                << endpoint.Requests() << ", token " << token << std::endl;
+      return 1;
+    }
+  }
+
+  // The token is kept across restarts, but not for other credentials.
+  {
+    char path[] = "/tmp/access_token_test.XXXXXX";
+    close(mkstemp(path));
+    AccessTokenSource::Options options;
+    options.cache_path = path;
+    FakeTokenEndpoint endpoint(Tokens(3600));
+    std::string error, token;
+    NewSource(endpoint, options)->Start(&error);
+    std::unique_ptr<AccessTokenSource> restarted = NewSource(endpoint, options);
+    if (!restarted->Start(&error) || !restarted->GetToken(&token, &error) ||
+        token != "token-1" || endpoint.Requests() != 1) {
+      std::cerr << "Test failed, cached token " << token << ", "
+                << endpoint.Requests() << " requests" << std::endl;
+      return 1;
+    }
+
+    std::string other = kCredentials;
+    other.replace(other.find("1/refresh"), 9, "2/refresh");
+    options.token_uri = endpoint.Uri();
+    std::unique_ptr<AccessTokenSource> other_account =
+        AccessTokenSource::Create(other, options, &error);
+    if (!other_account->Start(&error) || endpoint.Requests() != 2) {
+      std::cerr << "Test failed, cache used for other credentials"
+                << std::endl;
+      return 1;
+    }
+    unlink(path);
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
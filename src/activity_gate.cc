@@ -0,0 +1,118 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "activity_gate.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const int kSampleRate = 16000;
+
+int64_t SumOfSquares(const int16_t* samples, size_t count) {
+  size_t i = 0;
+  int64_t sum = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int64x2_t acc = vdupq_n_s64(0);
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vld1q_s16(samples + i);
+    // Each product fits in int32, a sum of two may not.
+    acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+    acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+  }
+  sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+    // Pairwise sums are at most 2^31, so they are widened as unsigned.
+    __m128i squares = _mm_madd_epi16(v, v);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+  sum = lanes[0] + lanes[1];
+#endif
+  for (; i < count; i++) {
+    sum += static_cast<int32_t>(samples[i]) * samples[i];
+  }
+  return sum;
+}
+
+double LevelDb(const int16_t* samples, size_t count) {
+  if (count == 0) {
+    return -100;
+  }
+  return 10 * std::log10(static_cast<double>(SumOfSquares(samples, count))
+                         / count / (32768.0 * 32768.0) + 1e-10);
+}
+
+ActivityGate::ActivityGate(const Options& options) : options_(options) {
+  Reset();
+}
+
+void ActivityGate::Reset() {
+  open_ = false;
+  has_floor_ = false;
+  quiet_samples_ = 0;
+}
+
+int ActivityGate::Process(const int16_t* samples, size_t count) {
+  if (count == 0) {
+    return 0;
+  }
+  double level_db = LevelDb(samples, count);
+  if (!has_floor_) {
+    floor_db_ = level_db;
+    has_floor_ = true;
+  }
+  bool active = level_db >= std::max(options_.min_db,
+                                     floor_db_ + options_.margin_db);
+
+  // The floor drops quickly to quieter hops and rises slowly, so that speech
+  // does not raise it much.
+  if (level_db < floor_db_) {
+    floor_db_ = (floor_db_ + level_db) / 2;
+  } else {
+    floor_db_ = std::min(level_db, floor_db_ + options_.floor_rise_db_per_second
+                                                   * count / kSampleRate);
+  }
+
+  if (active) {
+    quiet_samples_ = 0;
+    if (!open_) {
+      open_ = true;
+      size_t lookback = static_cast<size_t>(options_.lookback_ms) * kSampleRate / 1000;
+      return 1 + static_cast<int>((lookback + count - 1) / count);
+    }
+    return 1;
+  }
+  if (open_) {
+    quiet_samples_ += count;
+    if (quiet_samples_ * 1000 <= static_cast<uint64_t>(options_.hangover_ms) * kSampleRate) {
+      return 1;
+    }
+    open_ = false;
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef ACTIVITY_GATE_H
+#define ACTIVITY_GATE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Sum of the squared samples, vectorized with NEON or SSE2 where available.
+int64_t SumOfSquares(const int16_t* samples, size_t count);
+
+// Level of |samples| in dBFS.
+double LevelDb(const int16_t* samples, size_t count);
+
+// Cheap acoustic activity detector that sits in front of a keyword spotter,
+// so that the spotter only runs while there is sound. Input is mono, s16_le,
+// 16000Hz, in hops of constant size.
+//
+// A hop is active when its level is |margin_db| above the tracked noise
+// floor. The gate stays open for |hangover_ms| after the last active hop, so
+// the spotter sees the whole keyword and can decide on it. When the gate
+// opens, the caller replays the preceding |lookback_ms| so that a soft
+// keyword onset is not lost.
+class ActivityGate {
+ public:
+  struct Options {
+    // Hops quieter than this (dBFS) are never active.
+    double min_db = -60;
+    double margin_db = 6;
+    // How fast the noise floor follows a louder signal.
+    double floor_rise_db_per_second = 3;
+    int hangover_ms = 1000;
+    int lookback_ms = 400;
+  };
+
+  ActivityGate() : ActivityGate(Options()) {}
+  explicit ActivityGate(const Options& options);
+
+  void Reset();
+  // Classifies the next hop. Returns how many hops, ending with this one,
+  // should be fed to the spotter: 0 while the gate is closed, 1 while it is
+  // open, and 1 plus the lookback on the hop that opens it.
+  int Process(const int16_t* samples, size_t count);
+
+  bool IsOpen() const { return open_; }
+
+ private:
+  Options options_;
+  bool open_ = false;
+  bool has_floor_ = false;
+  double floor_db_ = 0;
+  // Samples since the last active hop.
+  uint64_t quiet_samples_ = 0;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "activity_gate.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Appends |ms| of a 440Hz tone with |amplitude|, plus noise of |noise|.
+void append(std::vector<int16_t>* audio, int ms, int amplitude, int noise) {
+  size_t start = audio->size();
+  for (int i = 0; i < ms * 16; i++) {
+    int value = amplitude * std::sin(2 * M_PI * 440 * (start + i) / 16000.0);
+    if (noise > 0) {
+      value += rand() % (2 * noise + 1) - noise;
+    }
+    audio->push_back(static_cast<int16_t>(value));
+  }
+}
+
+int main() {
+  // The vector path agrees with a plain loop, including at full scale and
+  // for lengths that leave a tail.
+  std::vector<int16_t> samples;
+  for (int i = 0; i < 1003; i++) {
+    samples.push_back(i % 7 == 0 ? -32768 : static_cast<int16_t>(rand()));
+  }
+  for (size_t count : {0, 1, 7, 8, 9, 320, 1003}) {
+    int64_t expected = 0;
+    for (size_t i = 0; i < count; i++) {
+      expected += static_cast<int64_t>(samples[i]) * samples[i];
+    }
+    if (SumOfSquares(samples.data(), count) != expected) {
+      std::cerr << "Test failed, SumOfSquares of " << count << " samples" << std::endl;
+      return 1;
+    }
+  }
+
+  // Steady noise stays gated; a tone opens the gate with the lookback, and
+  // it closes again after the hangover.
+  std::vector<int16_t> audio;
+  append(&audio, 2000, 0, 300);
+  append(&audio, 500, 8000, 300);
+  append(&audio, 2000, 0, 300);
+  ActivityGate gate;
+  const int kHop = 320;
+  int open_hop = -1, close_hop = -1, lookback = 0, fed = 0;
+  for (int hop = 0; (hop + 1) * kHop <= static_cast<int>(audio.size()); hop++) {
+    int feed = gate.Process(&audio[hop * kHop], kHop);
+    if (feed > 1) {
+      open_hop = hop;
+      lookback = feed - 1;
+    }
+    if (feed == 0 && open_hop >= 0 && close_hop < 0) {
+      close_hop = hop;
+    }
+    fed += feed > 0 ? 1 : 0;
+  }
+  // 20 ms hops: the tone starts at hop 100 and ends at hop 125.
+  if (open_hop != 100 || lookback != 20) {
+    std::cerr << "Test failed, gate opened at hop " << open_hop
+              << " with lookback " << lookback << std::endl;
+    return 1;
+  }
+  if (close_hop != 175) {
+    std::cerr << "Test failed, gate closed at hop " << close_hop << std::endl;
+    return 1;
+  }
+  if (fed != 75) {
+    std::cerr << "Test failed, fed " << fed << " hops" << std::endl;
+    return 1;
+  }
+
+  // Reset() forgets the noise floor and closes the gate.
+  gate.Reset();
+  if (gate.IsOpen() || gate.Process(&audio[0], kHop) != 0) {
+    std::cerr << "Test failed after Reset" << std::endl;
+    return 1;
+  }
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,334 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "alsa_capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "audio_shm.h"
+#include "beamformer.h"
+#include "dsp_pipeline.h"
+#include "log.h"
+#include "metrics.h"
+
+namespace {
+
+double Seconds(const timespec& time) {
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+double MonotonicSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return Seconds(now);
+}
+
+}  // namespace
+
+AlsaCapture::AlsaCapture(const std::string& source) {
+  MetricsRegistry& registry = MetricsRegistry::Global();
+  std::string labels = "source=\"" + source + "\"";
+  xruns_ = registry.GetCounter(
+      "assistant_capture_xruns_total", "ALSA capture overruns.", labels);
+  suspends_ = registry.GetCounter(
+      "assistant_capture_suspends_total", "ALSA capture suspends.", labels);
+  reopens_ = registry.GetCounter(
+      "assistant_capture_reopens_total",
+      "Capture devices reopened after they failed.", labels);
+  lost_frames_total_ = registry.GetCounter(
+      "assistant_capture_lost_frames_total",
+      "Frames lost while the capture device recovered.", labels);
+  recovery_seconds_ = registry.GetHistogram(
+      "assistant_capture_recovery_seconds",
+      "Time from a capture error until audio flowed again.",
+      {0.001, 0.005, 0.02, 0.1, 0.5, 2, 10}, labels);
+  steered_ = registry.GetGauge(
+      "assistant_capture_beamformer_steered",
+      "1 while the microphone array is mixed by delay-and-sum, 0 while the "
+      "best channel is selected.", labels);
+}
+
+AlsaCapture::~AlsaCapture() {
+  Close();
+}
+
+void AlsaCapture::SetChannels(int channels) {
+  channels_ = std::max(1, channels);
+}
+
+void AlsaCapture::SetPipeline(std::shared_ptr<DspPipeline> pipeline) {
+  pipeline_ = std::move(pipeline);
+}
+
+bool AlsaCapture::Open(const std::string& device, unsigned int rate,
+                       snd_pcm_uframes_t period_frames,
+                       snd_pcm_uframes_t buffer_frames, bool nonblocking) {
+  Close();
+  device_ = device;
+  rate_ = rate;
+  period_frames_ = period_frames;
+  buffer_frames_ = buffer_frames;
+  nonblocking_ = nonblocking;
+  position_ = 0;
+  next_position_ = 0;
+  has_next_time_ = false;
+  discontinuity_ = false;
+  lost_frames_ = 0;
+  recovering_ = false;
+  if (channels_ > 1) {
+    Beamformer::Options options;
+    options.channels = channels_;
+    beamformer_.reset(new Beamformer(options));
+    LOG(INFO) << "AlsaCapture beamforming " << channels_ << " channels of "
+              << device;
+  } else {
+    beamformer_.reset();
+  }
+  if (pipeline_) {
+    pipeline_->Restart();
+  }
+  return OpenDevice();
+}
+
+void AlsaCapture::Close() {
+  if (pcm_ != nullptr) {
+    snd_pcm_close(pcm_);
+    pcm_ = nullptr;
+  }
+}
+
+bool AlsaCapture::OpenDevice() {
+  int ret = snd_pcm_open(&pcm_, device_.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+  if (ret < 0) {
+    LOG(ERROR) << "AlsaCapture snd_pcm_open returned " << ret;
+    pcm_ = nullptr;
+    return false;
+  }
+  if (nonblocking_) {
+    ret = snd_pcm_nonblock(pcm_, SND_PCM_NONBLOCK);
+    if (ret < 0) {
+      LOG(ERROR) << "AlsaCapture snd_pcm_nonblock returned " << ret;
+      Close();
+      return false;
+    }
+  }
+
+  snd_pcm_hw_params_t* hw_params;
+  ret = snd_pcm_hw_params_malloc(&hw_params);
+  if (ret < 0) {
+    LOG(ERROR) << "AlsaCapture snd_pcm_hw_params_malloc returned " << ret;
+    Close();
+    return false;
+  }
+  snd_pcm_hw_params_any(pcm_, hw_params);
+  ret = snd_pcm_hw_params_set_access(pcm_, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+  if (ret >= 0) {
+    ret = snd_pcm_hw_params_set_format(pcm_, hw_params, SND_PCM_FORMAT_S16_LE);
+  }
+  if (ret >= 0) {
+    ret = snd_pcm_hw_params_set_channels(pcm_, hw_params, channels_);
+  }
+  unsigned int rate = rate_;
+  if (ret >= 0) {
+    ret = snd_pcm_hw_params_set_rate_near(pcm_, hw_params, &rate, nullptr);
+  }
+  if (ret < 0) {
+    LOG(ERROR) << "AlsaCapture cannot set S16_LE " << channels_ << " channel "
+               << rate_ << "Hz: " << ret;
+    snd_pcm_hw_params_free(hw_params);
+    Close();
+    return false;
+  }
+  // Period and buffer sizes are only hints.
+  if (period_frames_ > 0) {
+    snd_pcm_uframes_t frames = period_frames_;
+    ret = snd_pcm_hw_params_set_period_size_near(pcm_, hw_params, &frames, nullptr);
+    if (ret < 0) {
+      LOG(WARNING) << "AlsaCapture snd_pcm_hw_params_set_period_size_near returned " << ret;
+    }
+  }
+  if (buffer_frames_ > 0) {
+    snd_pcm_uframes_t frames = buffer_frames_;
+    ret = snd_pcm_hw_params_set_buffer_size_near(pcm_, hw_params, &frames);
+    if (ret < 0) {
+      LOG(WARNING) << "AlsaCapture snd_pcm_hw_params_set_buffer_size_near returned " << ret;
+    }
+  }
+  ret = snd_pcm_hw_params(pcm_, hw_params);
+  snd_pcm_hw_params_free(hw_params);
+  if (ret < 0) {
+    LOG(ERROR) << "AlsaCapture snd_pcm_hw_params returned " << ret;
+    Close();
+    return false;
+  }
+
+  // Monotonic timestamps make snd_pcm_htimestamp() usable for gap
+  // measurement. Without them the system clock at read time is used.
+  snd_pcm_sw_params_t* sw_params;
+  if (snd_pcm_sw_params_malloc(&sw_params) == 0) {
+    snd_pcm_sw_params_current(pcm_, sw_params);
+    snd_pcm_sw_params_set_tstamp_mode(pcm_, sw_params, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(pcm_, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+    ret = snd_pcm_sw_params(pcm_, sw_params);
+    if (ret < 0) {
+      LOG(WARNING) << "AlsaCapture snd_pcm_sw_params returned " << ret;
+    }
+    snd_pcm_sw_params_free(sw_params);
+  }
+  LOG(DEBUG) << "AlsaCapture opened " << device_;
+  return true;
+}
+
+snd_pcm_sframes_t AlsaCapture::Read(void* buffer, snd_pcm_uframes_t frames) {
+  if (pcm_ == nullptr) {
+    return -EBADFD;
+  }
+  // An array is read into |interleaved_| and beamformed into |buffer|.
+  void* read_buffer = buffer;
+  if (beamformer_) {
+    if (interleaved_.size() < frames * channels_) {
+      interleaved_.resize(frames * channels_);
+    }
+    read_buffer = interleaved_.data();
+  }
+  for (int recoveries = 0;; recoveries++) {
+    snd_pcm_sframes_t ret = snd_pcm_readi(pcm_, read_buffer, frames);
+    if (ret == -EAGAIN) {
+      return 0;
+    }
+    if (ret >= 0) {
+      if (ret > 0) {
+        if (beamformer_) {
+          beamformer_->Process(interleaved_.data(), ret,
+                               static_cast<int16_t*>(buffer));
+          steered_->Set(beamformer_->Steered() ? 1 : 0);
+        }
+        OnFrames(ret);
+        if (AudioShmWriter* shm = AudioShmWriter::Active()) {
+          shm->Write(this, position_, timestamp_, discontinuity_,
+                     static_cast<const int16_t*>(buffer), ret);
+        }
+        if (pipeline_) {
+          pipeline_->Process(static_cast<int16_t*>(buffer), ret);
+        }
+      }
+      return ret;
+    }
+    if (recoveries == kMaxRecoveriesPerRead || !Recover(ret)) {
+      LOG(ERROR) << "AlsaCapture cannot recover " << device_ << " from " << ret;
+      Close();
+      return ret;
+    }
+  }
+}
+
+bool AlsaCapture::Recover(int error) {
+  if (!recovering_) {
+    recovering_ = true;
+    error_time_ = MonotonicSeconds();
+  }
+  int ret = error;
+  switch (error) {
+    case -EPIPE:
+      // Overrun: the buffer filled up before it was read.
+      xruns_->Increment();
+      LOG(WARNING) << "AlsaCapture overrun on " << device_;
+      ret = snd_pcm_prepare(pcm_);
+      break;
+    case -ESTRPIPE:
+      suspends_->Increment();
+      LOG(WARNING) << "AlsaCapture " << device_ << " suspended";
+      for (int i = 0; i < kMaxResumeAttempts; i++) {
+        ret = snd_pcm_resume(pcm_);
+        if (ret != -EAGAIN) {
+          break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      if (ret < 0) {
+        // The driver cannot resume, restart the stream instead.
+        ret = snd_pcm_prepare(pcm_);
+      }
+      break;
+    case -EBADFD:
+      ret = snd_pcm_prepare(pcm_);
+      break;
+    default:
+      // -ENODEV, -EIO and the like: the device went away.
+      break;
+  }
+  if (ret >= 0) {
+    return true;
+  }
+  return Reopen();
+}
+
+bool AlsaCapture::Reopen() {
+  reopens_->Increment();
+  Close();
+  std::chrono::milliseconds backoff(100);
+  for (int attempt = 0; attempt < kMaxReopenAttempts; attempt++) {
+    LOG(WARNING) << "AlsaCapture reopening " << device_ << ", attempt " << attempt + 1;
+    std::this_thread::sleep_for(backoff);
+    if (OpenDevice()) {
+      return true;
+    }
+    backoff = std::min(backoff * 2, std::chrono::milliseconds(1000));
+  }
+  return false;
+}
+
+void AlsaCapture::OnFrames(snd_pcm_sframes_t frames) {
+  // The first frame read was captured |avail| + |frames| frames before the
+  // timestamp of the hardware pointer.
+  snd_pcm_uframes_t avail = 0;
+  snd_htimestamp_t tstamp = {0, 0};
+  double first_time;
+  if (snd_pcm_htimestamp(pcm_, &avail, &tstamp) == 0
+      && (tstamp.tv_sec != 0 || tstamp.tv_nsec != 0)) {
+    first_time = Seconds(tstamp) - static_cast<double>(avail + frames) / rate_;
+  } else {
+    first_time = MonotonicSeconds() - static_cast<double>(frames) / rate_;
+  }
+
+  discontinuity_ = false;
+  if (recovering_) {
+    recovering_ = false;
+    uint64_t lost = 0;
+    if (has_next_time_) {
+      lost = static_cast<uint64_t>(
+          std::max(0.0, std::round((first_time - next_time_) * rate_)));
+    }
+    double recovery = MonotonicSeconds() - error_time_;
+    recovery_seconds_->Observe(recovery);
+    lost_frames_ += lost;
+    lost_frames_total_->Increment(lost);
+    next_position_ += lost;
+    discontinuity_ = true;
+    LOG(WARNING) << "AlsaCapture " << device_ << " recovered after "
+                 << recovery * 1000 << "ms, lost " << lost << " frames";
+  }
+
+  position_ = next_position_;
+  next_position_ += frames;
+  next_time_ = first_time + static_cast<double>(frames) / rate_;
+  has_next_time_ = true;
+  timestamp_.tv_sec = static_cast<time_t>(first_time);
+  timestamp_.tv_nsec = static_cast<long>((first_time - timestamp_.tv_sec) * 1e9);
+}
@@ -0,0 +1,124 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef ALSA_CAPTURE_H
+#define ALSA_CAPTURE_H
+
+#include <alsa/asoundlib.h>
+#include <time.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Beamformer;
+class Counter;
+class DspPipeline;
+class Gauge;
+class Histogram;
+
+// Mono S16_LE capture from an ALSA device that heals itself. The device is
+// one microphone, or an array whose channels a Beamformer mixes into the mono
+// stream Read() returns. Read() recovers
+// from overruns with snd_pcm_prepare, from suspends with snd_pcm_resume, and
+// from a device that went away by reopening it, each with bounded retries.
+//
+// While an AudioShmWriter is active, every read is also published into it
+// for other processes, before this consumer's DspPipeline conditions it.
+//
+// Every frame has a stream position. Frames lost while recovering are
+// measured from the capture timestamps and counted in the positions, so
+// positions stay sample-accurate across gaps.
+class AlsaCapture {
+ public:
+  // |source| labels the metrics, e.g. "keyword".
+  explicit AlsaCapture(const std::string& source);
+  ~AlsaCapture();
+
+  // Number of microphones to capture from the next Open() on, 1 by default.
+  // With more, Read() returns them beamformed and |max_delay| frames late.
+  void SetChannels(int channels);
+  // Runs what Read() returns through |pipeline|. Open() restarts it but
+  // keeps what it adapted to, so captures that run one after another may
+  // share a pipeline. The audio comes out pipeline->Latency() frames late.
+  void SetPipeline(std::shared_ptr<DspPipeline> pipeline);
+
+  // |period_frames| and |buffer_frames| are hints, 0 for the driver default.
+  // In |nonblocking| mode Read() returns 0 instead of waiting for audio.
+  bool Open(const std::string& device, unsigned int rate,
+            snd_pcm_uframes_t period_frames, snd_pcm_uframes_t buffer_frames,
+            bool nonblocking);
+  void Close();
+  bool IsOpen() const { return pcm_ != nullptr; }
+
+  // Reads up to |frames| frames into |buffer|. Returns the number of frames
+  // read, 0 if none are available yet, or a negative error code if the
+  // device could not be recovered, in which case it is closed.
+  snd_pcm_sframes_t Read(void* buffer, snd_pcm_uframes_t frames);
+
+  // Position of the first frame of the last Read(), counted from Open().
+  uint64_t Position() const { return position_; }
+  // CLOCK_MONOTONIC capture time of the first frame of the last Read().
+  const timespec& Timestamp() const { return timestamp_; }
+  // Whether frames were lost right before the last Read().
+  bool Discontinuity() const { return discontinuity_; }
+  uint64_t LostFrames() const { return lost_frames_; }
+
+ private:
+  static constexpr int kMaxResumeAttempts = 10;
+  static constexpr int kMaxReopenAttempts = 8;
+  static constexpr int kMaxRecoveriesPerRead = 3;
+
+  bool OpenDevice();
+  bool Recover(int error);
+  bool Reopen();
+  // Updates positions and timestamps for |frames| frames just read.
+  void OnFrames(snd_pcm_sframes_t frames);
+
+  std::string device_;
+  unsigned int rate_ = 0;
+  snd_pcm_uframes_t period_frames_ = 0;
+  snd_pcm_uframes_t buffer_frames_ = 0;
+  bool nonblocking_ = false;
+  snd_pcm_t* pcm_ = nullptr;
+  int channels_ = 1;
+  std::unique_ptr<Beamformer> beamformer_;
+  // Interleaved frames read from an array, grown to the largest read.
+  std::vector<int16_t> interleaved_;
+  std::shared_ptr<DspPipeline> pipeline_;
+
+  uint64_t position_ = 0;
+  uint64_t next_position_ = 0;
+  // Expected capture time of the frame at |next_position_|, in seconds.
+  double next_time_ = 0;
+  bool has_next_time_ = false;
+  timespec timestamp_ = {0, 0};
+  bool discontinuity_ = false;
+  uint64_t lost_frames_ = 0;
+  // Set from the first error until audio flows again.
+  bool recovering_ = false;
+  double error_time_ = 0;
+
+  Counter* xruns_;
+  Counter* suspends_;
+  Counter* reopens_;
+  Counter* lost_frames_total_;
+  Histogram* recovery_seconds_;
+  Gauge* steered_;
+};
+
+#endif
@@ -0,0 +1,418 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "assist_stream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "log.h"
+#include "metrics.h"
+#include "response_audio.h"
+#include "session_log.h"
+
+using google::assistant::embedded::v1alpha2::AssistRequest;
+using google::assistant::embedded::v1alpha2::AssistResponse;
+using google::assistant::embedded::v1alpha2::EmbeddedAssistant;
+using grpc::ClientReaderWriter;
+
+namespace {
+
+Counter* const kHedges = MetricsRegistry::Global().GetCounter(
+    "assistant_assist_hedges_total",
+    "Assist streams replayed on the hedge channel.");
+Counter* const kPrimaryWins = MetricsRegistry::Global().GetCounter(
+    "assistant_assist_hedge_wins_total",
+    "Hedged dialogs, by the stream that answered first.", "stream=\"primary\"");
+Counter* const kHedgeWins = MetricsRegistry::Global().GetCounter(
+    "assistant_assist_hedge_wins_total",
+    "Hedged dialogs, by the stream that answered first.", "stream=\"hedge\"");
+
+class DirectAssistStream : public AssistStream {
+ public:
+  DirectAssistStream(std::shared_ptr<grpc::Channel> channel,
+                     std::shared_ptr<grpc::CallCredentials> credentials)
+      : stub_(EmbeddedAssistant::NewStub(channel)) {
+    context_.set_fail_fast(false);
+    context_.set_credentials(credentials);
+    stream_ = stub_->Assist(&context_);
+  }
+
+  bool Write(const AssistRequest& request) override {
+    return stream_->Write(request);
+  }
+  bool WritesDone() override { return stream_->WritesDone(); }
+  bool Read(std::shared_ptr<AssistResponse>* response) override {
+    *response = NewArenaResponse();
+    return stream_->Read(response->get());
+  }
+  grpc::Status Finish() override { return stream_->Finish(); }
+
+ private:
+  std::unique_ptr<EmbeddedAssistant::Stub> stub_;
+  grpc::ClientContext context_;
+  std::unique_ptr<ClientReaderWriter<AssistRequest, AssistResponse>> stream_;
+};
+
+// Runs up to two streams of one dialog, each with a writer thread that
+// replays |sent_| and a reader thread that queues its responses. Write()
+// returns once a stream that may still carry the dialog has written the
+// request, and false when none is left.
+class HedgedAssistStream : public AssistStream {
+ public:
+  HedgedAssistStream(std::shared_ptr<grpc::Channel> primary,
+                     std::shared_ptr<grpc::Channel> hedge,
+                     std::shared_ptr<grpc::CallCredentials> credentials,
+                     std::chrono::milliseconds hedge_delay)
+      : credentials_(credentials), hedge_delay_(hedge_delay) {
+    channels_[0] = primary;
+    channels_[1] = hedge;
+    std::unique_lock<std::mutex> lock(mutex_);
+    StartLeg(0);
+  }
+
+  ~HedgedAssistStream() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto& leg : legs_) {
+      if (leg && !leg->finished) {
+        leg->context.TryCancel();
+      }
+    }
+    lock.unlock();
+    JoinLegs();
+  }
+
+  bool Write(const AssistRequest& request) override {
+    std::shared_ptr<const AssistRequest> copy(new AssistRequest(request));
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (request.has_audio_in() && !audio_started_) {
+      audio_started_ = true;
+      hedge_at_ = std::chrono::steady_clock::now() + hedge_delay_;
+    }
+    size_t index = sent_base_ + sent_.size();
+    sent_.push_back(copy);
+    changed_.notify_all();
+    // A stalled leg must not hold up the others, so any running leg that
+    // may still carry the dialog writing the request is enough.
+    while (true) {
+      bool running = false;
+      for (const auto& leg : legs_) {
+        if (!leg || leg->writer_done ||
+            (winner_ >= 0 && leg->index != winner_)) {
+          continue;
+        }
+        if (leg->next_write > index) {
+          return true;
+        }
+        running = true;
+      }
+      if (!running) {
+        // Kept for the hedge to replay, unless no other stream is left.
+        return winner_ < 0 && !legs_[1];
+      }
+      changed_.wait(lock);
+    }
+  }
+
+  bool WritesDone() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    writes_done_ = true;
+    // A text query sends no audio; its deadline runs from the end of the
+    // request instead.
+    if (!audio_started_) {
+      audio_started_ = true;
+      hedge_at_ = std::chrono::steady_clock::now() + hedge_delay_;
+    }
+    changed_.notify_all();
+    return true;
+  }
+
+  bool Read(std::shared_ptr<AssistResponse>* response) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      if (!responses_.empty()) {
+        *response = responses_.front();
+        responses_.pop_front();
+        return true;
+      }
+      if (winner_ >= 0) {
+        if (legs_[winner_]->finished) {
+          return false;
+        }
+      } else if (!legs_[1] && ((legs_[0]->finished && !legs_[0]->status.ok()) ||
+          (!legs_[0]->finished && audio_started_ &&
+           std::chrono::steady_clock::now() >= hedge_at_))) {
+        // The primary is silent or failed; it keeps running until the hedge
+        // answers.
+        LOG(INFO) << "Assist stream silent, hedging onto the second channel";
+        kHedges->Increment();
+        StartLeg(1);
+        continue;
+      } else if (legs_[0]->finished && (!legs_[1] || legs_[1]->finished)) {
+        return false;
+      }
+      if (!legs_[1] && audio_started_) {
+        changed_.wait_until(lock, hedge_at_);
+      } else {
+        changed_.wait(lock);
+      }
+    }
+  }
+
+  grpc::Status Finish() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto& leg : legs_) {
+      while (leg && !leg->finished) {
+        changed_.wait(lock);
+      }
+    }
+    // The loser was cancelled, its status says nothing about the dialog.
+    int index = winner_ >= 0 ? winner_ : (legs_[1] ? 1 : 0);
+    grpc::Status status = legs_[index]->status;
+    lock.unlock();
+    JoinLegs();
+    return status;
+  }
+
+ private:
+  struct Leg {
+    int index;
+    grpc::ClientContext context;
+    std::unique_ptr<ClientReaderWriter<AssistRequest, AssistResponse>> stream;
+    // Guarded by |mutex_|. |next_write| counts every request written so
+    // far, including those already trimmed from |sent_|.
+    size_t next_write = 0;
+    bool writer_done = false;
+    bool read_done = false;
+    bool cancelled = false;
+    bool finished = false;
+    grpc::Status status;
+    std::thread writer;
+    std::thread reader;
+  };
+
+  // |mutex_| is held.
+  void StartLeg(int index) {
+    Leg* leg = new Leg;
+    leg->index = index;
+    leg->context.set_fail_fast(false);
+    leg->context.set_credentials(credentials_);
+    stubs_[index] = EmbeddedAssistant::NewStub(channels_[index]);
+    leg->stream = stubs_[index]->Assist(&leg->context);
+    legs_[index].reset(leg);
+    leg->writer = std::thread([this, leg]() { WriteLeg(leg); });
+    leg->reader = std::thread([this, leg]() { ReadLeg(leg); });
+  }
+
+  // Drops the requests no running leg will write anymore. Until a second
+  // leg exists or a leg has won, everything is kept for the hedge to
+  // replay. |mutex_| is held.
+  void TrimSent() {
+    if (winner_ < 0 && !legs_[1]) {
+      return;
+    }
+    size_t keep = sent_base_ + sent_.size();
+    for (const auto& leg : legs_) {
+      if (leg && !leg->writer_done && (winner_ < 0 || leg->index == winner_)) {
+        keep = std::min(keep, leg->next_write);
+      }
+    }
+    while (sent_base_ < keep) {
+      sent_.pop_front();
+      sent_base_++;
+    }
+  }
+
+  void WriteLeg(Leg* leg) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!leg->cancelled && !leg->read_done) {
+      if (leg->next_write < sent_base_ + sent_.size()) {
+        std::shared_ptr<const AssistRequest> request =
+            sent_[leg->next_write - sent_base_];
+        lock.unlock();
+        bool ok = leg->stream->Write(*request);
+        lock.lock();
+        if (!ok) {
+          break;
+        }
+        leg->next_write++;
+        TrimSent();
+        changed_.notify_all();
+      } else if (writes_done_) {
+        lock.unlock();
+        leg->stream->WritesDone();
+        lock.lock();
+        break;
+      } else {
+        changed_.wait(lock);
+      }
+    }
+    leg->writer_done = true;
+    TrimSent();
+    changed_.notify_all();
+  }
+
+  void ReadLeg(Leg* leg) {
+    while (true) {
+      std::shared_ptr<AssistResponse> response = NewArenaResponse();
+      if (!leg->stream->Read(response.get())) {
+        break;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (winner_ < 0) {
+        winner_ = leg->index;
+        if (legs_[1]) {
+          (leg->index == 0 ? kPrimaryWins : kHedgeWins)->Increment();
+        }
+        Leg* loser = legs_[1 - leg->index].get();
+        if (loser != nullptr && !loser->finished) {
+          loser->cancelled = true;
+          loser->context.TryCancel();
+        }
+        TrimSent();
+      }
+      if (winner_ == leg->index) {
+        responses_.push_back(response);
+        changed_.notify_all();
+      }
+    }
+    {
+      // Finish() may only run once the writer is done with the stream.
+      std::unique_lock<std::mutex> lock(mutex_);
+      leg->read_done = true;
+      changed_.notify_all();
+    }
+    leg->writer.join();
+    grpc::Status status = leg->stream->Finish();
+    std::unique_lock<std::mutex> lock(mutex_);
+    leg->status = status;
+    leg->finished = true;
+    changed_.notify_all();
+  }
+
+  void JoinLegs() {
+    for (auto& leg : legs_) {
+      if (leg && leg->reader.joinable()) {
+        leg->reader.join();
+      }
+    }
+  }
+
+  std::shared_ptr<grpc::Channel> channels_[2];
+  std::unique_ptr<EmbeddedAssistant::Stub> stubs_[2];
+  std::shared_ptr<grpc::CallCredentials> credentials_;
+  const std::chrono::milliseconds hedge_delay_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  // What a leg may still write, so that a hedge can replay it; the front
+  // is request number |sent_base_| of the dialog.
+  std::deque<std::shared_ptr<const AssistRequest>> sent_;
+  size_t sent_base_ = 0;
+  bool writes_done_ = false;
+  bool audio_started_ = false;
+  std::chrono::steady_clock::time_point hedge_at_;
+  std::unique_ptr<Leg> legs_[2];
+  int winner_ = -1;
+  std::deque<std::shared_ptr<AssistResponse>> responses_;
+};
+
+// Logs what goes through a stream to the session log, as the dialog sees
+// it: requests when written, responses when read.
+class RecordingAssistStream : public AssistStream {
+ public:
+  RecordingAssistStream(std::unique_ptr<AssistStream> stream,
+                        SessionRecorder* recorder)
+      : stream_(std::move(stream)),
+        recorder_(recorder),
+        id_(recorder->NextStream()) {}
+
+  bool Write(const AssistRequest& request) override {
+    Record(SessionRecordType::REQUEST, request);
+    return stream_->Write(request);
+  }
+  bool WritesDone() override {
+    recorder_->Append(SessionRecordType::WRITES_DONE, id_, nullptr, 0);
+    return stream_->WritesDone();
+  }
+  bool Read(std::shared_ptr<AssistResponse>* response) override {
+    if (!stream_->Read(response)) {
+      return false;
+    }
+    Record(SessionRecordType::RESPONSE, **response);
+    return true;
+  }
+  grpc::Status Finish() override {
+    grpc::Status status = stream_->Finish();
+    std::string payload(sizeof(int32_t), '\0');
+    int32_t code = status.error_code();
+    memcpy(&payload[0], &code, sizeof(code));
+    payload += status.error_message();
+    recorder_->Append(SessionRecordType::STATUS, id_, payload.data(),
+                      payload.size());
+    return status;
+  }
+
+ private:
+  // Serializes |message| straight into the log.
+  void Record(SessionRecordType type,
+              const google::protobuf::MessageLite& message) {
+    size_t size = message.ByteSizeLong();
+    SessionRecorder::Slot slot;
+    if (recorder_->Begin(type, id_, SessionNowNs(), size, &slot)) {
+      message.SerializeWithCachedSizesToArray(
+          reinterpret_cast<uint8_t*>(slot.data));
+      recorder_->Commit(slot);
+    }
+  }
+
+  std::unique_ptr<AssistStream> stream_;
+  SessionRecorder* recorder_;
+  const uint64_t id_;
+};
+
+}  // namespace
+
+AssistClient::AssistClient(std::shared_ptr<grpc::Channel> channel,
+                           std::shared_ptr<grpc::CallCredentials> credentials)
+    : channel_(channel), credentials_(credentials) {}
+
+void AssistClient::EnableHedging(std::shared_ptr<grpc::Channel> channel,
+                                 std::chrono::milliseconds hedge_delay) {
+  hedge_channel_ = channel;
+  hedge_delay_ = hedge_delay;
+  hedge_channel_->GetState(true);
+}
+
+std::unique_ptr<AssistStream> AssistClient::Open() {
+  std::unique_ptr<AssistStream> stream;
+  if (!hedge_channel_) {
+    stream.reset(new DirectAssistStream(channel_, credentials_));
+  } else {
+    // Reconnects the hedge channel if it went idle, before it is needed.
+    hedge_channel_->GetState(true);
+    stream.reset(new HedgedAssistStream(channel_, hedge_channel_, credentials_,
+                                        hedge_delay_));
+  }
+  if (SessionRecorder* recorder = SessionRecorder::Active()) {
+    stream.reset(new RecordingAssistStream(std::move(stream), recorder));
+  }
+  return stream;
+}
@@ -0,0 +1,76 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef ASSIST_STREAM_H
+#define ASSIST_STREAM_H
+
+#include <grpc++/grpc++.h>
+
+#include <chrono>
+#include <memory>
+
+#include "google/assistant/embedded/v1alpha2/embedded_assistant.grpc.pb.h"
+#include "google/assistant/embedded/v1alpha2/embedded_assistant.pb.h"
+
+// One Assist RPC as a dialog sees it. One thread may Write() while another
+// Read()s; Finish() is called once Read() returned false.
+class AssistStream {
+ public:
+  typedef google::assistant::embedded::v1alpha2::AssistRequest AssistRequest;
+  typedef google::assistant::embedded::v1alpha2::AssistResponse AssistResponse;
+
+  virtual ~AssistStream() {}
+
+  virtual bool Write(const AssistRequest& request) = 0;
+  virtual bool WritesDone() = 0;
+  // Returns the next response, parsed into its own arena (see
+  // NewArenaResponse()), or false at the end of the stream.
+  virtual bool Read(std::shared_ptr<AssistResponse>* response) = 0;
+  virtual grpc::Status Finish() = 0;
+};
+
+// Opens Assist streams on one channel, optionally hedged onto a second one:
+// if the first stream has not answered |hedge_delay| after the first audio
+// was written, or fails without answering, everything written so far is
+// replayed on a stream of the second channel. Whichever stream answers
+// first carries the dialog and the other is cancelled.
+//
+// While a SessionRecorder is active, streams log their requests, responses
+// and status to it.
+//
+// Exported metrics: assistant_assist_hedges_total and
+// assistant_assist_hedge_wins_total{stream="primary|hedge"}; divide the
+// former by assistant_dialogs_started_total for the hedge rate.
+class AssistClient {
+ public:
+  AssistClient(std::shared_ptr<grpc::Channel> channel,
+               std::shared_ptr<grpc::CallCredentials> credentials);
+
+  // |channel| should not share a connection with the first channel, see
+  // CreateChannel(). It is connected right away and kept connected.
+  void EnableHedging(std::shared_ptr<grpc::Channel> channel,
+                     std::chrono::milliseconds hedge_delay);
+
+  std::unique_ptr<AssistStream> Open();
+
+ private:
+  std::shared_ptr<grpc::Channel> channel_;
+  std::shared_ptr<grpc::Channel> hedge_channel_;
+  std::shared_ptr<grpc::CallCredentials> credentials_;
+  std::chrono::milliseconds hedge_delay_{0};
+};
+
+#endif
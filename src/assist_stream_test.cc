@@ -0,0 +1,179 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "assist_stream.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "metrics.h"
+#include "mock_assistant.h"
+
+using google::assistant::embedded::v1alpha2::AssistResponse;
+
+namespace {
+
+struct DialogResult {
+  bool ok = false;
+  double first_response_seconds = 0;
+  std::string display_text;
+};
+
+std::shared_ptr<grpc::Channel> NewChannel(int port) {
+  grpc::ChannelArguments args;
+  // Each channel gets its own connection, as in CreateChannel().
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+  return grpc::CreateCustomChannel("127.0.0.1:" + std::to_string(port),
+                                   grpc::InsecureChannelCredentials(), args);
+}
+
+// Streams audio packets of |packet_bytes|, faster than real time, until
+// the utterance ends, like the uplink does.
+DialogResult RunDialog(AssistClient* client, size_t packet_bytes = 3200) {
+  std::unique_ptr<AssistStream> stream = client->Open();
+  AssistStream::AssistRequest request;
+  request.mutable_config()->mutable_dialog_state_in()->set_language_code("en-US");
+  DialogResult result;
+  if (!stream->Write(request)) {
+    return result;
+  }
+
+  std::atomic<bool> end_of_utterance(false);
+  std::thread uplink([&stream, &end_of_utterance, packet_bytes]() {
+    AssistStream::AssistRequest audio;
+    audio.set_audio_in(std::string(packet_bytes, 0));
+    for (int i = 0; i < 100 && !end_of_utterance; i++) {
+      if (!stream->Write(audio)) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    stream->WritesDone();
+  });
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::shared_ptr<AssistResponse> response;
+  while (stream->Read(&response)) {
+    if (result.first_response_seconds == 0) {
+      result.first_response_seconds = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+    if (response->event_type() == AssistResponse::END_OF_UTTERANCE) {
+      end_of_utterance = true;
+    }
+    if (response->has_dialog_state_out()) {
+      result.display_text =
+          response->dialog_state_out().supplemental_display_text();
+    }
+  }
+  uplink.join();
+  result.ok = stream->Finish().ok();
+  return result;
+}
+
+uint64_t CounterValue(const std::string& name, const std::string& labels) {
+  return MetricsRegistry::Global().GetCounter(name, "", labels)->Value();
+}
+
+}  // namespace
+
+int main() {
+  // Every third stream stalls for 1.5s before it answers.
+  MockAssistantService::Options options;
+  options.delay_every = 3;
+  options.delay_ms = 1500;
+  MockAssistantService service(options);
+  int port = 0;
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+  if (!server) {
+    std::cerr << "Test failed, cannot start the mock server" << std::endl;
+    return 1;
+  }
+
+  // Stalled primaries (streams 0 and 3) are hedged after 200ms, and the
+  // hedge carries the dialog.
+  AssistClient hedged(NewChannel(port), nullptr);
+  hedged.EnableHedging(NewChannel(port), std::chrono::milliseconds(200));
+  for (int i = 0; i < 4; i++) {
+    DialogResult result = RunDialog(&hedged);
+    if (!result.ok || result.display_text != options.display_text ||
+        result.first_response_seconds > 1.0) {
+      std::cerr << "Test failed, hedged dialog " << i << " ok " << result.ok
+                << " first response after " << result.first_response_seconds
+                << "s" << std::endl;
+      return 1;
+    }
+  }
+  uint64_t hedges = CounterValue("assistant_assist_hedges_total", "");
+  uint64_t hedge_wins = CounterValue("assistant_assist_hedge_wins_total",
+                                     "stream=\"hedge\"");
+  if (hedges != 2 || hedge_wins != 2 || service.Streams() != 6) {
+    std::cerr << "Test failed, " << hedges << " hedges, " << hedge_wins
+              << " won, " << service.Streams() << " streams" << std::endl;
+    return 1;
+  }
+
+  // Without hedging, the stall (stream 6) reaches the dialog.
+  AssistClient direct(NewChannel(port), nullptr);
+  DialogResult result = RunDialog(&direct);
+  if (!result.ok || result.first_response_seconds < 1.5) {
+    std::cerr << "Test failed, direct dialog ok " << result.ok
+              << " first response after " << result.first_response_seconds
+              << "s" << std::endl;
+    return 1;
+  }
+
+  // A primary that stops reading backs up its writes once the flow-control
+  // window is full. The hedge must still get the rest of the utterance,
+  // far more than the window, and carry the dialog.
+  MockAssistantService::Options stall_options;
+  stall_options.stall_every = 2;
+  stall_options.utterance_bytes = 2 * 1024 * 1024;
+  MockAssistantService stall_service(stall_options);
+  int stall_port = 0;
+  grpc::ServerBuilder stall_builder;
+  stall_builder.AddListeningPort("127.0.0.1:0",
+                                 grpc::InsecureServerCredentials(), &stall_port);
+  // Keep the window at its initial size, as on a congested link.
+  stall_builder.AddChannelArgument(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+  stall_builder.AddChannelArgument(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES,
+                                   64 * 1024);
+  stall_builder.RegisterService(&stall_service);
+  std::unique_ptr<grpc::Server> stall_server = stall_builder.BuildAndStart();
+  AssistClient stalled(NewChannel(stall_port), nullptr);
+  stalled.EnableHedging(NewChannel(stall_port), std::chrono::milliseconds(200));
+  uint64_t hedge_wins_before = CounterValue("assistant_assist_hedge_wins_total",
+                                            "stream=\"hedge\"");
+  result = RunDialog(&stalled, 32000);
+  hedge_wins = CounterValue("assistant_assist_hedge_wins_total",
+                            "stream=\"hedge\"");
+  if (!result.ok || result.display_text != stall_options.display_text ||
+      hedge_wins != hedge_wins_before + 1) {
+    std::cerr << "Test failed, dialog on a stalled primary ok " << result.ok
+              << ", hedge wins " << hedge_wins - hedge_wins_before << std::endl;
+    return 1;
+  }
+
+  stall_server->Shutdown();
+  server->Shutdown();
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,466 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+// Drives many simulated assistants from one process, to find how many
+// simultaneous dialogs a box can sustain. Every session is a device of its
+// own, with its device id and conversation state, and speaks an audio file
+// in real time through an AudioInputFile. Sessions share a pool of
+// channels and dialogs run on a fixed pool of worker threads, either
+// keeping --concurrency dialogs in flight or starting --rate dialogs a
+// second:
+//
+//   ./mock_assistant_server &
+//   ./assistant_loadgen --sessions 200 --concurrency 100 utterance.raw
+//
+// Latencies are counted from when a dialog was due, so in rate runs a
+// backlog in the worker pool shows in the percentiles instead of quietly
+// lowering the rate.
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpc++/grpc++.h>
+
+#include "assist_stream.h"
+#include "audio_input_file.h"
+
+using google::assistant::embedded::v1alpha2::AssistRequest;
+using google::assistant::embedded::v1alpha2::AssistResponse;
+using google::assistant::embedded::v1alpha2::AssistResponse_EventType_END_OF_UTTERANCE;
+using google::assistant::embedded::v1alpha2::AudioInConfig;
+using google::assistant::embedded::v1alpha2::AudioOutConfig;
+
+typedef std::chrono::steady_clock Clock;
+
+static const std::string kDeviceModelId = "gigaspire-241cc-axu-99y67a";
+
+struct Session {
+  std::string device_id;
+  std::string conversation_state;
+  std::string audio_file;
+  AssistClient* client = nullptr;
+};
+
+struct DialogResult {
+  grpc::StatusCode code = grpc::StatusCode::OK;
+  bool answered = false;
+  // From when the dialog was due to when a worker started it.
+  double queue_ms = 0;
+  // From the end of the utterance to the first response audio, the wait a
+  // user hears. Measured from the last uplink write if the audio arrived
+  // before the utterance ended; not measured if nothing was written.
+  bool response_measured = false;
+  double response_ms = 0;
+  // From when the dialog was due to the end of the stream.
+  double dialog_ms = 0;
+};
+
+// Dialogs waiting for a worker, by the time they were due.
+class DialogQueue {
+ public:
+  void Push(Clock::time_point due) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    due_.push_back(due);
+    ready_.notify_one();
+  }
+
+  bool Pop(Clock::time_point* due) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [this]() { return closed_ || !due_.empty(); });
+    if (due_.empty()) {
+      return false;
+    }
+    *due = due_.front();
+    due_.pop_front();
+    return true;
+  }
+
+  // Wakes up the workers. Dialogs not started yet are dropped and counted.
+  size_t Close() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+    size_t dropped = due_.size();
+    due_.clear();
+    ready_.notify_all();
+    return dropped;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<Clock::time_point> due_;
+  bool closed_ = false;
+};
+
+// Sessions not in a dialog. A device only has one dialog at a time.
+class SessionPool {
+ public:
+  explicit SessionPool(std::vector<Session>* sessions) {
+    for (Session& session : *sessions) {
+      idle_.push_back(&session);
+    }
+  }
+
+  Session* Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (idle_.empty()) {
+      return nullptr;
+    }
+    Session* session = idle_.front();
+    idle_.pop_front();
+    return session;
+  }
+
+  void Release(Session* session) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.push_back(session);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<Session*> idle_;
+};
+
+static double Ms(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static AssistRequest MakeConfig(const Session& session) {
+  AssistRequest request;
+  auto* config = request.mutable_config();
+  config->mutable_dialog_state_in()->set_language_code("en-US");
+  if (!session.conversation_state.empty()) {
+    config->mutable_dialog_state_in()->set_conversation_state(
+        session.conversation_state);
+  }
+  config->mutable_device_config()->set_device_id(session.device_id);
+  config->mutable_device_config()->set_device_model_id(kDeviceModelId);
+  config->mutable_audio_out_config()->set_encoding(AudioOutConfig::LINEAR16);
+  config->mutable_audio_out_config()->set_sample_rate_hertz(16000);
+  config->mutable_audio_in_config()->set_encoding(AudioInConfig::LINEAR16);
+  config->mutable_audio_in_config()->set_sample_rate_hertz(16000);
+  return request;
+}
+
+// Runs one dialog of |session| the way run_assistant does: the audio is
+// written from the input's listener thread while this thread reads, and
+// the input is stopped at END_OF_UTTERANCE.
+static DialogResult RunDialog(Session* session, Clock::time_point due,
+                              int chunk_ms) {
+  DialogResult result;
+  result.queue_ms = Ms(Clock::now() - due);
+  std::unique_ptr<AssistStream> stream = session->client->Open();
+  AssistStream* writer = stream.get();
+  writer->Write(MakeConfig(*session));
+
+  std::atomic<Clock::rep> speech_end{0};
+  std::atomic<Clock::rep> last_write{0};
+  AudioInputFile input(session->audio_file, chunk_ms);
+  AudioBus::SubscriberOptions options;
+  options.name = "uplink";
+  options.policy = BusPolicy::COALESCE;
+  options.capacity = 16;
+  input.AddDataListener(
+      [writer, &last_write](const AudioPacketPtr& packet) {
+        AssistRequest request;
+        request.set_audio_in(packet->data.data(), packet->data.size());
+        writer->Write(request);
+        last_write = Clock::now().time_since_epoch().count();
+      },
+      options);
+  input.AddStopListener([writer, &speech_end]() {
+    speech_end = Clock::now().time_since_epoch().count();
+    writer->WritesDone();
+  });
+  input.Start();
+
+  std::shared_ptr<AssistResponse> response;
+  while (stream->Read(&response)) {
+    if (response->event_type() == AssistResponse_EventType_END_OF_UTTERANCE) {
+      input.Stop();
+    }
+    if (response->has_audio_out() && !result.answered) {
+      result.answered = true;
+      Clock::rep end = speech_end.load();
+      if (end == 0) {
+        end = last_write.load();
+      }
+      if (end != 0) {
+        result.response_measured = true;
+        Clock::time_point spoken{Clock::duration(end)};
+        result.response_ms = Ms(Clock::now() - spoken);
+      }
+    }
+    const std::string& state =
+        response->dialog_state_out().conversation_state();
+    if (!state.empty()) {
+      session->conversation_state = state;
+    }
+  }
+  input.Stop();
+  result.code = stream->Finish().error_code();
+  result.dialog_ms = Ms(Clock::now() - due);
+  return result;
+}
+
+static std::shared_ptr<grpc::Channel> CreateChannel(const std::string& endpoint) {
+  grpc::ChannelArguments channel_args;
+  // Every channel of the pool gets a connection of its own.
+  channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+  return grpc::CreateCustomChannel(
+      endpoint, grpc::InsecureChannelCredentials(), channel_args);
+}
+
+static double CpuSeconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static long PeakRssKb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static long CurrentRssKb() {
+  std::ifstream statm("/proc/self/statm");
+  long pages = 0, resident = 0;
+  statm >> pages >> resident;
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Nearest-rank percentile of sorted |values|.
+static double Percentile(const std::vector<double>& values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(std::ceil(p / 100 * values.size()));
+  return values[std::max<size_t>(rank, 1) - 1];
+}
+
+static void PrintLatencies(const std::string& name, std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  std::cout << name << " ms: p50 " << Percentile(values, 50)
+            << " p90 " << Percentile(values, 90)
+            << " p99 " << Percentile(values, 99)
+            << " max " << (values.empty() ? 0 : values.back()) << std::endl;
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: ./assistant_loadgen [--endpoint <host:port>] "
+            << "[--sessions <n>] [--concurrency <n> | --rate <dialogs/s>] "
+            << "[--threads <n>] [--channels <n>] [--duration_s <s>] "
+            << "[--chunk_ms <ms>] <audio_file>..." << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string endpoint = "127.0.0.1:50051";
+  int sessions = 0, concurrency = 0, threads = 0, channels = 4;
+  int duration_s = 10, chunk_ms = 100;
+  double rate = 0;
+
+  const struct option long_options[] = {
+    {"endpoint",    required_argument, nullptr, 'e'},
+    {"sessions",    required_argument, nullptr, 'n'},
+    {"concurrency", required_argument, nullptr, 'c'},
+    {"rate",        required_argument, nullptr, 'r'},
+    {"threads",     required_argument, nullptr, 'j'},
+    {"channels",    required_argument, nullptr, 'p'},
+    {"duration_s",  required_argument, nullptr, 'd'},
+    {"chunk_ms",    required_argument, nullptr, 'm'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char = getopt_long(argc, argv, "e:n:c:r:j:p:d:m:",
+                                  long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 'e':
+        endpoint = optarg;
+        break;
+      case 'n':
+        sessions = atoi(optarg);
+        break;
+      case 'c':
+        concurrency = atoi(optarg);
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'p':
+        channels = atoi(optarg);
+        break;
+      case 'd':
+        duration_s = atoi(optarg);
+        break;
+      case 'm':
+        chunk_ms = atoi(optarg);
+        break;
+      default:
+        PrintUsage();
+        return 1;
+    }
+  }
+  if (optind == argc || (concurrency > 0) == (rate > 0) || channels <= 0 ||
+      duration_s <= 0 || chunk_ms <= 0) {
+    PrintUsage();
+    return 1;
+  }
+  if (threads <= 0) {
+    threads = concurrency > 0 ? concurrency : 64;
+  }
+  if (concurrency > threads) {
+    std::cerr << "Only " << threads << " of " << concurrency
+              << " dialogs can be in flight, see --threads" << std::endl;
+    concurrency = threads;
+  }
+  if (sessions <= 0) {
+    sessions = threads;
+  }
+
+  std::vector<std::unique_ptr<AssistClient>> clients;
+  for (int i = 0; i < channels; i++) {
+    clients.emplace_back(new AssistClient(CreateChannel(endpoint), nullptr));
+  }
+  std::vector<Session> all_sessions(sessions);
+  for (int i = 0; i < sessions; i++) {
+    all_sessions[i].device_id = "loadgen-" + std::to_string(i);
+    all_sessions[i].audio_file = argv[optind + i % (argc - optind)];
+    all_sessions[i].client = clients[i % channels].get();
+  }
+  SessionPool idle_sessions(&all_sessions);
+
+  DialogQueue queue;
+  std::mutex results_mutex;
+  std::vector<DialogResult> results;
+  std::atomic<int> no_idle_session{0};
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::seconds(duration_s);
+  double cpu_start = CpuSeconds();
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([&]() {
+      Clock::time_point due;
+      while (queue.Pop(&due)) {
+        Session* session = idle_sessions.Acquire();
+        if (session == nullptr) {
+          no_idle_session++;
+          continue;
+        }
+        DialogResult result = RunDialog(session, due, chunk_ms);
+        idle_sessions.Release(session);
+        {
+          std::unique_lock<std::mutex> lock(results_mutex);
+          results.push_back(result);
+        }
+        // Closed-loop: the next dialog starts as soon as this one ended.
+        if (concurrency > 0 && Clock::now() < end) {
+          queue.Push(Clock::now());
+        }
+      }
+    });
+  }
+
+  if (concurrency > 0) {
+    for (int i = 0; i < concurrency; i++) {
+      queue.Push(start);
+    }
+    std::this_thread::sleep_until(end);
+  } else {
+    // Open-loop: dialogs are due on a fixed schedule, however long the
+    // previous ones take.
+    Clock::duration interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1 / rate));
+    for (Clock::time_point due = start; due < end; due += interval) {
+      std::this_thread::sleep_until(due);
+      queue.Push(due);
+    }
+  }
+  size_t not_started = queue.Close();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  double wall_seconds = Ms(Clock::now() - start) / 1000;
+  double cpu_seconds = CpuSeconds() - cpu_start;
+
+  std::map<int, int> codes;
+  std::vector<double> queue_ms, response_ms, dialog_ms;
+  int completed = 0;
+  for (const DialogResult& result : results) {
+    codes[result.code]++;
+    if (result.code == grpc::StatusCode::OK && result.answered) {
+      completed++;
+      queue_ms.push_back(result.queue_ms);
+      if (result.response_measured) {
+        response_ms.push_back(result.response_ms);
+      }
+      dialog_ms.push_back(result.dialog_ms);
+    }
+  }
+  std::cout << results.size() << " dialogs in " << wall_seconds << "s on "
+            << threads << " threads, " << sessions << " sessions, "
+            << channels << " channels" << std::endl;
+  std::cout << completed << " answered, " << completed / wall_seconds
+            << " dialogs/s" << std::endl;
+  for (const auto& code : codes) {
+    if (code.first != grpc::StatusCode::OK) {
+      std::cout << code.second << " failed with status " << code.first
+                << std::endl;
+    }
+  }
+  if (not_started > 0 || no_idle_session > 0) {
+    std::cout << not_started << " due dialogs not started, "
+              << no_idle_session << " skipped without an idle session"
+              << std::endl;
+  }
+  PrintLatencies("queue", queue_ms);
+  PrintLatencies("response", response_ms);
+  PrintLatencies("dialog", dialog_ms);
+  std::cout << "CPU " << cpu_seconds << "s (" << cpu_seconds / wall_seconds
+            << " cores), " << (results.empty() ? 0 : cpu_seconds * 1000 / results.size())
+            << "ms per dialog; RSS " << CurrentRssKb() / 1024 << "MB, peak "
+            << PeakRssKb() / 1024 << "MB" << std::endl;
+  return completed > 0 ? 0 : 1;
+}
@@ -0,0 +1,316 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "audio_bus.h"
+
+#include <pthread.h>
+
+#include <chrono>
+
+#include "metrics.h"
+
+struct AudioBus::Subscriber {
+  Subscriber(Handler handler, const SubscriberOptions& options)
+      : handler(handler), options(options), queue(options.capacity),
+        merge_pool(options.coalesce_bytes) {}
+
+  Handler handler;
+  SubscriberOptions options;
+  MpmcQueue<AudioPacketPtr> queue;
+
+  // COALESCE: the merge being filled and how many packets it holds, plus
+  // full merges waiting for queue room, oldest first. Only the publisher
+  // touches these.
+  static constexpr int kMaxBacklog = 4;
+  AudioPacketPool merge_pool;
+  AudioPacketPtr pending;
+  uint64_t pending_packets = 0;
+  AudioPacketPtr backlog[kMaxBacklog];
+  uint64_t backlog_packets[kMaxBacklog] = {};
+  int backlog_head = 0;
+  int backlog_size = 0;
+
+  std::atomic<uint64_t> delivered{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> coalesced{0};
+  std::atomic<size_t> high_water{0};
+  Counter* delivered_total;
+  Counter* dropped_total;
+  Counter* coalesced_total;
+  Gauge* high_water_gauge;
+
+  // The delivery thread sleeps on |ready| only after announcing it in
+  // |waiting|, so the publisher takes |mutex| only to wake it.
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::atomic<bool> waiting{false};
+  std::atomic<bool> closing{false};
+  std::thread thread;
+
+  void Wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)) {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.notify_one();
+    }
+  }
+
+  bool Push(const AudioPacketPtr& packet) {
+    if (!queue.TryPush(packet)) {
+      return false;
+    }
+    size_t depth = queue.SizeApprox();
+    if (depth > high_water.load(std::memory_order_relaxed)) {
+      high_water.store(depth, std::memory_order_relaxed);
+      high_water_gauge->Set(depth);
+    }
+    Wake();
+    return true;
+  }
+
+  void Drop(uint64_t packets) {
+    dropped.fetch_add(packets, std::memory_order_relaxed);
+    dropped_total->Increment(packets);
+  }
+
+  void PushBlocking(const AudioPacketPtr& packet) {
+    while (!Push(packet)) {
+      Wake();
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+  }
+
+  // Starts a new merge with a copy of |packet|.
+  void StartMerge(const AudioPacketPtr& packet) {
+    pending = merge_pool.Acquire();
+    pending->timestamp = packet->timestamp;
+    pending->sample_index = packet->sample_index;
+    pending->sequence = packet->sequence;
+    pending->format = packet->format;
+    pending->discontinuity = packet->discontinuity;
+    pending->data = packet->data;
+    pending_packets = 1;
+    coalesced.fetch_add(1, std::memory_order_relaxed);
+    coalesced_total->Increment();
+  }
+
+  // Moves the pending merge to the backlog. When the backlog is full its
+  // oldest merge is dropped, and the next one is flagged as following a gap.
+  void Retire() {
+    if (backlog_size == kMaxBacklog) {
+      Drop(backlog_packets[backlog_head]);
+      backlog[backlog_head].Reset();
+      backlog_head = (backlog_head + 1) % kMaxBacklog;
+      backlog_size--;
+      backlog[backlog_head]->discontinuity = true;
+    }
+    int tail = (backlog_head + backlog_size) % kMaxBacklog;
+    backlog[tail] = std::move(pending);
+    backlog_packets[tail] = pending_packets;
+    backlog_size++;
+  }
+
+  // Queues backlogged merges and then the pending one, in order, as far as
+  // the queue has room. Returns true once nothing is left behind.
+  bool Flush() {
+    while (backlog_size > 0) {
+      if (!Push(backlog[backlog_head])) {
+        return false;
+      }
+      backlog[backlog_head].Reset();
+      backlog_head = (backlog_head + 1) % kMaxBacklog;
+      backlog_size--;
+    }
+    if (pending) {
+      if (!Push(pending)) {
+        return false;
+      }
+      pending.Reset();
+    }
+    return true;
+  }
+
+  void FlushBlocking() {
+    while (!Flush()) {
+      Wake();
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+  }
+
+  void Merge(const AudioPacketPtr& packet) {
+    bool contiguous = !packet->discontinuity &&
+        packet->format.sample_rate == pending->format.sample_rate &&
+        packet->format.channels == pending->format.channels &&
+        packet->sample_index == pending->sample_index + pending->Frames();
+    if (!contiguous ||
+        pending->data.size() + packet->data.size() > options.coalesce_bytes) {
+      Retire();
+      StartMerge(packet);
+      return;
+    }
+    pending->data.insert(pending->data.end(), packet->data.begin(),
+                         packet->data.end());
+    pending_packets++;
+    coalesced.fetch_add(1, std::memory_order_relaxed);
+    coalesced_total->Increment();
+  }
+};
+
+AudioBus::AudioBus() {}
+
+AudioBus::~AudioBus() {
+  Close();
+}
+
+int AudioBus::Subscribe(Handler handler, const SubscriberOptions& options) {
+  std::unique_lock<std::mutex> lock(subscribe_mutex_);
+  int index = count_.load(std::memory_order_relaxed);
+  if (closed_.load(std::memory_order_relaxed) || index == kMaxSubscribers) {
+    return -1;
+  }
+  Subscriber* subscriber = new Subscriber(handler, options);
+  MetricsRegistry& registry = MetricsRegistry::Global();
+  std::string labels = "subscriber=\"" + options.name + "\"";
+  subscriber->delivered_total = registry.GetCounter(
+      "assistant_audio_bus_delivered_packets_total",
+      "Audio packets handed to a bus subscriber.", labels);
+  subscriber->dropped_total = registry.GetCounter(
+      "assistant_audio_bus_dropped_packets_total",
+      "Audio packets dropped because a bus subscriber fell behind.", labels);
+  subscriber->coalesced_total = registry.GetCounter(
+      "assistant_audio_bus_coalesced_packets_total",
+      "Audio packets merged because a bus subscriber fell behind.", labels);
+  subscriber->high_water_gauge = registry.GetGauge(
+      "assistant_audio_bus_queue_high_water",
+      "Deepest a bus subscriber's queue has been, in packets.", labels);
+  subscriber->thread = std::thread([this, subscriber]() {
+    Deliver(subscriber);
+  });
+  subscribers_[index].reset(subscriber);
+  count_.store(index + 1, std::memory_order_release);
+  return index;
+}
+
+void AudioBus::Publish(const AudioPacketPtr& packet) {
+  if (closed_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  int count = count_.load(std::memory_order_acquire);
+  for (int i = 0; i < count; i++) {
+    Subscriber* subscriber = subscribers_[i].get();
+    switch (subscriber->options.policy) {
+      case BusPolicy::BLOCK:
+        subscriber->PushBlocking(packet);
+        break;
+      case BusPolicy::DROP_OLDEST:
+        if (!subscriber->Push(packet)) {
+          AudioPacketPtr oldest;
+          if (subscriber->queue.TryPop(&oldest)) {
+            subscriber->Drop(1);
+          }
+          // The delivery thread may have taken the freed slot meanwhile.
+          if (!subscriber->Push(packet)) {
+            subscriber->Drop(1);
+          }
+        }
+        break;
+      case BusPolicy::DROP_NEWEST:
+        if (!subscriber->Push(packet)) {
+          subscriber->Drop(1);
+        }
+        break;
+      case BusPolicy::COALESCE:
+        if (!subscriber->Flush()) {
+          if (subscriber->pending) {
+            subscriber->Merge(packet);
+          } else {
+            subscriber->StartMerge(packet);
+          }
+          break;
+        }
+        if (!subscriber->Push(packet)) {
+          subscriber->StartMerge(packet);
+        }
+        break;
+    }
+  }
+}
+
+void AudioBus::Close() {
+  {
+    std::unique_lock<std::mutex> lock(subscribe_mutex_);
+    if (closed_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    closed_.store(true, std::memory_order_relaxed);
+  }
+  int count = count_.load(std::memory_order_acquire);
+  for (int i = 0; i < count; i++) {
+    Subscriber* subscriber = subscribers_[i].get();
+    subscriber->FlushBlocking();
+    {
+      std::unique_lock<std::mutex> lock(subscriber->mutex);
+      subscriber->closing.store(true, std::memory_order_release);
+      subscriber->ready.notify_one();
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    subscribers_[i]->thread.join();
+  }
+}
+
+AudioBus::SubscriberStats AudioBus::Stats(int subscriber) const {
+  SubscriberStats stats;
+  if (subscriber < 0 || subscriber >= count_.load(std::memory_order_acquire)) {
+    return stats;
+  }
+  const Subscriber& s = *subscribers_[subscriber];
+  stats.delivered = s.delivered.load(std::memory_order_relaxed);
+  stats.dropped = s.dropped.load(std::memory_order_relaxed);
+  stats.coalesced = s.coalesced.load(std::memory_order_relaxed);
+  stats.high_water = s.high_water.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void AudioBus::Deliver(Subscriber* subscriber) {
+  std::string name = "bus-" + subscriber->options.name;
+  pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+  AudioPacketPtr packet;
+  while (true) {
+    // Read |closing| first: everything queued before it was set is still
+    // popped below.
+    bool closing = subscriber->closing.load(std::memory_order_acquire);
+    if (subscriber->queue.TryPop(&packet)) {
+      subscriber->handler(packet);
+      packet.Reset();
+      subscriber->delivered.fetch_add(1, std::memory_order_relaxed);
+      subscriber->delivered_total->Increment();
+      continue;
+    }
+    if (closing) {
+      break;
+    }
+    std::unique_lock<std::mutex> lock(subscriber->mutex);
+    subscriber->waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (subscriber->queue.SizeApprox() == 0 &&
+        !subscriber->closing.load(std::memory_order_acquire)) {
+      // The timeout only guards against a missed wakeup.
+      subscriber->ready.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    subscriber->waiting.store(false, std::memory_order_relaxed);
+  }
+}
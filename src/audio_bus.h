@@ -0,0 +1,115 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef AUDIO_BUS_H
+#define AUDIO_BUS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "audio_packet.h"
+#include "mpmc_queue.h"
+
+class Counter;
+class Gauge;
+
+// What Publish() does when a subscriber's queue is full.
+enum class BusPolicy {
+  // Wait for room. The publisher stalls with the subscriber, so this is only
+  // for consumers that must see every packet and are known to keep up.
+  BLOCK,
+  // Discard the oldest queued packet to make room.
+  DROP_OLDEST,
+  // Discard the packet being published.
+  DROP_NEWEST,
+  // Merge packets into one larger packet until the queue has room, so a
+  // consumer with a high per-call cost (e.g. one network write per packet)
+  // catches up. A merged packet carries the timestamp, index and sequence of
+  // its first packet. A merge that is full or followed by a gap waits in a
+  // short backlog; when that overflows the oldest merge is dropped.
+  COALESCE,
+};
+
+// Broadcasts audio packets from a capture thread to subscribers. Every
+// subscriber has its own bounded lock-free queue and delivery thread, so
+// Publish() never runs a handler and a slow subscriber only delays itself
+// (unless it chose BLOCK). Queue drops, merges and high-water marks are
+// exported per subscriber as
+//   assistant_audio_bus_{delivered,dropped,coalesced}_packets_total
+//   assistant_audio_bus_queue_high_water
+// labelled with the subscriber name.
+class AudioBus {
+ public:
+  typedef std::function<void(const AudioPacketPtr&)> Handler;
+
+  struct SubscriberOptions {
+    // Labels the metrics and names the delivery thread.
+    std::string name = "listener";
+    BusPolicy policy = BusPolicy::DROP_OLDEST;
+    // Queue length in packets, rounded up to a power of two.
+    size_t capacity = 32;
+    // Largest merged packet under COALESCE.
+    size_t coalesce_bytes = 64 * 1024;
+  };
+
+  struct SubscriberStats {
+    uint64_t delivered = 0;
+    uint64_t dropped = 0;
+    uint64_t coalesced = 0;
+    size_t high_water = 0;
+  };
+
+  static constexpr int kMaxSubscribers = 16;
+
+  AudioBus();
+  ~AudioBus();
+
+  // Thread-safe, also while packets are being published. Returns the
+  // subscriber index, or -1 once kMaxSubscribers are registered or the bus
+  // is closed.
+  int Subscribe(Handler handler, const SubscriberOptions& options);
+  int Subscribe(Handler handler) {
+    return Subscribe(handler, SubscriberOptions());
+  }
+
+  // Queues |packet| for every subscriber. Only one thread may publish at a
+  // time. Does not allocate once the COALESCE merge packets are recycled.
+  void Publish(const AudioPacketPtr& packet);
+
+  // Delivers what is still queued, then stops the delivery threads. Call
+  // from the publishing thread; later Publish() calls are ignored.
+  void Close();
+
+  SubscriberStats Stats(int subscriber) const;
+
+ private:
+  struct Subscriber;
+
+  void Deliver(Subscriber* subscriber);
+
+  std::mutex subscribe_mutex_;
+  std::atomic<bool> closed_{false};
+  std::unique_ptr<Subscriber> subscribers_[kMaxSubscribers];
+  std::atomic<int> count_{0};
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "audio_bus.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t kPacketBytes = 320;  // 10ms at 16kHz.
+
+AudioPacketPtr MakePacket(AudioPacketPool* pool, uint64_t sequence) {
+  AudioPacketPtr packet = pool->Acquire();
+  packet->data.assign(kPacketBytes, static_cast<unsigned char>(sequence));
+  packet->sequence = sequence;
+  packet->sample_index = sequence * kPacketBytes / 2;
+  return packet;
+}
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+int main() {
+  const int kPackets = 200;
+  AudioPacketPool pool(kPacketBytes);
+
+  // A listener stuck for 50ms per packet does not slow the publisher, and
+  // the other policies lose or merge audio as documented.
+  {
+    AudioBus bus;
+    std::mutex mutex;
+    std::vector<uint64_t> fast, oldest, newest;
+    size_t coalesced_bytes = 0;
+    bool coalesced_in_order = true;
+    uint64_t next_index = 0;
+    AudioBus::SubscriberOptions options;
+    options.capacity = 8;
+
+    options.name = "fast";
+    options.policy = BusPolicy::BLOCK;
+    bus.Subscribe([&](const AudioPacketPtr& packet) {
+      std::unique_lock<std::mutex> lock(mutex);
+      fast.push_back(packet->sequence);
+    }, options);
+    options.name = "oldest";
+    options.policy = BusPolicy::DROP_OLDEST;
+    int oldest_id = bus.Subscribe([&](const AudioPacketPtr& packet) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      std::unique_lock<std::mutex> lock(mutex);
+      oldest.push_back(packet->sequence);
+    }, options);
+    options.name = "newest";
+    options.policy = BusPolicy::DROP_NEWEST;
+    int newest_id = bus.Subscribe([&](const AudioPacketPtr& packet) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      std::unique_lock<std::mutex> lock(mutex);
+      newest.push_back(packet->sequence);
+    }, options);
+    options.name = "coalesce";
+    options.policy = BusPolicy::COALESCE;
+    int coalesce_id = bus.Subscribe([&](const AudioPacketPtr& packet) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      std::unique_lock<std::mutex> lock(mutex);
+      coalesced_in_order &= packet->sample_index == next_index;
+      next_index = packet->sample_index + packet->Frames();
+      coalesced_bytes += packet->data.size();
+    }, options);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kPackets; i++) {
+      bus.Publish(MakePacket(&pool, i));
+    }
+    double publish_seconds = Seconds(start);
+    if (publish_seconds > 0.5) {
+      std::cerr << "Test failed, publishing took " << publish_seconds << "s"
+                << std::endl;
+      return 1;
+    }
+    bus.Close();
+
+    if (fast.size() != kPackets) {
+      std::cerr << "Test failed, BLOCK listener got " << fast.size()
+                << " packets" << std::endl;
+      return 1;
+    }
+    // DROP_OLDEST keeps the tail of the stream, DROP_NEWEST the head.
+    AudioBus::SubscriberStats stats = bus.Stats(oldest_id);
+    if (oldest.back() != kPackets - 1 || stats.dropped == 0 ||
+        stats.delivered + stats.dropped != kPackets || stats.high_water != 8) {
+      std::cerr << "Test failed, DROP_OLDEST delivered " << stats.delivered
+                << " dropped " << stats.dropped << " high water "
+                << stats.high_water << std::endl;
+      return 1;
+    }
+    stats = bus.Stats(newest_id);
+    if (newest.front() != 0 || newest.back() == kPackets - 1 ||
+        stats.delivered + stats.dropped != kPackets) {
+      std::cerr << "Test failed, DROP_NEWEST delivered " << stats.delivered
+                << " dropped " << stats.dropped << std::endl;
+      return 1;
+    }
+    // Everything fits in one merge, so COALESCE loses nothing.
+    stats = bus.Stats(coalesce_id);
+    if (coalesced_bytes != kPackets * kPacketBytes || !coalesced_in_order ||
+        stats.coalesced == 0 || stats.dropped != 0) {
+      std::cerr << "Test failed, COALESCE delivered " << coalesced_bytes
+                << " bytes, merged " << stats.coalesced << " packets"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // Full merges wait in the backlog; once that overflows the oldest merge
+  // is dropped and the next one starts with a discontinuity.
+  for (int packets : {16, 60}) {
+    AudioBus bus;
+    AudioBus::SubscriberOptions options;
+    options.name = "small";
+    options.policy = BusPolicy::COALESCE;
+    options.capacity = 2;
+    options.coalesce_bytes = 4 * kPacketBytes;
+    std::atomic<bool> release(false);
+    std::atomic<int> discontinuities(0);
+    size_t bytes = 0;
+    uint64_t last_index = 0;
+    int id = bus.Subscribe([&](const AudioPacketPtr& packet) {
+      while (!release) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      discontinuities += packet->discontinuity;
+      bytes += packet->data.size();
+      last_index = packet->sample_index + packet->Frames();
+    }, options);
+    for (int i = 0; i < packets; i++) {
+      bus.Publish(MakePacket(&pool, i));
+    }
+    release = true;
+    bus.Close();
+    AudioBus::SubscriberStats stats = bus.Stats(id);
+    bool overflow = packets > 20;
+    if ((stats.dropped != 0) != overflow ||
+        (discontinuities != 0) != overflow ||
+        bytes + stats.dropped * kPacketBytes != packets * kPacketBytes ||
+        last_index != packets * kPacketBytes / 2) {
+      std::cerr << "Test failed, " << packets << " packets through a small "
+                << "merge: dropped " << stats.dropped << ", delivered "
+                << bytes << " bytes" << std::endl;
+      return 1;
+    }
+  }
+
+  // Listeners may subscribe while packets are being published.
+  {
+    AudioBus bus;
+    std::atomic<int> received(0);
+    std::thread publisher([&]() {
+      for (int i = 0; i < 2000; i++) {
+        bus.Publish(MakePacket(&pool, i));
+      }
+    });
+    for (int i = 0; i < 4; i++) {
+      bus.Subscribe([&](const AudioPacketPtr&) { received++; });
+    }
+    publisher.join();
+    bus.Close();
+    if (bus.Subscribe([](const AudioPacketPtr&) {}) != -1) {
+      std::cerr << "Test failed, subscribed to a closed bus" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "audio_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static bool EndsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static uint32_t Le32(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+static uint16_t Le16(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | (u[1] << 8);
+}
+
+bool ReadAudioFile(const std::string& path, std::vector<int16_t>* samples,
+                   std::string* error) {
+  return ReadAudioFile(path, 1, samples, error);
+}
+
+bool ReadAudioFile(const std::string& path, int channels,
+                   std::vector<int16_t>* samples, std::string* error) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    *error = "cannot open file";
+    return false;
+  }
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+
+  size_t offset = 0;
+  size_t size = bytes.size();
+  if (EndsWith(path, ".wav") || EndsWith(path, ".WAV")) {
+    if (size < 12 || memcmp(&bytes[0], "RIFF", 4) != 0
+        || memcmp(&bytes[8], "WAVE", 4) != 0) {
+      *error = "not a RIFF/WAVE file";
+      return false;
+    }
+    bool have_format = false;
+    size_t chunk = 12;
+    offset = 0;
+    while (chunk + 8 <= size) {
+      uint32_t chunk_size = Le32(&bytes[chunk + 4]);
+      bool is_data = memcmp(&bytes[chunk], "data", 4) == 0;
+      // Only the data chunk may run past the end, as left by a recorder
+      // that was cut off.
+      if (chunk_size > size - chunk - 8 && !is_data) {
+        *error = "WAV chunk runs past the end of the file";
+        return false;
+      }
+      const char* body = bytes.data() + chunk + 8;
+      if (memcmp(&bytes[chunk], "fmt ", 4) == 0) {
+        if (chunk_size < 16) {
+          *error = "WAV fmt chunk is too short";
+          return false;
+        }
+        if (Le16(body) != 1 || Le16(body + 2) != channels
+            || Le32(body + 4) != 16000 || Le16(body + 14) != 16) {
+          *error = channels == 1
+              ? "WAV is not mono 16-bit PCM at 16000Hz"
+              : "WAV is not " + std::to_string(channels)
+                  + "-channel 16-bit PCM at 16000Hz";
+          return false;
+        }
+        have_format = true;
+      } else if (is_data) {
+        offset = chunk + 8;
+        size = std::min<size_t>(chunk_size, bytes.size() - offset);
+        break;
+      }
+      chunk += 8 + chunk_size + (chunk_size & 1);
+    }
+    if (!have_format || offset == 0) {
+      *error = "WAV has no fmt or data chunk";
+      return false;
+    }
+  }
+
+  // A trailing partial frame is dropped.
+  samples->resize(size / (sizeof(int16_t) * channels) * channels);
+  if (!samples->empty()) {
+    memcpy(samples->data(), &bytes[offset], samples->size() * sizeof(int16_t));
+  }
+  return true;
+}
+
+static void PutLe32(uint32_t value, std::string* out) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+static void PutLe16(uint16_t value, std::string* out) {
+  out->push_back(static_cast<char>(value));
+  out->push_back(static_cast<char>(value >> 8));
+}
+
+bool WriteWavFile(const std::string& path, int channels,
+                  const std::vector<int16_t>& samples, std::string* error) {
+  uint32_t data_size = samples.size() * sizeof(int16_t);
+  std::string header;
+  header.append("RIFF");
+  PutLe32(36 + data_size, &header);
+  header.append("WAVEfmt ");
+  PutLe32(16, &header);
+  PutLe16(1, &header);  // PCM
+  PutLe16(channels, &header);
+  PutLe32(16000, &header);
+  PutLe32(16000 * channels * sizeof(int16_t), &header);
+  PutLe16(channels * sizeof(int16_t), &header);
+  PutLe16(16, &header);
+  header.append("data");
+  PutLe32(data_size, &header);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(header.data(), header.size());
+  file.write(reinterpret_cast<const char*>(samples.data()), data_size);
+  if (!file) {
+    *error = "cannot write file";
+    return false;
+  }
+  return true;
+}
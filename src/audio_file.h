@@ -0,0 +1,40 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef AUDIO_FILE_H
+#define AUDIO_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads a mono, s16_le, 16000Hz recording into |samples|. Files ending in
+// ".wav" must be RIFF/WAVE PCM in that format; anything else is read as RAW.
+// Returns false and sets |error| if the file cannot be used.
+bool ReadAudioFile(const std::string& path, std::vector<int16_t>* samples,
+                   std::string* error);
+
+// Same for a recording of |channels| interleaved channels, e.g. from a
+// microphone array. A WAV file must have exactly |channels| channels.
+bool ReadAudioFile(const std::string& path, int channels,
+                   std::vector<int16_t>* samples, std::string* error);
+
+// Writes |samples|, |channels| interleaved channels of s16_le at 16000Hz, as
+// a RIFF/WAVE file.
+bool WriteWavFile(const std::string& path, int channels,
+                  const std::vector<int16_t>& samples, std::string* error);
+
+#endif
@@ -24,17 +24,29 @@ limitations under the License.
 #include <vector>
 #include <iostream>
 
+#include "audio_bus.h"
+#include "audio_packet.h"
+#include "session_log.h"
+
 // Base class for audio input. Input data should be mono, s16_le, 16000kz.
-// This class uses a separate thread to send audio data to listeners.
+// This class uses a separate thread to capture audio, and publishes it on an
+// AudioBus so that every listener runs on its own thread.
 class AudioInput {
  public:
+  typedef AudioBus::Handler DataListener;
+
   virtual ~AudioInput() {}
 
-  // Listeners might be called in different thread.
-  void AddDataListener(
-      std::function<void(std::shared_ptr<std::vector<unsigned char>>)>
-      listener) {
-    data_listeners_.push_back(listener);
+  // Listeners are called on their own delivery thread, never on the capture
+  // thread, so a slow listener only falls behind itself as |options| allows.
+  // They may keep the packet but must not modify it. Thread-safe.
+  int AddDataListener(DataListener listener,
+                      const AudioBus::SubscriberOptions& options =
+                          AudioBus::SubscriberOptions()) {
+    return bus_.Subscribe(listener, options);
+  }
+  AudioBus::SubscriberStats DataListenerStats(int listener) const {
+    return bus_.Stats(listener);
   }
   void AddStopListener(std::function<void()> listener) {
     stop_listeners_.push_back(listener);
@@ -79,21 +91,31 @@ class AudioInput {
   }
 
  protected:
-  // Function to call when audio input is stopped.
+  // Sends |packet| to the data listeners, and to the session log if one is
+  // being recorded.
+  void Publish(const AudioPacketPtr& packet) {
+    if (SessionRecorder* recorder = SessionRecorder::Active()) {
+      recorder->Append(SessionRecordType::CAPTURE, packet->sample_index,
+                       SessionTimestampNs(packet->timestamp),
+                       packet->data.data(), packet->data.size());
+    }
+    bus_.Publish(packet);
+  }
+
+  // Function to call when audio input is stopped. Listeners are stopped
+  // first, after they received everything published.
   void OnStop() {
+    bus_.Close();
     for (auto& stop_listener : stop_listeners_) {
       stop_listener();
     }
   }
 
-  // Listeners which will be called when audio input data arrives.
-  std::vector<std::function<void(std::shared_ptr<std::vector<unsigned char>>)>>
-      data_listeners_;
-
   // Whether audio input is being sent to listeners.
   bool is_running_ = false;
 
  private:
+  AudioBus bus_;
   std::vector<std::function<void()>> stop_listeners_;
   std::mutex is_running_mutex_;
   std::unique_ptr<std::thread> send_thread_;
@@ -16,87 +16,50 @@ limitations under the License.
 
 #include "audio_input_alsa.h"
 
-#include <alsa/asoundlib.h>
-
-#include <iostream>
+#include "alsa_capture.h"
+#include "log.h"
+#include "thread_config.h"
 
 std::unique_ptr<std::thread> AudioInputALSA::GetBackgroundThread() {
   return std::unique_ptr<std::thread>(new std::thread([this]() {
+    ApplyThreadConfig(ThreadRole::CAPTURE, "mic-capture");
     // Initialize.
-    snd_pcm_t* pcm_handle;
-    int pcm_open_ret = snd_pcm_open(&pcm_handle, "default", SND_PCM_STREAM_CAPTURE, 0);
-    if (pcm_open_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_open returned " << pcm_open_ret << std::endl;
-      return;
-    }
-    int pcm_nonblock_ret = snd_pcm_nonblock(pcm_handle, SND_PCM_NONBLOCK);
-    if (pcm_nonblock_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_nonblock returned " << pcm_nonblock_ret << std::endl;
-      return;
-    }
-    snd_pcm_hw_params_t* pcm_params;
-    int malloc_param_ret = snd_pcm_hw_params_malloc(&pcm_params);
-    if (malloc_param_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_hw_params_malloc returned " << malloc_param_ret
-          << std::endl;
-      return;
-    }
-    snd_pcm_hw_params_any(pcm_handle, pcm_params);
-    int set_param_ret =
-        snd_pcm_hw_params_set_access(pcm_handle, pcm_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    if (set_param_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_hw_params_set_access returned " << set_param_ret
-          << std::endl;
-      return;
-    }
-    set_param_ret =
-        snd_pcm_hw_params_set_format(pcm_handle, pcm_params, SND_PCM_FORMAT_S16_LE);
-    if (set_param_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_hw_params_set_format returned " << set_param_ret
-          << std::endl;
-      return;
-    }
-    set_param_ret =
-        snd_pcm_hw_params_set_channels(pcm_handle, pcm_params, 1);
-    if (set_param_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_hw_params_set_channels returned " << set_param_ret
-          << std::endl;
-      return;
-    }
-    unsigned int rate = 16000;
-    set_param_ret =
-        snd_pcm_hw_params_set_rate_near(pcm_handle, pcm_params, &rate, nullptr);
-    if (set_param_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_hw_params_set_rate_near returned " << set_param_ret
-          << std::endl;
-      return;
+    AlsaCapture capture("dialog");
+    capture.SetChannels(channels_);
+    if (pipeline_) {
+      capture.SetPipeline(pipeline_);
     }
-    set_param_ret = snd_pcm_hw_params(pcm_handle, pcm_params);
-    if (set_param_ret < 0) {
-      std::cerr << "AudioInputALSA snd_pcm_hw_params returned " << set_param_ret << std::endl;
+    if (!capture.Open("default", 16000, 0, 0, true)) {
+      LOG(ERROR) << "AudioInputALSA cannot open the capture device";
       return;
     }
-    snd_pcm_hw_params_free(pcm_params);
 
+    // Packets are recycled once every listener has released them.
+    AudioPacketPool pool(kFramesPerPacket * kBytesPerFrame);
+    uint64_t sequence = 0;
     while (is_running_) {
-      std::shared_ptr<std::vector<unsigned char>> audio_data(
-            new std::vector<unsigned char>(kFramesPerPacket * kBytesPerFrame));
-      int pcm_read_ret = snd_pcm_readi(pcm_handle, &(*audio_data.get())[0], kFramesPerPacket);
-      if (pcm_read_ret == -EAGAIN) {
+      AudioPacketPtr packet = pool.Acquire();
+      packet->data.resize(kFramesPerPacket * kBytesPerFrame);
+      // Overruns and suspends are recovered inside Read(); an error means
+      // the device is gone for good.
+      int pcm_read_ret = capture.Read(&packet->data[0], kFramesPerPacket);
+      if (pcm_read_ret == 0) {
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
       } else if (pcm_read_ret < 0) {
-        std::cerr << "AudioInputALSA snd_pcm_readi returned " << pcm_read_ret << std::endl;
+        LOG(ERROR) << "AudioInputALSA capture failed " << pcm_read_ret;
         break;
-      } else if (pcm_read_ret > 0) {
-        audio_data->resize(kBytesPerFrame * pcm_read_ret);
-        for (auto& listener : data_listeners_) {
-          listener(audio_data);
-        }
+      } else {
+        packet->data.resize(kBytesPerFrame * pcm_read_ret);
+        packet->timestamp = capture.Timestamp();
+        packet->sample_index = capture.Position();
+        packet->sequence = sequence++;
+        packet->discontinuity = capture.Discontinuity();
+        Publish(packet);
       }
     }
 
     // Finalize.
-    snd_pcm_close(pcm_handle);
+    capture.Close();
 
     // Call |OnStop|.
     OnStop();
@@ -14,17 +14,31 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <memory>
+
 #include "audio_input.h"
+#include "dsp_pipeline.h"
 
 class AudioInputALSA : public AudioInput {
  public:
+  // |channels| microphones are captured and beamformed into one stream,
+  // which |pipeline|, if set, conditions. The pipeline keeps what it adapted
+  // to, so pass the same one to the input of every dialog; only one input
+  // may run it at a time.
+  explicit AudioInputALSA(int channels = 1,
+                          std::shared_ptr<DspPipeline> pipeline = nullptr)
+      : channels_(channels), pipeline_(pipeline) {}
   ~AudioInputALSA() override {}
 
   virtual std::unique_ptr<std::thread> GetBackgroundThread() override;
 
  private:
-  // For 16000Hz, it's about 0.1 second.
-  static constexpr int kFramesPerPacket = 1600;
-  // 1 channel, S16LE, so 2 bytes each frame.
+  // For 16000Hz, it's 20ms, the smallest uplink request; the uplink
+  // groups packets into larger requests as the network requires.
+  static constexpr int kFramesPerPacket = 320;
+  // 1 channel after beamforming, S16LE, so 2 bytes each frame.
   static constexpr int kBytesPerFrame = 2;
+
+  int channels_;
+  std::shared_ptr<DspPipeline> pipeline_;
 };
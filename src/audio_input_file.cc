@@ -16,6 +16,9 @@ limitations under the License.
 
 #include "audio_input_file.h"
 
+#include <time.h>
+
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
@@ -28,25 +31,35 @@ std::unique_ptr<std::thread> AudioInputFile::GetBackgroundThread() {
       return;
     }
 
-    const size_t chunk_size = 20 * 1024;  // 20KB
-    std::shared_ptr<std::vector<unsigned char>> chunk(
-        new std::vector<unsigned char>);
-    chunk->resize(chunk_size);
+    // 16000Hz, 2 bytes per sample.
+    const size_t chunk_size = chunk_ms_ > 0 ? chunk_ms_ * 32 : 20 * 1024;  // 20KB
+    const std::chrono::milliseconds interval(chunk_ms_ > 0 ? chunk_ms_ : 1000);
+    std::chrono::steady_clock::time_point next_chunk =
+        std::chrono::steady_clock::now();
+    AudioPacketPool pool(chunk_size);
+    uint64_t sequence = 0;
+    uint64_t sample_index = 0;
     while (is_running_) {
+      AudioPacketPtr chunk = pool.Acquire();
+      chunk->data.resize(chunk_size);
       // Read another chunk from the file.
       std::streamsize bytes_read =
-          file_stream.rdbuf()->sgetn((char*)&(*chunk.get())[0], chunk->size());
+          file_stream.rdbuf()->sgetn((char*)&chunk->data[0], chunk->data.size());
       if (bytes_read > 0) {
-        chunk->resize(bytes_read);
-        for (auto& listener : data_listeners_) {
-          listener(chunk);
-        }
+        chunk->data.resize(bytes_read);
+        // The file stands in for a microphone that captured the chunk just now.
+        clock_gettime(CLOCK_MONOTONIC, &chunk->timestamp);
+        chunk->sample_index = sample_index;
+        chunk->sequence = sequence++;
+        sample_index += chunk->Frames();
+        Publish(chunk);
       }
-      if (bytes_read < chunk->size()) {
+      if (bytes_read < static_cast<std::streamsize>(chunk_size)) {
         break;
       }
-      // Wait a second before writing the next chunk.
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+      // Wait before writing the next chunk.
+      next_chunk += interval;
+      std::this_thread::sleep_until(next_chunk);
     }
 
     // Call |OnStop|.
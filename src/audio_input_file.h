@@ -19,10 +19,15 @@ limitations under the License.
 class AudioInputFile : public AudioInput {
  public:
   AudioInputFile(const std::string& file_path): file_path_(file_path) {}
+  // Sends |chunk_ms| of audio every |chunk_ms|, as a microphone would,
+  // instead of 20KB a second.
+  AudioInputFile(const std::string& file_path, int chunk_ms)
+      : file_path_(file_path), chunk_ms_(chunk_ms) {}
   ~AudioInputFile() override {}
 
   virtual std::unique_ptr<std::thread> GetBackgroundThread() override;
 
  private:
   const std::string file_path_;
+  const int chunk_ms_ = 0;
 };
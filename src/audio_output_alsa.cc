@@ -20,12 +20,27 @@ limitations under the License.
 
 #include <iostream>
 
+#include "log.h"
+#include "metrics.h"
+#include "session_log.h"
+#include "thread_config.h"
+
+static Counter* const kPlaybackXruns = MetricsRegistry::Global().GetCounter(
+    "assistant_playback_xruns_total", "ALSA playback underruns recovered.");
+static Gauge* const kPlaybackQueueDepth = MetricsRegistry::Global().GetGauge(
+    "assistant_playback_queue_depth", "Response audio chunks waiting for playback.");
+
 bool AudioOutputALSA::Start() {
   std::unique_lock<std::mutex> lock(isRunningMutex);
 
   if (isRunning) {
     return true;
   }
+  // The playback thread may have stopped on its own after a device error.
+  if (alsaThread) {
+    alsaThread->join();
+    alsaThread.reset(nullptr);
+  }
 
   snd_pcm_t* pcm_handle;
   int pcm_open_ret = snd_pcm_open(&pcm_handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
@@ -78,7 +93,8 @@ bool AudioOutputALSA::Start() {
   snd_pcm_hw_params_free(pcm_params);
 
   isRunning = true;
-  alsaThread.reset(new std::thread([this, pcm_handle]() {
+  alsaThread.reset(new std::thread([this, pcm_handle, rate]() {
+    ApplyThreadConfig(ThreadRole::PLAYBACK, "playback");
     while (isRunning) {
       std::unique_lock<std::mutex> lock(audioDataMutex);
       while (audioData.size() == 0 && isRunning) {
@@ -88,17 +104,46 @@ bool AudioOutputALSA::Start() {
         break;
       }
 
-      std::shared_ptr<std::vector<unsigned char>> data = audioData[0];
+      AudioChunk chunk = std::move(audioData[0]);
       audioData.erase(audioData.begin());
-      int frames = data->size() / 2;  // 1 channel, S16LE, so 2 bytes each frame.
-      int pcm_write_ret = snd_pcm_writei(pcm_handle, &(*data.get())[0], frames);
+      kPlaybackQueueDepth->Set(audioData.size());
+      writing = true;
+      // Send() must not wait for the device.
+      lock.unlock();
+      int frames = chunk.size / 2;  // 1 channel, S16LE, so 2 bytes each frame.
+      if (SessionRecorder* recorder = SessionRecorder::Active()) {
+        recorder->Append(SessionRecordType::PLAYBACK, frames, chunk.data, chunk.size);
+      }
+      int pcm_write_ret = snd_pcm_writei(pcm_handle, chunk.data, frames);
       if (pcm_write_ret < 0) {
+        kPlaybackXruns->Increment();
         int pcm_recover_ret = snd_pcm_recover(pcm_handle, pcm_write_ret, 0);
         if (pcm_recover_ret < 0) {
-          std::cerr << "AudioOutputALSA snd_pcm_recover returns " << pcm_recover_ret << std::endl;
+          LOG(ERROR) << "AudioOutputALSA snd_pcm_recover returns " << pcm_recover_ret;
           break;
         }
       }
+      // Frames still in the device buffer tell when this chunk is heard.
+      snd_pcm_sframes_t delay = 0;
+      if (snd_pcm_delay(pcm_handle, &delay) < 0 || delay < 0) {
+        delay = 0;
+      }
+      std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now()
+          + std::chrono::microseconds(delay * 1000000LL / rate);
+      lock.lock();
+      writing = false;
+      playedUntil = until;
+      playedCv.notify_all();
+    }
+    {
+      // Whether stopped or failed, nothing queued will be played, so
+      // waiters must not wait for it.
+      std::unique_lock<std::mutex> lock(audioDataMutex);
+      isRunning = false;
+      audioData.clear();
+      kPlaybackQueueDepth->Set(0);
+      writing = false;
+      playedCv.notify_all();
     }
     // Wait for all data to be consumed.
     snd_pcm_drain(pcm_handle);
@@ -110,17 +155,30 @@ bool AudioOutputALSA::Start() {
 void AudioOutputALSA::Stop() {
   std::unique_lock<std::mutex> lick(isRunningMutex);
 
-  if (!isRunning) {
-    return;
-  }
-
+  // Also joins a playback thread that stopped on its own.
   isRunning = false;
-  alsaThread->join();
-  alsaThread.reset(nullptr);
+  if (alsaThread) {
+    alsaThread->join();
+    alsaThread.reset(nullptr);
+  }
 }
 
-void AudioOutputALSA::Send(std::shared_ptr<std::vector<unsigned char>> data) {
+void AudioOutputALSA::Send(const AudioChunk& chunk) {
   std::unique_lock<std::mutex> lock(audioDataMutex);
-  audioData.push_back(data);
+  audioData.push_back(chunk);
+  kPlaybackQueueDepth->Set(audioData.size());
   audioDataCv.notify_one();
 }
+
+void AudioOutputALSA::WaitUntilPlayed() {
+  std::unique_lock<std::mutex> lock(audioDataMutex);
+  while ((!audioData.empty() || writing) && isRunning) {
+    playedCv.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  if (!isRunning) {
+    return;
+  }
+  std::chrono::steady_clock::time_point until = playedUntil;
+  lock.unlock();
+  std::this_thread::sleep_until(until);
+}
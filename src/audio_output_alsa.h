@@ -14,11 +14,15 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "audio_packet.h"
+
 // Audio output using ALSA.
 class AudioOutputALSA {
  public:
@@ -26,15 +30,27 @@ class AudioOutputALSA {
 
   void Stop();
 
-  void Send(std::shared_ptr<std::vector<unsigned char>> data);
+  // Queues |chunk| for playback. It is released once ALSA has consumed it.
+  void Send(const AudioChunk& chunk);
+
+  // Blocks until everything sent so far has been heard, i.e. the queue is
+  // empty and the device has played out its buffer. Returns at once if
+  // output is stopped, and as soon as the playback thread stops after a
+  // device error, which drops the queued audio. Start() reopens the device.
+  void WaitUntilPlayed();
 
   friend void fill_audio(void* userdata, unsigned char* stream, int len);
 
  private:
-  std::vector<std::shared_ptr<std::vector<unsigned char>>> audioData;
+  std::vector<AudioChunk> audioData;
   std::mutex audioDataMutex;
   std::condition_variable audioDataCv;
+  // Whether the playback thread is writing a chunk, and when the audio
+  // written so far will have played out. Guarded by |audioDataMutex|.
+  bool writing = false;
+  std::chrono::steady_clock::time_point playedUntil;
+  std::condition_variable playedCv;
   std::unique_ptr<std::thread> alsaThread;
-  bool isRunning = false;
+  std::atomic<bool> isRunning{false};
   std::mutex isRunningMutex;
 };
@@ -0,0 +1,96 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "audio_packet.h"
+
+struct AudioPacketPoolState {
+  std::mutex mutex;
+  std::vector<AudioPacket*> free;
+  size_t capacity_bytes = 0;
+  size_t allocated = 0;
+  bool closed = false;
+};
+
+void AudioPacketPtr::Reset() {
+  if (packet_ == nullptr) {
+    return;
+  }
+  AudioPacket* packet = packet_;
+  packet_ = nullptr;
+  if (packet->refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  AudioPacketPoolState* state = packet->pool_.get();
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (!state->closed) {
+      state->free.push_back(packet);
+      return;
+    }
+  }
+  delete packet;
+}
+
+AudioPacketPool::AudioPacketPool(size_t capacity_bytes)
+    : state_(new AudioPacketPoolState) {
+  state_->capacity_bytes = capacity_bytes;
+}
+
+AudioPacketPool::~AudioPacketPool() {
+  std::vector<AudioPacket*> free;
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+    free.swap(state_->free);
+  }
+  for (AudioPacket* packet : free) {
+    delete packet;
+  }
+}
+
+AudioPacketPtr AudioPacketPool::Acquire() {
+  AudioPacket* packet = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    if (!state_->free.empty()) {
+      packet = state_->free.back();
+      state_->free.pop_back();
+    } else {
+      state_->allocated++;
+      // Reserve room for every packet up front, so that returning one never
+      // grows the free list.
+      state_->free.reserve(state_->allocated);
+    }
+  }
+  if (packet == nullptr) {
+    packet = new AudioPacket;
+    packet->data.reserve(state_->capacity_bytes);
+    packet->pool_ = state_;
+  }
+  packet->timestamp = {0, 0};
+  packet->sample_index = 0;
+  packet->sequence = 0;
+  packet->format = AudioFormat();
+  packet->discontinuity = false;
+  packet->data.clear();
+  packet->refs_.store(1, std::memory_order_relaxed);
+  return AudioPacketPtr(packet);
+}
+
+size_t AudioPacketPool::Allocated() const {
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  return state_->allocated;
+}
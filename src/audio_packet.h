@@ -0,0 +1,131 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef AUDIO_PACKET_H
+#define AUDIO_PACKET_H
+
+#include <time.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Sample format of an AudioPacket. Samples are interleaved S16_LE.
+struct AudioFormat {
+  int sample_rate = 16000;
+  int channels = 1;
+
+  int BytesPerFrame() const { return channels * 2; }
+};
+
+struct AudioPacketPoolState;
+
+// One block of captured audio with its place in the stream. Packets are
+// reference counted through AudioPacketPtr and recycled by the
+// AudioPacketPool they came from, so passing them to listeners does not
+// allocate.
+class AudioPacket {
+ public:
+  // CLOCK_MONOTONIC capture time of the first frame.
+  timespec timestamp = {0, 0};
+  // Index of the first frame since the source started. Frames lost to
+  // overruns are counted, so indexes stay sample-accurate across gaps.
+  uint64_t sample_index = 0;
+  // Packet number within the source, starting at 0 and without gaps.
+  uint64_t sequence = 0;
+  AudioFormat format;
+  // Set when frames were lost between the previous packet and this one.
+  bool discontinuity = false;
+  std::vector<unsigned char> data;
+
+  size_t Frames() const { return data.size() / format.BytesPerFrame(); }
+  const int16_t* Samples() const {
+    return reinterpret_cast<const int16_t*>(data.data());
+  }
+
+ private:
+  friend class AudioPacketPtr;
+  friend class AudioPacketPool;
+
+  std::atomic<int> refs_{0};
+  std::shared_ptr<AudioPacketPoolState> pool_;
+};
+
+// Shared, read-only handle to an AudioPacket. Copying only touches the
+// reference count; the last handle returns the packet to its pool.
+class AudioPacketPtr {
+ public:
+  AudioPacketPtr() {}
+  AudioPacketPtr(const AudioPacketPtr& other) : packet_(other.packet_) {
+    if (packet_ != nullptr) {
+      packet_->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  AudioPacketPtr(AudioPacketPtr&& other) : packet_(other.packet_) {
+    other.packet_ = nullptr;
+  }
+  AudioPacketPtr& operator=(AudioPacketPtr other) {
+    std::swap(packet_, other.packet_);
+    return *this;
+  }
+  ~AudioPacketPtr() { Reset(); }
+
+  void Reset();
+
+  AudioPacket* get() const { return packet_; }
+  AudioPacket& operator*() const { return *packet_; }
+  AudioPacket* operator->() const { return packet_; }
+  explicit operator bool() const { return packet_ != nullptr; }
+
+ private:
+  friend class AudioPacketPool;
+  explicit AudioPacketPtr(AudioPacket* packet) : packet_(packet) {}
+
+  AudioPacket* packet_ = nullptr;
+};
+
+// Recycles packets of one source. Packets may outlive the pool.
+class AudioPacketPool {
+ public:
+  // Packets are created with room for |capacity_bytes| of data.
+  explicit AudioPacketPool(size_t capacity_bytes);
+  ~AudioPacketPool();
+
+  // Returns a packet with default fields and empty data. Allocates only
+  // when every packet of the pool is still in use.
+  AudioPacketPtr Acquire();
+
+  // Number of packets the pool has created.
+  size_t Allocated() const;
+
+ private:
+  std::shared_ptr<AudioPacketPoolState> state_;
+};
+
+// A block of audio borrowed from another buffer, such as a parsed response.
+// |data| stays valid as long as |owner| is held, so the bytes are played
+// where they are without a copy.
+struct AudioChunk {
+  std::shared_ptr<const void> owner;
+  const unsigned char* data = nullptr;
+  size_t size = 0;
+};
+
+#endif
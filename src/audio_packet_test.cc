@@ -0,0 +1,79 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "audio_packet.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+int main() {
+  AudioPacketPool pool(3200);
+
+  // A steady stream where every packet is handed to two listeners and
+  // released creates only the packets that are in flight at once.
+  std::vector<AudioPacketPtr> in_flight;
+  for (int i = 0; i < 1000; i++) {
+    AudioPacketPtr packet = pool.Acquire();
+    const unsigned char* buffer = packet->data.data();
+    packet->data.resize(3200);
+    if (packet->data.data() != buffer) {
+      std::cerr << "Test failed, packet data was reallocated" << std::endl;
+      return 1;
+    }
+    packet->sequence = i;
+    AudioPacketPtr uplink = packet;
+    in_flight.push_back(uplink);
+    if (in_flight.size() > 3) {
+      in_flight.erase(in_flight.begin());
+    }
+  }
+  if (pool.Allocated() != 4) {
+    std::cerr << "Test failed, pool allocated " << pool.Allocated() << " packets"
+              << std::endl;
+    return 1;
+  }
+
+  // Recycled packets come back with default fields.
+  in_flight.clear();
+  AudioPacketPtr recycled = pool.Acquire();
+  if (recycled->sequence != 0 || !recycled->data.empty()
+      || recycled->discontinuity || pool.Allocated() != 4) {
+    std::cerr << "Test failed, recycled packet not reset" << std::endl;
+    return 1;
+  }
+  recycled.Reset();
+
+  // Packets released on other threads, and after the pool is gone, are
+  // returned or freed safely.
+  std::vector<std::thread> threads;
+  {
+    AudioPacketPool short_lived(320);
+    for (int t = 0; t < 4; t++) {
+      AudioPacketPtr packet = short_lived.Acquire();
+      threads.emplace_back([packet]() {
+        AudioPacketPtr copy = packet;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      });
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
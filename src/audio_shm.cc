@@ -0,0 +1,319 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "audio_shm.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+
+namespace {
+
+const char kMagic[8] = {'A', 'S', 'S', 'T', 'S', 'H', 'M', '1'};
+const uint32_t kVersion = 1;
+
+static_assert(sizeof(AudioShmHeader) <= kAudioShmHeaderSize,
+              "AudioShmHeader does not fit");
+static_assert(sizeof(AudioShmSlot) <= kAudioShmSlotHeaderSize,
+              "AudioShmSlot does not fit");
+
+// Shared with other processes, so neither may be private to this one.
+uint32_t* FutexWord(std::atomic<uint32_t>* word) {
+  return reinterpret_cast<uint32_t*>(word);
+}
+
+void FutexWait(std::atomic<uint32_t>* word, uint32_t value,
+               const timespec* timeout) {
+  syscall(SYS_futex, FutexWord(word), FUTEX_WAIT, value, timeout, nullptr, 0);
+}
+
+void FutexWakeAll(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, FutexWord(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+int64_t TimestampNs(const timespec& time) {
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+}  // namespace
+
+std::atomic<AudioShmWriter*> AudioShmWriter::active_{nullptr};
+
+std::unique_ptr<AudioShmWriter> AudioShmWriter::Create(
+    const std::string& name, const Options& options, std::string* error) {
+  if (options.slot_count == 0 ||
+      (options.slot_count & (options.slot_count - 1)) != 0 ||
+      options.slot_frames == 0) {
+    *error = "The slot count must be a power of two";
+    return nullptr;
+  }
+  size_t slot_size = kAudioShmSlotHeaderSize +
+                     options.slot_frames * options.format.BytesPerFrame();
+  slot_size = (slot_size + 63) & ~static_cast<size_t>(63);
+  size_t size = kAudioShmHeaderSize + options.slot_count * slot_size;
+
+  // Readers of a stale ring keep their mapping, the name gets a new one.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, options.mode);
+  if (fd < 0) {
+    *error = "Cannot create " + name + ": " + strerror(errno);
+    return nullptr;
+  }
+  // Not narrowed by the umask.
+  fchmod(fd, options.mode);
+  if (ftruncate(fd, size) != 0) {
+    *error = "Cannot size " + name + ": " + strerror(errno);
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    *error = "Cannot map " + name + ": " + strerror(errno);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+
+  std::unique_ptr<AudioShmWriter> writer(new AudioShmWriter());
+  writer->name_ = name;
+  writer->base_ = static_cast<char*>(base);
+  writer->size_ = size;
+  // The new object is zero-filled: no packets, every slot sequence 0.
+  AudioShmHeader* header = new (base) AudioShmHeader();
+  header->version = kVersion;
+  header->sample_rate = options.format.sample_rate;
+  header->channels = options.format.channels;
+  header->slot_count = options.slot_count;
+  header->slot_frames = options.slot_frames;
+  header->slot_size = slot_size;
+  header->write_count.store(0);
+  header->futex.store(0);
+  header->waiters.store(0);
+  header->closed.store(0);
+  // Readers check the magic last.
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, kMagic, sizeof(kMagic));
+  writer->header_ = header;
+  return writer;
+}
+
+AudioShmWriter::~AudioShmWriter() {
+  if (Active() == this) {
+    SetActive(nullptr);
+  }
+  header_->closed.store(1);
+  header_->futex.fetch_add(1);
+  FutexWakeAll(&header_->futex);
+  munmap(base_, size_);
+  shm_unlink(name_.c_str());
+}
+
+void AudioShmWriter::Write(const void* source, uint64_t position,
+                           const timespec& timestamp, bool discontinuity,
+                           const int16_t* samples, size_t frames) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  int64_t timestamp_ns = TimestampNs(timestamp);
+  bool continues = source == last_source_ && position == next_position_ &&
+                   !discontinuity;
+  if (!continues && next_timestamp_ns_ != 0 &&
+      timestamp_ns > next_timestamp_ns_) {
+    // Count what the ring missed from the capture clock.
+    next_index_ += (timestamp_ns - next_timestamp_ns_) *
+                   header_->sample_rate / 1000000000;
+  }
+  uint32_t flags = continues ? 0 : kAudioShmDiscontinuity;
+  last_source_ = source;
+  next_position_ = position + frames;
+  while (frames > 0) {
+    size_t chunk = std::min<size_t>(frames, header_->slot_frames);
+    Publish(next_index_, timestamp_ns, flags, samples, chunk);
+    next_index_ += chunk;
+    timestamp_ns += chunk * 1000000000 / header_->sample_rate;
+    samples += chunk * header_->channels;
+    frames -= chunk;
+    flags = 0;
+  }
+  next_timestamp_ns_ = timestamp_ns;
+}
+
+uint64_t AudioShmWriter::PacketsWritten() const {
+  return header_->write_count.load(std::memory_order_relaxed);
+}
+
+void AudioShmWriter::Publish(uint64_t sample_index, int64_t timestamp_ns,
+                             uint32_t flags, const int16_t* samples,
+                             size_t frames) {
+  uint64_t n = header_->write_count.load(std::memory_order_relaxed);
+  char* slot_base = base_ + kAudioShmHeaderSize +
+                    (n & (header_->slot_count - 1)) * header_->slot_size;
+  AudioShmSlot* slot = reinterpret_cast<AudioShmSlot*>(slot_base);
+  slot->sequence.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->sample_index = sample_index;
+  slot->timestamp_ns = timestamp_ns;
+  slot->frames = frames;
+  slot->flags = flags;
+  memcpy(slot_base + kAudioShmSlotHeaderSize, samples,
+         frames * header_->channels * sizeof(int16_t));
+  slot->sequence.store(2 * n + 2, std::memory_order_release);
+  header_->write_count.store(n + 1, std::memory_order_release);
+  // Ordered before the check of |waiters|, against a reader that checks
+  // |write_count| and then goes to sleep.
+  header_->futex.fetch_add(1, std::memory_order_seq_cst);
+  if (header_->waiters.load(std::memory_order_seq_cst) > 0) {
+    FutexWakeAll(&header_->futex);
+  }
+}
+
+std::unique_ptr<AudioShmReader> AudioShmReader::Open(const std::string& name,
+                                                     std::string* error) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    *error = "Cannot open " + name + ": " + strerror(errno);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < static_cast<off_t>(kAudioShmHeaderSize)) {
+    *error = name + " is not an audio ring";
+    close(fd);
+    return nullptr;
+  }
+  void* base =
+      mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    *error = "Cannot map " + name + ": " + strerror(errno);
+    return nullptr;
+  }
+  std::unique_ptr<AudioShmReader> reader(new AudioShmReader());
+  reader->base_ = static_cast<const char*>(base);
+  reader->size_ = st.st_size;
+  reader->header_ = static_cast<AudioShmHeader*>(base);
+  const AudioShmHeader* header = reader->header_;
+  bool valid = memcmp(header->magic, kMagic, sizeof(kMagic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!valid || header->version != kVersion ||
+      kAudioShmHeaderSize +
+              static_cast<size_t>(header->slot_count) * header->slot_size >
+          static_cast<size_t>(st.st_size)) {
+    *error = name + " is not an audio ring";
+    return nullptr;
+  }
+  reader->next_ = header->write_count.load(std::memory_order_acquire);
+  return reader;
+}
+
+AudioShmReader::~AudioShmReader() {
+  munmap(const_cast<char*>(base_), size_);
+}
+
+AudioFormat AudioShmReader::Format() const {
+  AudioFormat format;
+  format.sample_rate = header_->sample_rate;
+  format.channels = header_->channels;
+  return format;
+}
+
+const AudioShmSlot* AudioShmReader::SlotAt(uint64_t sequence) const {
+  return reinterpret_cast<const AudioShmSlot*>(
+      base_ + kAudioShmHeaderSize +
+      (sequence & (header_->slot_count - 1)) * header_->slot_size);
+}
+
+AudioShmStatus AudioShmReader::Next(AudioShmView* view, int timeout_ms) {
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    uint32_t word = header_->futex.load(std::memory_order_seq_cst);
+    uint64_t written = header_->write_count.load(std::memory_order_acquire);
+    if (written > next_) {
+      if (written - next_ > header_->slot_count) {
+        lost_ += written - 1 - next_;
+        next_ = written - 1;
+        return AudioShmStatus::OVERRUN;
+      }
+      const AudioShmSlot* slot = SlotAt(next_);
+      if (slot->sequence.load(std::memory_order_acquire) != 2 * next_ + 2) {
+        // Lapped since |written| was read; the next round skips ahead.
+        continue;
+      }
+      view->sequence = next_;
+      view->sample_index = slot->sample_index;
+      view->timestamp_ns = slot->timestamp_ns;
+      view->flags = slot->flags;
+      view->frames = std::min<size_t>(slot->frames, header_->slot_frames);
+      view->samples = reinterpret_cast<const int16_t*>(
+          reinterpret_cast<const char*>(slot) + kAudioShmSlotHeaderSize);
+      next_++;
+      return AudioShmStatus::OK;
+    }
+    if (header_->closed.load()) {
+      return AudioShmStatus::CLOSED;
+    }
+
+    timespec timeout;
+    if (timeout_ms >= 0) {
+      std::chrono::nanoseconds remaining =
+          deadline - std::chrono::steady_clock::now();
+      if (remaining.count() <= 0) {
+        return AudioShmStatus::TIMEOUT;
+      }
+      timeout.tv_sec = remaining.count() / 1000000000;
+      timeout.tv_nsec = remaining.count() % 1000000000;
+    }
+    header_->waiters.fetch_add(1, std::memory_order_seq_cst);
+    // Returns at once if a packet was published since |word| was read.
+    FutexWait(&header_->futex, word, timeout_ms >= 0 ? &timeout : nullptr);
+    header_->waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+bool AudioShmReader::Valid(const AudioShmView& view) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return SlotAt(view.sequence)->sequence.load(std::memory_order_relaxed) ==
+         2 * view.sequence + 2;
+}
+
+AudioShmStatus AudioShmReader::Read(AudioShmView* view,
+                                    std::vector<int16_t>* samples,
+                                    int timeout_ms) {
+  while (true) {
+    AudioShmStatus status = Next(view, timeout_ms);
+    if (status != AudioShmStatus::OK) {
+      return status;
+    }
+    samples->assign(view->samples,
+                    view->samples + view->frames * header_->channels);
+    if (Valid(*view)) {
+      view->samples = samples->data();
+      return AudioShmStatus::OK;
+    }
+    lost_++;
+  }
+}
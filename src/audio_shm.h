@@ -0,0 +1,206 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef AUDIO_SHM_H
+#define AUDIO_SHM_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "audio_packet.h"
+
+// The microphone stream in a POSIX shared memory ring, so that other
+// processes on the device can read it without opening the capture device
+// again. One process writes, any number read, and nobody takes a lock:
+//
+//   AudioShmHeader, padded to kAudioShmHeaderSize
+//   slot 0: AudioShmSlot, padded to kAudioShmSlotHeaderSize, then samples
+//   slot 1 ...
+//
+// Packet n goes to slot n % slot_count. Each slot is a seqlock: its
+// sequence is odd while the writer fills it and 2n + 2 once packet n is
+// complete, so a reader can check that a packet it read in place was not
+// overwritten meanwhile. Readers sleep on a futex word the writer bumps
+// after every packet, and the writer only makes the wake-up system call
+// when some reader is asleep.
+struct AudioShmHeader {
+  char magic[8];  // "ASSTSHM1"
+  uint32_t version;
+  uint32_t sample_rate;
+  uint32_t channels;
+  // A power of two.
+  uint32_t slot_count;
+  uint32_t slot_frames;
+  // Bytes from one slot to the next.
+  uint32_t slot_size;
+  // Packets published so far.
+  std::atomic<uint64_t> write_count;
+  // Bumped after every packet and on close.
+  std::atomic<uint32_t> futex;
+  // Readers asleep on |futex|.
+  std::atomic<uint32_t> waiters;
+  // Set once the writer has gone away.
+  std::atomic<uint32_t> closed;
+};
+
+struct AudioShmSlot {
+  // 2n + 1 while packet n is written, 2n + 2 once it is complete.
+  std::atomic<uint64_t> sequence;
+  // Frames since the ring was created, including frames it missed, so
+  // that indexes stay sample-accurate across capture restarts.
+  uint64_t sample_index;
+  // CLOCK_MONOTONIC capture time of the first frame.
+  int64_t timestamp_ns;
+  uint32_t frames;
+  uint32_t flags;
+};
+
+const size_t kAudioShmHeaderSize = 128;
+const size_t kAudioShmSlotHeaderSize = 64;
+// Frames were lost right before the packet.
+const uint32_t kAudioShmDiscontinuity = 1;
+
+// Creates the ring and publishes the capture into it.
+class AudioShmWriter {
+ public:
+  struct Options {
+    AudioFormat format;
+    size_t slot_count = 64;
+    // Longer captures are split over several slots.
+    size_t slot_frames = 1024;
+    // Readers need write access too, to sleep on the futex.
+    mode_t mode = 0660;
+  };
+
+  // Creates the shared memory object |name|, e.g. "/assistant_mic",
+  // replacing a stale one. Returns nullptr and sets |*error| on failure.
+  static std::unique_ptr<AudioShmWriter> Create(const std::string& name,
+                                                const Options& options,
+                                                std::string* error);
+  // Closes the ring for readers and removes its name.
+  ~AudioShmWriter();
+
+  // The ring that AlsaCapture publishes into, or nullptr.
+  static AudioShmWriter* Active() {
+    return active_.load(std::memory_order_acquire);
+  }
+  // The writer must stay alive until it is replaced.
+  static void SetActive(AudioShmWriter* writer) {
+    active_.store(writer, std::memory_order_release);
+  }
+
+  // Publishes |frames| interleaved frames that |source| captured at
+  // |position| of its stream. Captures from different sources follow one
+  // another in the ring, with the time between them counted in the sample
+  // indexes. Thread-safe.
+  void Write(const void* source, uint64_t position, const timespec& timestamp,
+             bool discontinuity, const int16_t* samples, size_t frames);
+
+  uint64_t PacketsWritten() const;
+
+ private:
+  AudioShmWriter() {}
+
+  void Publish(uint64_t sample_index, int64_t timestamp_ns, uint32_t flags,
+               const int16_t* samples, size_t frames);
+
+  static std::atomic<AudioShmWriter*> active_;
+
+  std::string name_;
+  char* base_ = nullptr;
+  size_t size_ = 0;
+  AudioShmHeader* header_ = nullptr;
+
+  // Serializes writers in this process, e.g. the keyword and the dialog
+  // capture handing over the microphone.
+  std::mutex mutex_;
+  const void* last_source_ = nullptr;
+  uint64_t next_position_ = 0;
+  uint64_t next_index_ = 0;
+  int64_t next_timestamp_ns_ = 0;
+};
+
+// A packet in the ring, read in place.
+struct AudioShmView {
+  // Packet number in the ring.
+  uint64_t sequence = 0;
+  uint64_t sample_index = 0;
+  int64_t timestamp_ns = 0;
+  uint32_t flags = 0;
+  const int16_t* samples = nullptr;
+  size_t frames = 0;
+};
+
+enum class AudioShmStatus {
+  OK,
+  TIMEOUT,
+  // The reader fell more than a ring behind and skipped to the newest
+  // packet.
+  OVERRUN,
+  // The writer has gone away and every packet was read.
+  CLOSED,
+};
+
+// Reads the ring from another process. Not thread-safe; use one reader per
+// thread.
+class AudioShmReader {
+ public:
+  // Attaches to the ring |name|, starting at the next packet. Returns
+  // nullptr and sets |*error| if there is none.
+  static std::unique_ptr<AudioShmReader> Open(const std::string& name,
+                                              std::string* error);
+  ~AudioShmReader();
+
+  AudioFormat Format() const;
+
+  // Waits up to |timeout_ms|, or forever if negative, for the next packet
+  // and points |*view| at it in shared memory, without copying. The
+  // samples may be overwritten once the writer laps the reader: check
+  // Valid() after using them.
+  AudioShmStatus Next(AudioShmView* view, int timeout_ms);
+  // Whether the packet of |view| was still intact after it was used.
+  bool Valid(const AudioShmView& view) const;
+
+  // Like Next(), but copies the samples into |*samples| and skips packets
+  // that were overwritten while they were copied.
+  AudioShmStatus Read(AudioShmView* view, std::vector<int16_t>* samples,
+                      int timeout_ms);
+
+  // Packets skipped because the reader fell behind.
+  uint64_t Lost() const { return lost_; }
+
+ private:
+  AudioShmReader() {}
+
+  const AudioShmSlot* SlotAt(uint64_t sequence) const;
+
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  AudioShmHeader* header_ = nullptr;
+  uint64_t next_ = 0;
+  uint64_t lost_ = 0;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+// Measures the shared memory audio ring with reader processes:
+//
+//   ./audio_shm_benchmark [--readers <n>] [--packet_frames <n>] [--seconds <s>]
+//
+// - throughput: the writer publishes as fast as it can while every reader
+//   sums each packet in place;
+// - latency: the writer publishes in real time, and every reader measures
+//   how long after the write it woke up with the packet.
+
+#include <getopt.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_shm.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct ReaderStats {
+  uint64_t packets = 0;
+  uint64_t lost = 0;
+  uint64_t torn = 0;
+  int64_t checksum = 0;
+};
+
+int64_t NowNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Runs in a child process until the ring closes, then sends its stats and
+// wake-up latencies in nanoseconds to |fd|.
+void RunReader(const std::string& name, int fd) {
+  std::string error;
+  std::unique_ptr<AudioShmReader> reader = AudioShmReader::Open(name, &error);
+  if (!reader) {
+    std::cerr << error << std::endl;
+    _exit(1);
+  }
+  ReaderStats stats;
+  std::vector<int64_t> latencies;
+  latencies.reserve(1 << 16);
+  AudioShmView view;
+  while (true) {
+    AudioShmStatus status = reader->Next(&view, -1);
+    if (status == AudioShmStatus::CLOSED) {
+      break;
+    }
+    if (status != AudioShmStatus::OK) {
+      continue;
+    }
+    int64_t now_ns = NowNs();
+    int64_t sum = 0;
+    for (size_t i = 0; i < view.frames; i++) {
+      sum += view.samples[i];
+    }
+    if (!reader->Valid(view)) {
+      stats.torn++;
+      continue;
+    }
+    stats.packets++;
+    stats.checksum += sum;
+    if (latencies.size() < latencies.capacity()) {
+      latencies.push_back(now_ns - view.timestamp_ns);
+    }
+  }
+  stats.lost = reader->Lost();
+  uint64_t count = latencies.size();
+  if (write(fd, &stats, sizeof(stats)) != sizeof(stats) ||
+      write(fd, &count, sizeof(count)) != sizeof(count) ||
+      write(fd, latencies.data(), count * sizeof(int64_t)) !=
+          static_cast<ssize_t>(count * sizeof(int64_t))) {
+    _exit(1);
+  }
+  _exit(0);
+}
+
+bool ReadAll(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = read(fd, bytes, size);
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+double Percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(std::ceil(p / 100 * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1] / 1000.0;
+}
+
+// Publishes for |seconds| to |readers| reader processes, a packet every
+// |interval|, or back to back if it is zero.
+void Run(const std::string& phase, int readers, size_t packet_frames,
+         double seconds, Clock::duration interval) {
+  std::string name = "/audio_shm_benchmark." + std::to_string(getpid());
+  std::string error;
+  AudioShmWriter::Options options;
+  std::unique_ptr<AudioShmWriter> writer =
+      AudioShmWriter::Create(name, options, &error);
+  if (!writer) {
+    std::cerr << error << std::endl;
+    exit(1);
+  }
+  std::vector<int> pipes;
+  std::vector<pid_t> children;
+  for (int i = 0; i < readers; i++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      exit(1);
+    }
+    pid_t child = fork();
+    if (child == 0) {
+      close(fds[0]);
+      RunReader(name, fds[1]);
+    }
+    close(fds[1]);
+    pipes.push_back(fds[0]);
+    children.push_back(child);
+  }
+  // Readers start at the next packet once attached.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::vector<int16_t> samples(packet_frames);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = static_cast<int16_t>(i);
+  }
+  int source;
+  uint64_t position = 0;
+  Clock::time_point start = Clock::now();
+  Clock::time_point end =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(seconds));
+  Clock::time_point next = start;
+  while (Clock::now() < end) {
+    if (interval.count() > 0) {
+      next += interval;
+      std::this_thread::sleep_until(next);
+    }
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    writer->Write(&source, position, now, false, samples.data(),
+                  packet_frames);
+    position += packet_frames;
+  }
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  uint64_t written = writer->PacketsWritten();
+  writer.reset();
+
+  std::vector<int64_t> latencies;
+  ReaderStats total;
+  for (int i = 0; i < readers; i++) {
+    ReaderStats stats;
+    uint64_t count = 0;
+    if (ReadAll(pipes[i], &stats, sizeof(stats)) &&
+        ReadAll(pipes[i], &count, sizeof(count))) {
+      size_t offset = latencies.size();
+      latencies.resize(offset + count);
+      ReadAll(pipes[i], &latencies[offset], count * sizeof(int64_t));
+    }
+    close(pipes[i]);
+    waitpid(children[i], nullptr, 0);
+    total.packets += stats.packets;
+    total.lost += stats.lost;
+    total.torn += stats.torn;
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout << phase << ": " << written << " packets of " << packet_frames
+            << " frames in " << elapsed << "s, "
+            << written / elapsed / 1000 << "k packets/s ("
+            << written * packet_frames * 2 / elapsed / 1e6 << " MB/s); "
+            << readers << " readers got "
+            << 100.0 * total.packets / std::max<uint64_t>(written * readers, 1)
+            << "%, lost " << total.lost << ", torn " << total.torn
+            << "; wake-up latency us p50 " << Percentile(latencies, 50)
+            << " p99 " << Percentile(latencies, 99) << " max "
+            << Percentile(latencies, 100) << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int readers = 2;
+  int packet_frames = 160;
+  double seconds = 2;
+
+  const struct option long_options[] = {
+    {"readers",       required_argument, nullptr, 'r'},
+    {"packet_frames", required_argument, nullptr, 'f'},
+    {"seconds",       required_argument, nullptr, 's'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char =
+        getopt_long(argc, argv, "r:f:s:", long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 'r':
+        readers = atoi(optarg);
+        break;
+      case 'f':
+        packet_frames = atoi(optarg);
+        break;
+      case 's':
+        seconds = atof(optarg);
+        break;
+      default:
+        std::cerr << "Usage: ./audio_shm_benchmark [--readers <n>] "
+                  << "[--packet_frames <n>] [--seconds <s>]" << std::endl;
+        return 1;
+    }
+  }
+  if (readers < 1 || packet_frames < 1 || packet_frames > 1024 ||
+      seconds <= 0) {
+    std::cerr << "Need at least one reader, 1-1024 frames a packet and a "
+              << "positive duration" << std::endl;
+    return 1;
+  }
+
+  Run("throughput", readers, packet_frames, seconds, Clock::duration::zero());
+  Run("latency", readers, packet_frames, seconds,
+      std::chrono::microseconds(packet_frames * 1000000LL / 16000));
+  return 0;
+}
@@ -0,0 +1,162 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "audio_shm.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::vector<int16_t> Ramp(size_t frames, int16_t start) {
+  std::vector<int16_t> samples(frames);
+  for (size_t i = 0; i < frames; i++) {
+    samples[i] = static_cast<int16_t>(start + i);
+  }
+  return samples;
+}
+
+timespec Seconds(double seconds) {
+  timespec time;
+  time.tv_sec = static_cast<time_t>(seconds);
+  time.tv_nsec = static_cast<long>((seconds - time.tv_sec) * 1e9);
+  return time;
+}
+
+}  // namespace
+
+int main() {
+  std::string name = "/audio_shm_test." + std::to_string(getpid());
+  std::string error;
+  AudioShmWriter::Options options;
+  options.slot_count = 8;
+  options.slot_frames = 1024;
+  std::unique_ptr<AudioShmWriter> writer =
+      AudioShmWriter::Create(name, options, &error);
+  std::unique_ptr<AudioShmReader> reader = AudioShmReader::Open(name, &error);
+  if (!writer || !reader || reader->Format().sample_rate != 16000 ||
+      reader->Format().channels != 1) {
+    std::cerr << "Test failed, " << error << std::endl;
+    return 1;
+  }
+  int source_a, source_b;
+
+  // Packets come out in order and intact, with their sample indexes; a
+  // capture longer than a slot is split.
+  {
+    std::vector<int16_t> first = Ramp(320, 0), second = Ramp(2500, 320);
+    writer->Write(&source_a, 0, Seconds(10), false, first.data(), 320);
+    writer->Write(&source_a, 320, Seconds(10.02), false, second.data(), 2500);
+    const size_t frames[] = {320, 1024, 1024, 452};
+    uint64_t sample_index = 0;
+    for (int i = 0; i < 4; i++) {
+      AudioShmView view;
+      if (reader->Next(&view, 0) != AudioShmStatus::OK ||
+          view.frames != frames[i] || view.sample_index != sample_index ||
+          view.samples[0] != static_cast<int16_t>(sample_index) ||
+          view.samples[view.frames - 1] !=
+              static_cast<int16_t>(sample_index + view.frames - 1) ||
+          view.flags != (i == 0 ? kAudioShmDiscontinuity : 0) ||
+          !reader->Valid(view)) {
+        std::cerr << "Test failed, packet " << i << " index "
+                  << view.sample_index << " frames " << view.frames
+                  << std::endl;
+        return 1;
+      }
+      sample_index += frames[i];
+    }
+    AudioShmView view;
+    if (reader->Next(&view, 20) != AudioShmStatus::TIMEOUT) {
+      std::cerr << "Test failed, read past the last packet" << std::endl;
+      return 1;
+    }
+  }
+
+  // When another capture takes over a second later, its indexes continue
+  // from the capture clock.
+  {
+    std::vector<int16_t> samples = Ramp(320, 0);
+    writer->Write(&source_b, 0, Seconds(10 + 2820 / 16000.0 + 1), false,
+                  samples.data(), 320);
+    AudioShmView view;
+    if (reader->Next(&view, 0) != AudioShmStatus::OK ||
+        view.sample_index != 2820 + 16000 ||
+        view.flags != kAudioShmDiscontinuity) {
+      std::cerr << "Test failed, handover index " << view.sample_index
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // A reader that falls more than a ring behind skips to the newest
+  // packet, and a packet overwritten while it was used is caught.
+  {
+    std::vector<int16_t> samples = Ramp(160, 0);
+    AudioShmView held;
+    writer->Write(&source_b, 320, Seconds(20), false, samples.data(), 160);
+    reader->Next(&held, 0);
+    for (int i = 0; i < 12; i++) {
+      writer->Write(&source_b, 480 + i * 160, Seconds(20), false,
+                    samples.data(), 160);
+    }
+    AudioShmView view;
+    if (reader->Valid(held) ||
+        reader->Next(&view, 0) != AudioShmStatus::OVERRUN ||
+        reader->Lost() != 11 || reader->Next(&view, 0) != AudioShmStatus::OK ||
+        view.sequence != writer->PacketsWritten() - 1) {
+      std::cerr << "Test failed, overrun lost " << reader->Lost() << std::endl;
+      return 1;
+    }
+  }
+
+  // Another process sleeps on the futex until a packet comes, and sees the
+  // ring close.
+  {
+    pid_t child = fork();
+    if (child == 0) {
+      std::unique_ptr<AudioShmReader> remote = AudioShmReader::Open(name, &error);
+      std::vector<int16_t> samples;
+      AudioShmView view;
+      if (!remote || remote->Read(&view, &samples, 5000) != AudioShmStatus::OK ||
+          samples != Ramp(64, 7)) {
+        _exit(1);
+      }
+      _exit(remote->Read(&view, &samples, 5000) == AudioShmStatus::CLOSED ? 0
+                                                                           : 2);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::vector<int16_t> samples = Ramp(64, 7);
+    writer->Write(&source_a, 0, Seconds(30), false, samples.data(), 64);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    writer.reset();
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cerr << "Test failed, reader process exited with " << status
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
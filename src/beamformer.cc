@@ -0,0 +1,232 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "beamformer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "dsp_kernels.h"
+
+namespace {
+
+const int kSampleRate = 16000;
+// How fast the noise floor of a channel follows a louder signal.
+const double kFloorRiseDbPerSecond = 3;
+
+double LevelDb(double sum_of_squares, size_t count) {
+  return 10 * std::log10(sum_of_squares / count / (32768.0 * 32768.0) + 1e-10);
+}
+
+}  // namespace
+
+Beamformer::Beamformer(const Options& options) : options_(options) {
+  options_.channels = std::max(1, options_.channels);
+  options_.max_delay = std::max(0, options_.max_delay);
+  options_.frame_size = std::max(1, options_.frame_size);
+  options_.steer_window = std::max(options_.frame_size, options_.steer_window);
+  history_ = 2 * options_.max_delay;
+  planar_.assign(options_.channels,
+                 std::vector<float>(history_ + options_.frame_size));
+  steer_.assign(options_.channels,
+                std::vector<float>(history_ + options_.steer_window));
+  mixed_.resize(options_.frame_size);
+  faded_.resize(options_.frame_size);
+  delays_.assign(options_.channels, 0);
+  correlations_.assign(options_.channels, 0);
+  frame_energy_.assign(options_.channels, 0);
+  floor_db_.assign(options_.channels, 0);
+  snr_db_.assign(options_.channels, 0);
+  Reset();
+}
+
+void Beamformer::Reset() {
+  for (std::vector<float>& channel : planar_) {
+    std::fill(channel.begin(), channel.end(), 0);
+  }
+  // Steering windows start without history.
+  steer_fill_ = 0;
+  frame_fill_ = 0;
+  std::fill(frame_energy_.begin(), frame_energy_.end(), 0);
+  fading_ = false;
+  mix_.steered = false;
+  mix_.channel = 0;
+  mix_.delays.assign(options_.channels, 0);
+  last_mix_ = mix_;
+  coherent_ = false;
+  std::fill(delays_.begin(), delays_.end(), 0);
+  std::fill(correlations_.begin(), correlations_.end(), 0);
+  selected_ = 0;
+  has_floor_ = false;
+}
+
+void Beamformer::Process(const int16_t* input, size_t frames, int16_t* output) {
+  const size_t channels = options_.channels;
+  const size_t frame_size = options_.frame_size;
+  const size_t window = steer_[0].size();
+  while (frames > 0) {
+    if (frame_fill_ == 0) {
+      // The mix only changes on frame boundaries, so the output does not
+      // depend on how the input was split into reads.
+      mix_.steered = coherent_ && channels > 1;
+      mix_.channel = selected_;
+      if (mix_.steered) {
+        mix_.delays = delays_;
+      }
+      fading_ = mix_.steered != last_mix_.steered
+          || (mix_.steered ? mix_.delays != last_mix_.delays
+                           : mix_.channel != last_mix_.channel);
+    }
+    size_t count = std::min(frames, frame_size - frame_fill_);
+    for (size_t c = 0; c < channels; c++) {
+      float* block = &planar_[c][history_];
+      // Exact, so that frame levels do not depend on the read sizes either.
+      int64_t energy = 0;
+      for (size_t i = 0; i < count; i++) {
+        int32_t sample = input[i * channels + c];
+        block[i] = sample;
+        energy += sample * sample;
+      }
+      frame_energy_[c] += energy;
+    }
+    // The steering window may fill up in the middle of the block.
+    for (size_t done = 0; done < count;) {
+      size_t take = std::min(count - done, window - steer_fill_);
+      for (size_t c = 0; c < channels; c++) {
+        memcpy(&steer_[c][steer_fill_], &planar_[c][history_ + done],
+               take * sizeof(float));
+      }
+      steer_fill_ += take;
+      done += take;
+      if (steer_fill_ == window) {
+        Steer();
+        // The margin after this window is the margin before the next one.
+        for (size_t c = 0; c < channels; c++) {
+          memmove(&steer_[c][0], &steer_[c][window - history_],
+                  history_ * sizeof(float));
+        }
+        steer_fill_ = history_;
+      }
+    }
+
+    Render(mix_, count, mixed_.data());
+    if (fading_) {
+      // Crossfade from the previous mix over the frame, so that switching
+      // does not click.
+      Render(last_mix_, count, faded_.data());
+      for (size_t i = 0; i < count; i++) {
+        float weight = (frame_fill_ + i + 1) / static_cast<float>(frame_size);
+        mixed_[i] = faded_[i] + (mixed_[i] - faded_[i]) * weight;
+      }
+    }
+    FloatToS16(mixed_.data(), count, output);
+
+    for (size_t c = 0; c < channels; c++) {
+      memmove(&planar_[c][0], &planar_[c][count], history_ * sizeof(float));
+    }
+    frame_fill_ += count;
+    if (frame_fill_ == frame_size) {
+      UpdateSelection();
+      frame_fill_ = 0;
+      if (fading_) {
+        last_mix_.steered = mix_.steered;
+        last_mix_.channel = mix_.channel;
+        last_mix_.delays = mix_.delays;
+      }
+    }
+    input += count * channels;
+    output += count;
+    frames -= count;
+  }
+}
+
+void Beamformer::Render(const Mix& mix, size_t count, float* out) {
+  // Output frame i is input frame i - max_delay, so channel c contributes
+  // its sample delays[c] later than that.
+  const size_t base = history_ - options_.max_delay;
+  if (!mix.steered) {
+    memcpy(out, &planar_[mix.channel][base], count * sizeof(float));
+    return;
+  }
+  memset(out, 0, count * sizeof(float));
+  for (int c = 0; c < options_.channels; c++) {
+    AddTo(&planar_[c][base + mix.delays[c]], count, out);
+  }
+  Scale(1.0f / options_.channels, count, out);
+}
+
+void Beamformer::UpdateSelection() {
+  const size_t count = options_.frame_size;
+  for (int c = 0; c < options_.channels; c++) {
+    double level_db = LevelDb(static_cast<double>(frame_energy_[c]), count);
+    frame_energy_[c] = 0;
+    if (!has_floor_) {
+      floor_db_[c] = level_db;
+    } else if (level_db < floor_db_[c]) {
+      // Like ActivityGate, the floor drops quickly and rises slowly.
+      floor_db_[c] = (floor_db_[c] + level_db) / 2;
+    } else {
+      floor_db_[c] = std::min(level_db, floor_db_[c] + kFloorRiseDbPerSecond
+                                                       * count / kSampleRate);
+    }
+    snr_db_[c] = level_db - floor_db_[c];
+  }
+  has_floor_ = true;
+
+  int best = static_cast<int>(
+      std::max_element(snr_db_.begin(), snr_db_.end()) - snr_db_.begin());
+  if (snr_db_[best] > snr_db_[selected_] + options_.switch_hysteresis_db) {
+    selected_ = best;
+  }
+}
+
+void Beamformer::Steer() {
+  const size_t window = options_.steer_window;
+  const int max_delay = options_.max_delay;
+  const float* reference = &steer_[0][max_delay];
+  float reference_energy = DotProduct(reference, reference, window);
+  double level_db = LevelDb(reference_energy, window);
+  if (level_db < options_.min_steer_db
+      || level_db < floor_db_[0] + options_.steer_margin_db) {
+    return;
+  }
+
+  bool coherent = true;
+  for (int c = 1; c < options_.channels; c++) {
+    const float* centered = &steer_[c][max_delay];
+    float energy = DotProduct(centered, centered, window);
+    float norm = std::sqrt(reference_energy * energy) + 1e-3f;
+    float best = -1;
+    int best_delay = 0;
+    for (int delay = -max_delay; delay <= max_delay; delay++) {
+      float correlation = DotProduct(reference, centered + delay, window) / norm;
+      if (correlation > best) {
+        best = correlation;
+        best_delay = delay;
+      }
+    }
+    correlations_[c] = best;
+    if (best >= options_.min_correlation) {
+      delays_[c] = best_delay;
+    } else {
+      coherent = false;
+    }
+  }
+  correlations_[0] = 1;
+  coherent_ = coherent;
+}
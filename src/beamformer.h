@@ -0,0 +1,125 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef BEAMFORMER_H
+#define BEAMFORMER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Mixes the channels of a microphone array into one mono stream. Input is
+// interleaved s16_le at 16000Hz, in reads of any size; how the input is split
+// into reads does not change the output.
+//
+// The delay of every channel relative to channel 0 is estimated from the
+// normalized cross-correlation of each steering window with audio in it.
+// While all channels correlate well, they are delayed into alignment and
+// averaged (delay-and-sum), which keeps the talker and averages down
+// uncorrelated noise. When they do not, e.g. with a dead or noisy mic or
+// reverberant diffuse sound, each frame is taken from the channel with the
+// best signal-to-noise ratio, with a crossfade on every switch.
+//
+// The output lags the input by |max_delay| samples in both modes, so that
+// every channel can be advanced or delayed by up to that much.
+class Beamformer {
+ public:
+  struct Options {
+    int channels = 2;
+    // Largest delay between channel 0 and any other, in samples. 8 samples
+    // is 17cm of path difference at 16000Hz.
+    int max_delay = 8;
+    // Granularity of channel selection, in samples.
+    int frame_size = 160;
+    // Audio per delay estimate, in samples.
+    int steer_window = 1600;
+    // Peak normalized cross-correlation each channel needs for
+    // delay-and-sum.
+    double min_correlation = 0.5;
+    // Steering windows quieter than this (dBFS), or less than |steer_margin_db|
+    // above the noise floor of channel 0, keep the previous estimate.
+    double min_steer_db = -55;
+    double steer_margin_db = 6;
+    // A channel is only switched to if its SNR is better by this much.
+    double switch_hysteresis_db = 3;
+  };
+
+  explicit Beamformer(const Options& options);
+
+  // Forgets all history and steering.
+  void Reset();
+  // Mixes |frames| frames of |input|, |frames| * channels samples, into
+  // |frames| samples of |output|. Allocates nothing.
+  void Process(const int16_t* input, size_t frames, int16_t* output);
+
+  const Options& options() const { return options_; }
+  // Whether the last frame was delay-and-sum rather than a single channel.
+  bool Steered() const { return mix_.steered; }
+  // Estimated delay of each channel relative to channel 0, in samples.
+  const std::vector<int>& Delays() const { return delays_; }
+  // Peak normalized cross-correlation of each channel with channel 0 in the
+  // last steering window with audio in it.
+  const std::vector<float>& Correlations() const { return correlations_; }
+  // Channel with the best signal-to-noise ratio, used while not steered.
+  int SelectedChannel() const { return selected_; }
+
+ private:
+  // How the output is formed from the channels.
+  struct Mix {
+    bool steered = false;
+    int channel = 0;
+    std::vector<int> delays;
+  };
+
+  // Tracks the noise floor and SNR of every channel at the end of a frame.
+  void UpdateSelection();
+  // Re-estimates the delays once |steer_| holds a full window.
+  void Steer();
+  // Renders the |count| new frames in |planar_| with |mix| into |out|.
+  void Render(const Mix& mix, size_t count, float* out);
+
+  Options options_;
+  // Samples of history kept before the new frames of every channel.
+  size_t history_;
+  // Per channel, |history_| samples followed by up to |frame_size| new ones.
+  std::vector<std::vector<float>> planar_;
+  // Per channel, a steering window with |max_delay| samples on either side.
+  std::vector<std::vector<float>> steer_;
+  size_t steer_fill_ = 0;
+  // Frames of the current selection frame seen so far, and their energy per
+  // channel.
+  size_t frame_fill_ = 0;
+  std::vector<int64_t> frame_energy_;
+  std::vector<float> mixed_;
+  std::vector<float> faded_;
+
+  Mix mix_;
+  // The mix of the previous frame, faded out when |mix_| differs.
+  Mix last_mix_;
+  bool fading_ = false;
+  // Whether the last steering window with audio in it correlated well.
+  bool coherent_ = false;
+  std::vector<int> delays_;
+  std::vector<float> correlations_;
+  int selected_ = 0;
+
+  bool has_floor_ = false;
+  std::vector<double> floor_db_;
+  std::vector<double> snr_db_;
+};
+
+#endif
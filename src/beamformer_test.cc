@@ -0,0 +1,257 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "beamformer.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "audio_file.h"
+
+static const int kSampleRate = 16000;
+
+double ThreadCpuSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double Noise() {
+  return rand() / static_cast<double>(RAND_MAX) * 2 - 1;
+}
+
+// |seconds| of low-passed noise with a syllable-rate envelope after one
+// second of silence, roughly the spectrum and rhythm of speech.
+std::vector<double> Talker(double seconds, double amplitude) {
+  std::vector<double> talker(kSampleRate * (seconds + 1), 0);
+  double state = 0;
+  for (size_t i = kSampleRate; i < talker.size(); i++) {
+    state = 0.6 * state + 0.4 * Noise();
+    double envelope = 0.55 + 0.45 * std::sin(2 * M_PI * 4 * i / kSampleRate);
+    talker[i] = amplitude * envelope * state;
+  }
+  return talker;
+}
+
+// Interleaves |talker| delayed by |delays| and scaled by |gains|, plus
+// independent noise of |noise| on every channel.
+std::vector<int16_t> Array(const std::vector<double>& talker,
+                           const std::vector<int>& delays,
+                           const std::vector<double>& gains,
+                           const std::vector<double>& noise) {
+  size_t channels = delays.size();
+  std::vector<int16_t> audio(talker.size() * channels);
+  for (size_t i = 0; i < talker.size(); i++) {
+    for (size_t c = 0; c < channels; c++) {
+      long source = static_cast<long>(i) - delays[c];
+      double value = source >= 0 && source < static_cast<long>(talker.size())
+          ? gains[c] * talker[source] : 0;
+      value += noise[c] * Noise();
+      audio[i * channels + c] = static_cast<int16_t>(
+          std::max(-32768.0, std::min(32767.0, std::round(value))));
+    }
+  }
+  return audio;
+}
+
+// Writes |audio| to a WAV file and reads it back, like a recording from the
+// array would be.
+bool RoundTrip(int channels, std::vector<int16_t>* audio) {
+  std::string path = "/tmp/beamformer_test_" + std::to_string(getpid()) + ".wav";
+  std::string error;
+  bool ok = WriteWavFile(path, channels, *audio, &error)
+      && ReadAudioFile(path, channels, audio, &error);
+  unlink(path.c_str());
+  if (!ok) {
+    std::cerr << "Test failed, " << path << ": " << error << std::endl;
+  }
+  return ok;
+}
+
+// Runs |audio| through |beamformer| in reads of the sizes in |reads| in
+// turn, by default varying as ALSA returns them. Adds the CPU time spent to
+// |*cpu_seconds|.
+std::vector<int16_t> Process(Beamformer* beamformer,
+                             const std::vector<int16_t>& audio,
+                             double* cpu_seconds,
+                             const std::vector<size_t>& reads =
+                                 {320, 317, 1, 160, 641}) {
+  size_t channels = beamformer->options().channels;
+  size_t frames = audio.size() / channels;
+  std::vector<int16_t> mono(frames);
+  double start = ThreadCpuSeconds();
+  for (size_t offset = 0, n = 0; offset < frames; n++) {
+    size_t count = std::min(reads[n % reads.size()], frames - offset);
+    beamformer->Process(&audio[offset * channels], count, &mono[offset]);
+    offset += count;
+  }
+  *cpu_seconds += ThreadCpuSeconds() - start;
+  return mono;
+}
+
+// SNR in dB of |actual| against |expected|, from |begin| on.
+double SnrDb(const std::vector<int16_t>& actual,
+             const std::vector<double>& expected, size_t begin) {
+  double signal = 0, error = 0;
+  for (size_t i = begin; i < actual.size(); i++) {
+    signal += expected[i] * expected[i];
+    error += (actual[i] - expected[i]) * (actual[i] - expected[i]);
+  }
+  return 10 * std::log10(signal / error);
+}
+
+// |audio| delayed by |delay| samples.
+std::vector<double> Delayed(const std::vector<double>& audio, int delay) {
+  std::vector<double> delayed(audio.size(), 0);
+  std::copy(audio.begin(), audio.end() - delay, delayed.begin() + delay);
+  return delayed;
+}
+
+int main() {
+  srand(1);
+
+  // A single channel comes out unchanged, |max_delay| samples later, for
+  // every read size and at full scale.
+  {
+    std::vector<int16_t> audio;
+    for (int i = 0; i < 5000; i++) {
+      int16_t sample = static_cast<int16_t>(rand());
+      if (i % 11 == 0) {
+        sample = -32768;
+      } else if (i % 13 == 0) {
+        sample = 32767;
+      }
+      audio.push_back(sample);
+    }
+    Beamformer::Options options;
+    options.channels = 1;
+    Beamformer beamformer(options);
+    double cpu = 0;
+    std::vector<int16_t> mono = Process(&beamformer, audio, &cpu);
+    for (size_t i = 0; i < mono.size(); i++) {
+      int16_t expected = i < 8 ? 0 : audio[i - 8];
+      if (mono[i] != expected) {
+        std::cerr << "Test failed, mono sample " << i << " is " << mono[i]
+                  << " instead of " << expected << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // A talker reaches four mics at different times, each with its own noise.
+  // The delays are found and delay-and-sum raises the SNR over any one mic
+  // by close to the 6dB four uncorrelated noises allow.
+  const double kSeconds = 10;
+  std::vector<double> talker = Talker(kSeconds, 12000);
+  std::vector<int> delays = {0, 3, -2, 5};
+  double cpu_seconds[5] = {0};
+  {
+    std::vector<int16_t> audio =
+        Array(talker, delays, {1, 1, 1, 1}, {1500, 1500, 1500, 1500});
+    if (!RoundTrip(4, &audio)) {
+      return 1;
+    }
+    Beamformer::Options options;
+    options.channels = 4;
+    Beamformer beamformer(options);
+    std::vector<int16_t> mono = Process(&beamformer, audio, &cpu_seconds[4]);
+    if (beamformer.Delays() != delays || !beamformer.Steered()) {
+      std::cerr << "Test failed, delays";
+      for (int delay : beamformer.Delays()) {
+        std::cerr << " " << delay;
+      }
+      std::cerr << (beamformer.Steered() ? " steered" : " not steered") << std::endl;
+      return 1;
+    }
+    std::vector<double> expected = Delayed(talker, options.max_delay);
+    std::vector<int16_t> first(audio.size() / 4);
+    for (size_t i = 0; i < first.size(); i++) {
+      first[i] = i < 8 ? 0 : audio[(i - 8) * 4];
+    }
+    // The first steering windows with speech are mixed from one channel.
+    size_t begin = 3 * kSampleRate;
+    double gain = SnrDb(mono, expected, begin) - SnrDb(first, expected, begin);
+    if (gain < 5) {
+      std::cerr << "Test failed, delay-and-sum gained " << gain << "dB" << std::endl;
+      return 1;
+    }
+
+    // Reading one frame at a time gives the same output.
+    Beamformer single(options);
+    double cpu = 0;
+    if (Process(&single, audio, &cpu, {1}) != mono) {
+      std::cerr << "Test failed, output depends on the read size" << std::endl;
+      return 1;
+    }
+  }
+
+  // Two mics steer as well.
+  {
+    std::vector<int16_t> audio = Array(talker, {0, -4}, {1, 0.8}, {1500, 1500});
+    Beamformer::Options options;
+    options.channels = 2;
+    Beamformer beamformer(options);
+    Process(&beamformer, audio, &cpu_seconds[2]);
+    if (beamformer.Delays() != std::vector<int>({0, -4}) || !beamformer.Steered()) {
+      std::cerr << "Test failed, two mics delay " << beamformer.Delays()[1]
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // Channel 0 is dead and channel 1 sits next to a fan: the mics do not
+  // correlate, so every frame comes from channel 2, the best SNR.
+  {
+    std::vector<int16_t> audio =
+        Array(talker, {0, 2, 4}, {0, 1, 1}, {0, 6000, 300});
+    if (!RoundTrip(3, &audio)) {
+      return 1;
+    }
+    Beamformer::Options options;
+    options.channels = 3;
+    Beamformer beamformer(options);
+    double cpu = 0;
+    std::vector<int16_t> mono = Process(&beamformer, audio, &cpu);
+    if (beamformer.Steered() || beamformer.SelectedChannel() != 2) {
+      std::cerr << "Test failed, selected channel "
+                << beamformer.SelectedChannel()
+                << (beamformer.Steered() ? " steered" : "") << std::endl;
+      return 1;
+    }
+    std::vector<double> expected = Delayed(talker, options.max_delay + 4);
+    double snr = SnrDb(mono, expected, 3 * kSampleRate);
+    if (snr < 15) {
+      std::cerr << "Test failed, selection SNR " << snr << "dB" << std::endl;
+      return 1;
+    }
+  }
+
+  for (int channels : {2, 4}) {
+    std::cout << channels << " channels: "
+              << cpu_seconds[channels] / (kSeconds + 1) * 1000
+              << "ms CPU per second of audio" << std::endl;
+  }
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,346 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "device_action.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern "C" {
+#include <src/core/lib/json/json.h>
+}
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "json_util.h"
+#include "log.h"
+#include "metrics.h"
+
+extern char** environ;
+
+namespace {
+
+Counter* DeviceActionCounter(const char* result) {
+  return MetricsRegistry::Global().GetCounter(
+      "assistant_device_actions_total", "Device commands, by outcome.",
+      std::string("result=\"") + result + "\"");
+}
+
+Counter* const kActionsOk = DeviceActionCounter("ok");
+Counter* const kActionsFailed = DeviceActionCounter("failed");
+Counter* const kActionsTimeout = DeviceActionCounter("timeout");
+Counter* const kActionsRejected = DeviceActionCounter("rejected");
+Counter* const kActionsUnknown = DeviceActionCounter("unknown");
+
+const JsonPath* const kCommandsPath =
+    JsonPath::Compile("inputs[*].payload.commands[*]").release();
+const JsonPath* const kDeviceIdsPath =
+    JsonPath::Compile("devices[*].id").release();
+const JsonPath* const kExecutionsPath =
+    JsonPath::Compile("execution[*]").release();
+const JsonPath* const kCommandPath = JsonPath::Compile("command").release();
+const JsonPath* const kParamsPath = JsonPath::Compile("params").release();
+
+void FlattenParams(grpc_json* node, const std::string& path,
+                   std::map<std::string, std::string>* params) {
+  switch (node->type) {
+    case GRPC_JSON_OBJECT:
+    case GRPC_JSON_ARRAY: {
+      int index = 0;
+      for (grpc_json* child = node->child; child != nullptr;
+           child = child->next, index++) {
+        std::string key = node->type == GRPC_JSON_ARRAY || child->key == nullptr
+                              ? std::to_string(index)
+                              : child->key;
+        FlattenParams(child, path.empty() ? key : path + "." + key, params);
+      }
+      break;
+    }
+    case GRPC_JSON_TRUE:
+      (*params)[path] = "true";
+      break;
+    case GRPC_JSON_FALSE:
+      (*params)[path] = "false";
+      break;
+    case GRPC_JSON_NULL:
+      (*params)[path] = "";
+      break;
+    default:
+      (*params)[path] = node->value != nullptr ? node->value : "";
+      break;
+  }
+}
+
+}  // namespace
+
+bool ParseDeviceRequest(const std::string& device_request_json,
+                        std::vector<DeviceCommand>* commands) {
+  std::unique_ptr<JsonDocument> document =
+      JsonDocument::Parse(device_request_json);
+  if (!document) {
+    return false;
+  }
+
+  std::vector<grpc_json*> command_nodes, nodes;
+  kCommandsPath->Evaluate(document->root(), &command_nodes);
+  for (grpc_json* command : command_nodes) {
+    std::vector<std::string> device_ids;
+    kDeviceIdsPath->Evaluate(command, &nodes);
+    for (grpc_json* id : nodes) {
+      JsonStringView value;
+      if (GetJsonString(id, &value)) {
+        device_ids.push_back(value.ToString());
+      }
+    }
+    kExecutionsPath->Evaluate(command, &nodes);
+    for (grpc_json* execution : nodes) {
+      JsonStringView name;
+      if (!GetJsonString(kCommandPath->First(execution), &name)) {
+        continue;
+      }
+      DeviceCommand parsed;
+      parsed.name = name.ToString();
+      parsed.device_ids = device_ids;
+      grpc_json* params = kParamsPath->First(execution);
+      if (params != nullptr) {
+        FlattenParams(params, "", &parsed.params);
+      }
+      commands->push_back(parsed);
+    }
+  }
+  return true;
+}
+
+DeviceActionDispatcher::DeviceActionDispatcher(const Options& options)
+    : options_(options) {
+  for (int i = 0; i < options_.threads; i++) {
+    threads_.emplace_back([this]() {
+      pthread_setname_np(pthread_self(), "device-action");
+      Run();
+    });
+  }
+}
+
+DeviceActionDispatcher::~DeviceActionDispatcher() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    changed_.notify_all();
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool DeviceActionDispatcher::Register(const std::string& command,
+                                      Handler handler,
+                                      std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (frozen_ || index_.count(command) > 0) {
+    return false;
+  }
+  Entry entry;
+  entry.name = command;
+  entry.handler = handler;
+  entry.timeout = timeout;
+  entry.seconds = MetricsRegistry::Global().GetHistogram(
+      "assistant_device_action_seconds",
+      "Time from receiving a device command until its handler returned.",
+      {0.01, 0.05, 0.1, 0.5, 1, 2, 5, 10}, "command=\"" + command + "\"");
+  index_[command] = entries_.size();
+  entries_.push_back(entry);
+  return true;
+}
+
+int DeviceActionDispatcher::Dispatch(const std::string& device_request_json) {
+  std::vector<DeviceCommand> commands;
+  if (!ParseDeviceRequest(device_request_json, &commands)) {
+    LOG(WARNING) << "Malformed device request";
+    kActionsFailed->Increment();
+    return 0;
+  }
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  frozen_ = true;
+  int queued = 0;
+  for (DeviceCommand& command : commands) {
+    auto it = index_.find(command.name);
+    if (it == index_.end()) {
+      LOG(WARNING) << "No handler for device command " << command.name;
+      kActionsUnknown->Increment();
+      continue;
+    }
+    if (queue_.size() >= options_.queue_size) {
+      LOG(WARNING) << "Device command " << command.name << " rejected, "
+                   << queue_.size() << " queued";
+      kActionsRejected->Increment();
+      continue;
+    }
+    const Entry& entry = entries_[it->second];
+    Task task;
+    task.entry = &entry;
+    task.command = std::move(command);
+    task.queued = now;
+    task.deadline = now + entry.timeout;
+    queue_.push_back(std::move(task));
+    queued++;
+  }
+  changed_.notify_all();
+  return queued;
+}
+
+void DeviceActionDispatcher::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return queue_.empty() && running_ == 0; });
+}
+
+void DeviceActionDispatcher::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    Task task = std::move(queue_.front());
+    queue_.pop_front();
+    running_++;
+    lock.unlock();
+
+    const Entry& entry = *task.entry;
+    bool ok = false;
+    bool timed_out = std::chrono::steady_clock::now() >= task.deadline;
+    if (!timed_out) {
+      ok = entry.handler(task.command, task.deadline);
+      timed_out = std::chrono::steady_clock::now() > task.deadline;
+    }
+    std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+    entry.seconds->Observe(
+        std::chrono::duration<double>(done - task.queued).count());
+    if (timed_out) {
+      LOG(WARNING) << "Device command " << entry.name << " timed out after "
+                   << entry.timeout.count() << "ms";
+      kActionsTimeout->Increment();
+    } else if (ok) {
+      LOG(INFO) << "Device command " << entry.name << " done";
+      kActionsOk->Increment();
+    } else {
+      LOG(WARNING) << "Device command " << entry.name << " failed";
+      kActionsFailed->Increment();
+    }
+
+    lock.lock();
+    running_--;
+    changed_.notify_all();
+  }
+}
+
+namespace {
+
+// PARAM_ plus |path| in upper case, with everything else than letters and
+// digits turned into '_'.
+std::string ParamVariable(const std::string& path) {
+  std::string name = "PARAM_";
+  for (char c : path) {
+    name += isalnum(static_cast<unsigned char>(c))
+                ? static_cast<char>(toupper(static_cast<unsigned char>(c)))
+                : '_';
+  }
+  return name;
+}
+
+DeviceActionDispatcher::Handler ProgramHandler(const std::string& path) {
+  return [path](const DeviceCommand& command,
+                DeviceActionDispatcher::Deadline deadline) {
+    std::vector<std::string> args = {path};
+    args.insert(args.end(), command.device_ids.begin(),
+                command.device_ids.end());
+    std::vector<std::string> env;
+    for (char** variable = environ; *variable != nullptr; variable++) {
+      env.push_back(*variable);
+    }
+    for (const auto& param : command.params) {
+      env.push_back(ParamVariable(param.first) + "=" + param.second);
+    }
+    std::vector<char*> argv, envp;
+    for (std::string& arg : args) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    for (std::string& variable : env) {
+      envp.push_back(&variable[0]);
+    }
+    envp.push_back(nullptr);
+
+    pid_t pid;
+    int ret = posix_spawn(&pid, path.c_str(), nullptr, nullptr, argv.data(),
+                          envp.data());
+    if (ret != 0) {
+      LOG(WARNING) << "Cannot run " << path << ": " << strerror(ret);
+      return false;
+    }
+    int status = 0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  };
+}
+
+}  // namespace
+
+int RegisterDeviceActionPrograms(DeviceActionDispatcher* dispatcher,
+                                 const std::string& dir,
+                                 std::chrono::milliseconds timeout) {
+  DIR* directory = opendir(dir.c_str());
+  if (directory == nullptr) {
+    LOG(WARNING) << "Cannot open device action directory " << dir;
+    return 0;
+  }
+  std::vector<std::string> names;
+  while (dirent* entry = readdir(directory)) {
+    names.push_back(entry->d_name);
+  }
+  closedir(directory);
+  std::sort(names.begin(), names.end());
+
+  int registered = 0;
+  for (const std::string& name : names) {
+    std::string path = dir + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+        access(path.c_str(), X_OK) != 0) {
+      continue;
+    }
+    if (dispatcher->Register(name, ProgramHandler(path), timeout)) {
+      LOG(INFO) << "Device command " << name << " runs " << path;
+      registered++;
+    }
+  }
+  return registered;
+}
@@ -0,0 +1,131 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef DEVICE_ACTION_H
+#define DEVICE_ACTION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Counter;
+class Histogram;
+
+// One command of an EXECUTE device request, e.g.
+// action.devices.commands.selectChannel on the devices it names.
+struct DeviceCommand {
+  std::string name;
+  std::vector<std::string> device_ids;
+  // Scalar parameters by path, e.g. "channelNumber" or "color.spectrumRGB".
+  // Array elements are numbered, e.g. "modes.0".
+  std::map<std::string, std::string> params;
+};
+
+// Parses a DeviceAction.device_request_json into its commands. Returns
+// false if it is not valid JSON.
+bool ParseDeviceRequest(const std::string& device_request_json,
+                        std::vector<DeviceCommand>* commands);
+
+// Runs device action handlers off the response stream. Commands are looked
+// up in a registry that is fixed before the first dispatch, and run on a
+// small pool of threads with a bounded queue, so a slow handler never holds
+// up the response or its audio.
+//
+// A handler gets the deadline of its command and should give up after it.
+// Commands still queued at their deadline are not run; handlers that return
+// after it count as timed out. Exported metrics:
+//   assistant_device_action_seconds{command=...}, queueing included
+//   assistant_device_actions_total{result="ok|failed|timeout|rejected|unknown"}
+class DeviceActionDispatcher {
+ public:
+  typedef std::chrono::steady_clock::time_point Deadline;
+  // Returns whether the command succeeded.
+  typedef std::function<bool(const DeviceCommand&, Deadline)> Handler;
+
+  struct Options {
+    int threads = 2;
+    // Commands waiting for a thread; more are rejected.
+    size_t queue_size = 16;
+  };
+
+  DeviceActionDispatcher() : DeviceActionDispatcher(Options()) {}
+  explicit DeviceActionDispatcher(const Options& options);
+  // Waits for the handlers that are running; queued ones are dropped.
+  ~DeviceActionDispatcher();
+
+  // Returns false if |command| is registered already or commands have been
+  // dispatched.
+  bool Register(const std::string& command, Handler handler,
+                std::chrono::milliseconds timeout);
+
+  // Parses |device_request_json| and queues its commands without waiting
+  // for them. Returns the number queued.
+  int Dispatch(const std::string& device_request_json);
+
+  // Waits until the queue is empty and no handler is running.
+  void Drain();
+
+ private:
+  struct Entry {
+    std::string name;
+    Handler handler;
+    std::chrono::milliseconds timeout;
+    Histogram* seconds;
+  };
+  struct Task {
+    const Entry* entry;
+    DeviceCommand command;
+    std::chrono::steady_clock::time_point queued;
+    Deadline deadline;
+  };
+
+  void Run();
+
+  const Options options_;
+  // Command names interned to their entry. Written only until the first
+  // Dispatch(), then read without locking.
+  std::unordered_map<std::string, size_t> index_;
+  std::vector<Entry> entries_;
+  bool frozen_ = false;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<Task> queue_;
+  int running_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// Registers every executable in |dir| as the handler of the command it is
+// named after. A command runs its program with the device ids as arguments
+// and each parameter in the environment as PARAM_<PATH>, e.g.
+// PARAM_CHANNELNUMBER=5; it succeeds if the program exits with 0 and is
+// killed at its deadline. Returns the number of programs registered.
+int RegisterDeviceActionPrograms(DeviceActionDispatcher* dispatcher,
+                                 const std::string& dir,
+                                 std::chrono::milliseconds timeout);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "device_action.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "metrics.h"
+
+namespace {
+
+// What the Assistant sends for "switch to channel 5".
+const char kSelectChannel[] = R"({
+  "requestId": "ff36a3cc-ec34-11e6-b1a0-64510650abcf",
+  "inputs": [{
+    "intent": "action.devices.EXECUTE",
+    "payload": {
+      "commands": [{
+        "devices": [{"id": "tv"}, {"id": "tuner"}],
+        "execution": [{
+          "command": "action.devices.commands.selectChannel",
+          "params": {"channelNumber": "5", "tune": true,
+                     "range": {"low": 1, "high": [2, 3]}}
+        }, {
+          "command": "com.example.commands.Unknown"
+        }]
+      }]
+    }
+  }]
+})";
+
+std::string Request(const std::string& command, int count) {
+  std::string executions;
+  for (int i = 0; i < count; i++) {
+    executions += std::string(i > 0 ? "," : "") + "{\"command\": \"" +
+                  command + "\"}";
+  }
+  return "{\"inputs\": [{\"payload\": {\"commands\": [{\"devices\": [], "
+         "\"execution\": [" + executions + "]}]}}]}";
+}
+
+uint64_t Actions(const std::string& result) {
+  return MetricsRegistry::Global()
+      .GetCounter("assistant_device_actions_total",
+                  "Device commands, by outcome.",
+                  "result=\"" + result + "\"")
+      ->Value();
+}
+
+void WriteProgram(const std::string& path, const std::string& script) {
+  std::ofstream(path) << "#!/bin/sh\n" << script << "\n";
+  chmod(path.c_str(), 0755);
+}
+
+}  // namespace
+
+int main() {
+  {
+    std::vector<DeviceCommand> commands;
+    if (!ParseDeviceRequest(kSelectChannel, &commands) ||
+        commands.size() != 2 ||
+        commands[0].name != "action.devices.commands.selectChannel" ||
+        commands[0].device_ids.size() != 2 ||
+        commands[0].device_ids[1] != "tuner" ||
+        commands[0].params["channelNumber"] != "5" ||
+        commands[0].params["tune"] != "true" ||
+        commands[0].params["range.low"] != "1" ||
+        commands[0].params["range.high.1"] != "3") {
+      std::cerr << "Test failed, parsed " << commands.size() << " commands"
+                << std::endl;
+      return 1;
+    }
+    if (ParseDeviceRequest("{\"inputs\": [", &commands)) {
+      std::cerr << "Test failed, parsed malformed JSON" << std::endl;
+      return 1;
+    }
+  }
+
+  // Handlers run off the dispatching thread; commands nobody registered
+  // are skipped and the registry is fixed once dispatching starts.
+  {
+    DeviceActionDispatcher dispatcher;
+    std::atomic<bool> done(false);
+    std::string channel;
+    dispatcher.Register(
+        "action.devices.commands.selectChannel",
+        [&](const DeviceCommand& command, DeviceActionDispatcher::Deadline) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(200));
+          channel = command.params.at("channelNumber");
+          done = true;
+          return true;
+        },
+        std::chrono::milliseconds(1000));
+    uint64_t unknown = Actions("unknown");
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    int queued = dispatcher.Dispatch(kSelectChannel);
+    double dispatch_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    if (queued != 1 || dispatch_ms > 50 || done ||
+        Actions("unknown") != unknown + 1) {
+      std::cerr << "Test failed, Dispatch() queued " << queued << " in "
+                << dispatch_ms << "ms" << std::endl;
+      return 1;
+    }
+    dispatcher.Drain();
+    if (channel != "5" ||
+        dispatcher.Register("late", [](const DeviceCommand&,
+                                       DeviceActionDispatcher::Deadline) {
+          return true;
+        }, std::chrono::milliseconds(1))) {
+      std::cerr << "Test failed, handler saw channel " << channel << std::endl;
+      return 1;
+    }
+  }
+
+  // The queue is bounded and slow handlers time out.
+  {
+    DeviceActionDispatcher::Options options;
+    options.threads = 1;
+    options.queue_size = 2;
+    DeviceActionDispatcher dispatcher(options);
+    dispatcher.Register(
+        "slow",
+        [](const DeviceCommand&, DeviceActionDispatcher::Deadline) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(50));
+          return true;
+        },
+        std::chrono::milliseconds(20));
+    uint64_t rejected = Actions("rejected");
+    uint64_t timeout = Actions("timeout");
+    int queued = dispatcher.Dispatch(Request("slow", 5));
+    dispatcher.Drain();
+    if (queued != 2 || Actions("rejected") != rejected + 3 ||
+        Actions("timeout") != timeout + 2) {
+      std::cerr << "Test failed, queued " << queued << " rejected "
+                << Actions("rejected") - rejected << " timed out "
+                << Actions("timeout") - timeout << std::endl;
+      return 1;
+    }
+  }
+
+  // Programs get the devices as arguments and the parameters in the
+  // environment, and are killed at the deadline.
+  {
+    char dir_template[] = "/tmp/device_action_test.XXXXXX";
+    std::string dir = mkdtemp(dir_template);
+    std::string out = dir + "/out";
+    WriteProgram(dir + "/action.devices.commands.selectChannel",
+                 "echo \"$1 $2 $PARAM_CHANNELNUMBER $PARAM_RANGE_HIGH_0\" > " + out);
+    WriteProgram(dir + "/hang", "sleep 10");
+    WriteProgram(dir + "/fail", "exit 1");
+    std::ofstream(dir + "/README") << "not a command";
+
+    DeviceActionDispatcher dispatcher;
+    int registered = RegisterDeviceActionPrograms(
+        &dispatcher, dir, std::chrono::milliseconds(300));
+    uint64_t ok = Actions("ok");
+    uint64_t failed = Actions("failed");
+    uint64_t timeout = Actions("timeout");
+    dispatcher.Dispatch(kSelectChannel);
+    dispatcher.Dispatch(Request("hang", 1));
+    dispatcher.Dispatch(Request("fail", 1));
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    dispatcher.Drain();
+    double drain_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    std::string line;
+    std::getline(std::ifstream(out), line);
+    if (registered != 3 || line != "tv tuner 5 2" ||
+        Actions("ok") != ok + 1 || Actions("failed") != failed + 1 ||
+        Actions("timeout") != timeout + 1 || drain_seconds > 2) {
+      std::cerr << "Test failed, " << registered << " programs wrote \""
+                << line << "\", drained in " << drain_seconds << "s"
+                << std::endl;
+      return 1;
+    }
+    system(("rm -rf " + dir).c_str());
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
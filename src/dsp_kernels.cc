@@ -0,0 +1,278 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "dsp_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+float DotProduct(const float* a, const float* b, size_t count) {
+  size_t i = 0;
+  float sum = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t acc = vdupq_n_f32(0);
+  for (; i + 4 <= count; i += 4) {
+    acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+  float lanes[4];
+  vst1q_f32(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void AddTo(const float* x, size_t count, float* acc) {
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), vld1q_f32(x + i)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < count; i++) {
+    acc[i] += x[i];
+  }
+}
+
+void MultiplyBy(const float* y, size_t count, float* x) {
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), vld1q_f32(y + i)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+  }
+#endif
+  for (; i < count; i++) {
+    x[i] *= y[i];
+  }
+}
+
+void Scale(float gain, size_t count, float* x) {
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t g = vdupq_n_f32(gain);
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), g));
+  }
+#elif defined(__SSE2__)
+  __m128 g = _mm_set1_ps(gain);
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), g));
+  }
+#endif
+  for (; i < count; i++) {
+    x[i] *= gain;
+  }
+}
+
+void ApplyGainRamp(float from, float to, size_t count, float* x) {
+  if (from == to) {
+    Scale(to, count, x);
+    return;
+  }
+  // Sample i gets from + step * (i + 1) on every path.
+  const float step = (to - from) / count;
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const float offsets[4] = {1, 2, 3, 4};
+  float32x4_t base = vld1q_f32(offsets);
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t index = vaddq_f32(vdupq_n_f32(static_cast<float>(i)), base);
+    float32x4_t gain = vaddq_f32(vdupq_n_f32(from), vmulq_f32(index, vdupq_n_f32(step)));
+    vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), gain));
+  }
+#elif defined(__SSE2__)
+  const __m128 base = _mm_setr_ps(1, 2, 3, 4);
+  for (; i + 4 <= count; i += 4) {
+    __m128 index = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), base);
+    __m128 gain = _mm_add_ps(_mm_set1_ps(from), _mm_mul_ps(index, _mm_set1_ps(step)));
+    _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), gain));
+  }
+#endif
+  for (; i < count; i++) {
+    x[i] *= from + static_cast<float>(i + 1) * step;
+  }
+}
+
+float MaxAbs(const float* x, size_t count) {
+  size_t i = 0;
+  float peak = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t acc = vdupq_n_f32(0);
+  for (; i + 4 <= count; i += 4) {
+    acc = vmaxq_f32(acc, vabsq_f32(vld1q_f32(x + i)));
+  }
+  float lanes[4];
+  vst1q_f32(lanes, acc);
+  peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#elif defined(__SSE2__)
+  const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4) {
+    acc = _mm_max_ps(acc, _mm_and_ps(_mm_loadu_ps(x + i), mask));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+  for (; i < count; i++) {
+    peak = std::max(peak, std::fabs(x[i]));
+  }
+  return peak;
+}
+
+void PowerSpectrum(const float* re, const float* im, size_t count, float* out) {
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t r = vld1q_f32(re + i);
+    float32x4_t m = vld1q_f32(im + i);
+    vst1q_f32(out + i, vmlaq_f32(vmulq_f32(r, r), m, m));
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    __m128 r = _mm_loadu_ps(re + i);
+    __m128 m = _mm_loadu_ps(im + i);
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m)));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = re[i] * re[i] + im[i] * im[i];
+  }
+}
+
+void S16ToFloat(const int16_t* in, size_t count, float* out) {
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vld1q_s16(in + i);
+    vst1q_f32(out + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))));
+    vst1q_f32(out + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))));
+  }
+#elif defined(__SSE2__)
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // Unpacking a sample with itself and shifting back sign-extends it.
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+    _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = in[i];
+  }
+}
+
+void FloatToS16(const float* in, size_t count, int16_t* out) {
+  size_t i = 0;
+#if defined(__aarch64__)
+  for (; i + 8 <= count; i += 8) {
+    int32x4_t lo = vcvtnq_s32_f32(vld1q_f32(in + i));
+    int32x4_t hi = vcvtnq_s32_f32(vld1q_f32(in + i + 4));
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 8 <= count; i += 8) {
+    __m128i lo = _mm_cvtps_epi32(_mm_loadu_ps(in + i));
+    __m128i hi = _mm_cvtps_epi32(_mm_loadu_ps(in + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; i < count; i++) {
+    float value = std::nearbyint(in[i]);
+    out[i] = static_cast<int16_t>(std::min(32767.0f, std::max(-32768.0f, value)));
+  }
+}
+
+Fft::Fft(size_t size) : size_(size), bit_reverse_(size), cos_(size / 2), sin_(size / 2) {
+  int bits = 0;
+  while ((size_t(1) << bits) < size) {
+    bits++;
+  }
+  for (size_t i = 0; i < size; i++) {
+    uint32_t reversed = 0;
+    for (int b = 0; b < bits; b++) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bit_reverse_[i] = reversed;
+  }
+  for (size_t k = 0; k < size / 2; k++) {
+    cos_[k] = std::cos(2 * M_PI * k / size);
+    sin_[k] = std::sin(2 * M_PI * k / size);
+  }
+}
+
+void Fft::Forward(float* re, float* im) const {
+  for (size_t i = 0; i < size_; i++) {
+    size_t j = bit_reverse_[i];
+    if (i < j) {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+  }
+  // Radix-2 decimation in time.
+  for (size_t length = 2; length <= size_; length *= 2) {
+    size_t half = length / 2;
+    size_t stride = size_ / length;
+    for (size_t start = 0; start < size_; start += length) {
+      for (size_t k = 0; k < half; k++) {
+        float wr = cos_[k * stride];
+        float wi = -sin_[k * stride];
+        size_t a = start + k;
+        size_t b = a + half;
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+void Fft::Inverse(float* re, float* im) const {
+  // The inverse is the forward transform with real and imaginary parts
+  // swapped on the way in and out.
+  Forward(im, re);
+  Scale(1.0f / size_, size_, re);
+  Scale(1.0f / size_, size_, im);
+}
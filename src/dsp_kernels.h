@@ -0,0 +1,67 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef DSP_KERNELS_H
+#define DSP_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Float kernels for the capture path, vectorized with NEON or SSE2 where
+// available. Buffers need no alignment and may have any length.
+
+float DotProduct(const float* a, const float* b, size_t count);
+// |acc| += |x|.
+void AddTo(const float* x, size_t count, float* acc);
+// |x| *= |y|, element by element.
+void MultiplyBy(const float* y, size_t count, float* x);
+// |x| *= |gain|.
+void Scale(float gain, size_t count, float* x);
+// |x| *= a gain that ramps linearly from |from| to reach |to| at the last
+// sample, so that gain changes do not click.
+void ApplyGainRamp(float from, float to, size_t count, float* x);
+// Largest absolute value in |x|.
+float MaxAbs(const float* x, size_t count);
+// |out| = |re|^2 + |im|^2.
+void PowerSpectrum(const float* re, const float* im, size_t count, float* out);
+
+void S16ToFloat(const int16_t* in, size_t count, float* out);
+// Rounds to nearest even and saturates. Every path rounds the same way, so
+// the result does not depend on which samples fall into the scalar tail.
+// 32-bit NEON has no such conversion and takes the scalar loop.
+void FloatToS16(const float* in, size_t count, int16_t* out);
+
+// In-place complex FFT of a power of two size on separate real and imaginary
+// arrays. Tables are computed once, transforms allocate nothing.
+class Fft {
+ public:
+  explicit Fft(size_t size);
+
+  size_t size() const { return size_; }
+  void Forward(float* re, float* im) const;
+  // Scaled by 1 / size, so that Inverse(Forward(x)) == x.
+  void Inverse(float* re, float* im) const;
+
+ private:
+  size_t size_;
+  std::vector<uint32_t> bit_reverse_;
+  std::vector<float> cos_;
+  std::vector<float> sin_;
+};
+
+#endif
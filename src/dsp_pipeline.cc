@@ -0,0 +1,159 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "dsp_pipeline.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "dsp_kernels.h"
+#include "dsp_stages.h"
+#include "metrics.h"
+
+namespace {
+
+int64_t ThreadCpuNanoseconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Parses the optional ":<number>" of a stage into |*value|.
+bool ParseParameter(const std::string& item, size_t colon, double* value) {
+  if (colon == std::string::npos) {
+    return true;
+  }
+  const char* begin = item.c_str() + colon + 1;
+  char* end;
+  *value = strtod(begin, &end);
+  return end != begin && *end == '\0';
+}
+
+}  // namespace
+
+std::unique_ptr<DspPipeline> DspPipeline::Create(const std::string& spec,
+                                                 const std::string& source,
+                                                 std::string* error) {
+  std::unique_ptr<DspPipeline> pipeline(new DspPipeline(source));
+  std::stringstream stream(spec);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    size_t colon = item.find(':');
+    std::string name = item.substr(0, colon);
+    std::unique_ptr<DspStage> stage;
+    if (name == "highpass") {
+      HighPassFilter::Options options;
+      if (ParseParameter(item, colon, &options.cutoff_hz)
+          && options.cutoff_hz > 0 && options.cutoff_hz < 4000) {
+        stage.reset(new HighPassFilter(options));
+      }
+    } else if (name == "agc") {
+      AutomaticGainControl::Options options;
+      if (ParseParameter(item, colon, &options.target_db)
+          && options.target_db < 0) {
+        stage.reset(new AutomaticGainControl(options));
+      }
+    } else if (name == "ns") {
+      NoiseSuppressor::Options options;
+      if (ParseParameter(item, colon, &options.max_suppression_db)
+          && options.max_suppression_db > 0) {
+        stage.reset(new NoiseSuppressor(options));
+      }
+    } else {
+      *error = "unknown DSP stage \"" + name + "\"";
+      return nullptr;
+    }
+    if (!stage) {
+      *error = "invalid parameter in \"" + item + "\"";
+      return nullptr;
+    }
+    pipeline->AddStage(std::move(stage));
+  }
+  return pipeline;
+}
+
+DspPipeline::DspPipeline(const std::string& source)
+    : source_(source), input_(kBlockFrames), output_(kBlockFrames) {}
+
+void DspPipeline::AddStage(std::unique_ptr<DspStage> stage) {
+  StageStats stats = {stage->Name(), 0, 0};
+  stats_.push_back(stats);
+  cpu_nanoseconds_.push_back(MetricsRegistry::Global().GetCounter(
+      "assistant_capture_dsp_cpu_nanoseconds_total",
+      "CPU time spent in each capture DSP stage.",
+      "source=\"" + source_ + "\",stage=\"" + stage->Name() + "\""));
+  stages_.push_back(std::move(stage));
+}
+
+void DspPipeline::Process(int16_t* samples, size_t frames) {
+  while (frames > 0) {
+    size_t count = std::min(frames, kBlockFrames - fill_);
+    S16ToFloat(samples, count, &input_[fill_]);
+    memcpy(samples, &output_[fill_], count * sizeof(int16_t));
+    fill_ += count;
+    if (fill_ == kBlockFrames) {
+      ProcessBlock();
+      fill_ = 0;
+    }
+    samples += count;
+    frames -= count;
+  }
+}
+
+void DspPipeline::ProcessBlock() {
+  int64_t start = ThreadCpuNanoseconds();
+  for (size_t i = 0; i < stages_.size(); i++) {
+    stages_[i]->Process(input_.data());
+    int64_t end = ThreadCpuNanoseconds();
+    stats_[i].blocks++;
+    stats_[i].cpu_nanoseconds += end - start;
+    cpu_nanoseconds_[i]->Increment(end - start);
+    start = end;
+  }
+  FloatToS16(input_.data(), kBlockFrames, output_.data());
+}
+
+void DspPipeline::Reset() {
+  for (std::unique_ptr<DspStage>& stage : stages_) {
+    stage->Reset();
+  }
+  std::fill(output_.begin(), output_.end(), 0);
+  fill_ = 0;
+}
+
+void DspPipeline::Restart() {
+  for (std::unique_ptr<DspStage>& stage : stages_) {
+    stage->Restart();
+  }
+  std::fill(output_.begin(), output_.end(), 0);
+  fill_ = 0;
+}
+
+size_t DspPipeline::Latency() const {
+  size_t latency = kBlockFrames;
+  for (const std::unique_ptr<DspStage>& stage : stages_) {
+    latency += stage->Latency();
+  }
+  return latency;
+}
@@ -0,0 +1,105 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef DSP_PIPELINE_H
+#define DSP_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Counter;
+
+// One processing step of a DspPipeline. Works in place on fixed blocks of
+// DspPipeline::kBlockFrames float samples in s16 scale, mono at 16000Hz.
+// Process() runs on the capture thread and must not allocate or block.
+class DspStage {
+ public:
+  virtual ~DspStage() {}
+
+  virtual const char* Name() const = 0;
+  virtual void Process(float* block) = 0;
+  virtual void Reset() = 0;
+  // Drops the audio in flight, e.g. when a new stream starts, but keeps
+  // what the stage adapted to, such as a gain or a noise estimate.
+  virtual void Restart() { Reset(); }
+  // Frames by which the stage delays its output.
+  virtual size_t Latency() const { return 0; }
+};
+
+// Conditions captured audio between the capture device and one consumer:
+// the stages run in order on every block of kBlockFrames frames. Reads of
+// any size are processed in place and come out one block late, plus the
+// latency of the stages. Every buffer is allocated up front, so Process()
+// allocates nothing.
+//
+// The CPU time of every stage is measured with the thread CPU clock,
+// kept in Stats() and exported as
+// assistant_capture_dsp_cpu_nanoseconds_total{source, stage}.
+class DspPipeline {
+ public:
+  static constexpr size_t kBlockFrames = 160;
+
+  // Builds a pipeline from |spec|, stage names separated by commas, each
+  // with an optional parameter:
+  //   highpass[:<cutoff Hz>]   DC and rumble removal, 80Hz by default.
+  //   agc[:<target dBFS>]      automatic gain control, -20dBFS by default.
+  //   ns[:<max dB>]            spectral noise suppression, by up to 15dB.
+  // |source| labels the metrics, e.g. "keyword". Returns nullptr and sets
+  // |error| if |spec| is invalid, and an empty pipeline for an empty spec.
+  static std::unique_ptr<DspPipeline> Create(const std::string& spec,
+                                             const std::string& source,
+                                             std::string* error);
+
+  explicit DspPipeline(const std::string& source);
+
+  // Must be called before the first Process().
+  void AddStage(std::unique_ptr<DspStage> stage);
+  bool Empty() const { return stages_.empty(); }
+
+  // Processes |frames| samples in place.
+  void Process(int16_t* samples, size_t frames);
+  // Forgets all history.
+  void Reset();
+  // Drops the audio in flight when a new stream starts, keeping what the
+  // stages adapted to, so a short stream starts out conditioned.
+  void Restart();
+  size_t Latency() const;
+
+  struct StageStats {
+    const char* name;
+    uint64_t blocks;
+    uint64_t cpu_nanoseconds;
+  };
+  const std::vector<StageStats>& Stats() const { return stats_; }
+
+ private:
+  void ProcessBlock();
+
+  std::string source_;
+  std::vector<std::unique_ptr<DspStage>> stages_;
+  std::vector<StageStats> stats_;
+  std::vector<Counter*> cpu_nanoseconds_;
+  // The block being filled, and the processed block being read out.
+  std::vector<float> input_;
+  std::vector<int16_t> output_;
+  size_t fill_ = 0;
+};
+
+#endif
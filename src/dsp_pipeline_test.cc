@@ -0,0 +1,367 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "dsp_pipeline.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "dsp_kernels.h"
+#include "dsp_stages.h"
+
+static const int kSampleRate = 16000;
+
+// Counts every allocation, to check that the pipeline makes none.
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+double Noise() {
+  return rand() / static_cast<double>(RAND_MAX) * 2 - 1;
+}
+
+// Appends |ms| of a |hz| tone of |amplitude| plus |offset| and uniform
+// noise of |noise|.
+void Append(std::vector<int16_t>* audio, int ms, double hz, double amplitude,
+            double offset, double noise) {
+  size_t start = audio->size();
+  for (int i = 0; i < ms * kSampleRate / 1000; i++) {
+    double value = offset + amplitude * std::sin(2 * M_PI * hz * (start + i) / kSampleRate)
+        + noise * Noise();
+    audio->push_back(static_cast<int16_t>(std::round(value)));
+  }
+}
+
+// Appends |ms| of low-passed noise with a syllable-rate envelope, roughly
+// the spectrum and rhythm of speech.
+void AppendTalker(std::vector<int16_t>* audio, int ms, double amplitude,
+                  double noise) {
+  double state = 0;
+  size_t start = audio->size();
+  for (int i = 0; i < ms * kSampleRate / 1000; i++) {
+    state = 0.6 * state + 0.4 * Noise();
+    double envelope = 0.55 + 0.45 * std::sin(2 * M_PI * 4 * (start + i) / kSampleRate);
+    audio->push_back(static_cast<int16_t>(
+        std::round(amplitude * envelope * state + noise * Noise())));
+  }
+}
+
+// Runs |audio| through |pipeline| in place, in reads of varying size.
+void Run(DspPipeline* pipeline, std::vector<int16_t>* audio) {
+  static const size_t kReads[] = {320, 317, 1, 160, 641, 480};
+  for (size_t offset = 0, n = 0; offset < audio->size(); n++) {
+    size_t count = std::min(kReads[n % 6], audio->size() - offset);
+    pipeline->Process(&(*audio)[offset], count);
+    offset += count;
+  }
+}
+
+// Level in dBFS of |audio| from |begin_ms| to |end_ms|.
+double LevelDb(const std::vector<int16_t>& audio, int begin_ms, int end_ms) {
+  double sum = 0;
+  size_t begin = begin_ms * kSampleRate / 1000, end = end_ms * kSampleRate / 1000;
+  for (size_t i = begin; i < end; i++) {
+    sum += static_cast<double>(audio[i]) * audio[i];
+  }
+  return 10 * std::log10(sum / (end - begin) / (32768.0 * 32768.0) + 1e-10);
+}
+
+std::unique_ptr<DspPipeline> Pipeline(const std::string& spec) {
+  std::string error;
+  std::unique_ptr<DspPipeline> pipeline = DspPipeline::Create(spec, "test", &error);
+  if (!pipeline) {
+    std::cerr << "Test failed, spec " << spec << ": " << error << std::endl;
+    exit(1);
+  }
+  return pipeline;
+}
+
+int main() {
+  srand(1);
+
+  // The kernels agree with plain loops for lengths that leave a tail.
+  for (size_t count : {0, 1, 7, 8, 9, 160, 1003}) {
+    std::vector<float> a(count), b(count), ramped(count);
+    std::vector<int16_t> s16(count), converted(count);
+    float dot = 0, peak = 0;
+    for (size_t i = 0; i < count; i++) {
+      a[i] = 40000 * Noise();
+      b[i] = Noise();
+      dot += a[i] * b[i];
+      peak = std::max(peak, std::fabs(a[i]));
+      ramped[i] = a[i] * (0.5f + (i + 1) * (2.0f - 0.5f) / count);
+    }
+    FloatToS16(a.data(), count, s16.data());
+    for (size_t i = 0; i < count; i++) {
+      float expected = std::min(32767.0f, std::max(-32768.0f, std::nearbyint(a[i])));
+      if (s16[i] != expected) {
+        std::cerr << "Test failed, FloatToS16 of " << a[i] << " is " << s16[i] << std::endl;
+        return 1;
+      }
+    }
+    std::vector<float> back(count);
+    S16ToFloat(s16.data(), count, back.data());
+    FloatToS16(back.data(), count, converted.data());
+    if (converted != s16) {
+      std::cerr << "Test failed, S16ToFloat of " << count << " samples" << std::endl;
+      return 1;
+    }
+    if (std::fabs(DotProduct(a.data(), b.data(), count) - dot) > 1 + std::fabs(dot) * 1e-4
+        || MaxAbs(a.data(), count) != peak) {
+      std::cerr << "Test failed, DotProduct or MaxAbs of " << count << " samples" << std::endl;
+      return 1;
+    }
+    ApplyGainRamp(0.5f, 2.0f, count, a.data());
+    for (size_t i = 0; i < count; i++) {
+      if (std::fabs(a[i] - ramped[i]) > 1e-3f * std::fabs(ramped[i]) + 1e-3f) {
+        std::cerr << "Test failed, ApplyGainRamp at " << i << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // The FFT matches a direct DFT and inverts.
+  {
+    const size_t kSize = 16;
+    Fft fft(kSize);
+    std::vector<float> re(kSize), im(kSize), x(kSize);
+    for (size_t i = 0; i < kSize; i++) {
+      x[i] = re[i] = Noise();
+    }
+    fft.Forward(re.data(), im.data());
+    for (size_t k = 0; k < kSize; k++) {
+      double dft_re = 0, dft_im = 0;
+      for (size_t n = 0; n < kSize; n++) {
+        dft_re += x[n] * std::cos(2 * M_PI * k * n / kSize);
+        dft_im -= x[n] * std::sin(2 * M_PI * k * n / kSize);
+      }
+      if (std::fabs(re[k] - dft_re) > 1e-4 || std::fabs(im[k] - dft_im) > 1e-4) {
+        std::cerr << "Test failed, FFT bin " << k << std::endl;
+        return 1;
+      }
+    }
+    fft.Inverse(re.data(), im.data());
+    for (size_t i = 0; i < kSize; i++) {
+      if (std::fabs(re[i] - x[i]) > 1e-5 || std::fabs(im[i]) > 1e-5) {
+        std::cerr << "Test failed, inverse FFT sample " << i << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // Specs.
+  {
+    std::string error;
+    std::unique_ptr<DspPipeline> pipeline =
+        DspPipeline::Create("highpass,agc:-18,ns:12", "test", &error);
+    if (!pipeline || pipeline->Stats().size() != 3
+        || std::string(pipeline->Stats()[2].name) != "ns"
+        || pipeline->Latency() != 2 * DspPipeline::kBlockFrames) {
+      std::cerr << "Test failed, valid spec" << std::endl;
+      return 1;
+    }
+    if (!DspPipeline::Create("", "test", &error)->Empty()) {
+      std::cerr << "Test failed, empty spec" << std::endl;
+      return 1;
+    }
+    for (const char* spec : {"echo", "agc:loud", "highpass:0", "ns:", "agc:3"}) {
+      if (DspPipeline::Create(spec, "test", &error)) {
+        std::cerr << "Test failed, accepted " << spec << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // Without stages, audio comes out unchanged one block late.
+  {
+    std::vector<int16_t> audio;
+    for (int i = 0; i < 5000; i++) {
+      audio.push_back(static_cast<int16_t>(rand()));
+    }
+    std::vector<int16_t> processed = audio;
+    DspPipeline pipeline("test");
+    Run(&pipeline, &processed);
+    for (size_t i = 0; i < audio.size(); i++) {
+      int16_t expected = i < DspPipeline::kBlockFrames ? 0 : audio[i - DspPipeline::kBlockFrames];
+      if (processed[i] != expected) {
+        std::cerr << "Test failed, sample " << i << " is " << processed[i] << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // The high-pass filter removes DC and rumble and keeps the voice band.
+  {
+    std::vector<int16_t> voice, rumble;
+    Append(&voice, 1000, 1000, 8000, 5000, 0);
+    Append(&rumble, 1000, 20, 8000, 0, 0);
+    std::vector<int16_t> voice_in = voice, rumble_in = rumble;
+    std::unique_ptr<DspPipeline> pipeline = Pipeline("highpass");
+    Run(pipeline.get(), &voice);
+    pipeline->Reset();
+    Run(pipeline.get(), &rumble);
+    double mean = 0;
+    for (size_t i = kSampleRate / 2; i < voice.size(); i++) {
+      mean += voice[i];
+    }
+    mean /= voice.size() - kSampleRate / 2;
+    double voice_gain = LevelDb(voice, 500, 1000) - LevelDb(voice_in, 500, 1000);
+    double rumble_gain = LevelDb(rumble, 500, 1000) - LevelDb(rumble_in, 500, 1000);
+    // The input level includes the DC offset: 8000^2 / 2 + 5000^2 in power
+    // is 2.5dB above the tone alone.
+    if (std::fabs(mean) > 20 || std::fabs(voice_gain + 2.5) > 0.5 || rumble_gain > -20) {
+      std::cerr << "Test failed, high-pass mean " << mean << " voice " << voice_gain
+                << "dB rumble " << rumble_gain << "dB" << std::endl;
+      return 1;
+    }
+  }
+
+  // AGC brings a quiet talker to the target level, holds the gain through
+  // pauses and keeps a sudden loud sound from clipping.
+  {
+    std::vector<int16_t> audio;
+    AppendTalker(&audio, 1000, 0, 30);
+    AppendTalker(&audio, 8000, 1000, 30);
+    AppendTalker(&audio, 1000, 0, 30);
+    Append(&audio, 500, 1000, 20000, 0, 0);
+    std::vector<int16_t> input = audio;
+    AutomaticGainControl::Options options;
+    std::unique_ptr<DspPipeline> pipeline = Pipeline("agc");
+    Run(pipeline.get(), &audio);
+    double level = LevelDb(audio, 7010, 9010);
+    double input_level = LevelDb(input, 7000, 9000);
+    int peak = 0;
+    for (int16_t sample : audio) {
+      peak = std::max(peak, std::abs(static_cast<int>(sample)));
+    }
+    if (std::fabs(level - options.target_db) > 3 || peak > 31000) {
+      std::cerr << "Test failed, AGC took " << input_level << "dBFS to " << level
+                << "dBFS, peak " << peak << std::endl;
+      return 1;
+    }
+  }
+
+  // Noise suppression takes the noise down by close to its maximum and
+  // keeps a tone.
+  {
+    std::vector<int16_t> clean, audio;
+    Append(&clean, 2000, 1000, 0, 0, 0);
+    Append(&clean, 2000, 1000, 3000, 0, 0);
+    for (int16_t sample : clean) {
+      audio.push_back(static_cast<int16_t>(sample + std::round(1500 * Noise())));
+    }
+    std::vector<int16_t> input = audio;
+    std::unique_ptr<DspPipeline> pipeline = Pipeline("ns");
+    Run(pipeline.get(), &audio);
+    const size_t latency = pipeline->Latency();
+    double noise_gain = LevelDb(audio, 1000, 1900) - LevelDb(input, 1000, 1900);
+    double error_in = 0, error_out = 0, signal = 0;
+    for (size_t i = 2500 * kSampleRate / 1000; i < clean.size(); i++) {
+      double expected = clean[i - latency];
+      signal += expected * expected;
+      error_in += (input[i - latency] - expected) * (input[i - latency] - expected);
+      error_out += (audio[i] - expected) * (audio[i] - expected);
+    }
+    double snr_gain = 10 * std::log10(error_in / error_out);
+    if (noise_gain > -10 || snr_gain < 6) {
+      std::cerr << "Test failed, noise suppressed by " << -noise_gain
+                << "dB, SNR gained " << snr_gain << "dB" << std::endl;
+      return 1;
+    }
+  }
+
+  // A pipeline shared by the dialogs keeps its gain and noise estimate when
+  // a dialog restarts it, so even a short utterance comes out as it does
+  // once the pipeline has settled, first words included. A fresh pipeline
+  // leaves it far below the target.
+  {
+    AutomaticGainControl::Options options;
+    std::unique_ptr<DspPipeline> warm = Pipeline("agc,ns");
+    double settled_level = 0;
+    for (int dialog = 0; dialog < 4; dialog++) {
+      std::vector<int16_t> audio;
+      // Silence around the speech, as before the wake word and until the
+      // end of the utterance is heard.
+      AppendTalker(&audio, 500, 0, 30);
+      AppendTalker(&audio, 2500, 1000, 30);
+      AppendTalker(&audio, 500, 0, 30);
+      warm->Restart();
+      Run(warm.get(), &audio);
+      settled_level = LevelDb(audio, 550, 2000);
+    }
+    // The utterance starts right away, with no noise to learn from.
+    std::vector<int16_t> utterance;
+    AppendTalker(&utterance, 1500, 1000, 30);
+    std::vector<int16_t> warm_out = utterance, fresh_out = utterance;
+    warm->Restart();
+    Run(warm.get(), &warm_out);
+    std::unique_ptr<DspPipeline> fresh = Pipeline("agc,ns");
+    Run(fresh.get(), &fresh_out);
+    double warm_level = LevelDb(warm_out, 50, 1500);
+    double fresh_level = LevelDb(fresh_out, 50, 1500);
+    if (std::fabs(warm_level - settled_level) > 1
+        || std::fabs(warm_level - options.target_db) > 3
+        || std::fabs(fresh_level - options.target_db) < 6) {
+      std::cerr << "Test failed, short utterance at " << warm_level
+                << "dBFS through a warm pipeline (settled at " << settled_level
+                << "dBFS), " << fresh_level << "dBFS through a fresh one"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // A full pipeline allocates nothing once built, whatever the reads.
+  std::vector<int16_t> speech;
+  AppendTalker(&speech, 10000, 4000, 300);
+  std::unique_ptr<DspPipeline> pipeline = Pipeline("highpass,agc,ns");
+  std::vector<int16_t> audio = speech;
+  uint64_t before = allocations;
+  Run(pipeline.get(), &audio);
+  pipeline->Reset();
+  Run(pipeline.get(), &audio);
+  if (allocations != before) {
+    std::cerr << "Test failed, " << allocations - before << " allocations" << std::endl;
+    return 1;
+  }
+
+  double seconds = 2 * speech.size() / static_cast<double>(kSampleRate);
+  for (const DspPipeline::StageStats& stats : pipeline->Stats()) {
+    std::cout << stats.name << ": " << stats.cpu_nanoseconds / 1e6 / seconds
+              << "ms CPU per second of audio" << std::endl;
+  }
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,196 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "dsp_stages.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const double kSampleRate = 16000;
+const double kBlockSeconds = DspPipeline::kBlockFrames / kSampleRate;
+
+double LevelDb(const float* block, size_t count) {
+  return 10 * std::log10(DotProduct(block, block, count) / count
+                         / (32768.0 * 32768.0) + 1e-10);
+}
+
+double DbToGain(double db) {
+  return std::pow(10.0, db / 20);
+}
+
+}  // namespace
+
+HighPassFilter::HighPassFilter(const Options& options) {
+  // Butterworth, Q = 1/sqrt(2), from the bilinear transform.
+  double w0 = 2 * M_PI * options.cutoff_hz / kSampleRate;
+  double alpha = std::sin(w0) / std::sqrt(2.0);
+  double cosw0 = std::cos(w0);
+  double a0 = 1 + alpha;
+  b0_ = (1 + cosw0) / 2 / a0;
+  b1_ = -(1 + cosw0) / a0;
+  b2_ = b0_;
+  a1_ = -2 * cosw0 / a0;
+  a2_ = (1 - alpha) / a0;
+}
+
+void HighPassFilter::Process(float* block) {
+  // Recursive, so it runs one sample at a time.
+  for (size_t i = 0; i < DspPipeline::kBlockFrames; i++) {
+    double x = block[i];
+    double y = b0_ * x + z1_;
+    z1_ = b1_ * x - a1_ * y + z2_;
+    z2_ = b2_ * x - a2_ * y;
+    block[i] = static_cast<float>(y);
+  }
+}
+
+void HighPassFilter::Reset() {
+  z1_ = 0;
+  z2_ = 0;
+}
+
+AutomaticGainControl::AutomaticGainControl(const Options& options)
+    : options_(options) {
+  Reset();
+}
+
+void AutomaticGainControl::Reset() {
+  gain_db_ = 0;
+  has_level_ = false;
+  has_floor_ = false;
+}
+
+void AutomaticGainControl::Process(float* block) {
+  const size_t count = DspPipeline::kBlockFrames;
+  double level_db = LevelDb(block, count);
+  // Like ActivityGate, the floor drops quickly and rises slowly.
+  if (!has_floor_) {
+    floor_db_ = level_db;
+    has_floor_ = true;
+  } else if (level_db < floor_db_) {
+    floor_db_ = (floor_db_ + level_db) / 2;
+  } else {
+    floor_db_ = std::min(level_db, floor_db_ + 3 * kBlockSeconds);
+  }
+
+  double gain_db = gain_db_;
+  if (level_db >= options_.min_speech_db
+      && level_db >= floor_db_ + options_.speech_margin_db) {
+    level_db_ = has_level_ ? level_db_ + 0.1 * (level_db - level_db_) : level_db;
+    has_level_ = true;
+    double wanted = std::max(options_.min_gain_db,
+                             std::min(options_.max_gain_db,
+                                      options_.target_db - level_db_));
+    if (wanted > gain_db) {
+      gain_db = std::min(wanted, gain_db + options_.rise_db_per_second * kBlockSeconds);
+    } else {
+      gain_db = std::max(wanted, gain_db - options_.fall_db_per_second * kBlockSeconds);
+    }
+  }
+  // Peaks are kept 0.5dB below full scale from the first sample of the
+  // block on, so the ramp starts no higher than the limit either.
+  float peak = MaxAbs(block, count);
+  double limit_db = peak > 0 ? 20 * std::log10(30900.0 / peak) : options_.max_gain_db;
+  gain_db = std::min(gain_db, limit_db);
+  ApplyGainRamp(DbToGain(std::min(gain_db_, limit_db)), DbToGain(gain_db),
+                count, block);
+  gain_db_ = gain_db;
+}
+
+NoiseSuppressor::NoiseSuppressor(const Options& options)
+    : options_(options),
+      fft_(kFftSize),
+      window_(kFrame),
+      frame_(kFrame),
+      re_(kFftSize),
+      im_(kFftSize),
+      power_(kBins),
+      smoothed_(kBins),
+      noise_(kBins),
+      previous_snr_(kBins),
+      gains_(kFftSize),
+      overlap_(DspPipeline::kBlockFrames) {
+  // Squared, the windows of consecutive frames sum to one.
+  for (size_t i = 0; i < kFrame; i++) {
+    window_[i] = std::sin(M_PI * i / kFrame);
+  }
+  // Per block, in power.
+  noise_rise_ = std::pow(10.0, options_.noise_rise_db_per_second * kBlockSeconds / 10);
+  min_gain_ = DbToGain(-options_.max_suppression_db);
+  Reset();
+}
+
+void NoiseSuppressor::Reset() {
+  Restart();
+  has_noise_ = false;
+}
+
+void NoiseSuppressor::Restart() {
+  std::fill(frame_.begin(), frame_.end(), 0);
+  std::fill(overlap_.begin(), overlap_.end(), 0);
+  std::fill(previous_snr_.begin(), previous_snr_.end(), 0);
+}
+
+void NoiseSuppressor::Process(float* block) {
+  const size_t count = DspPipeline::kBlockFrames;
+  memmove(&frame_[0], &frame_[count], count * sizeof(float));
+  memcpy(&frame_[count], block, count * sizeof(float));
+
+  memcpy(&re_[0], &frame_[0], kFrame * sizeof(float));
+  MultiplyBy(window_.data(), kFrame, re_.data());
+  std::fill(re_.begin() + kFrame, re_.end(), 0);
+  std::fill(im_.begin(), im_.end(), 0);
+  fft_.Forward(re_.data(), im_.data());
+  PowerSpectrum(re_.data(), im_.data(), kBins, power_.data());
+
+  if (!has_noise_) {
+    smoothed_.assign(power_.begin(), power_.end());
+    noise_.assign(power_.begin(), power_.end());
+    has_noise_ = true;
+  }
+  // The minimum of the smoothed power sits about 3dB below the mean noise
+  // power, which |kNoiseBias| makes up for.
+  const float kNoiseBias = 2;
+  const float prior_weight = options_.prior_weight;
+  for (size_t k = 0; k < kBins; k++) {
+    smoothed_[k] = 0.7f * smoothed_[k] + 0.3f * power_[k];
+    noise_[k] = std::min(smoothed_[k], noise_[k] * noise_rise_);
+    float posterior = power_[k] / (kNoiseBias * noise_[k] + 1e-3f);
+    float prior = prior_weight * previous_snr_[k]
+        + (1 - prior_weight) * std::max(posterior - 1, 0.0f);
+    float gain = std::max(prior / (1 + prior), min_gain_);
+    previous_snr_[k] = gain * gain * posterior;
+    gains_[k] = gain;
+  }
+  // The spectrum of a real frame is symmetric.
+  for (size_t k = kBins; k < kFftSize; k++) {
+    gains_[k] = gains_[kFftSize - k];
+  }
+  MultiplyBy(gains_.data(), kFftSize, re_.data());
+  MultiplyBy(gains_.data(), kFftSize, im_.data());
+  fft_.Inverse(re_.data(), im_.data());
+  MultiplyBy(window_.data(), kFrame, re_.data());
+
+  // Output the previous block: the first half of this frame completes it.
+  for (size_t i = 0; i < count; i++) {
+    block[i] = re_[i] + overlap_[i];
+  }
+  memcpy(&overlap_[0], &re_[count], count * sizeof(float));
+}
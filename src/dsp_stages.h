@@ -0,0 +1,138 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef DSP_STAGES_H
+#define DSP_STAGES_H
+
+#include <vector>
+
+#include "dsp_kernels.h"
+#include "dsp_pipeline.h"
+
+// Second-order Butterworth high-pass filter. Removes DC offset, handling
+// noise and room rumble below the voice band.
+class HighPassFilter : public DspStage {
+ public:
+  struct Options {
+    double cutoff_hz = 80;
+  };
+
+  explicit HighPassFilter(const Options& options);
+
+  const char* Name() const override { return "highpass"; }
+  void Process(float* block) override;
+  void Reset() override;
+
+ private:
+  // Biquad coefficients, normalized so that a0 is 1.
+  double b0_, b1_, b2_, a1_, a2_;
+  // Transposed direct form II state.
+  double z1_ = 0;
+  double z2_ = 0;
+};
+
+// Brings speech to a constant level. The level is tracked over blocks that
+// are well above the noise floor, so that the gain holds through pauses
+// instead of pumping up the noise. The gain falls quickly and rises slowly,
+// and never lets a peak clip.
+class AutomaticGainControl : public DspStage {
+ public:
+  struct Options {
+    double target_db = -20;
+    double max_gain_db = 30;
+    double min_gain_db = -10;
+    double rise_db_per_second = 6;
+    double fall_db_per_second = 40;
+    // Blocks count as speech when they are this much above the noise floor
+    // and louder than |min_speech_db| (dBFS).
+    double speech_margin_db = 10;
+    double min_speech_db = -65;
+  };
+
+  explicit AutomaticGainControl(const Options& options);
+
+  const char* Name() const override { return "agc"; }
+  void Process(float* block) override;
+  void Reset() override;
+  // The gain, speech level and noise floor carry over.
+  void Restart() override {}
+
+  double GainDb() const { return gain_db_; }
+
+ private:
+  Options options_;
+  double gain_db_ = 0;
+  // Speech level, smoothed over roughly 100ms.
+  double level_db_ = 0;
+  bool has_level_ = false;
+  double floor_db_ = 0;
+  bool has_floor_ = false;
+};
+
+// Short-time spectral noise suppression. Each block and the one before it
+// are windowed and transformed; the noise spectrum is tracked from the
+// minima of the smoothed power in every bin, and each bin is scaled by a
+// Wiener gain with a decision-directed a priori SNR, which keeps residual
+// noise from turning into musical tones. Overlap-add delays the output by
+// one block.
+class NoiseSuppressor : public DspStage {
+ public:
+  struct Options {
+    // Floor of the gain of a bin.
+    double max_suppression_db = 15;
+    // How fast the noise estimate follows a louder signal.
+    double noise_rise_db_per_second = 3;
+    // Weight of the previous frame in the a priori SNR.
+    double prior_weight = 0.98;
+  };
+
+  explicit NoiseSuppressor(const Options& options);
+
+  const char* Name() const override { return "ns"; }
+  void Process(float* block) override;
+  void Reset() override;
+  // The noise estimate carries over.
+  void Restart() override;
+  size_t Latency() const override { return DspPipeline::kBlockFrames; }
+
+ private:
+  static constexpr size_t kFrame = 2 * DspPipeline::kBlockFrames;
+  static constexpr size_t kFftSize = 512;
+  static constexpr size_t kBins = kFftSize / 2 + 1;
+
+  Options options_;
+  Fft fft_;
+  // Square root of a periodic Hann window, for analysis and synthesis.
+  std::vector<float> window_;
+  // The previous block followed by the current one.
+  std::vector<float> frame_;
+  std::vector<float> re_;
+  std::vector<float> im_;
+  std::vector<float> power_;
+  std::vector<float> smoothed_;
+  std::vector<float> noise_;
+  // Estimated clean power of the previous frame, over the noise.
+  std::vector<float> previous_snr_;
+  std::vector<float> gains_;
+  // Second half of the previous synthesis frame.
+  std::vector<float> overlap_;
+  bool has_noise_ = false;
+  float noise_rise_;
+  float min_gain_;
+};
+
+#endif
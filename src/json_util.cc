@@ -14,6 +14,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+
 #include "json_util.h"
 #include "scope_exit.h"
 
@@ -21,9 +22,20 @@ extern "C" {
 #include <src/core/lib/json/json.h>
 }
 
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 
+namespace {
+
+// Whether the NUL-terminated |key| is |size| bytes of |data|.
+bool KeyEquals(const char* key, const char* data, size_t size) {
+  return key != nullptr && key[0] == (size > 0 ? data[0] : '\0') &&
+         strncmp(key, data, size) == 0 && key[size] == '\0';
+}
+
+}  // namespace
+
 grpc_json* GetJsonValueOrNullFromDict(grpc_json* dict_node, const char* key) {
   if (dict_node->type != GRPC_JSON_OBJECT) {
     return nullptr;
@@ -51,3 +63,223 @@ grpc_json* GetJsonValueOrNullFromArray(grpc_json* array_node, int index) {
   }
   return child;
 }
+
+std::unique_ptr<std::string> GetCustomResponseOrNull(const std::string& json) {
+  static const JsonPath* const kCustomResponse =
+      JsonPath::Compile(
+          "inputs[0].payload.commands[0].execution[0].params.customResponse")
+          .release();
+  std::unique_ptr<JsonDocument> document = JsonDocument::Parse(json);
+  if (!document) {
+    return nullptr;
+  }
+  JsonStringView response;
+  if (!GetJsonString(kCustomResponse->First(document->root()), &response)) {
+    return nullptr;
+  }
+  return std::unique_ptr<std::string>(new std::string(response.ToString()));
+}
+
+bool GetJsonString(const grpc_json* node, JsonStringView* value) {
+  if (node == nullptr || node->value == nullptr ||
+      (node->type != GRPC_JSON_STRING && node->type != GRPC_JSON_NUMBER)) {
+    return false;
+  }
+  *value = JsonStringView(node->value);
+  return true;
+}
+
+std::unique_ptr<JsonDocument> JsonDocument::Parse(const std::string& json) {
+  std::unique_ptr<JsonDocument> document(new JsonDocument());
+  // The parser works in place; strings in the tree point into |text_|.
+  document->text_.assign(json.begin(), json.end());
+  document->text_.push_back('\0');
+  document->root_ = grpc_json_parse_string_with_len(
+      document->text_.data(), json.size());
+  if (document->root_ == nullptr) {
+    return nullptr;
+  }
+  return document;
+}
+
+JsonDocument::~JsonDocument() {
+  if (root_ != nullptr) {
+    grpc_json_destroy(root_);
+  }
+}
+
+std::unique_ptr<JsonPath> JsonPath::Compile(const std::string& expression,
+                                            std::string* error) {
+  std::unique_ptr<JsonPath> path(new JsonPath());
+  std::string problem;
+  size_t i = 0;
+  while (i < expression.size() && problem.empty()) {
+    if (expression[i] == '[') {
+      size_t end = expression.find(']', i);
+      if (end == std::string::npos || end == i + 1) {
+        problem = "unterminated subscript";
+        break;
+      }
+      std::string subscript = expression.substr(i + 1, end - i - 1);
+      Step step;
+      step.is_index = true;
+      if (subscript == "*") {
+        step.index = -1;
+      } else {
+        char* rest;
+        long index = strtol(subscript.c_str(), &rest, 10);
+        if (*rest != '\0' || index < 0) {
+          problem = "bad subscript [" + subscript + "]";
+          break;
+        }
+        step.index = static_cast<int>(index);
+      }
+      path->steps_.push_back(step);
+      i = end + 1;
+      if (i < expression.size() && expression[i] == '.') {
+        i++;
+        if (i == expression.size()) {
+          problem = "trailing '.'";
+        }
+      }
+    } else {
+      size_t end = expression.find_first_of(".[]", i);
+      if (end == std::string::npos) {
+        end = expression.size();
+      }
+      if (end == i) {
+        problem = std::string("unexpected '") + expression[i] + "'";
+        break;
+      }
+      Step step;
+      step.key = expression.substr(i, end - i);
+      path->steps_.push_back(step);
+      i = end;
+      if (i < expression.size() && expression[i] == '.') {
+        i++;
+        if (i == expression.size()) {
+          problem = "trailing '.'";
+        }
+      }
+    }
+  }
+  if (!problem.empty()) {
+    if (error != nullptr) {
+      *error = problem + " at " + std::to_string(i) + " in " + expression;
+    }
+    return nullptr;
+  }
+  return path;
+}
+
+void JsonPath::Evaluate(grpc_json* root,
+                        std::vector<grpc_json*>* matches) const {
+  matches->clear();
+  if (root != nullptr) {
+    Visit(root, 0, matches, nullptr);
+  }
+}
+
+grpc_json* JsonPath::First(grpc_json* root) const {
+  grpc_json* first = nullptr;
+  if (root != nullptr) {
+    Visit(root, 0, nullptr, &first);
+  }
+  return first;
+}
+
+bool JsonPath::Visit(grpc_json* node, size_t step,
+                     std::vector<grpc_json*>* matches,
+                     grpc_json** first) const {
+  if (step == steps_.size()) {
+    if (matches != nullptr) {
+      matches->push_back(node);
+      return false;
+    }
+    *first = node;
+    return true;
+  }
+  const Step& s = steps_[step];
+  if (!s.is_index) {
+    if (node->type != GRPC_JSON_OBJECT) {
+      return false;
+    }
+    for (grpc_json* child = node->child; child != nullptr;
+         child = child->next) {
+      if (KeyEquals(child->key, s.key.data(), s.key.size())) {
+        return Visit(child, step + 1, matches, first);
+      }
+    }
+    return false;
+  }
+  if (node->type != GRPC_JSON_ARRAY) {
+    return false;
+  }
+  int index = 0;
+  for (grpc_json* child = node->child; child != nullptr;
+       child = child->next, index++) {
+    if (s.index < 0) {
+      if (Visit(child, step + 1, matches, first)) {
+        return true;
+      }
+    } else if (index == s.index) {
+      return Visit(child, step + 1, matches, first);
+    }
+  }
+  return false;
+}
+
+JsonIndex::JsonIndex(grpc_json* node) {
+  if (node == nullptr ||
+      (node->type != GRPC_JSON_OBJECT && node->type != GRPC_JSON_ARRAY)) {
+    return;
+  }
+  for (grpc_json* child = node->child; child != nullptr; child = child->next) {
+    elements_.push_back(child);
+  }
+  if (node->type != GRPC_JSON_OBJECT) {
+    return;
+  }
+  // At most half full.
+  size_t capacity = 4;
+  while (capacity < elements_.size() * 2) {
+    capacity *= 2;
+  }
+  slots_.assign(capacity, 0);
+  hashes_.resize(elements_.size());
+  for (size_t i = 0; i < elements_.size(); i++) {
+    const char* key = elements_[i]->key != nullptr ? elements_[i]->key : "";
+    hashes_[i] = Hash(key, strlen(key));
+    // Linear probing; earlier duplicates are found first, as in a scan.
+    size_t slot = hashes_[i] & (capacity - 1);
+    while (slots_[slot] != 0) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    slots_[slot] = i + 1;
+  }
+}
+
+grpc_json* JsonIndex::Find(const char* key, size_t size) const {
+  if (slots_.empty()) {
+    return nullptr;
+  }
+  uint32_t hash = Hash(key, size);
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask; slots_[slot] != 0;
+       slot = (slot + 1) & mask) {
+    size_t i = slots_[slot] - 1;
+    if (hashes_[i] == hash && KeyEquals(elements_[i]->key, key, size)) {
+      return elements_[i];
+    }
+  }
+  return nullptr;
+}
+
+// FNV-1a.
+uint32_t JsonIndex::Hash(const char* key, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+  }
+  return hash;
+}
@@ -14,10 +14,130 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+
 #ifndef JSON_UTIL_H
 #define JSON_UTIL_H
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
+
+struct grpc_json;
+
+// Returns the value of |key| in the object |dict_node|, or nullptr.
+grpc_json* GetJsonValueOrNullFromDict(grpc_json* dict_node, const char* key);
+// Returns element |index| of the array |array_node|, or nullptr.
+grpc_json* GetJsonValueOrNullFromArray(grpc_json* array_node, int index);
+
+// Returns the customResponse parameter of the first command of a device
+// request, the text the device should answer with, or nullptr if the JSON
+// is invalid or has none.
+std::unique_ptr<std::string> GetCustomResponseOrNull(const std::string& json);
+
+// Non-owning view of a key or value in a parsed tree, valid as long as the
+// tree.
+struct JsonStringView {
+  const char* data = nullptr;
+  size_t size = 0;
+
+  JsonStringView() {}
+  JsonStringView(const char* data, size_t size) : data(data), size(size) {}
+  explicit JsonStringView(const char* str)
+      : data(str), size(str != nullptr ? strlen(str) : 0) {}
+
+  bool Equals(const char* str, size_t length) const {
+    return size == length && memcmp(data, str, length) == 0;
+  }
+  bool operator==(const char* str) const { return Equals(str, strlen(str)); }
+  std::string ToString() const { return std::string(data, size); }
+};
+
+// Sets |*value| to the text of a string or number node, without copying.
+// Returns false for other nodes.
+bool GetJsonString(const grpc_json* node, JsonStringView* value);
+
+// A parsed JSON text. The tree points into a private copy of the text.
+class JsonDocument {
+ public:
+  // Returns nullptr if |json| is not valid JSON.
+  static std::unique_ptr<JsonDocument> Parse(const std::string& json);
+  ~JsonDocument();
+
+  grpc_json* root() const { return root_; }
+
+ private:
+  JsonDocument() {}
+
+  std::vector<char> text_;
+  grpc_json* root_ = nullptr;
+};
+
+// A path into a JSON tree, parsed once and evaluated in one walk over the
+// nodes it names. Steps are object keys separated by '.', each optionally
+// followed by array subscripts, which are indexes or [*] for every element:
+//
+//   inputs[0].payload.commands[*].execution
+//
+// Evaluation does not allocate, except to grow |matches|.
+class JsonPath {
+ public:
+  // Returns nullptr and sets |*error| if |expression| is malformed.
+  static std::unique_ptr<JsonPath> Compile(const std::string& expression,
+                                           std::string* error = nullptr);
+
+  // Replaces |*matches| with the nodes the path names under |root|, in
+  // document order.
+  void Evaluate(grpc_json* root, std::vector<grpc_json*>* matches) const;
+  // Returns the first node the path names, or nullptr.
+  grpc_json* First(grpc_json* root) const;
+
+ private:
+  struct Step {
+    // Either an object key or an array subscript.
+    std::string key;
+    bool is_index = false;
+    // Array index, -1 for every element.
+    int index = 0;
+  };
+
+  JsonPath() {}
+  // Visits the nodes |steps_|[step...] name under |node|. Returns true to
+  // stop, once |matches| is null and a node was found.
+  bool Visit(grpc_json* node, size_t step, std::vector<grpc_json*>* matches,
+             grpc_json** first) const;
+
+  std::vector<Step> steps_;
+};
+
+// Hashed index of the members of one object, for objects with many keys
+// that are looked up repeatedly; plain lookups scan every member. Also
+// indexes the elements of an array. Built in one pass, then lookups do not
+// allocate. The tree must outlive the index and must not change.
+class JsonIndex {
+ public:
+  explicit JsonIndex(grpc_json* node);
+
+  // Member |key| of the object, or nullptr.
+  grpc_json* Find(const char* key) const { return Find(key, strlen(key)); }
+  grpc_json* Find(const char* key, size_t size) const;
+  // Element |index| of the array, or nullptr.
+  grpc_json* At(size_t index) const {
+    return index < elements_.size() ? elements_[index] : nullptr;
+  }
+  size_t size() const { return elements_.size(); }
+
+ private:
+  static uint32_t Hash(const char* key, size_t size);
+
+  // Children in document order.
+  std::vector<grpc_json*> elements_;
+  // Open addressing table of object members: indexes into |elements_| plus
+  // one, 0 for an empty slot. Its size is a power of two.
+  std::vector<uint32_t> slots_;
+  std::vector<uint32_t> hashes_;
+};
 
 #endif
@@ -0,0 +1,174 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+// Compares the ways json_util offers to navigate a parsed tree, on payloads
+// shaped like device requests but larger than usual:
+//
+//   ./json_util_benchmark [--commands <n>] [--keys <n>]
+//
+// - every command name of a request with n commands of 4 executions each,
+//   by index with the Get*OrNull helpers and with one compiled JsonPath;
+// - every member of an object with n keys, by scanning and with a JsonIndex.
+
+#include <getopt.h>
+
+extern "C" {
+#include <src/core/lib/json/json.h>
+}
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "json_util.h"
+
+namespace {
+
+const int kExecutionsPerCommand = 4;
+
+std::string DeviceRequest(int commands) {
+  std::string json =
+      "{\"requestId\": \"ff36a3cc\", \"inputs\": [{\"intent\": "
+      "\"action.devices.EXECUTE\", \"payload\": {\"commands\": [";
+  for (int i = 0; i < commands; i++) {
+    json += i > 0 ? ", " : "";
+    json += "{\"devices\": [{\"id\": \"device" + std::to_string(i) +
+            "\"}], \"execution\": [";
+    for (int j = 0; j < kExecutionsPerCommand; j++) {
+      json += j > 0 ? ", " : "";
+      json += "{\"command\": \"action.devices.commands.OnOff\", "
+              "\"params\": {\"on\": true}}";
+    }
+    json += "]}";
+  }
+  return json + "]}}]}";
+}
+
+std::string LargeObject(int keys) {
+  std::string json = "{";
+  for (int i = 0; i < keys; i++) {
+    json += (i > 0 ? ", \"" : "\"") + std::string("setting") +
+            std::to_string(i) + "\": " + std::to_string(i);
+  }
+  return json + "}";
+}
+
+// Runs |body| |iterations| times and prints the time per |ops|.
+template <typename Body>
+void Measure(const std::string& name, int iterations, size_t ops, Body body) {
+  size_t found = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    found += body();
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+  std::cout << name << ": " << ns / iterations / ops << "ns per lookup ("
+            << found / iterations << " found)" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int commands = 200, keys = 1000;
+  const struct option long_options[] = {
+    {"commands", required_argument, nullptr, 'c'},
+    {"keys",     required_argument, nullptr, 'k'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char = getopt_long(argc, argv, "c:k:", long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 'c':
+        commands = atoi(optarg);
+        break;
+      case 'k':
+        keys = atoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: ./json_util_benchmark [--commands <n>] [--keys <n>]"
+                  << std::endl;
+        return 1;
+    }
+  }
+
+  std::unique_ptr<JsonDocument> request =
+      JsonDocument::Parse(DeviceRequest(commands));
+  size_t executions = static_cast<size_t>(commands) * kExecutionsPerCommand;
+  std::cout << commands << " commands, " << executions << " executions"
+            << std::endl;
+  Measure("GetJsonValueOrNullFromArray", 20, executions, [&]() {
+    size_t found = 0;
+    grpc_json* input = GetJsonValueOrNullFromArray(
+        GetJsonValueOrNullFromDict(request->root(), "inputs"), 0);
+    grpc_json* list = GetJsonValueOrNullFromDict(
+        GetJsonValueOrNullFromDict(input, "payload"), "commands");
+    for (int i = 0;; i++) {
+      grpc_json* command = GetJsonValueOrNullFromArray(list, i);
+      if (command == nullptr) {
+        break;
+      }
+      grpc_json* execution = GetJsonValueOrNullFromDict(command, "execution");
+      for (int j = 0;; j++) {
+        grpc_json* item = GetJsonValueOrNullFromArray(execution, j);
+        if (item == nullptr) {
+          break;
+        }
+        found += GetJsonValueOrNullFromDict(item, "command") != nullptr;
+      }
+    }
+    return found;
+  });
+  std::unique_ptr<JsonPath> path =
+      JsonPath::Compile("inputs[0].payload.commands[*].execution[*].command");
+  std::vector<grpc_json*> matches;
+  Measure("JsonPath", 20, executions, [&]() {
+    path->Evaluate(request->root(), &matches);
+    return matches.size();
+  });
+
+  std::unique_ptr<JsonDocument> object = JsonDocument::Parse(LargeObject(keys));
+  std::vector<std::string> names;
+  for (int i = 0; i < keys; i++) {
+    names.push_back("setting" + std::to_string(i));
+  }
+  std::cout << keys << " keys" << std::endl;
+  Measure("GetJsonValueOrNullFromDict", 20, keys, [&]() {
+    size_t found = 0;
+    for (const std::string& name : names) {
+      found += GetJsonValueOrNullFromDict(object->root(), name.c_str()) != nullptr;
+    }
+    return found;
+  });
+  Measure("JsonIndex build", 20, keys, [&]() {
+    return JsonIndex(object->root()).size();
+  });
+  JsonIndex index(object->root());
+  Measure("JsonIndex::Find", 20, keys, [&]() {
+    size_t found = 0;
+    for (const std::string& name : names) {
+      found += index.Find(name.data(), name.size()) != nullptr;
+    }
+    return found;
+  });
+  return 0;
+}
@@ -14,8 +14,13 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+
 #include "json_util.h"
 
+extern "C" {
+#include <src/core/lib/json/json.h>
+}
+
 #include <iostream>
 
 bool check_result(const std::string& input_json,
@@ -41,5 +46,104 @@ int main() {
     return 1;
   }
 
-  std::cerr << "Test passed" << std::endl;
+  std::string valid_json =
+      "{\"inputs\": [{\"payload\": {\"commands\": [{\"execution\": [{"
+      "\"command\": \"com.example.commands.Blink\", "
+      "\"params\": {\"customResponse\": \"Blinking 3 times\"}}]}]}}]}";
+  intended_result.reset(new std::string("Blinking 3 times"));
+  if (!check_result(valid_json, std::move(intended_result))) {
+    std::cerr << "Test failed for valid JSON" << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<JsonDocument> document = JsonDocument::Parse(
+      "{\"inputs\": [{\"payload\": {\"commands\": ["
+      "{\"execution\": [{\"command\": \"a\"}, {\"command\": \"b\"}]},"
+      "{\"execution\": [{\"command\": \"c\"}]}]}},"
+      "{\"payload\": {\"commands\": [{\"execution\": [{\"command\": 4}]}]}}]}");
+  if (!document) {
+    std::cerr << "Test failed, cannot parse document" << std::endl;
+    return 1;
+  }
+
+  // Wildcards fan out in document order; indexes pick one element.
+  {
+    std::unique_ptr<JsonPath> path =
+        JsonPath::Compile("inputs[*].payload.commands[*].execution[*].command");
+    std::vector<grpc_json*> matches;
+    path->Evaluate(document->root(), &matches);
+    std::string names;
+    for (grpc_json* match : matches) {
+      JsonStringView name;
+      if (GetJsonString(match, &name)) {
+        names += name.ToString();
+      }
+    }
+    JsonStringView first;
+    GetJsonString(
+        JsonPath::Compile("inputs[0].payload.commands[1].execution[0].command")
+            ->First(document->root()),
+        &first);
+    if (names != "abc4" || !(first == "c")) {
+      std::cerr << "Test failed, path matched " << names << " and "
+                << first.ToString() << std::endl;
+      return 1;
+    }
+    if (JsonPath::Compile("inputs[2].payload")->First(document->root()) !=
+            nullptr ||
+        JsonPath::Compile("inputs.payload")->First(document->root()) !=
+            nullptr) {
+      std::cerr << "Test failed, path matched a missing node" << std::endl;
+      return 1;
+    }
+  }
+
+  // Malformed paths are rejected.
+  {
+    const char* malformed[] = {"a[", "a[x]", "a[-1]", "a.", ".a", "a..b",
+                               "a]"};
+    for (const char* expression : malformed) {
+      std::string error;
+      if (JsonPath::Compile(expression, &error) || error.empty()) {
+        std::cerr << "Test failed, compiled " << expression << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // The index finds the same members as a scan, the first of duplicates.
+  {
+    std::string json = "{";
+    for (int i = 0; i < 100; i++) {
+      json += "\"key" + std::to_string(i) + "\": " + std::to_string(i) + ", ";
+    }
+    json += "\"key7\": \"duplicate\", \"\": \"empty\"}";
+    std::unique_ptr<JsonDocument> object = JsonDocument::Parse(json);
+    JsonIndex index(object->root());
+    for (int i = 0; i < 100; i++) {
+      std::string key = "key" + std::to_string(i);
+      JsonStringView value;
+      if (index.Find(key.c_str()) !=
+              GetJsonValueOrNullFromDict(object->root(), key.c_str()) ||
+          !GetJsonString(index.Find(key.c_str()), &value) ||
+          value.ToString() != std::to_string(i)) {
+        std::cerr << "Test failed, index lookup of " << key << std::endl;
+        return 1;
+      }
+    }
+    if (index.Find("key100") != nullptr || index.Find("key1", 3) != nullptr ||
+        index.Find("") == nullptr || index.size() != 102) {
+      std::cerr << "Test failed, index found a missing key" << std::endl;
+      return 1;
+    }
+    JsonIndex commands(JsonPath::Compile("inputs[0].payload.commands")
+                           ->First(document->root()));
+    if (commands.size() != 2 || commands.At(1) == nullptr ||
+        commands.At(2) != nullptr || commands.Find("execution") != nullptr) {
+      std::cerr << "Test failed, array index" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Test passed" << std::endl;
 }
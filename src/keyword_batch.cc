@@ -0,0 +1,369 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Runs a keyword spotter over directories of RAW/WAV recordings as fast as
+// the CPUs allow, and writes every detection to a report. One spotter per
+// worker thread; files are spread across per-worker queues and idle workers
+// steal from the others.
+//
+// The summary groups results by input argument, so passing a directory of
+// recordings that contain the keyword and one that does not gives the
+// false-reject rate and the false accepts per hour:
+//
+//   ./keyword_batch --threads 8 --report report.tsv positive/ negative/
+//
+// With --gate every file is also run through an ActivityGate in front of the
+// spotter, as on the device, and files whose detections the gate lost are
+// listed. The exit status is 2 if there are any.
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "activity_gate.h"
+#include "audio_file.h"
+#include "keyword_spotter.h"
+
+static const int kSampleRate = 16000;
+
+struct FileResult {
+  std::string path;
+  // Index of the command line argument the file was found under.
+  int group = 0;
+  double seconds = 0;
+  std::string error;
+  std::vector<KeywordEvent> events;
+  // With --gate: detections behind the gate, and the audio it held back.
+  std::vector<KeywordEvent> gated_events;
+  double gated_seconds = 0;
+};
+
+// Per-worker task queue. The owner takes from the back, thieves from the
+// front, so they rarely contend for the same file.
+class WorkQueue {
+ public:
+  void Push(size_t task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+  }
+  bool Pop(size_t* task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = tasks_.back();
+    tasks_.pop_back();
+    return true;
+  }
+  bool Steal(size_t* task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = tasks_.front();
+    tasks_.pop_front();
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<size_t> tasks_;
+};
+
+static bool IsAudioFile(const std::string& name) {
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string ext = name.substr(dot);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".raw" || ext == ".wav";
+}
+
+static void FindAudioFiles(const std::string& path, int group,
+                           std::vector<FileResult>* files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    std::cerr << "Cannot stat " << path << std::endl;
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    FileResult file;
+    file.path = path;
+    file.group = group;
+    files->push_back(file);
+    return;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    std::cerr << "Cannot open directory " << path << std::endl;
+    return;
+  }
+  std::vector<std::string> entries;
+  while (dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      entries.push_back(name);
+    }
+  }
+  closedir(dir);
+  std::sort(entries.begin(), entries.end());
+  for (const std::string& name : entries) {
+    std::string child = path + "/" + name;
+    if (stat(child.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      FindAudioFiles(child, group, files);
+    } else if (IsAudioFile(name)) {
+      FileResult file;
+      file.path = child;
+      file.group = group;
+      files->push_back(file);
+    }
+  }
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: ./keyword_batch [--backend <sensory|energy>] "
+            << "[--model <model_file>] [--threads <n>] [--hop_ms <ms>] "
+            << "[--report <tsv_file>] [--gate] <dir_or_file>..." << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string backend = kDefaultKeywordBackend, model, report_path;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  int hop_ms = 100;
+  bool gate = false;
+
+  const struct option long_options[] = {
+    {"backend", required_argument, nullptr, 'b'},
+    {"model",   required_argument, nullptr, 'm'},
+    {"threads", required_argument, nullptr, 'j'},
+    {"hop_ms",  required_argument, nullptr, 'h'},
+    {"report",  required_argument, nullptr, 'r'},
+    {"gate",    no_argument,       nullptr, 'g'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char =
+        getopt_long(argc, argv, "b:m:j:h:r:g", long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 'b':
+        backend = optarg;
+        break;
+      case 'm':
+        model = optarg;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'h':
+        hop_ms = atoi(optarg);
+        break;
+      case 'r':
+        report_path = optarg;
+        break;
+      case 'g':
+        gate = true;
+        break;
+      default:
+        PrintUsage();
+        return 1;
+    }
+  }
+  if (optind == argc || threads <= 0 || hop_ms <= 0) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::vector<FileResult> files;
+  for (int i = optind; i < argc; i++) {
+    FindAudioFiles(argv[i], i - optind, &files);
+  }
+  if (files.empty()) {
+    std::cerr << "No RAW or WAV files found" << std::endl;
+    return 1;
+  }
+  threads = std::min<int>(threads, files.size());
+
+  // Deal files out round-robin, largest first, so queues start balanced.
+  std::vector<std::pair<off_t, size_t>> by_size;
+  for (size_t i = 0; i < files.size(); i++) {
+    struct stat st;
+    by_size.push_back(std::make_pair(
+        stat(files[i].path.c_str(), &st) == 0 ? st.st_size : 0, i));
+  }
+  std::sort(by_size.rbegin(), by_size.rend());
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  for (int i = 0; i < threads; i++) {
+    queues.emplace_back(new WorkQueue);
+  }
+  for (size_t i = 0; i < by_size.size(); i++) {
+    queues[i % threads]->Push(by_size[i].second);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  bool init_failed = false;
+  std::mutex init_mutex;
+  std::vector<std::thread> workers;
+  for (int w = 0; w < threads; w++) {
+    workers.emplace_back([&, w]() {
+      std::unique_ptr<KeywordSpotter> spotter = CreateKeywordSpotter(backend, model);
+      if (!spotter || !spotter->Init()) {
+        std::unique_lock<std::mutex> lock(init_mutex);
+        init_failed = true;
+        return;
+      }
+      std::vector<KeywordEvent>* events = nullptr;
+      spotter->SetListener([&events](const KeywordEvent& event) {
+        events->push_back(event);
+      });
+      ActivityGate activity_gate;
+      FileResult* current = nullptr;
+
+      size_t hop_samples = kSampleRate * hop_ms / 1000;
+      std::vector<int16_t> audio;
+      size_t task;
+      while (true) {
+        bool found = queues[w]->Pop(&task);
+        for (int i = 1; !found && i < threads; i++) {
+          found = queues[(w + i) % threads]->Steal(&task);
+        }
+        if (!found) {
+          break;
+        }
+        current = &files[task];
+        if (!ReadAudioFile(current->path, &audio, &current->error)) {
+          continue;
+        }
+        spotter->Reset();
+        events = &current->events;
+        for (size_t offset = 0; offset < audio.size(); offset += hop_samples) {
+          spotter->Feed(&audio[offset], std::min(hop_samples, audio.size() - offset));
+        }
+        current->seconds = audio.size() / double(kSampleRate);
+        if (!gate) {
+          continue;
+        }
+
+        spotter->Reset();
+        activity_gate.Reset();
+        events = &current->gated_events;
+        size_t unfed = 0;
+        for (size_t offset = 0; offset < audio.size(); offset += hop_samples) {
+          size_t count = std::min(hop_samples, audio.size() - offset);
+          int feed = activity_gate.Process(&audio[offset], count);
+          if (feed == 0) {
+            current->gated_seconds += count / double(kSampleRate);
+            continue;
+          }
+          // Replay the lookback the gate asks for, like KeywordDetect does.
+          size_t lookback = (feed - 1) * hop_samples;
+          size_t first = std::max(offset >= lookback ? offset - lookback : 0, unfed);
+          spotter->Feed(&audio[first], offset + count - first);
+          unfed = offset + count;
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  double wall_seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  if (init_failed) {
+    std::cerr << "Cannot initialize keyword backend " << backend << std::endl;
+    return 1;
+  }
+
+  std::ofstream report_file;
+  if (!report_path.empty()) {
+    report_file.open(report_path);
+    if (!report_file) {
+      std::cerr << "Cannot write " << report_path << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& report = report_path.empty() ? std::cout : report_file;
+  report << "file\tkeyword\tbegin_s\tend_s\tconfidence\n";
+
+  int groups = argc - optind;
+  std::vector<int> group_files(groups), group_detected(groups), group_events(groups);
+  std::vector<double> group_seconds(groups);
+  double total_seconds = 0, gated_seconds = 0;
+  std::vector<std::string> lost;
+  for (const FileResult& file : files) {
+    if (!file.error.empty()) {
+      std::cerr << file.path << ": " << file.error << std::endl;
+      continue;
+    }
+    for (const KeywordEvent& event : file.events) {
+      report << file.path << "\t" << event.keyword << "\t"
+             << event.begin_sample / double(kSampleRate) << "\t"
+             << event.end_sample / double(kSampleRate) << "\t"
+             << event.confidence << "\n";
+    }
+    group_files[file.group]++;
+    group_detected[file.group] += file.events.empty() ? 0 : 1;
+    group_events[file.group] += file.events.size();
+    group_seconds[file.group] += file.seconds;
+    total_seconds += file.seconds;
+    gated_seconds += file.gated_seconds;
+    if (gate && file.gated_events.size() < file.events.size()) {
+      lost.push_back(file.path);
+    }
+  }
+
+  for (int g = 0; g < groups; g++) {
+    if (group_files[g] == 0) {
+      continue;
+    }
+    double hours = group_seconds[g] / 3600;
+    std::cerr << argv[optind + g] << ": " << group_files[g] << " files, "
+              << hours << "h, " << group_detected[g] << " files with detections ("
+              << 100.0 * group_detected[g] / group_files[g] << "%), "
+              << (hours > 0 ? group_events[g] / hours : 0)
+              << " detections per hour" << std::endl;
+  }
+  std::cerr << total_seconds / 3600 << "h of audio in " << wall_seconds
+            << "s on " << threads << " threads ("
+            << total_seconds / wall_seconds << "x real time)" << std::endl;
+  if (gate) {
+    std::cerr << "Gate held back " << 100 * gated_seconds / total_seconds
+              << "% of the audio; " << lost.size()
+              << " files lost detections" << std::endl;
+    for (const std::string& path : lost) {
+      std::cerr << "  " << path << std::endl;
+    }
+    return lost.empty() ? 0 : 2;
+  }
+  return 0;
+}
@@ -1,107 +1,107 @@
 #include "keyword_detect.h"
+#include <algorithm>
 #include <alsa/asoundlib.h>
-#include "snsr.h"
+#include "log.h"
+#include "metrics.h"
+#include "thread_config.h"
 
 using namespace std;
 
+static Counter* const kWakeDetections = MetricsRegistry::Global().GetCounter(
+    "assistant_wake_detections_total", "Wake words detected.");
+static Counter* const kModelOverruns = MetricsRegistry::Global().GetCounter(
+    "assistant_keyword_model_overruns_total",
+    "Times a keyword model fell too far behind capture and skipped audio.");
+static Counter* const kCapturedMs = MetricsRegistry::Global().GetCounter(
+    "assistant_keyword_audio_milliseconds_total", "Audio captured for keyword detection.");
+static Counter* const kGatedMs = MetricsRegistry::Global().GetCounter(
+    "assistant_keyword_gated_milliseconds_total",
+    "Captured audio the activity gate kept from the keyword models.");
+
+
+void KeywordDetect::AddModel(const std::string& name, std::unique_ptr<KeywordSpotter> spotter) {
+    std::unique_ptr<Model> model(new Model);
+    model->name = name;
+    model->spotter = std::move(spotter);
+    model->spotter->SetListener([this, name](const KeywordEvent& event) {
+        OnKeyword(name, event);
+    });
+    m_models.push_back(std::move(model));
+}
 
-string SNSR_MODEL_FILE ("/etc/sensory/wakeup-word.snsr");
-
-
-static std::string getSensoryDetails(SnsrSession session, SnsrRC result) {
-    std::string message;
-    // It is recommended by Sensory to prefer snsrErrorDetail() over snsrRCMessage() as it provides more details.
-    if (session) {
-        message = snsrErrorDetail(session);
-    } else {
-        message = snsrRCMessage(result);
+bool KeywordDetect::Init() {
+    if (m_models.empty()) {
+        LOG(ERROR) << "KeywordDetect::Init no keyword model";
+        return false;
     }
-    if (message.empty()) {
-        message = "Unrecognized error";
+    for (auto& model : m_models) {
+        if (!model->spotter->Init()) {
+            LOG(ERROR) << "KeywordDetect::Init cannot load model " << model->name;
+            return false;
+        }
     }
-    return message;
+    return true;
 }
 
-void KeywordDetect::InitSNSR() {
-
-    SnsrRC result = snsrNew(&m_session);
-    if (result != SNSR_RC_OK) {
-        printf("snsrNew error %s\n", getSensoryDetails(m_session, result).c_str());
-        return;
-    } 
-    
-    result = snsrLoad(m_session, snsrStreamFromFileName(SNSR_MODEL_FILE.c_str(), "r"));
-    if (result != SNSR_RC_OK) {
-        printf("snsrLoad error %s\n", getSensoryDetails(m_session, result).c_str());
-        return;
-    }
-    
-    result = snsrRequire(m_session, SNSR_TASK_TYPE, SNSR_PHRASESPOT);
-    if (result != SNSR_RC_OK) {
-        printf("snsrRequire error %s\n", getSensoryDetails(m_session, result).c_str());
+void KeywordDetect::OnKeyword(const std::string& model, const KeywordEvent& event) {
+    LOG(INFO) << "KeywordDetect keyword: " << event.keyword << " model " << model
+              << " confidence " << event.confidence;
+    KeywordEvent named = event;
+    named.model = model;
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    // Another model may have woken the assistant in the same hop.
+    if (!m_isRunning) {
         return;
     }
-    
-    if (!setUpRuntimeSettings(&m_session)) {
-        return ;
+    if (m_handlers.Dispatch(named)) {
+        kWakeDetections->Increment();
+        m_wakeEvent = named;
+        m_isRunning = false;
+        {
+            std::unique_lock<std::mutex> ring_lock(m_ringMutex);
+        }
+        m_ringReady.notify_all();
     }
-    printf("KeywordDetect::InitSNSR\n");    
 }
 
-bool KeywordDetect::InitPCM() {
-    int pcm_open_ret = snd_pcm_open(&pcm_handle, "default", SND_PCM_STREAM_CAPTURE, 0);
-    if (pcm_open_ret < 0) {
-        std::cerr << "KeywordDetect snd_pcm_open returned " << pcm_open_ret << std::endl;
-        return false;
-    }
-
-    snd_pcm_hw_params_t* pcm_params;
-    int malloc_param_ret = snd_pcm_hw_params_malloc(&pcm_params);
-    if (malloc_param_ret < 0) {
-        std::cerr << "KeywordDetect snd_pcm_hw_params_malloc returned " << malloc_param_ret
-            << std::endl;
-        return false;
+void KeywordDetect::SetHopMs(int hop_ms) {
+    if (hop_ms < kMinHopMs) {
+        hop_ms = kMinHopMs;
+    } else if (hop_ms > kMaxHopMs) {
+        hop_ms = kMaxHopMs;
     }
+    m_hopFrames = kSampleRate * hop_ms / 1000;
+}
 
-    snd_pcm_hw_params_any(pcm_handle, pcm_params);
-    int set_param_ret = snd_pcm_hw_params_set_access(pcm_handle, pcm_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    if (set_param_ret < 0) {
-        std::cerr << "KeywordDetect snd_pcm_hw_params_set_access returned " << set_param_ret
-            << std::endl;
-        return false;
-    }
+void KeywordDetect::SetGate(bool enabled, const ActivityGate::Options& options) {
+    m_gateEnabled = enabled;
+    m_gate = ActivityGate(options);
+}
 
-    set_param_ret = snd_pcm_hw_params_set_format(pcm_handle, pcm_params, SND_PCM_FORMAT_S16_LE);
-    if (set_param_ret < 0) {
-        std::cerr << "KeywordDetect snd_pcm_hw_params_set_format returned " << set_param_ret
-            << std::endl;
-        return false;
-    }
-    set_param_ret = snd_pcm_hw_params_set_channels(pcm_handle, pcm_params, 1);
-    if (set_param_ret < 0) {
-        std::cerr << "AudioOutputALSA snd_pcm_hw_params_set_channels returned " << set_param_ret
-            << std::endl;
-        return false;
-    }
-    unsigned int rate = 16000;
-    set_param_ret = snd_pcm_hw_params_set_rate_near(pcm_handle, pcm_params, &rate, nullptr);
-    if (set_param_ret < 0) {
-        std::cerr << "AudioOutputALSA snd_pcm_hw_params_set_rate_near returned " << set_param_ret
-            << std::endl;
-        return false;
-    }
-    set_param_ret = snd_pcm_hw_params(pcm_handle, pcm_params);
-    if (set_param_ret < 0) {
-        std::cerr << "AudioOutputALSA snd_pcm_hw_params returned " << set_param_ret << std::endl;
+bool KeywordDetect::InitPCM() {
+    // Wake up once per hop, but keep enough buffer to ride out scheduling hiccups.
+    if (!m_capture.Open("default", kSampleRate, m_hopFrames, kBufferFrames, false)) {
         return false;
     }
-    snd_pcm_hw_params_free(pcm_params);
-    printf("KeywordDetect::InitPCM\n");    
+    LOG(DEBUG) << "KeywordDetect::InitPCM";
+    return true;
 }
 
-void KeywordDetect::Start() {
+bool KeywordDetect::Start() {
+    // Re-arm instead of reloading the models.
+    for (auto& model : m_models) {
+        if (!model->spotter->Reset()) {
+            return false;
+        }
+    }
+    m_ring.assign(kRingHops * m_hopFrames, 0);
+    m_gate.Reset();
+    m_hopsWritten = 0;
+    m_discontinuities = 0;
+    m_wakeEvent = KeywordEvent();
     m_isRunning = true;
-    printf("KeywordDetect::Start\n");    
+    LOG(DEBUG) << "KeywordDetect::Start";
+    return true;
 }
 
 void KeywordDetect::Stop() {
@@ -109,150 +109,135 @@ void KeywordDetect::Stop() {
     if (loopThread->joinable()) {
         loopThread->join();
     }
-}
-
-void KeywordDetect::AnalyzeAudio(std::shared_ptr<std::vector<unsigned char>> data){
-    SnsrRC result;
-    bool didErrorOccur = false;
-    snsrSetStream(
-        m_session,
-        SNSR_SOURCE_AUDIO_PCM,
-        snsrStreamFromMemory(
-                    &((*data)[0]), data->size(), SNSR_ST_MODE_READ)
-    );
-    result = snsrRun(m_session);
-    switch (result) {
-        case SNSR_RC_STREAM_END:
-                    // Reached end of buffer without any keyword detections
-                    break;
-        case SNSR_RC_OK:
-                    break;
-        default:
-                    // A different return from the callback function that indicates some sort of error
-            std::cerr << "KeywordDetect::AnalyzeAudio()" << getSensoryDetails(m_session, result);
-
-            didErrorOccur = true;
-            break;
-    }
-    if (didErrorOccur) {
-       std::cerr<< "KeywordDetect::AnalyzeAudio()" << "ERROR" <<std::endl;
+    for (auto& model : m_models) {
+        if (model->thread && model->thread->joinable()) {
+            model->thread->join();
+        }
     }
 }
-bool KeywordDetect::setUpRuntimeSettings(SnsrSession* session) {
-    if (!session) {
-        std::cerr << "KeywordDetect::setUpRuntimeSettings() session is null" << std::endl;
-        return false;
-    }
-
-    // Setting the callback handler
-    SnsrRC result = snsrSetHandler(
-        *session, SNSR_RESULT_EVENT, snsrCallback(keyWordDetectedCallback, nullptr, reinterpret_cast<void*>(this)));
-
-    if (result != SNSR_RC_OK) {
-        std::cerr << "KeywordDetect::setUpRuntimeSettings()" << getSensoryDetails(*session, result);
-        return false;
-    }
 
-    /*
-     * Turns off automatic pipeline flushing that happens when the end of the input stream is reached. This is an
-     * internal setting recommended by Sensory when audio is presented to Sensory in small chunks.
-     */
-    result = snsrSetInt(*session, SNSR_AUTO_FLUSH, 0);
-    if (result != SNSR_RC_OK) {
-        std::cerr << "KeywordDetect::setUpRuntimeSettings()" << getSensoryDetails(*session, result);
-        return false;
-    }
-
-    return true;
+bool KeywordDetect::FeedHop(Model* model, uint64_t hop) {
+    int slot = hop % kRingHops;
+    model->spotter->Feed(&m_ring[slot * m_hopFrames], m_ringFrames[slot]);
+    // Like a seqlock reader: the capture thread starts overwriting the slot
+    // once it has written hop + kRingHops - 1, so if that happened during
+    // Feed() the model may have seen torn audio.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return m_hopsWritten.load(std::memory_order_relaxed) - hop < kRingHops;
 }
 
-SnsrRC KeywordDetect::keyWordDetectedCallback(SnsrSession s, const char* key, void* userData) {
-    SnsrRC result;
-    const char* keyword;
-    double begin;
-    double end;
-    result = snsrGetDouble(s, SNSR_RES_BEGIN_SAMPLE, &begin);
-    if (result != SNSR_RC_OK) {
-        std::cerr << "KeywordDetect::keyWordDetectedCallback()" << getSensoryDetails(s, result);
-        return result;
-    }
-
-    result = snsrGetDouble(s, SNSR_RES_END_SAMPLE, &end);
-    if (result != SNSR_RC_OK) {
-        std::cerr << "KeywordDetect::keyWordDetectedCallback()" << getSensoryDetails(s, result);
-        return result;
-    }
-
-    result = snsrGetString(s, SNSR_RES_TEXT, &keyword);
-    if (result != SNSR_RC_OK) {
-        std::cerr << "KeywordDetect::keyWordDetectedCallback()" << getSensoryDetails(s, result);
-        return result;
-    }
-    std:cout << "KeywordDetect::keyWordDetectedCallback()" << " keyword: " << keyword << std::endl; 
-
-    if (strcmp(keyword, "alexa") == 0 || strcmp(keyword, "ok-google") == 0)
-    {
-        KeywordDetect *p = (KeywordDetect*)userData;
-        p->m_isRunning = false;
-    }
-
-    return SNSR_RC_OK;
+void KeywordDetect::RunModel(Model* model) {
+    ApplyThreadConfig(ThreadRole::KEYWORD, "kwd-model");
+    LOG(DEBUG) << "KeywordDetect::RunModel " << model->name;
+    uint64_t next = 0;
+    // First hop not fed yet, so that the lookback never feeds a hop twice.
+    uint64_t unfed = 0;
+    uint64_t discontinuities = 0;
+    while (true) {
+        uint64_t written;
+        {
+            std::unique_lock<std::mutex> lock(m_ringMutex);
+            m_ringReady.wait(lock, [this, next]() {
+                return !m_isRunning || m_hopsWritten.load(std::memory_order_acquire) > next;
+            });
+            if (!m_isRunning) {
+                break;
+            }
+            written = m_hopsWritten.load(std::memory_order_acquire);
+        }
+        uint64_t seen = m_discontinuities.load(std::memory_order_acquire);
+        if (seen != discontinuities) {
+            discontinuities = seen;
+            model->spotter->Reset();
+        }
+        for (; next < written && m_isRunning; next++) {
+            // The capture thread is about to reuse the slot, skip ahead.
+            bool behind = m_hopsWritten.load(std::memory_order_acquire) - next >= kRingHops - 1;
+            int feed = behind ? 0 : m_ringFeed[next % kRingHops];
+            if (!behind && feed > 0) {
+                // Replay the gate's lookback, as far as the ring still holds it.
+                uint64_t oldest = m_hopsWritten.load(std::memory_order_acquire) + 2;
+                oldest = oldest > kRingHops ? oldest - kRingHops : 0;
+                uint64_t first = next + 1 >= static_cast<uint64_t>(feed) ? next + 1 - feed : 0;
+                first = std::max(first, std::max(oldest, unfed));
+                for (uint64_t hop = first; hop <= next && !behind; hop++) {
+                    behind = !FeedHop(model, hop);
+                }
+                unfed = next + 1;
+            }
+            if (behind) {
+                LOG(WARNING) << "KeywordDetect model " << model->name << " fell behind";
+                kModelOverruns->Increment();
+                next = written;
+                unfed = written;
+                model->spotter->Reset();
+                break;
+            }
+        }
+    }
+    LOG(DEBUG) << "KeywordDetect::RunModel Exit " << model->name;
 }
 
 void KeywordDetect::Loop() {
-    printf("KeywordDetect::Loop\n");
+    LOG(DEBUG) << "KeywordDetect::Loop";
+    for (auto& model : m_models) {
+        Model* m = model.get();
+        model->thread.reset(new std::thread([this, m]() { RunModel(m); }));
+    }
     loopThread = std::unique_ptr<std::thread>(new std::thread([this]() {
 
-    printf("KeywordDetect::Thread\n");
-    SnsrRC result;
+    ApplyThreadConfig(ThreadRole::CAPTURE, "kwd-capture");
+    LOG(DEBUG) << "KeywordDetect::Thread";
 
-    InitPCM();
+    // The capture device is released while a dialog is running, so it is
+    // opened again on every wake cycle.
+    while (!InitPCM()) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
 
     while (m_isRunning) {
-      std::shared_ptr<std::vector<unsigned char>> audio_data(
-            new std::vector<unsigned char>(kFramesPerPacket * kBytesPerFrame));
-
-      int pcm_read_ret = snd_pcm_readi(pcm_handle, &(*audio_data.get())[0], kFramesPerPacket);
-      if (pcm_read_ret == -EAGAIN) {
-          std::this_thread::sleep_for(std::chrono::milliseconds(20));
-      } else if (pcm_read_ret == -EBADFD) {
-          std::cerr << "KeywordDetect::Loop -EBADFD" <<std::endl;
-      } else if (pcm_read_ret == -EPIPE) {
-          std::cerr << "KeywordDetect::Loop -EPIPE" <<std::endl;
-          SnsrSession newSession{nullptr};
-            /*
-             * This duplicated SnsrSession will have all the same configurations as m_session but none of the runtime
-             * settings. Thus, we will need to setup some of the runtime settings again. The reason for creating a new
-             * session is so that on overrun conditions, Sensory can start counting from 0 again.
-             */
-          result = snsrDup(m_session, &newSession);
-          if (result != SNSR_RC_OK) {
-              break;
+      uint64_t hop = m_hopsWritten.load(std::memory_order_relaxed);
+      int slot = hop % kRingHops;
+      // Capture straight into the ring, the models read it in place.
+      int pcm_read_ret = m_capture.Read(&m_ring[slot * m_hopFrames], m_hopFrames);
+      if (pcm_read_ret < 0) {
+          // Recovery gave up. Keep trying rather than leave the microphone dead.
+          LOG(ERROR) << "KeywordDetect::Loop capture failed " << pcm_read_ret;
+          while (m_isRunning && !InitPCM()) {
+              std::this_thread::sleep_for(std::chrono::seconds(1));
           }
-
-          if (!setUpRuntimeSettings(&newSession)) {
-              break;
-          }
-
-          m_session = newSession;
-      } else if (pcm_read_ret == -ESTRPIPE) {
-          std::cerr << "KeywordDetect::Loop -ESTRPIPE" <<std::endl;
+          m_discontinuities.fetch_add(1, std::memory_order_release);
       } else if (pcm_read_ret > 0) {
-          //std::cout << "KeywordDetect::Loop read audio data " << pcm_read_ret << "bytes" << std::endl;
-          audio_data->resize(kBytesPerFrame * pcm_read_ret);
-          AnalyzeAudio(audio_data);
-          snsrClearRC(m_session);
-/*
-          for (auto& listener : data_listeners_) {
-              listener(audio_data);
+          if (m_capture.Discontinuity()) {
+              m_discontinuities.fetch_add(1, std::memory_order_release);
+          }
+          m_ringFrames[slot] = pcm_read_ret;
+          // The gate runs once here for all models.
+          int feed = 1;
+          if (m_gateEnabled) {
+              feed = std::min(m_gate.Process(&m_ring[slot * m_hopFrames], pcm_read_ret), kRingHops / 2);
+          }
+          m_ringFeed[slot] = feed;
+          uint64_t captured_ms = pcm_read_ret * 1000 / kSampleRate;
+          kCapturedMs->Increment(captured_ms);
+          if (feed == 0) {
+              kGatedMs->Increment(captured_ms);
           }
-*/
+          {
+              std::unique_lock<std::mutex> lock(m_ringMutex);
+              m_hopsWritten.store(hop + 1, std::memory_order_release);
+          }
+          m_ringReady.notify_all();
       }
     }
 
     // Finalize.
-    snd_pcm_close(pcm_handle);
-    std::cout << "KeywordDetect::Loop Exit" << std::endl;
+    m_capture.Close();
+    {
+        std::unique_lock<std::mutex> lock(m_ringMutex);
+    }
+    m_ringReady.notify_all();
+    LOG(DEBUG) << "KeywordDetect::Loop Exit";
 
-  }));     
+  }));
 }
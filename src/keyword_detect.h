@@ -2,31 +2,95 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <iostream>
 #include <atomic>
-#include "snsr.h"
+#include <condition_variable>
 #include <alsa/asoundlib.h>
 
+#include "activity_gate.h"
+#include "alsa_capture.h"
+#include "dsp_pipeline.h"
+#include "keyword_registry.h"
+#include "keyword_spotter.h"
+
+// Captures audio from ALSA in hops of 10-30 ms and runs every added model
+// over it until a keyword wakes the assistant. Each model runs on its own
+// worker thread and reads the hops from one shared capture ring, so another
+// model costs only its own CPU: no extra capture device and no extra copy.
+// An ActivityGate in front of the models keeps them idle in a silent room.
+// Models are initialized once; every Start() only re-arms them.
 class KeywordDetect {
 
 public:
-   void InitSNSR();
+   // |name| identifies the model in KeywordEvent::model and in the registry.
+   // Must be called before Init().
+   void AddModel(const std::string& name, std::unique_ptr<KeywordSpotter> spotter);
+   bool Init();
    bool InitPCM();
-   void Start();
+   bool Start();
    void Stop();
    void Loop();
-   void AnalyzeAudio(std::shared_ptr<std::vector<unsigned char>> data);
-   bool setUpRuntimeSettings(SnsrSession* session);
-   static SnsrRC keyWordDetectedCallback(SnsrSession s, const char* key, void* userData);
+   // Must be called before Start().
+   void SetHopMs(int hop_ms);
+   // Microphones to capture and beamform into one stream, 1 by default.
+   // Must be called before Start().
+   void SetChannels(int channels) { m_capture.SetChannels(channels); }
+   // Conditions the captured audio before the models see it. Must be called
+   // before Start().
+   void SetPipeline(std::unique_ptr<DspPipeline> pipeline) {
+      m_capture.SetPipeline(std::move(pipeline));
+   }
+   // Enabled by default. Must be called before Start().
+   void SetGate(bool enabled, const ActivityGate::Options& options = ActivityGate::Options());
+   // Actions for the detected keywords. Must be filled before Start().
+   KeywordRegistry* Handlers() { return &m_handlers; }
+   // The event that ended the last Loop(), valid after Stop().
+   const KeywordEvent& WakeEvent() const { return m_wakeEvent; }
 private:
+   struct Model {
+      std::string name;
+      std::unique_ptr<KeywordSpotter> spotter;
+      std::unique_ptr<std::thread> thread;
+   };
+
+   void OnKeyword(const std::string& model, const KeywordEvent& event);
+   void RunModel(Model* model);
+   // Feeds ring hop |hop| to |model|. Returns false if the capture thread
+   // reused its slot meanwhile, in which case the model must be re-armed.
+   bool FeedHop(Model* model, uint64_t hop);
+
    std::unique_ptr<std::thread> loopThread;
-   std::vector<int16_t> audio_data;
-   SnsrSession m_session;
+   std::vector<std::unique_ptr<Model>> m_models;
+   KeywordRegistry m_handlers;
+   // Serializes the handlers, so that only the first wake word wins.
+   std::mutex m_wakeMutex;
+   KeywordEvent m_wakeEvent;
    std::atomic<bool> m_isRunning;
-   snd_pcm_t *pcm_handle;
-// For 16000Hz, it's about 0.1 second.
-  static constexpr int kFramesPerPacket = 8000;
-  // 1 channel, S16LE, so 2 bytes each frame.
-  static constexpr int kBytesPerFrame = 2;
+   AlsaCapture m_capture{"keyword"};
+
+   static constexpr int kSampleRate = 16000;
+   static constexpr int kMinHopMs = 10;
+   static constexpr int kMaxHopMs = 30;
+   // 20 ms by default.
+   int m_hopFrames = kSampleRate / 50;
+   // About 0.5 second of capture buffer.
+   static constexpr int kBufferFrames = 8000;
+
+   // Hops shared by the models. The capture thread writes slot
+   // |m_hopsWritten| % kRingHops; a model that falls more than kRingHops - 1
+   // hops behind skips ahead and is re-armed.
+   static constexpr int kRingHops = 64;
+   std::vector<int16_t> m_ring;
+   int m_ringFrames[kRingHops];
+   // ActivityGate::Process() result for each slot; at most kRingHops / 2.
+   int m_ringFeed[kRingHops];
+   bool m_gateEnabled = true;
+   ActivityGate m_gate;
+   std::atomic<uint64_t> m_hopsWritten{0};
+   // Bumped after a capture overrun; models re-arm when they see it change.
+   std::atomic<uint64_t> m_discontinuities{0};
+   std::mutex m_ringMutex;
+   std::condition_variable m_ringReady;
 };
@@ -0,0 +1,46 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "keyword_registry.h"
+
+void KeywordRegistry::Register(const std::string& keyword, Handler handler) {
+  handlers_[Key("", keyword)] = handler;
+}
+
+void KeywordRegistry::Register(const std::string& model,
+                               const std::string& keyword, Handler handler) {
+  handlers_[Key(model, keyword)] = handler;
+}
+
+void KeywordRegistry::RegisterModel(const std::string& model,
+                                    Handler handler) {
+  model_handlers_[model] = handler;
+}
+
+bool KeywordRegistry::Dispatch(const KeywordEvent& event) const {
+  auto it = handlers_.find(Key(event.model, event.keyword));
+  if (it != handlers_.end()) {
+    return it->second(event);
+  }
+  it = model_handlers_.find(event.model);
+  if (it == model_handlers_.end()) {
+    it = handlers_.find(Key("", event.keyword));
+    if (it == handlers_.end()) {
+      return false;
+    }
+  }
+  return it->second(event);
+}
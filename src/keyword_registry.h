@@ -0,0 +1,54 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef KEYWORD_REGISTRY_H
+#define KEYWORD_REGISTRY_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "keyword_spotter.h"
+
+// Maps keywords to the actions they trigger. A handler can be registered
+// for a keyword from any model, for every keyword of one model, or for a
+// keyword from one model only; the most specific one is run. Handlers are
+// registered before detection starts;
+// Dispatch() only reads the registry and can be called from any thread.
+class KeywordRegistry {
+ public:
+  // Returns true if the keyword wakes the assistant, which ends detection.
+  typedef std::function<bool(const KeywordEvent&)> Handler;
+
+  void Register(const std::string& keyword, Handler handler);
+  void Register(const std::string& model, const std::string& keyword,
+                Handler handler);
+  // For the keywords of |model| that have no handler of their own.
+  void RegisterModel(const std::string& model, Handler handler);
+
+  // Runs the handler for |event|. Keywords without a handler are ignored.
+  bool Dispatch(const KeywordEvent& event) const;
+
+ private:
+  static std::string Key(const std::string& model, const std::string& keyword) {
+    return model + '\n' + keyword;
+  }
+
+  std::unordered_map<std::string, Handler> handlers_;
+  std::unordered_map<std::string, Handler> model_handlers_;
+};
+
+#endif
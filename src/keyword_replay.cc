@@ -0,0 +1,140 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Replays mono, s16_le, 16000Hz RAW or WAV files through a KeywordSpotter in hops
+// and reports every detection with its decision latency (how long after the
+// end of the keyword the spotter fired), plus the CPU time spent per second
+// of audio.
+
+#include <getopt.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "audio_file.h"
+#include "keyword_spotter.h"
+
+static const int kSampleRate = 16000;
+
+void PrintUsage() {
+  std::cerr << "Usage: ./keyword_replay [--backend <sensory|energy>] "
+            << "[--model <model_file>] [--hop_ms <ms>] <audio_file>..."
+            << std::endl;
+}
+
+double ThreadCpuSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  std::string backend = kDefaultKeywordBackend, model;
+  int hop_ms = 20;
+
+  const struct option long_options[] = {
+    {"backend", required_argument, nullptr, 'b'},
+    {"model",   required_argument, nullptr, 'm'},
+    {"hop_ms",  required_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char =
+        getopt_long(argc, argv, "b:m:h:", long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 'b':
+        backend = optarg;
+        break;
+      case 'm':
+        model = optarg;
+        break;
+      case 'h':
+        hop_ms = atoi(optarg);
+        break;
+      default:
+        PrintUsage();
+        return 1;
+    }
+  }
+  if (optind == argc || hop_ms <= 0) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::unique_ptr<KeywordSpotter> spotter = CreateKeywordSpotter(backend, model);
+  if (!spotter) {
+    std::cerr << "Unknown keyword backend " << backend << std::endl;
+    return 1;
+  }
+  std::vector<double> latencies_ms;
+  std::string current_file;
+  spotter->SetListener(
+      [&latencies_ms, &current_file](const KeywordEvent& event) {
+        double latency_ms =
+            (event.fired_sample - event.end_sample) * 1000.0 / kSampleRate;
+        latencies_ms.push_back(latency_ms);
+        std::cout << current_file << ": " << event.keyword
+                  << " begin " << event.begin_sample / double(kSampleRate)
+                  << "s end " << event.end_sample / double(kSampleRate)
+                  << "s confidence " << event.confidence
+                  << " fired after " << latency_ms << "ms" << std::endl;
+      });
+  if (!spotter->Init()) {
+    return 1;
+  }
+
+  size_t hop_samples = kSampleRate * hop_ms / 1000;
+  double audio_seconds = 0;
+  double cpu_seconds = 0;
+  for (int i = optind; i < argc; i++) {
+    current_file = argv[i];
+    std::vector<int16_t> audio;
+    std::string error;
+    if (!ReadAudioFile(current_file, &audio, &error)) {
+      std::cerr << current_file << ": " << error << std::endl;
+      return 1;
+    }
+
+    spotter->Reset();
+    double cpu_start = ThreadCpuSeconds();
+    for (size_t offset = 0; offset < audio.size(); offset += hop_samples) {
+      spotter->Feed(&audio[offset], std::min(hop_samples, audio.size() - offset));
+    }
+    cpu_seconds += ThreadCpuSeconds() - cpu_start;
+    audio_seconds += audio.size() / double(kSampleRate);
+  }
+
+  std::cout << backend << ": " << audio_seconds << "s of audio, "
+            << cpu_seconds / audio_seconds * 1000
+            << "ms CPU per second of audio" << std::endl;
+  if (!latencies_ms.empty()) {
+    double sum = 0;
+    for (double latency : latencies_ms) {
+      sum += latency;
+    }
+    std::cout << latencies_ms.size() << " detections, decision latency mean "
+              << sum / latencies_ms.size() << "ms max "
+              << *std::max_element(latencies_ms.begin(), latencies_ms.end())
+              << "ms (+ up to " << hop_ms << "ms hop fill)" << std::endl;
+  }
+  return 0;
+}
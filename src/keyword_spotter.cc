@@ -0,0 +1,42 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "keyword_spotter.h"
+
+#include "keyword_spotter_energy.h"
+#ifdef ENABLE_SENSORY
+#include "keyword_spotter_sensory.h"
+#endif
+
+#ifdef ENABLE_SENSORY
+const char kDefaultKeywordBackend[] = "sensory";
+#else
+const char kDefaultKeywordBackend[] = "energy";
+#endif
+
+std::unique_ptr<KeywordSpotter> CreateKeywordSpotter(const std::string& backend,
+                                                     const std::string& model) {
+  if (backend == "energy") {
+    return std::unique_ptr<KeywordSpotter>(new EnergyKeywordSpotter());
+  }
+#ifdef ENABLE_SENSORY
+  if (backend == "sensory") {
+    return std::unique_ptr<KeywordSpotter>(new SensoryKeywordSpotter(
+        model.empty() ? SensoryKeywordSpotter::kDefaultModel : model));
+  }
+#endif
+  return nullptr;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef KEYWORD_SPOTTER_H
+#define KEYWORD_SPOTTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// A keyword reported by a KeywordSpotter. Sample offsets count from the last
+// Reset().
+struct KeywordEvent {
+  std::string keyword;
+  // Name of the model that fired, set by KeywordDetect.
+  std::string model;
+  uint64_t begin_sample = 0;
+  uint64_t end_sample = 0;
+  // Samples fed when the spotter fired, so |fired_sample| - |end_sample| is
+  // the decision latency.
+  uint64_t fired_sample = 0;
+  // In [0, 1].
+  double confidence = 0;
+};
+
+// Keyword spotting engine. Input is mono, s16_le, 16000Hz. Feed() and Reset()
+// must be called from one thread; the listener is called on that thread.
+class KeywordSpotter {
+ public:
+  typedef std::function<void(const KeywordEvent&)> Listener;
+
+  virtual ~KeywordSpotter() {}
+
+  // Loads the model. Called once.
+  virtual bool Init() = 0;
+  // Drops all state, so that the next sample is sample 0. Must be cheap, it
+  // is called on every wake cycle and after overruns.
+  virtual bool Reset() = 0;
+  virtual bool Feed(const int16_t* samples, size_t count) = 0;
+
+  void SetListener(Listener listener) { listener_ = listener; }
+
+ protected:
+  void OnKeyword(const KeywordEvent& event) {
+    if (listener_) {
+      listener_(event);
+    }
+  }
+
+ private:
+  Listener listener_;
+};
+
+// "sensory" when it is compiled in, "energy" otherwise.
+extern const char kDefaultKeywordBackend[];
+
+// Returns a spotter for |backend| ("sensory" or "energy"), or nullptr if the
+// backend is unknown or not compiled in. |model| is the model file for
+// backends that have one.
+std::unique_ptr<KeywordSpotter> CreateKeywordSpotter(const std::string& backend,
+                                                     const std::string& model);
+
+#endif
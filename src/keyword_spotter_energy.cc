@@ -0,0 +1,108 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "keyword_spotter_energy.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "activity_gate.h"
+
+static const int kSampleRate = 16000;
+
+EnergyKeywordSpotter::EnergyKeywordSpotter(const Options& options)
+    : options_(options) {
+  Reset();
+}
+
+bool EnergyKeywordSpotter::Reset() {
+  frame_fill_ = 0;
+  sample_ = 0;
+  in_burst_ = false;
+  saturated_ = false;
+  quiet_frames_ = 0;
+  return true;
+}
+
+bool EnergyKeywordSpotter::Feed(const int16_t* samples, size_t count) {
+  while (count > 0) {
+    size_t n = std::min(count, static_cast<size_t>(kFrameSamples - frame_fill_));
+    memcpy(frame_ + frame_fill_, samples, n * sizeof(int16_t));
+    frame_fill_ += n;
+    samples += n;
+    count -= n;
+    if (frame_fill_ == kFrameSamples) {
+      ProcessFrame(frame_);
+      frame_fill_ = 0;
+    }
+  }
+  return true;
+}
+
+void EnergyKeywordSpotter::ProcessFrame(const int16_t* frame) {
+  double energy_db = LevelDb(frame, kFrameSamples);
+  bool active = energy_db >= options_.threshold_db;
+  uint64_t frame_start = sample_;
+  sample_ += kFrameSamples;
+
+  if (saturated_) {
+    saturated_ = active;
+    return;
+  }
+  if (!in_burst_) {
+    if (active) {
+      in_burst_ = true;
+      onset_ = frame_start;
+      last_active_end_ = sample_;
+      peak_db_ = energy_db;
+      quiet_frames_ = 0;
+    }
+    return;
+  }
+
+  if (active) {
+    last_active_end_ = sample_;
+    peak_db_ = std::max(peak_db_, energy_db);
+    quiet_frames_ = 0;
+  } else {
+    quiet_frames_++;
+  }
+
+  uint64_t max_samples = static_cast<uint64_t>(options_.max_ms) * kSampleRate / 1000;
+  if (last_active_end_ - onset_ > max_samples) {
+    // Too long for a keyword: continuous noise or speech.
+    in_burst_ = false;
+    saturated_ = active;
+    return;
+  }
+  if (quiet_frames_ * kFrameSamples * 1000 < options_.hangover_ms * kSampleRate) {
+    return;
+  }
+
+  in_burst_ = false;
+  uint64_t min_samples = static_cast<uint64_t>(options_.min_ms) * kSampleRate / 1000;
+  if (last_active_end_ - onset_ < min_samples) {
+    return;
+  }
+  KeywordEvent event;
+  event.keyword = options_.keyword;
+  event.begin_sample = onset_;
+  event.end_sample = last_active_end_;
+  event.fired_sample = sample_;
+  event.confidence =
+      std::min(1.0, std::max(0.0, (peak_db_ - options_.threshold_db) / 20));
+  OnKeyword(event);
+}
@@ -0,0 +1,65 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef KEYWORD_SPOTTER_ENERGY_H
+#define KEYWORD_SPOTTER_ENERGY_H
+
+#include "keyword_spotter.h"
+
+// Reference spotter with no model: reports an utterance-sized burst of
+// energy as a keyword. It is deterministic and needs no vendor library, so
+// the wake path can be built, tested and benchmarked anywhere.
+class EnergyKeywordSpotter : public KeywordSpotter {
+ public:
+  struct Options {
+    std::string keyword = "energy";
+    // Frames at or above this level (dBFS) are active.
+    double threshold_db = -35;
+    // Bursts outside [min_ms, max_ms] are ignored.
+    int min_ms = 200;
+    int max_ms = 2000;
+    // Inactive time that ends a burst.
+    int hangover_ms = 100;
+  };
+
+  EnergyKeywordSpotter() : EnergyKeywordSpotter(Options()) {}
+  explicit EnergyKeywordSpotter(const Options& options);
+
+  bool Init() override { return Reset(); }
+  bool Reset() override;
+  bool Feed(const int16_t* samples, size_t count) override;
+
+ private:
+  // 10 ms at 16000Hz.
+  static constexpr int kFrameSamples = 160;
+
+  void ProcessFrame(const int16_t* frame);
+
+  const Options options_;
+  int16_t frame_[kFrameSamples];
+  int frame_fill_ = 0;
+  uint64_t sample_ = 0;
+  bool in_burst_ = false;
+  // Set when a burst ran longer than |max_ms|; cleared by the next quiet
+  // frame.
+  bool saturated_ = false;
+  uint64_t onset_ = 0;
+  uint64_t last_active_end_ = 0;
+  int quiet_frames_ = 0;
+  double peak_db_ = 0;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "keyword_spotter_energy.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Appends |ms| of a 440Hz tone with |amplitude| (0 for silence).
+void append(std::vector<int16_t>* audio, int ms, int amplitude) {
+  size_t start = audio->size();
+  for (int i = 0; i < ms * 16; i++) {
+    audio->push_back(static_cast<int16_t>(
+        amplitude * std::sin(2 * M_PI * 440 * (start + i) / 16000.0)));
+  }
+}
+
+int main() {
+  EnergyKeywordSpotter spotter;
+  std::vector<KeywordEvent> events;
+  spotter.SetListener([&events](const KeywordEvent& event) {
+    events.push_back(event);
+  });
+  spotter.Init();
+
+  // A short click, then a keyword-sized burst, fed in odd-sized hops.
+  std::vector<int16_t> audio;
+  append(&audio, 300, 0);
+  append(&audio, 50, 8000);
+  append(&audio, 300, 0);
+  append(&audio, 500, 8000);
+  append(&audio, 500, 0);
+  for (size_t offset = 0; offset < audio.size(); offset += 333) {
+    spotter.Feed(&audio[offset], std::min<size_t>(333, audio.size() - offset));
+  }
+
+  if (events.size() != 1) {
+    std::cerr << "Test failed, expected 1 detection, got " << events.size()
+              << std::endl;
+    return 1;
+  }
+  const KeywordEvent& event = events[0];
+  if (event.keyword != "energy" || event.begin_sample != 650 * 16
+      || event.end_sample != 1150 * 16 || event.fired_sample != 1250 * 16
+      || event.confidence <= 0) {
+    std::cerr << "Test failed for detection " << event.begin_sample << "-"
+              << event.end_sample << " fired at " << event.fired_sample
+              << std::endl;
+    return 1;
+  }
+
+  // Sample offsets restart after Reset(), and continuous noise never fires.
+  events.clear();
+  spotter.Reset();
+  audio.clear();
+  append(&audio, 500, 8000);
+  append(&audio, 200, 0);
+  spotter.Feed(&audio[0], audio.size());
+  if (events.size() != 1 || events[0].begin_sample != 0) {
+    std::cerr << "Test failed after Reset" << std::endl;
+    return 1;
+  }
+  events.clear();
+  audio.clear();
+  append(&audio, 5000, 8000);
+  append(&audio, 200, 0);
+  spotter.Feed(&audio[0], audio.size());
+  if (!events.empty()) {
+    std::cerr << "Test failed for continuous noise" << std::endl;
+    return 1;
+  }
+
+  std::cerr << "Test passed" << std::endl;
+}
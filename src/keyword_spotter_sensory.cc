@@ -0,0 +1,214 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "keyword_spotter_sensory.h"
+
+#include "log.h"
+
+const char SensoryKeywordSpotter::kDefaultModel[] = "/etc/sensory/wakeup-word.snsr";
+
+static std::string getSensoryDetails(SnsrSession session, SnsrRC result) {
+    std::string message;
+    // It is recommended by Sensory to prefer snsrErrorDetail() over snsrRCMessage() as it provides more details.
+    if (session) {
+        message = snsrErrorDetail(session);
+    } else {
+        message = snsrRCMessage(result);
+    }
+    if (message.empty()) {
+        message = "Unrecognized error";
+    }
+    return message;
+}
+
+SensoryKeywordSpotter::~SensoryKeywordSpotter() {
+    if (m_session) {
+        snsrRelease(m_session);
+    }
+    if (m_stream) {
+        snsrRelease(m_stream);
+    }
+    if (m_template) {
+        snsrRelease(m_template);
+    }
+}
+
+bool SensoryKeywordSpotter::Init() {
+    if (m_template) {
+        return true;
+    }
+
+    SnsrRC result = snsrNew(&m_template);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "snsrNew error " << getSensoryDetails(m_template, result);
+        return false;
+    }
+
+    result = snsrLoad(m_template, snsrStreamFromFileName(m_modelFile.c_str(), "r"));
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "snsrLoad error " << getSensoryDetails(m_template, result);
+        snsrRelease(m_template);
+        m_template = nullptr;
+        return false;
+    }
+
+    result = snsrRequire(m_template, SNSR_TASK_TYPE, SNSR_PHRASESPOT);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "snsrRequire error " << getSensoryDetails(m_template, result);
+        snsrRelease(m_template);
+        m_template = nullptr;
+        return false;
+    }
+    LOG(DEBUG) << "SensoryKeywordSpotter::Init " << m_modelFile;
+    return Reset();
+}
+
+bool SensoryKeywordSpotter::Reset() {
+    if (!m_template) {
+        return false;
+    }
+
+    SnsrSession newSession{nullptr};
+    /*
+     * The duplicated SnsrSession has the loaded model of m_template but none of the runtime settings, so they
+     * are set up again. Starting from a fresh duplicate also makes Sensory count samples from 0 again.
+     */
+    SnsrRC result = snsrDup(m_template, &newSession);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "snsrDup error " << getSensoryDetails(m_template, result);
+        return false;
+    }
+
+    if (!setUpRuntimeSettings(&newSession)) {
+        snsrRelease(newSession);
+        return false;
+    }
+
+    /*
+     * Audio is fed through one continuous FIFO stream per session instead of a new memory stream per packet, so
+     * the model sees an unbroken signal and can fire as soon as a hop completes the keyword.
+     */
+    SnsrStream newStream = snsrStreamFromBuffer(kStreamBufferBytes, kStreamBufferBytes);
+    snsrRetain(newStream);
+    result = snsrSetStream(newSession, SNSR_SOURCE_AUDIO_PCM, newStream);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "snsrSetStream error " << getSensoryDetails(newSession, result);
+        snsrRelease(newStream);
+        snsrRelease(newSession);
+        return false;
+    }
+
+    if (m_session) {
+        snsrRelease(m_session);
+    }
+    if (m_stream) {
+        snsrRelease(m_stream);
+    }
+    m_session = newSession;
+    m_stream = newStream;
+    m_samplesFed = 0;
+    return true;
+}
+
+bool SensoryKeywordSpotter::Feed(const int16_t* samples, size_t count) {
+    snsrStreamWrite(m_stream, samples, sizeof(int16_t), count);
+    m_samplesFed += count;
+    SnsrRC result = snsrRun(m_session);
+    bool didErrorOccur = false;
+    switch (result) {
+        case SNSR_RC_STREAM_END:
+            // Reached end of buffer without any keyword detections
+            break;
+        case SNSR_RC_OK:
+            break;
+        default:
+            // A different return from the callback function that indicates some sort of error
+            LOG(ERROR) << "SensoryKeywordSpotter::Feed() " << getSensoryDetails(m_session, result);
+            didErrorOccur = true;
+            break;
+    }
+    snsrClearRC(m_session);
+    return !didErrorOccur;
+}
+
+bool SensoryKeywordSpotter::setUpRuntimeSettings(SnsrSession* session) {
+    if (!session) {
+        LOG(ERROR) << "SensoryKeywordSpotter::setUpRuntimeSettings() session is null";
+        return false;
+    }
+
+    // Setting the callback handler
+    SnsrRC result = snsrSetHandler(
+        *session, SNSR_RESULT_EVENT, snsrCallback(keyWordDetectedCallback, nullptr, reinterpret_cast<void*>(this)));
+
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "SensoryKeywordSpotter::setUpRuntimeSettings() " << getSensoryDetails(*session, result);
+        return false;
+    }
+
+    /*
+     * Turns off automatic pipeline flushing that happens when the end of the input stream is reached. This is an
+     * internal setting recommended by Sensory when audio is presented to Sensory in small chunks.
+     */
+    result = snsrSetInt(*session, SNSR_AUTO_FLUSH, 0);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "SensoryKeywordSpotter::setUpRuntimeSettings() " << getSensoryDetails(*session, result);
+        return false;
+    }
+
+    return true;
+}
+
+SnsrRC SensoryKeywordSpotter::keyWordDetectedCallback(SnsrSession s, const char* key, void* userData) {
+    SnsrRC result;
+    const char* keyword;
+    double begin;
+    double end;
+    double score;
+    result = snsrGetDouble(s, SNSR_RES_BEGIN_SAMPLE, &begin);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "SensoryKeywordSpotter::keyWordDetectedCallback() " << getSensoryDetails(s, result);
+        return result;
+    }
+
+    result = snsrGetDouble(s, SNSR_RES_END_SAMPLE, &end);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "SensoryKeywordSpotter::keyWordDetectedCallback() " << getSensoryDetails(s, result);
+        return result;
+    }
+
+    result = snsrGetString(s, SNSR_RES_TEXT, &keyword);
+    if (result != SNSR_RC_OK) {
+        LOG(ERROR) << "SensoryKeywordSpotter::keyWordDetectedCallback() " << getSensoryDetails(s, result);
+        return result;
+    }
+
+    // Not every model reports a score.
+    if (snsrGetDouble(s, SNSR_RES_SCORE, &score) != SNSR_RC_OK) {
+        score = 1;
+    }
+
+    SensoryKeywordSpotter *spotter = (SensoryKeywordSpotter*)userData;
+    KeywordEvent event;
+    event.keyword = keyword;
+    event.begin_sample = static_cast<uint64_t>(begin);
+    event.end_sample = static_cast<uint64_t>(end);
+    event.fired_sample = spotter->m_samplesFed;
+    event.confidence = score;
+    spotter->OnKeyword(event);
+
+    return SNSR_RC_OK;
+}
@@ -0,0 +1,51 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef KEYWORD_SPOTTER_SENSORY_H
+#define KEYWORD_SPOTTER_SENSORY_H
+
+#include "keyword_spotter.h"
+#include "snsr.h"
+
+// Sensory TrulyHandsfree phrase spotter. The model is loaded once by Init()
+// into a template session; every Reset() re-arms from a duplicate of that
+// template. Audio is fed through one continuous stream per session.
+class SensoryKeywordSpotter : public KeywordSpotter {
+public:
+    static const char kDefaultModel[];
+
+    explicit SensoryKeywordSpotter(const std::string& model_file) : m_modelFile(model_file) {}
+    ~SensoryKeywordSpotter() override;
+
+    bool Init() override;
+    bool Reset() override;
+    bool Feed(const int16_t* samples, size_t count) override;
+
+private:
+    bool setUpRuntimeSettings(SnsrSession* session);
+    static SnsrRC keyWordDetectedCallback(SnsrSession s, const char* key, void* userData);
+
+    const std::string m_modelFile;
+    SnsrSession m_template{nullptr};
+    SnsrSession m_session{nullptr};
+    SnsrStream m_stream{nullptr};
+    uint64_t m_samplesFed = 0;
+
+    // Room for several hops in the Sensory input stream.
+    static constexpr int kStreamBufferBytes = 8192;
+};
+
+#endif
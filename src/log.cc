@@ -0,0 +1,226 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "log.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::atomic<int> Logger::min_level_(LOG_LEVEL_INFO);
+
+namespace {
+
+struct Record {
+  int64_t timestamp_us;
+  int severity;
+  int thread_id;
+  const char* file;
+  int line;
+  int size;
+  char text[LogMessage::kMaxMessageSize];
+};
+
+// Single-producer single-consumer ring. The producer is the owning thread,
+// the consumer is the sink thread.
+class Ring {
+ public:
+  static constexpr uint32_t kSize = 64;
+
+  bool Push(const Record& record) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kSize) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    records_[tail % kSize] = record;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Pop(Record* record) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *record = records_[head % kSize];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint64_t TakeDropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  Record records_[kSize];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+class Sink {
+ public:
+  static Sink& Get() {
+    // Never destroyed, threads may still log during exit.
+    static Sink* sink = new Sink();
+    return *sink;
+  }
+
+  std::shared_ptr<Ring> NewRing() {
+    std::shared_ptr<Ring> ring(new Ring);
+    std::unique_lock<std::mutex> lock(mutex_);
+    rings_.push_back(ring);
+    if (!thread_) {
+      thread_.reset(new std::thread([this]() { Run(); }));
+      thread_->detach();
+      atexit([]() { Logger::Flush(); });
+    }
+    return ring;
+  }
+
+  void SetRateLimit(int lines_per_second) {
+    rate_limit_.store(lines_per_second, std::memory_order_relaxed);
+  }
+
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Drain();
+  }
+
+ private:
+  void Run() {
+    while (true) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      std::unique_lock<std::mutex> lock(mutex_);
+      Drain();
+    }
+  }
+
+  // Writes out all pending records in timestamp order. |mutex_| is held.
+  void Drain() {
+    batch_.clear();
+    uint64_t dropped = 0;
+    Record record;
+    for (size_t i = 0; i < rings_.size();) {
+      while (rings_[i]->Pop(&record)) {
+        batch_.push_back(record);
+      }
+      dropped += rings_[i]->TakeDropped();
+      // The owning thread has exited and everything has been read.
+      if (rings_[i].use_count() == 1) {
+        rings_.erase(rings_.begin() + i);
+      } else {
+        i++;
+      }
+    }
+    std::stable_sort(batch_.begin(), batch_.end(),
+        [](const Record& a, const Record& b) {
+          return a.timestamp_us < b.timestamp_us;
+        });
+
+    // Token bucket, refilled once per second.
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int rate_limit = rate_limit_.load(std::memory_order_relaxed);
+    if (now_us - window_start_us_ >= 1000000) {
+      window_start_us_ = now_us;
+      window_lines_ = 0;
+    }
+
+    for (const Record& r : batch_) {
+      if (rate_limit > 0 && window_lines_ >= rate_limit) {
+        dropped++;
+        continue;
+      }
+      window_lines_++;
+      time_t seconds = r.timestamp_us / 1000000;
+      struct tm tm_time;
+      localtime_r(&seconds, &tm_time);
+      const char* base = strrchr(r.file, '/');
+      fprintf(stderr, "%c%02d%02d %02d:%02d:%02d.%06d %5d %s:%d] %.*s\n",
+              "DIWE"[r.severity], tm_time.tm_mon + 1, tm_time.tm_mday,
+              tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec,
+              static_cast<int>(r.timestamp_us % 1000000), r.thread_id,
+              base ? base + 1 : r.file, r.line, r.size, r.text);
+    }
+    if (dropped > 0) {
+      fprintf(stderr, "W log dropped %llu messages\n",
+              static_cast<unsigned long long>(dropped));
+    }
+    if (!batch_.empty() || dropped > 0) {
+      fflush(stderr);
+    }
+  }
+
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::vector<Record> batch_;
+  std::unique_ptr<std::thread> thread_;
+  std::atomic<int> rate_limit_{200};
+  int64_t window_start_us_ = 0;
+  int window_lines_ = 0;
+};
+
+Ring* ThreadRing() {
+  thread_local std::shared_ptr<Ring> ring = Sink::Get().NewRing();
+  return ring.get();
+}
+
+int ThreadId() {
+  thread_local int tid = syscall(SYS_gettid);
+  return tid;
+}
+
+}  // namespace
+
+void Logger::SetRateLimit(int lines_per_second) {
+  Sink::Get().SetRateLimit(lines_per_second);
+}
+
+void Logger::Flush() {
+  Sink::Get().Flush();
+}
+
+LogMessage::LogMessage(int severity, const char* file, int line)
+    : severity_(severity), file_(file), line_(line),
+      buffer_(text_, sizeof(text_)), stream_(&buffer_) {}
+
+LogMessage::~LogMessage() {
+  Record record;
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  record.timestamp_us = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+  record.severity = severity_;
+  record.thread_id = ThreadId();
+  record.file = file_;
+  record.line = line_;
+  record.size = buffer_.size();
+  memcpy(record.text, text_, record.size);
+  ThreadRing()->Push(record);
+}
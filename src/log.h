@@ -0,0 +1,104 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+
+// Asynchronous logging.
+//
+//   LOG(INFO) << "ubus_call ret " << ret;
+//
+// The calling thread formats the message into a fixed buffer and pushes it
+// into its own lock-free ring. A background thread writes the rings to
+// stderr, flushing once per batch and dropping messages above a rate limit.
+// If a ring is full the message is dropped, so logging never blocks.
+//
+// Levels below LOG_MIN_LEVEL are compiled out; levels below
+// Logger::SetMinLevel() are skipped at runtime.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_IS_ON(severity)                     \
+  (LOG_LEVEL_##severity >= LOG_MIN_LEVEL &&     \
+   LOG_LEVEL_##severity >= Logger::MinLevel())
+
+#define LOG(severity)                                            \
+  !LOG_IS_ON(severity) ? (void)0                                 \
+      : LogMessageVoidify() &                                    \
+        LogMessage(LOG_LEVEL_##severity, __FILE__, __LINE__).stream()
+
+class Logger {
+ public:
+  static int MinLevel() { return min_level_.load(std::memory_order_relaxed); }
+  static void SetMinLevel(int level) {
+    min_level_.store(level, std::memory_order_relaxed);
+  }
+  // Maximum number of lines written per second. Excess lines are dropped
+  // and reported as a count.
+  static void SetRateLimit(int lines_per_second);
+  // Synchronously writes out everything logged so far.
+  static void Flush();
+
+ private:
+  static std::atomic<int> min_level_;
+};
+
+// Formats one message into a fixed-size buffer, without allocating.
+class LogMessage {
+ public:
+  LogMessage(int severity, const char* file, int line);
+  ~LogMessage();
+
+  std::ostream& stream() { return stream_; }
+
+  // Longer messages are truncated.
+  static constexpr int kMaxMessageSize = 200;
+
+ private:
+  class Buffer : public std::streambuf {
+   public:
+    Buffer(char* begin, size_t size) { setp(begin, begin + size); }
+    size_t size() const { return pptr() - pbase(); }
+  };
+
+  int severity_;
+  const char* file_;
+  int line_;
+  char text_[kMaxMessageSize];
+  Buffer buffer_;
+  std::ostream stream_;
+};
+
+// Turns the stream expression in LOG() into void, so that it can be used in
+// the conditional operator.
+class LogMessageVoidify {
+ public:
+  void operator&(std::ostream&) {}
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+Histogram::Histogram(const std::vector<double>& bounds)
+    : bounds_(bounds),
+      buckets_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+  for (size_t i = 0; i <= bounds_.size(); i++) {
+    buckets_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::Observe(double value) {
+  size_t i = 0;
+  while (i < bounds_.size() && value > bounds_[i]) {
+    i++;
+  }
+  buckets_[i].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_micros_.fetch_add(static_cast<int64_t>(std::llround(value * 1e6)),
+                        std::memory_order_relaxed);
+}
+
+double Histogram::Sum() const {
+  return sum_micros_.load(std::memory_order_relaxed) / 1e6;
+}
+
+MetricsRegistry& MetricsRegistry::Global() {
+  static MetricsRegistry* registry = new MetricsRegistry();
+  return *registry;
+}
+
+MetricsRegistry::Entry* MetricsRegistry::FindOrAdd(
+    const std::string& name, const std::string& help,
+    const std::string& labels, Type type) {
+  for (auto& entry : entries_) {
+    if (entry->name == name && entry->labels == labels) {
+      return entry->type == type ? entry.get() : nullptr;
+    }
+  }
+  std::unique_ptr<Entry> entry(new Entry);
+  entry->name = name;
+  entry->help = help;
+  entry->labels = labels;
+  entry->type = type;
+  entries_.push_back(std::move(entry));
+  return entries_.back().get();
+}
+
+Counter* MetricsRegistry::GetCounter(const std::string& name,
+                                     const std::string& help,
+                                     const std::string& labels) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Entry* entry = FindOrAdd(name, help, labels, Type::COUNTER);
+  if (entry == nullptr) {
+    std::cerr << "Metric " << name << " registered with another type" << std::endl;
+    abort();
+  }
+  if (!entry->counter) {
+    entry->counter.reset(new Counter);
+  }
+  return entry->counter.get();
+}
+
+Gauge* MetricsRegistry::GetGauge(const std::string& name,
+                                 const std::string& help,
+                                 const std::string& labels) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Entry* entry = FindOrAdd(name, help, labels, Type::GAUGE);
+  if (entry == nullptr) {
+    std::cerr << "Metric " << name << " registered with another type" << std::endl;
+    abort();
+  }
+  if (!entry->gauge) {
+    entry->gauge.reset(new Gauge);
+  }
+  return entry->gauge.get();
+}
+
+Histogram* MetricsRegistry::GetHistogram(const std::string& name,
+                                         const std::string& help,
+                                         const std::vector<double>& bounds,
+                                         const std::string& labels) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Entry* entry = FindOrAdd(name, help, labels, Type::HISTOGRAM);
+  if (entry == nullptr) {
+    std::cerr << "Metric " << name << " registered with another type" << std::endl;
+    abort();
+  }
+  if (!entry->histogram) {
+    entry->histogram.reset(new Histogram(bounds));
+  }
+  return entry->histogram.get();
+}
+
+static std::string WithLabels(const std::string& name,
+                              const std::string& labels,
+                              const std::string& extra = "") {
+  if (labels.empty() && extra.empty()) {
+    return name;
+  }
+  std::string all = labels;
+  if (!all.empty() && !extra.empty()) {
+    all += ",";
+  }
+  all += extra;
+  return name + "{" + all + "}";
+}
+
+std::string MetricsRegistry::Serialize() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  std::vector<bool> done(entries_.size(), false);
+  // Prometheus wants all samples of one metric family to be contiguous.
+  for (size_t i = 0; i < entries_.size(); i++) {
+    if (done[i]) {
+      continue;
+    }
+    const Entry& family = *entries_[i];
+    const char* type_name = family.type == Type::COUNTER ? "counter"
+        : family.type == Type::GAUGE ? "gauge" : "histogram";
+    out << "# HELP " << family.name << " " << family.help << "\n";
+    out << "# TYPE " << family.name << " " << type_name << "\n";
+    for (size_t j = i; j < entries_.size(); j++) {
+      const Entry& entry = *entries_[j];
+      if (entry.name != family.name) {
+        continue;
+      }
+      done[j] = true;
+      switch (entry.type) {
+        case Type::COUNTER:
+          out << WithLabels(entry.name, entry.labels) << " "
+              << entry.counter->Value() << "\n";
+          break;
+        case Type::GAUGE:
+          out << WithLabels(entry.name, entry.labels) << " "
+              << entry.gauge->Value() << "\n";
+          break;
+        case Type::HISTOGRAM: {
+          const Histogram& histogram = *entry.histogram;
+          uint64_t cumulative = 0;
+          for (size_t b = 0; b <= histogram.Bounds().size(); b++) {
+            cumulative += histogram.BucketCount(b);
+            std::ostringstream le;
+            if (b < histogram.Bounds().size()) {
+              le << "le=\"" << histogram.Bounds()[b] << "\"";
+            } else {
+              le << "le=\"+Inf\"";
+            }
+            out << WithLabels(entry.name + "_bucket", entry.labels, le.str())
+                << " " << cumulative << "\n";
+          }
+          out << WithLabels(entry.name + "_sum", entry.labels) << " "
+              << histogram.Sum() << "\n";
+          out << WithLabels(entry.name + "_count", entry.labels) << " "
+              << histogram.Count() << "\n";
+          break;
+        }
+      }
+    }
+  }
+  return out.str();
+}
+
+bool MetricsServer::Start(const std::string& address) {
+  if (is_running_) {
+    return true;
+  }
+
+  static const std::string kUnixPrefix = "unix:";
+  if (address.compare(0, kUnixPrefix.size(), kUnixPrefix) == 0) {
+    unix_path_ = address.substr(kUnixPrefix.size());
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (unix_path_.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "MetricsServer socket path too long: " << unix_path_ << std::endl;
+      return false;
+    }
+    strncpy(addr.sun_path, unix_path_.c_str(), sizeof(addr.sun_path) - 1);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      std::cerr << "MetricsServer socket returned " << errno << std::endl;
+      return false;
+    }
+    unlink(unix_path_.c_str());
+    if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      std::cerr << "MetricsServer bind " << unix_path_ << " returned " << errno << std::endl;
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+  } else {
+    int port = atoi(address.c_str());
+    if (port <= 0 || port > 65535) {
+      std::cerr << "MetricsServer invalid address: " << address << std::endl;
+      return false;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      std::cerr << "MetricsServer socket returned " << errno << std::endl;
+      return false;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      std::cerr << "MetricsServer bind port " << port << " returned " << errno << std::endl;
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+  }
+  if (listen(listen_fd_, 4) < 0) {
+    std::cerr << "MetricsServer listen returned " << errno << std::endl;
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+
+  is_running_ = true;
+  serve_thread_.reset(new std::thread([this]() { Serve(); }));
+  return true;
+}
+
+void MetricsServer::Stop() {
+  if (!is_running_) {
+    return;
+  }
+  is_running_ = false;
+  serve_thread_->join();
+  serve_thread_.reset(nullptr);
+  close(listen_fd_);
+  listen_fd_ = -1;
+  if (!unix_path_.empty()) {
+    unlink(unix_path_.c_str());
+  }
+}
+
+void MetricsServer::Serve() {
+  while (is_running_) {
+    pollfd pfd = {listen_fd_, POLLIN, 0};
+    // Wake up regularly to notice |Stop|.
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      continue;
+    }
+    // The request itself is not interesting, every path returns the metrics.
+    // Read whatever was sent so that the client sees an orderly close.
+    char request[1024];
+    pollfd cfd = {client_fd, POLLIN, 0};
+    if (poll(&cfd, 1, 100) > 0) {
+      ssize_t ignored = read(client_fd, request, sizeof(request));
+      (void)ignored;
+    }
+    std::string body = registry_->Serialize();
+    std::ostringstream response;
+    response << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.size() << "\r\n\r\n"
+             << body;
+    std::string data = response.str();
+    size_t written = 0;
+    while (written < data.size()) {
+      ssize_t ret = send(client_fd, data.data() + written,
+                         data.size() - written, MSG_NOSIGNAL);
+      if (ret <= 0) {
+        break;
+      }
+      written += ret;
+    }
+    close(client_fd);
+  }
+}
@@ -0,0 +1,135 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// In-process metrics. Updating a metric is a single relaxed atomic
+// operation, so metrics can be updated from the audio threads. Looking up a
+// metric by name takes a lock and should be done once, e.g. into a static
+// pointer.
+
+class Counter {
+ public:
+  void Increment(uint64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+ public:
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+class Histogram {
+ public:
+  // |bounds| are the upper bounds of the buckets, in increasing order.
+  explicit Histogram(const std::vector<double>& bounds);
+
+  void Observe(double value);
+
+  const std::vector<double>& Bounds() const { return bounds_; }
+  // Non-cumulative count of bucket |i|. |i| == Bounds().size() is +Inf.
+  uint64_t BucketCount(size_t i) const {
+    return buckets_[i].load(std::memory_order_relaxed);
+  }
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  double Sum() const;
+
+ private:
+  const std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> count_{0};
+  // Sum is kept in fixed point (micro units) so that it stays wait-free.
+  std::atomic<int64_t> sum_micros_{0};
+};
+
+class MetricsRegistry {
+ public:
+  static MetricsRegistry& Global();
+
+  // Returns the metric with |name| and |labels|, creating it if needed.
+  // |labels| is in Prometheus form without braces, e.g. "code=\"OK\"".
+  // Returned pointers stay valid for the lifetime of the registry.
+  Counter* GetCounter(const std::string& name, const std::string& help,
+                      const std::string& labels = "");
+  Gauge* GetGauge(const std::string& name, const std::string& help,
+                  const std::string& labels = "");
+  Histogram* GetHistogram(const std::string& name, const std::string& help,
+                          const std::vector<double>& bounds,
+                          const std::string& labels = "");
+
+  // Renders all metrics in the Prometheus text exposition format.
+  std::string Serialize();
+
+ private:
+  enum class Type { COUNTER, GAUGE, HISTOGRAM };
+  struct Entry {
+    std::string name;
+    std::string help;
+    std::string labels;
+    Type type;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  Entry* FindOrAdd(const std::string& name, const std::string& help,
+                   const std::string& labels, Type type);
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+// Serves the registry in Prometheus text format over HTTP/1.0.
+// |address| is either "unix:<path>" for a Unix domain socket or a TCP port,
+// which is bound to the loopback interface only.
+class MetricsServer {
+ public:
+  explicit MetricsServer(MetricsRegistry* registry) : registry_(registry) {}
+  ~MetricsServer() { Stop(); }
+
+  bool Start(const std::string& address);
+  void Stop();
+
+ private:
+  void Serve();
+
+  MetricsRegistry* registry_;
+  std::string unix_path_;
+  int listen_fd_ = -1;
+  std::atomic<bool> is_running_{false};
+  std::unique_ptr<std::thread> serve_thread_;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "metrics.h"
+
+#include <iostream>
+
+bool contains(const std::string& text, const std::string& line) {
+  return text.find(line + "\n") != std::string::npos;
+}
+
+int main() {
+  MetricsRegistry registry;
+  registry.GetCounter("test_total", "A counter.")->Increment(3);
+  registry.GetCounter("status_total", "By code.", "code=\"OK\"")->Increment();
+  registry.GetGauge("depth", "A gauge.")->Set(-2);
+  registry.GetCounter("status_total", "By code.", "code=\"UNAVAILABLE\"")->Increment(2);
+  Histogram* histogram =
+      registry.GetHistogram("latency_seconds", "A histogram.", {0.1, 1});
+  histogram->Observe(0.05);
+  histogram->Observe(0.5);
+  histogram->Observe(2);
+
+  if (registry.GetCounter("test_total", "A counter.")->Value() != 3) {
+    std::cerr << "Test failed for counter lookup" << std::endl;
+    return 1;
+  }
+
+  std::string text = registry.Serialize();
+  if (!contains(text, "# TYPE test_total counter")
+      || !contains(text, "test_total 3")
+      || !contains(text, "depth -2")) {
+    std::cerr << "Test failed for counter and gauge:\n" << text << std::endl;
+    return 1;
+  }
+
+  // Samples with different labels must be grouped under one TYPE line.
+  size_t type_line = text.find("# TYPE status_total counter\n");
+  size_t ok_line = text.find("status_total{code=\"OK\"} 1\n");
+  size_t unavailable_line = text.find("status_total{code=\"UNAVAILABLE\"} 2\n");
+  size_t depth_line = text.find("# TYPE depth gauge\n");
+  if (type_line == std::string::npos || ok_line < type_line
+      || unavailable_line < ok_line || depth_line < unavailable_line) {
+    std::cerr << "Test failed for labelled counters:\n" << text << std::endl;
+    return 1;
+  }
+
+  if (!contains(text, "latency_seconds_bucket{le=\"0.1\"} 1")
+      || !contains(text, "latency_seconds_bucket{le=\"1\"} 2")
+      || !contains(text, "latency_seconds_bucket{le=\"+Inf\"} 3")
+      || !contains(text, "latency_seconds_sum 2.55")
+      || !contains(text, "latency_seconds_count 3")) {
+    std::cerr << "Test failed for histogram:\n" << text << std::endl;
+    return 1;
+  }
+
+  std::cerr << "Test passed" << std::endl;
+}
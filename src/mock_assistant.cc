@@ -0,0 +1,109 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "mock_assistant.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using google::assistant::embedded::v1alpha2::AssistRequest;
+using google::assistant::embedded::v1alpha2::AssistResponse;
+using google::assistant::embedded::v1alpha2::DialogStateOut;
+
+namespace {
+
+const size_t kResponseChunkBytes = 3200;
+
+// Sleeps for |delay_ms| unless the client goes away first.
+bool Delay(grpc::ServerContext* context, int delay_ms) {
+  std::chrono::steady_clock::time_point until =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+  while (std::chrono::steady_clock::now() < until) {
+    if (context->IsCancelled()) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+}  // namespace
+
+grpc::Status MockAssistantService::Assist(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriter<AssistResponse, AssistRequest>* stream) {
+  int number = streams_++;
+  AssistRequest request;
+  if (!stream->Read(&request) || !request.has_config()) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "The first request must carry the config");
+  }
+  const std::string& text_query = request.config().text_query();
+  // Each turn extends the conversation state, so clients can check that it
+  // is carried from one turn to the next.
+  std::string conversation_state =
+      request.config().dialog_state_in().conversation_state() + ".";
+
+  if (options_.delay_every > 0 && number % options_.delay_every == 0 &&
+      !Delay(context, options_.delay_ms)) {
+    return grpc::Status(grpc::StatusCode::CANCELLED, "Client went away");
+  }
+
+  if (options_.stall_every > 0 && number % options_.stall_every == 0) {
+    while (!context->IsCancelled()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return grpc::Status(grpc::StatusCode::CANCELLED, "Client went away");
+  }
+
+  AssistResponse response;
+  if (text_query.empty()) {
+    size_t audio_bytes = 0;
+    while (audio_bytes < options_.utterance_bytes && stream->Read(&request)) {
+      audio_bytes += request.audio_in().size();
+    }
+    response.add_speech_results()->set_transcript(options_.transcript);
+    response.mutable_speech_results(0)->set_stability(1);
+    stream->Write(response);
+    response.Clear();
+    response.set_event_type(AssistResponse::END_OF_UTTERANCE);
+    stream->Write(response);
+    // Audio the client sent before it saw END_OF_UTTERANCE.
+    while (stream->Read(&request)) {
+    }
+  }
+
+  response.Clear();
+  DialogStateOut* dialog_state = response.mutable_dialog_state_out();
+  dialog_state->set_supplemental_display_text(
+      text_query.empty() ? options_.display_text : text_query);
+  dialog_state->set_conversation_state(conversation_state);
+  dialog_state->set_microphone_mode(DialogStateOut::CLOSE_MICROPHONE);
+  stream->Write(response);
+  for (size_t sent = 0; sent < options_.response_audio_bytes;
+       sent += kResponseChunkBytes) {
+    response.Clear();
+    response.mutable_audio_out()->set_audio_data(std::string(
+        std::min(kResponseChunkBytes, options_.response_audio_bytes - sent), 0));
+    if (!stream->Write(response)) {
+      break;
+    }
+  }
+  return context->IsCancelled()
+      ? grpc::Status(grpc::StatusCode::CANCELLED, "Client went away")
+      : grpc::Status::OK;
+}
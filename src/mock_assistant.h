@@ -0,0 +1,71 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef MOCK_ASSISTANT_H
+#define MOCK_ASSISTANT_H
+
+#include <grpc++/grpc++.h>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#include "google/assistant/embedded/v1alpha2/embedded_assistant.grpc.pb.h"
+
+// Local stand-in for the Assistant service, for tests and load runs. It
+// follows the shape of a real dialog: the config, audio until the
+// utterance is "heard", speech results and END_OF_UTTERANCE, then once the
+// client is done writing the dialog state and response audio. Text queries
+// are answered right away. Delays can be injected to simulate slow
+// connections or stalled streams.
+class MockAssistantService
+    : public google::assistant::embedded::v1alpha2::EmbeddedAssistant::Service {
+ public:
+  struct Options {
+    // Streams whose number, counted from 0, is a multiple of |delay_every|
+    // wait |delay_ms| before their first response. 0 never delays.
+    int delay_every = 0;
+    int delay_ms = 0;
+    // Streams whose number is a multiple of |stall_every| stop reading after
+    // the config until the client cancels them, so once the flow-control
+    // window is full the client's writes block. 0 never stalls.
+    int stall_every = 0;
+    // Audio bytes after which the utterance ends.
+    size_t utterance_bytes = 16000;
+    // Response audio, sent in 100 ms chunks.
+    size_t response_audio_bytes = 32000;
+    std::string transcript = "what time is it";
+    std::string display_text = "It's noon.";
+  };
+
+  MockAssistantService() {}
+  explicit MockAssistantService(const Options& options) : options_(options) {}
+
+  grpc::Status Assist(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<
+          google::assistant::embedded::v1alpha2::AssistResponse,
+          google::assistant::embedded::v1alpha2::AssistRequest>* stream) override;
+
+  // Number of streams started.
+  int Streams() const { return streams_.load(); }
+
+ private:
+  const Options options_;
+  std::atomic<int> streams_{0};
+};
+
+#endif
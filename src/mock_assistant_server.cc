@@ -0,0 +1,89 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Serves MockAssistantService on a local port, for load runs and for
+// checking clients against injected delays.
+
+#include <getopt.h>
+
+#include <iostream>
+#include <string>
+
+#include "mock_assistant.h"
+
+void PrintUsage() {
+  std::cerr << "Usage: ./mock_assistant_server [--port <port>] "
+            << "[--delay_ms <ms> --delay_every <n>] [--stall_every <n>] "
+            << "[--utterance_ms <ms>]"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int port = 50051;
+  MockAssistantService::Options options;
+
+  const struct option long_options[] = {
+    {"port",         required_argument, nullptr, 'p'},
+    {"delay_ms",     required_argument, nullptr, 'd'},
+    {"delay_every",  required_argument, nullptr, 'n'},
+    {"stall_every",  required_argument, nullptr, 's'},
+    {"utterance_ms", required_argument, nullptr, 'u'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char =
+        getopt_long(argc, argv, "p:d:n:s:u:", long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'd':
+        options.delay_ms = atoi(optarg);
+        break;
+      case 'n':
+        options.delay_every = atoi(optarg);
+        break;
+      case 's':
+        options.stall_every = atoi(optarg);
+        break;
+      case 'u':
+        // 16000Hz, 2 bytes per sample.
+        options.utterance_bytes = atoi(optarg) * 32;
+        break;
+      default:
+        PrintUsage();
+        return 1;
+    }
+  }
+
+  MockAssistantService service(options);
+  std::string address = "127.0.0.1:" + std::to_string(port);
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+  if (!server) {
+    std::cerr << "Cannot listen on " << address << std::endl;
+    return 1;
+  }
+  std::cout << "Mock assistant listening on " << address << std::endl;
+  server->Wait();
+  return 0;
+}
@@ -0,0 +1,45 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "response_audio.h"
+
+using google::assistant::embedded::v1alpha2::AssistResponse;
+using google::protobuf::Arena;
+
+namespace {
+
+// Enough for a typical response with its audio in the first block.
+const size_t kArenaStartBlockBytes = 16 * 1024;
+
+}  // namespace
+
+std::shared_ptr<AssistResponse> NewArenaResponse() {
+  google::protobuf::ArenaOptions options;
+  options.start_block_size = kArenaStartBlockBytes;
+  std::shared_ptr<Arena> arena = std::make_shared<Arena>(options);
+  AssistResponse* response = Arena::CreateMessage<AssistResponse>(arena.get());
+  // Shares ownership of the arena, which owns the message.
+  return std::shared_ptr<AssistResponse>(arena, response);
+}
+
+AudioChunk TakeResponseAudio(const std::shared_ptr<AssistResponse>& response) {
+  const std::string& audio = response->audio_out().audio_data();
+  AudioChunk chunk;
+  chunk.owner = response;
+  chunk.data = reinterpret_cast<const unsigned char*>(audio.data());
+  chunk.size = audio.size();
+  return chunk;
+}
@@ -0,0 +1,37 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef RESPONSE_AUDIO_H
+#define RESPONSE_AUDIO_H
+
+#include <memory>
+
+#include "audio_packet.h"
+#include "google/assistant/embedded/v1alpha2/embedded_assistant.pb.h"
+
+// Returns an empty AssistResponse allocated on its own protobuf arena, so
+// that parsing it allocates in a few large blocks. The arena is freed when
+// the last copy of the pointer, or of an AudioChunk taken from it, is gone.
+std::shared_ptr<google::assistant::embedded::v1alpha2::AssistResponse>
+NewArenaResponse();
+
+// Returns the audio_out bytes of |response| without copying them. The chunk
+// keeps |response| alive until playback releases it.
+AudioChunk TakeResponseAudio(
+    const std::shared_ptr<google::assistant::embedded::v1alpha2::AssistResponse>&
+        response);
+
+#endif
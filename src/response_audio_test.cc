@@ -0,0 +1,95 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "response_audio.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+using google::assistant::embedded::v1alpha2::AssistResponse;
+
+// Counts every heap allocation made by the test.
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+int main() {
+  // A response as the server sends it, with 100ms of audio.
+  AssistResponse sent;
+  sent.mutable_audio_out()->set_audio_data(std::string(3200, '\x7f'));
+  sent.mutable_dialog_state_out()->set_supplemental_display_text("It's noon.");
+  std::string wire = sent.SerializeAsString();
+
+  std::weak_ptr<AssistResponse> parsed;
+  AudioChunk chunk;
+  {
+    std::shared_ptr<AssistResponse> response = NewArenaResponse();
+    if (!response->ParseFromString(wire)) {
+      std::cerr << "Test failed, response did not parse" << std::endl;
+      return 1;
+    }
+    parsed = response;
+
+    // Handing the audio to playback neither allocates nor copies it.
+    size_t before = allocations;
+    chunk = TakeResponseAudio(response);
+    if (allocations != before) {
+      std::cerr << "Test failed, " << allocations - before
+                << " allocations per chunk" << std::endl;
+      return 1;
+    }
+    if (chunk.data != reinterpret_cast<const unsigned char*>(
+            response->audio_out().audio_data().data()) ||
+        chunk.size != 3200) {
+      std::cerr << "Test failed, chunk does not point into the response"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // The dialog has moved on to the next response; the chunk keeps the audio
+  // alive until playback releases it.
+  if (parsed.expired() || chunk.data[0] != 0x7f || chunk.data[3199] != 0x7f) {
+    std::cerr << "Test failed, response released before playback" << std::endl;
+    return 1;
+  }
+  chunk = AudioChunk();
+  if (!parsed.expired()) {
+    std::cerr << "Test failed, response not released after playback"
+              << std::endl;
+    return 1;
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -17,6 +17,7 @@ limitations under the License.
 #include <grpc++/grpc++.h>
 
 #include <getopt.h>
+#include <pthread.h>
 
 #include <chrono>
 #include <fstream>
@@ -39,12 +40,23 @@ limitations under the License.
 #include "google/assistant/embedded/v1alpha2/embedded_assistant.pb.h"
 #include "google/assistant/embedded/v1alpha2/embedded_assistant.grpc.pb.h"
 
+#include "access_token.h"
+#include "assist_stream.h"
 #include "assistant_config.h"
 #include "audio_input.h"
+#include "audio_shm.h"
 #include "audio_input_file.h"
+#include "device_action.h"
+#include "dsp_pipeline.h"
 #include "json_util.h"
 #include "keyword_detect.h"
+#include "log.h"
+#include "metrics.h"
+#include "response_audio.h"
+#include "session_log.h"
 #include "state_manager.h"
+#include "thread_config.h"
+#include "uplink_packetizer.h"
 #include "signal.h"
 
 
@@ -53,6 +65,7 @@ using google::assistant::embedded::v1alpha2::AssistRequest;
 using google::assistant::embedded::v1alpha2::AssistResponse;
 using google::assistant::embedded::v1alpha2::AudioInConfig;
 using google::assistant::embedded::v1alpha2::AudioOutConfig;
+using google::assistant::embedded::v1alpha2::ScreenOutConfig;
 using google::assistant::embedded::v1alpha2::AssistResponse_EventType_END_OF_UTTERANCE;
 using google::assistant::embedded::v1alpha2::AssistResponse_EventType_EVENT_TYPE_UNSPECIFIED;
 using google::assistant::embedded::v1alpha2::DialogStateOut_MicrophoneMode_CLOSE_MICROPHONE;
@@ -68,6 +81,7 @@ static const std::string kALSAAudioInput = "ALSA_INPUT";
 static const std::string kLanguageCode = "en-US";
 static const std::string kDeviceInstanceId = "test";
 static const std::string kDeviceModelId = "gigaspire-241cc-axu-99y67a";
+static const int kDeviceActionTimeoutMs = 5000;
 
 static const std::string kUbusSockFd = "/tmp/ubus.sock";
 
@@ -75,10 +89,56 @@ bool verbose = false;
 std::string mConversationState;
 
 AssistantStateManager mStateManager;
+UplinkPacketizer mUplinkPacketizer;
+
+static Counter* const kDialogsStarted = MetricsRegistry::Global().GetCounter(
+	"assistant_dialogs_started_total", "Assist streams started.");
+static Counter* const kUplinkBytes = MetricsRegistry::Global().GetCounter(
+	"assistant_uplink_bytes_total", "Serialized AssistRequest bytes written.");
+static Counter* const kDownlinkBytes = MetricsRegistry::Global().GetCounter(
+	"assistant_downlink_bytes_total", "Serialized AssistResponse bytes read.");
+static Histogram* const kUplinkLatency = MetricsRegistry::Global().GetHistogram(
+	"assistant_uplink_latency_seconds",
+	"Time from capturing the first frame of an audio_in request until it was written to the stream.",
+	{0.01, 0.05, 0.1, 0.2, 0.5, 1, 2});
+static Histogram* const kUplinkWriteTime = MetricsRegistry::Global().GetHistogram(
+	"assistant_uplink_write_seconds", "Time an audio_in write blocked.",
+	{0.001, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5});
+static Gauge* const kUplinkChunkMs = MetricsRegistry::Global().GetGauge(
+	"assistant_uplink_chunk_ms", "Audio per audio_in request chosen for the next write.");
+static Gauge* const kUplinkLagMs = MetricsRegistry::Global().GetGauge(
+	"assistant_uplink_lag_ms", "Age of the first frame of the last audio_in request once written.");
+static Counter* const kUplinkDiscontinuities = MetricsRegistry::Global().GetCounter(
+	"assistant_uplink_discontinuities_total", "Uplink packets that followed lost audio.");
+
+// Counts the final status of each Assist stream, labelled by gRPC code.
+void RecordGrpcStatus(const grpc::Status& status) {
+	static const char* const kCodeNames[] = {
+		"OK", "CANCELLED", "UNKNOWN", "INVALID_ARGUMENT", "DEADLINE_EXCEEDED",
+		"NOT_FOUND", "ALREADY_EXISTS", "PERMISSION_DENIED", "RESOURCE_EXHAUSTED",
+		"FAILED_PRECONDITION", "ABORTED", "OUT_OF_RANGE", "UNIMPLEMENTED",
+		"INTERNAL", "UNAVAILABLE", "DATA_LOSS", "UNAUTHENTICATED"
+	};
+	static const int kNumCodes = sizeof(kCodeNames) / sizeof(kCodeNames[0]);
+	int code = status.error_code();
+	const char* name = (code >= 0 && code < kNumCodes) ? kCodeNames[code] : "UNKNOWN";
+	MetricsRegistry::Global().GetCounter(
+		"assistant_grpc_status_total", "Assist streams finished, by gRPC status code.",
+		std::string("code=\"") + name + "\"")->Increment();
+}
 
-void signal_handler(int signal) {
+// Shuts down on SIGINT. The signal is blocked in every thread and taken
+// here with sigwait(), so the shutdown runs in normal thread context where
+// logging and Logger::Flush() are safe.
+void WatchShutdownSignal(sigset_t signals) {
+    pthread_setname_np(pthread_self(), "signals");
+    int signal = 0;
+    if (sigwait(&signals, &signal) != 0) {
+        return;
+    }
     mStateManager.init(kUbusSockFd); 
-    std::cout << "Shut down google assistant" << std::endl;
+    LOG(INFO) << "Shut down google assistant";
+    Logger::Flush();
     abort();
 }
 
@@ -89,34 +149,51 @@ std::shared_ptr<Channel> CreateChannel(const std::string& host) {
 	buffer << file.rdbuf();
 	std::string roots_pem = buffer.str();
 
-	if (verbose) {
-		std::clog << "assistant_sdk robots_pem: " << roots_pem << std::endl;
-	}
+	LOG(DEBUG) << "assistant_sdk robots_pem: " << roots_pem;
 	::grpc::SslCredentialsOptions ssl_opts = {roots_pem, "", ""};
 	auto creds = ::grpc::SslCredentials(ssl_opts);
 	std::string server = host + ":443";
-	if (verbose) {
-		std::clog << "assistant_sdk CreateCustomChannel(" << server << ", creds, arg)"
-			<< std::endl << std::endl;
-	}
+	LOG(DEBUG) << "assistant_sdk CreateCustomChannel(" << server << ", creds, arg)";
 	::grpc::ChannelArguments channel_args;
+	// Every channel gets a connection of its own, see --hedge_ms.
+	channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
 	return CreateCustomChannel(server, creds, channel_args);
 }
 
 void PrintUsage() {
 	std::cerr << "Usage: ./run_assistant "
-		<< "[--audio_input [<" << kALSAAudioInput << ">|<audio_file>] OR --text_input <string>] "
+		<< "[--audio_input [<" << kALSAAudioInput << ">|<audio_file>] OR --text_input <string> [--no_audio] [--screen_out <html_file>]] "
 		<< "--credentials_file <credentials_file> "
 		<< "[--credentials_type <" << kCredentialsTypeUserAccount << ">] "
+		<< "[--token_cache <file>] "
 		<< "[--api_endpoint <API endpoint>] "
-		<< "[--locale <locale>]"
+		<< "[--hedge_ms <ms> [--hedge_endpoint <API endpoint>]] "
+		<< "[--device_action_dir <dir>] "
+		<< "[--record <session_log> [--record_mb <mb>]] "
+		<< "[--audio_shm <name>] "
+		<< "[--mic_channels <n>] "
+		<< "[--keyword_dsp <stages>] [--dialog_dsp <stages>] "
+		<< "[--locale <locale>] "
+		<< "[--metrics_address <unix:<path>|<port>>] "
+		<< "[--keyword_hop_ms <10-30>] "
+		<< "[--keyword_backend <sensory|energy>] "
+		<< "[--keyword_model <model_file>[:<locale>[:<keyword>,...]]]... "
+		<< "[--keyword_gate <on|off>] "
+		<< "[--thread_config <role>=<policy>[:<priority>][@<cpus>],...]"
 		<< std::endl;
 }
 
 bool GetCommandLineFlags(
 	int argc, char** argv, std::string* audio_input, std::string* text_input,
 	std::string* credentials_file_path, std::string* credentials_type,
-	std::string* api_endpoint, std::string* locale) {
+	std::string* api_endpoint, std::string* locale, std::string* metrics_address,
+	int* keyword_hop_ms, std::string* keyword_backend,
+	std::vector<std::string>* keyword_models, bool* keyword_gate,
+	std::string* thread_config, int* hedge_ms, std::string* hedge_endpoint,
+	bool* no_audio, std::string* screen_out, std::string* device_action_dir,
+	std::string* record_path, int* record_mb, std::string* token_cache,
+	std::string* audio_shm, int* mic_channels, std::string* keyword_dsp,
+	std::string* dialog_dsp) {
 		
 	const struct option long_options[] = {
 		{"audio_input",      required_argument, nullptr, 'i'},
@@ -125,13 +202,31 @@ bool GetCommandLineFlags(
 		{"credentials_type", required_argument, nullptr, 'c'},
 		{"api_endpoint",     required_argument, nullptr, 'e'},
 		{"locale",           required_argument, nullptr, 'l'},
+		{"metrics_address",  required_argument, nullptr, 'm'},
+		{"keyword_hop_ms",   required_argument, nullptr, 'k'},
+		{"keyword_backend",  required_argument, nullptr, 'b'},
+		{"keyword_model",    required_argument, nullptr, 'w'},
+		{"keyword_gate",     required_argument, nullptr, 'g'},
+		{"thread_config",    required_argument, nullptr, 'r'},
+		{"hedge_ms",         required_argument, nullptr, 'd'},
+		{"hedge_endpoint",   required_argument, nullptr, 'a'},
+		{"no_audio",         no_argument,       nullptr, 'n'},
+		{"screen_out",       required_argument, nullptr, 's'},
+		{"device_action_dir", required_argument, nullptr, 'x'},
+		{"record",           required_argument, nullptr, 'o'},
+		{"record_mb",        required_argument, nullptr, 'q'},
+		{"token_cache",      required_argument, nullptr, 'u'},
+		{"audio_shm",        required_argument, nullptr, 'y'},
+		{"mic_channels",     required_argument, nullptr, 'j'},
+		{"keyword_dsp",      required_argument, nullptr, 'p'},
+		{"dialog_dsp",       required_argument, nullptr, 'z'},
 		{"verbose",          no_argument, nullptr, 'v'},
 		{nullptr, 0, nullptr, 0}
 	};
 	*api_endpoint = ASSISTANT_ENDPOINT;
 	while (true) {
 		int option_index;
-		int option_char = getopt_long(argc, argv, "i:t:f:c:e:l:v", long_options, &option_index);
+		int option_char = getopt_long(argc, argv, "i:t:f:c:e:l:m:k:b:w:g:r:d:a:ns:x:o:q:u:y:j:p:z:v", long_options, &option_index);
 		if (option_char == -1) {
 			break;
 		}
@@ -141,6 +236,7 @@ bool GetCommandLineFlags(
 				break;
 			case 't':
 				*text_input = optarg;
+				break;
 			case 'f':
 				*credentials_file_path = optarg;
 				break;
@@ -159,6 +255,64 @@ bool GetCommandLineFlags(
 			case 'l':
 				*locale = optarg;
 				break;
+			case 'm':
+				*metrics_address = optarg;
+				break;
+			case 'k':
+				*keyword_hop_ms = atoi(optarg);
+				break;
+			case 'b':
+				*keyword_backend = optarg;
+				break;
+			case 'w':
+				keyword_models->push_back(optarg);
+				break;
+			case 'g':
+				*keyword_gate = std::string(optarg) != "off";
+				break;
+			case 'r':
+				*thread_config = optarg;
+				break;
+			case 'd':
+				*hedge_ms = atoi(optarg);
+				break;
+			case 'a':
+				*hedge_endpoint = optarg;
+				break;
+			case 'n':
+				*no_audio = true;
+				break;
+			case 's':
+				*screen_out = optarg;
+				break;
+			case 'x':
+				*device_action_dir = optarg;
+				break;
+			case 'o':
+				*record_path = optarg;
+				break;
+			case 'q':
+				*record_mb = atoi(optarg);
+				break;
+			case 'u':
+				*token_cache = optarg;
+				break;
+			case 'y':
+				*audio_shm = optarg;
+				break;
+			case 'j':
+				*mic_channels = atoi(optarg);
+				if (*mic_channels < 1) {
+					std::cerr << "--mic_channels must be at least 1" << std::endl;
+					return false;
+				}
+				break;
+			case 'p':
+				*keyword_dsp = optarg;
+				break;
+			case 'z':
+				*dialog_dsp = optarg;
+				break;
 			case 'v':
 				verbose = true;
 				break;
@@ -167,17 +321,26 @@ bool GetCommandLineFlags(
 				return false;
 		}
 	}
+	if ((*no_audio || !screen_out->empty()) && text_input->empty()) {
+		std::cerr << "--no_audio and --screen_out need --text_input" << std::endl;
+		return false;
+	}
 	return true;
 }
 
-AssistRequest MakeAssistRequestConfig(std::string locale){
+// |text_query|, if set, replaces the microphone as the input. |screen| asks
+// for visual (HTML) responses as well. Without |audio| the spoken reply is
+// not played, so the cheapest one is requested.
+AssistRequest MakeAssistRequestConfig(std::string locale,
+				const std::string& text_query = "", bool screen = false,
+				bool audio = true){
     AssistRequest req;
     auto* assist_config = req.mutable_config();
   
     if (locale.empty()) {
         locale = kLanguageCode; // Default locale
     }
-    std::cout << "Using locale " << locale << std::endl;
+    LOG(INFO) << "Using locale " << locale;
     // Set the DialogStateIn of the AssistRequest
     assist_config->mutable_dialog_state_in()->set_language_code(locale);
 	if (mConversationState.size()>0) {
@@ -188,9 +351,25 @@ AssistRequest MakeAssistRequestConfig(std::string locale){
     assist_config->mutable_device_config()->set_device_model_id(kDeviceModelId);
   
     // Set parameters for audio output
-    assist_config->mutable_audio_out_config()->set_encoding(AudioOutConfig::LINEAR16);
-    assist_config->mutable_audio_out_config()->set_sample_rate_hertz(16000);
+    if (audio) {
+        assist_config->mutable_audio_out_config()->set_encoding(AudioOutConfig::LINEAR16);
+        assist_config->mutable_audio_out_config()->set_sample_rate_hertz(16000);
+    } else {
+        // The API always sends audio; Opus at the lowest rate and volume is
+        // a fraction of the LINEAR16 bytes.
+        assist_config->mutable_audio_out_config()->set_encoding(AudioOutConfig::OPUS_IN_OGG);
+        assist_config->mutable_audio_out_config()->set_sample_rate_hertz(16000);
+        assist_config->mutable_audio_out_config()->set_volume_percentage(1);
+    }
   
+    if (screen) {
+        assist_config->mutable_screen_out_config()->set_screen_mode(ScreenOutConfig::PLAYING);
+    }
+
+    if (!text_query.empty()) {
+        assist_config->set_text_query(text_query);
+        return req;
+    }
     // Set the AudioInConfig of the AssistRequest
     assist_config->mutable_audio_in_config()->set_encoding(AudioInConfig::LINEAR16);
     assist_config->mutable_audio_in_config()->set_sample_rate_hertz(16000);
@@ -205,15 +384,66 @@ void PlaySoundCue(const char* file) {
   
 }
 
-bool StartDialog(std::string locale,
-				std::shared_ptr<EmbeddedAssistant::Stub> assistant,
-				std::shared_ptr<CallCredentials> call_credentials,
-				std::shared_ptr<AudioOutputALSA> audio_output) {
+// The uplink writes to the network on its own thread. When the network is
+// slower than the microphone, queued audio is merged into larger requests
+// instead of stalling capture.
+AudioBus::SubscriberOptions UplinkListenerOptions() {
+	AudioBus::SubscriberOptions options;
+	options.name = "uplink";
+	options.policy = BusPolicy::COALESCE;
+	options.capacity = 16;
+	return options;
+}
+
+// Writes the audio gathered by mUplinkPacketizer as one request, and lets
+// it size the next one from how long this write blocked and how old the
+// audio was by then.
+void WriteUplinkAudio(AssistStream* stream, AssistRequest* request_audio_in) {
+	request_audio_in->set_audio_in(mUplinkPacketizer.Audio());
+	std::chrono::steady_clock::time_point write_start = std::chrono::steady_clock::now();
+	stream->Write(*request_audio_in);
+	double write_seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - write_start).count();
+	kUplinkBytes->Increment(request_audio_in->ByteSizeLong());
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const timespec& captured = mUplinkPacketizer.Timestamp();
+	double lag_seconds = (now.tv_sec - captured.tv_sec)
+		+ (now.tv_nsec - captured.tv_nsec) / 1e9;
+	kUplinkLatency->Observe(lag_seconds);
+	kUplinkWriteTime->Observe(write_seconds);
+	kUplinkLagMs->Set(static_cast<int64_t>(lag_seconds * 1000));
+	mUplinkPacketizer.OnWritten(write_seconds, lag_seconds);
+	kUplinkChunkMs->Set(mUplinkPacketizer.ChunkMs());
+}
+
+// Opens an Assist stream and sends its config request.
+std::unique_ptr<AssistStream> OpenDialogStream(const std::string& locale,
+				std::shared_ptr<AssistClient> assistant) {
+	std::unique_ptr<AssistStream> dialog = assistant->Open();
+	kDialogsStarted->Increment();
+
+	AssistRequest config_request = MakeAssistRequestConfig(locale);
+	dialog->Write(config_request);
+	kUplinkBytes->Increment(config_request.ByteSizeLong());
+	LOG(INFO) << "==>AssistRequest.config";
+	return dialog;
+}
+
+// Runs one turn of a conversation on |*next_dialog|, or on a new stream if
+// it is empty. When the assistant expects a follow-on, the stream for the
+// next turn is opened into |*next_dialog| while the response is still
+// playing, and true is returned; the next turn's microphone goes live as
+// soon as the response has played out.
+bool StartDialog(std::unique_ptr<AssistStream>* next_dialog,
+				std::string locale,
+				std::shared_ptr<AssistClient> assistant,
+				std::shared_ptr<AudioOutputALSA> audio_output,
+				std::shared_ptr<DeviceActionDispatcher> device_actions,
+				int mic_channels, std::shared_ptr<DspPipeline> dialog_pipeline) {
 	bool b_cont = false;
 	// ConverseRequest Audio in
 	AssistRequest request_audio_in;
-	// ConverseResponse
-	AssistResponse response;
 	// AudioInput
 	std::unique_ptr<AudioInput> audio_input;
 	// AudioOutput
@@ -222,169 +452,444 @@ bool StartDialog(std::string locale,
         // If we start audio output when there is audio output in the response, TX path will fail to lock to the RX lock.
 	audio_output->Start();
 
-	// Begin a stream.
-	grpc::ClientContext context;
-	context.set_fail_fast(false);
-	context.set_credentials(call_credentials);
-	
-	std::shared_ptr<ClientReaderWriter<AssistRequest, AssistResponse>>
-		stream(std::move(assistant->Assist(&context)));
+	// Begin a stream, unless the previous turn already did.
+	std::shared_ptr<AssistStream> stream = std::move(*next_dialog);
+	if (!stream) {
+		stream = OpenDialogStream(locale, assistant);
+	}
 	
 	// Reset Audio Input
-	audio_input.reset(new AudioInputALSA());
+	audio_input.reset(new AudioInputALSA(mic_channels, dialog_pipeline));
+	mUplinkPacketizer.Reset();
 
 	audio_input->AddDataListener(
-		[stream, &request_audio_in](std::shared_ptr<std::vector<unsigned char>> data) {
-			request_audio_in.set_audio_in(&((*data)[0]), data->size());
-			stream->Write(request_audio_in);
-			//std::cout << "==>AssistRequest.audio_in" << std::endl;
-		}
+		[stream, &request_audio_in](const AudioPacketPtr& packet) {
+			if (packet->discontinuity) {
+				kUplinkDiscontinuities->Increment();
+			}
+			if (mUplinkPacketizer.Add(*packet)) {
+				WriteUplinkAudio(stream.get(), &request_audio_in);
+			}
+			//LOG(DEBUG) << "==>AssistRequest.audio_in";
+		},
+		UplinkListenerOptions()
 	);
-	audio_input->AddStopListener([stream]() {
+	// Runs after the data listener has finished.
+	audio_input->AddStopListener([stream, &request_audio_in]() {
+		if (mUplinkPacketizer.HasPending()) {
+			WriteUplinkAudio(stream.get(), &request_audio_in);
+		}
 		stream->WritesDone();
-		std::cout << "==>AssistRequest.audio_in END" << std::endl;
+		LOG(INFO) << "==>AssistRequest.audio_in END";
 	});
 
-	stream->Write(MakeAssistRequestConfig(locale));
-	std::cout << "==>AssistRequest.config" << std::endl;	
 	//PlaySoundCue("ful_ui_wakesound.wav");
         //mStateManager.changeState(AssistantStateManager::State::LISTENING);
  
-	// Start Audio Input Thread
+	// Start Audio Input Thread once the previous turn's response has been
+	// heard, so that the microphone does not pick it up.
+	audio_output->WaitUntilPlayed();
 	audio_input->Start();
         mStateManager.changeState(AssistantStateManager::State::LISTENING);
 	std::cout << std::endl << "*****PLEASE SPEAK YOUR REQUEST:" <<std::endl;
   
-	// Start reading response
-	while (stream->Read(&response)) {  // Returns false when no more to read.
+	// Start reading response. Each response is parsed into its own arena, so
+	// that its audio can be played without copying it out.
+	std::shared_ptr<AssistResponse> response_ptr;
+	while (stream->Read(&response_ptr)) {  // Returns false when no more to read.
+		const AssistResponse& response = *response_ptr;
+		kDownlinkBytes->Increment(response.ByteSizeLong());
 	
 	    std::string conversationState = response.dialog_state_out().conversation_state();
 		
 		
 		if (conversationState.size())
 		{
-			std::cout << "<==Converstation State: " << conversationState <<std::endl;
+			LOG(DEBUG) << "<==Converstation State: " << conversationState;
 			mConversationState = conversationState;
 		}
 		
 		if(response.event_type() == AssistResponse_EventType_END_OF_UTTERANCE) {
-			std::cout << "<==AssistResponse.event_type.END_OF_UTTERANCE" <<std::endl;
+			LOG(INFO) << "<==AssistResponse.event_type.END_OF_UTTERANCE";
 			audio_input->Stop();
 			//PlaySoundCue("ful_ui_endpointing.wav");
                         mStateManager.changeState(AssistantStateManager::State::THINKING);
 		}else if (response.event_type() == AssistResponse_EventType_EVENT_TYPE_UNSPECIFIED) {
-			//std::cout << "<==AssistResponse.event_type.EVENT_TYPE_UNSPECIFIED" <<std::endl;
+			//LOG(DEBUG) << "<==AssistResponse.event_type.EVENT_TYPE_UNSPECIFIED";
 		}
  
 		if (response.dialog_state_out().microphone_mode() == DialogStateOut_MicrophoneMode_CLOSE_MICROPHONE) {
-			std::cout << "<==AssistResponse.dialog_state_out.microphone_mode.CLOSE_MICROPHONE" <<std::endl;
+			LOG(INFO) << "<==AssistResponse.dialog_state_out.microphone_mode.CLOSE_MICROPHONE";
 			b_cont = false;
 		}
 		else if (response.dialog_state_out().microphone_mode() == DialogStateOut_MicrophoneMode_DIALOG_FOLLOW_ON) {
-			std::cout << "<==AssistResponse.dialog_state_out.microphone_mode.DIALOG_FOLLOW_ON" <<std::endl;
+			LOG(INFO) << "<==AssistResponse.dialog_state_out.microphone_mode.DIALOG_FOLLOW_ON";
 			b_cont = true;
 		}
 	
 		// Playback the response audio
 		if (response.has_audio_out()) {
 			mStateManager.changeState(AssistantStateManager::State::SPEAKING);                        
-			//std::cout << "<==AssistResponse.audio_out" <<std::endl;
-			std::shared_ptr<std::vector<unsigned char>>
-			data(new std::vector<unsigned char>);
-			data->resize(response.audio_out().audio_data().length());
-			memcpy(&((*data)[0]), response.audio_out().audio_data().c_str(), response.audio_out().audio_data().length());
-			audio_output->Send(data);
+			//LOG(DEBUG) << "<==AssistResponse.audio_out";
+			audio_output->Send(TakeResponseAudio(response_ptr));
 		}
 		// Device Action
+		// Handlers run on the dispatcher's threads, while the response keeps
+		// streaming and playing.
 		if (response.has_device_action()) {
-			std::cout << "<==AssistResponse.device_action" <<std::endl;
-			std::string action_json;
-			action_json = response.device_action().device_request_json();
-			std::cout << action_json <<std::endl;
+			LOG(INFO) << "<==AssistResponse.device_action";
+			LOG(DEBUG) << response.device_action().device_request_json();
+			device_actions->Dispatch(response.device_action().device_request_json());
 		}
 
 		// CUSTOMIZE: render spoken request on screen
 		for (int i = 0; i < response.speech_results_size(); i++) {
-			google::assistant::embedded::v1alpha2::SpeechRecognitionResult result =response.speech_results(i);
-			if (verbose) {
-				std::clog << "<==AssistResponse.speech_results[]: \n"
-					<< result.transcript() << " ("
-					<< std::to_string(result.stability())
-					<< ")" << std::endl;
-			}
+			const google::assistant::embedded::v1alpha2::SpeechRecognitionResult& result = response.speech_results(i);
+			LOG(DEBUG) << "<==AssistResponse.speech_results[]: "
+				<< result.transcript() << " ("
+				<< std::to_string(result.stability())
+				<< ")";
 		}
 		if (response.dialog_state_out().supplemental_display_text().size() > 0) {
 			// CUSTOMIZE: render spoken response on screen
-			std::clog << "<==AssistResponse.dialog_state_out.supplemental_display_text:" << std::endl;
+			LOG(DEBUG) << "<==AssistResponse.dialog_state_out.supplemental_display_text:";
 			std::cout << response.dialog_state_out().supplemental_display_text()
 				<< std::endl;
 		}
 	}
 
 	
+	// The next dialog's input runs the same DSP pipeline, so this one must
+	// be done with it even if the utterance never ended.
+	audio_input->Stop();
 	// Destroy the stream
 	grpc::Status status = stream->Finish();
+	RecordGrpcStatus(status);
 	if (!status.ok()) {
 		// Report the RPC failure.
-		std::cerr << "assistant_sdk failed, error: " << status.error_message() << std::endl;
+		LOG(ERROR) << "assistant_sdk failed, error: " << status.error_message();
+	}
+	if (b_cont) {
+		// Prepare the next turn while the response is still playing.
+		*next_dialog = OpenDialogStream(locale, assistant);
+	} else {
+		// Stop the Audio Output Thread
+		audio_output->Stop();
 	}
-	// Stop the Audio Output Thread
-	audio_output->Stop();
 	return b_cont;
 }
 
+// Sends one text query and prints the reply, without capturing audio. The
+// spoken reply is played on |audio_output|, or dropped if it is null, in
+// which case ALSA is never opened. With |screen_out_path| the visual reply
+// is requested and written there as HTML.
+bool RunTextQuery(const std::string& text_query, const std::string& locale,
+				std::shared_ptr<AssistClient> assistant,
+				std::shared_ptr<AudioOutputALSA> audio_output,
+				std::shared_ptr<DeviceActionDispatcher> device_actions,
+				const std::string& screen_out_path) {
+	if (audio_output && !audio_output->Start()) {
+		return false;
+	}
+	std::unique_ptr<AssistStream> stream = assistant->Open();
+	kDialogsStarted->Increment();
+	AssistRequest config_request =
+		MakeAssistRequestConfig(locale, text_query, !screen_out_path.empty(),
+			audio_output != nullptr);
+	stream->Write(config_request);
+	stream->WritesDone();
+	kUplinkBytes->Increment(config_request.ByteSizeLong());
+	LOG(INFO) << "==>AssistRequest.config text_query";
+
+	std::ofstream screen_out;
+	std::shared_ptr<AssistResponse> response_ptr;
+	while (stream->Read(&response_ptr)) {
+		const AssistResponse& response = *response_ptr;
+		kDownlinkBytes->Increment(response.ByteSizeLong());
+		if (!response.dialog_state_out().conversation_state().empty()) {
+			mConversationState = response.dialog_state_out().conversation_state();
+		}
+		if (response.has_audio_out() && audio_output) {
+			audio_output->Send(TakeResponseAudio(response_ptr));
+		}
+		if (response.has_device_action()) {
+			device_actions->Dispatch(response.device_action().device_request_json());
+		}
+		if (response.has_screen_out() && !screen_out_path.empty()) {
+			if (!screen_out.is_open()) {
+				screen_out.open(screen_out_path);
+			}
+			screen_out << response.screen_out().data();
+		}
+		if (response.dialog_state_out().supplemental_display_text().size() > 0) {
+			std::cout << response.dialog_state_out().supplemental_display_text()
+				<< std::endl;
+		}
+	}
+
+	grpc::Status status = stream->Finish();
+	RecordGrpcStatus(status);
+	if (!status.ok()) {
+		LOG(ERROR) << "assistant_sdk failed, error: " << status.error_message();
+	}
+	if (audio_output) {
+		audio_output->WaitUntilPlayed();
+		audio_output->Stop();
+	}
+	device_actions->Drain();
+	return status.ok();
+}
+
+// Heap touched up front when memory is locked, enough for the audio
+// buffers of a dialog.
+static const size_t kPrefaultHeapBytes = 8 << 20;
+
 int main(int argc, char** argv) {
 	std::string audio_input_source, text_input_source, credentials_file_path, credentials_type, api_endpoint, locale;
+	std::string metrics_address;
+	int keyword_hop_ms = 20;
+	std::string keyword_backend = kDefaultKeywordBackend;
+	std::vector<std::string> keyword_models;
+	bool keyword_gate = true;
+	std::string thread_config;
+	int hedge_ms = 0;
+	std::string hedge_endpoint;
+	bool no_audio = false;
+	std::string screen_out;
+	std::string device_action_dir;
+	std::string record_path;
+	int record_mb = 64;
+	std::string token_cache;
+	std::string audio_shm;
+	int mic_channels = 1;
+	std::string keyword_dsp;
+	std::string dialog_dsp;
 	bool b_cont = true;
 	// Initialize gRPC and DNS resolvers
 	// https://github.com/grpc/grpc/issues/11366#issuecomment-328595941
-        signal(SIGINT, signal_handler);
+        // Block SIGINT before any other thread starts, so they all inherit
+        // the mask and only the watcher receives it.
+        sigset_t shutdown_signals;
+        sigemptyset(&shutdown_signals);
+        sigaddset(&shutdown_signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &shutdown_signals, nullptr);
+        std::thread(WatchShutdownSignal, shutdown_signals).detach();
 	grpc_init();
 	if (!GetCommandLineFlags(argc, argv, &audio_input_source, &text_input_source,
 		&credentials_file_path, &credentials_type,
-		&api_endpoint, &locale)) {
+		&api_endpoint, &locale, &metrics_address, &keyword_hop_ms,
+		&keyword_backend, &keyword_models, &keyword_gate,
+		&thread_config, &hedge_ms, &hedge_endpoint, &no_audio, &screen_out,
+		&device_action_dir, &record_path, &record_mb, &token_cache,
+		&audio_shm, &mic_channels, &keyword_dsp, &dialog_dsp)) {
+		return -1;
+	}
+	if (verbose) {
+		Logger::SetMinLevel(LOG_LEVEL_DEBUG);
+	}
+	if (!thread_config.empty()) {
+		std::string error;
+		if (!ParseThreadConfigs(thread_config, &error)) {
+			LOG(ERROR) << "Invalid thread_config: " << error;
+			return -1;
+		}
+		// Real-time audio threads should not take page faults. Both steps
+		// only warn when the process lacks the privileges.
+		LockMemory(kPrefaultHeapBytes);
+		VerifyThreadConfigs();
+	}
+
+	MetricsServer metrics_server(&MetricsRegistry::Global());
+	if (!metrics_address.empty() && !metrics_server.Start(metrics_address)) {
+		LOG(ERROR) << "Cannot serve metrics on " << metrics_address;
+		return -1;
+	}
+
+	// Capture, streams, state changes and playback are logged for
+	// session_replay while the recorder is active.
+	std::unique_ptr<SessionRecorder> recorder;
+	if (!record_path.empty()) {
+		recorder = SessionRecorder::Create(record_path,
+			static_cast<size_t>(record_mb) << 20);
+		if (!recorder) {
+			return -1;
+		}
+		SessionRecorder::SetActive(recorder.get());
+	}
+
+	// Other processes read the microphone from this ring instead of
+	// opening the capture device again.
+	std::unique_ptr<AudioShmWriter> shm_writer;
+	if (!audio_shm.empty()) {
+		std::string shm_error;
+		shm_writer = AudioShmWriter::Create(audio_shm,
+			AudioShmWriter::Options(), &shm_error);
+		if (!shm_writer) {
+			LOG(ERROR) << shm_error;
+			return -1;
+		}
+		AudioShmWriter::SetActive(shm_writer.get());
+	}
+
+	// The wake word and the dialogs each condition the capture with their
+	// own DSP pipeline. Both are built once, so that the gain and noise
+	// estimates carry over from one wake cycle or dialog to the next.
+	std::string dsp_error;
+	std::unique_ptr<DspPipeline> keyword_pipeline =
+		DspPipeline::Create(keyword_dsp, "keyword", &dsp_error);
+	std::shared_ptr<DspPipeline> dialog_pipeline;
+	if (keyword_pipeline) {
+		dialog_pipeline = DspPipeline::Create(dialog_dsp, "dialog", &dsp_error);
+	}
+	if (!keyword_pipeline || !dialog_pipeline) {
+		LOG(ERROR) << "Invalid DSP pipeline: " << dsp_error;
 		return -1;
 	}
+	if (dialog_pipeline->Empty()) {
+		dialog_pipeline.reset();
+	}
 
 	// Read credentials file.
 	std::ifstream credentials_file(credentials_file_path);
 	if (!credentials_file) {
-		std::cerr << "Credentials file \"" << credentials_file_path
-			<< "\" does not exist." << std::endl;
+		LOG(ERROR) << "Credentials file \"" << credentials_file_path
+			<< "\" does not exist.";
 		return -1;
 	}
 	std::stringstream credentials_buffer;
 	credentials_buffer << credentials_file.rdbuf();
 	std::string credentials = credentials_buffer.str();
-	std::shared_ptr<CallCredentials> call_credentials;
-	call_credentials = grpc::GoogleRefreshTokenCredentials(credentials);
-	if (call_credentials.get() == nullptr) {
-		std::cerr << "Credentials file \"" << credentials_file_path
-			<< "\" is invalid. Check step 5 in README for how to get valid "
-			<< "credentials." << std::endl;
+	// The access token is fetched now and refreshed ahead of expiry, so that
+	// no dialog waits for the token endpoint.
+	AccessTokenSource::Options token_options;
+	token_options.cache_path = token_cache;
+	std::string token_error;
+	std::unique_ptr<AccessTokenSource> token_source =
+		AccessTokenSource::Create(credentials, token_options, &token_error);
+	if (!token_source) {
+		LOG(ERROR) << "Credentials file \"" << credentials_file_path
+			<< "\" is invalid (" << token_error << "). Check step 5 in README "
+			<< "for how to get valid credentials.";
 		return -1;
 	}
+	if (!token_source->Start(&token_error)) {
+		LOG(WARNING) << "No access token yet, retrying in the background: "
+			<< token_error;
+	}
+	std::shared_ptr<CallCredentials> call_credentials =
+		token_source->CallCredentials();
 
 	// Begin a stream.
 
-	auto channel = CreateChannel(api_endpoint);
-	std::shared_ptr<EmbeddedAssistant::Stub> assistant(
-		EmbeddedAssistant::NewStub(channel));
+	std::shared_ptr<AssistClient> assistant(
+		new AssistClient(CreateChannel(api_endpoint), call_credentials));
+	if (hedge_ms > 0) {
+		// A channel of its own, so that a stalled connection of the first one
+		// is not shared.
+		assistant->EnableHedging(
+			CreateChannel(hedge_endpoint.empty() ? api_endpoint : hedge_endpoint),
+			std::chrono::milliseconds(hedge_ms));
+	}
+
+	// Device commands are run by the programs in |device_action_dir| that
+	// are named after them.
+	std::shared_ptr<DeviceActionDispatcher> device_actions(new DeviceActionDispatcher());
+	if (!device_action_dir.empty()) {
+		RegisterDeviceActionPrograms(device_actions.get(), device_action_dir,
+			std::chrono::milliseconds(kDeviceActionTimeoutMs));
+	}
+
+	// A text query is answered once, without the microphone or the wake word.
+	if (!text_input_source.empty()) {
+		std::shared_ptr<AudioOutputALSA> text_audio_output;
+		if (!no_audio) {
+			text_audio_output.reset(new AudioOutputALSA());
+		}
+		bool ok = RunTextQuery(text_input_source, locale, assistant,
+			text_audio_output, device_actions, screen_out);
+		Logger::Flush();
+		return ok ? 0 : -1;
+	}
+
 	std::shared_ptr<AudioOutputALSA> audio_output(new AudioOutputALSA());
         
         mStateManager.init(kUbusSockFd);
 
+	// Load the keyword models once, each wake cycle only re-arms them. All
+	// models listen to the same capture stream; the wake words of each model,
+	// all it reports unless the spec lists them, start a dialog in that
+	// model's locale.
+	KeywordDetect detect;
+	detect.SetHopMs(keyword_hop_ms);
+	detect.SetGate(keyword_gate);
+	detect.SetChannels(mic_channels);
+	if (!keyword_pipeline->Empty()) {
+		detect.SetPipeline(std::move(keyword_pipeline));
+	}
+	if (keyword_models.empty()) {
+		keyword_models.push_back("");
+	}
+	std::string dialog_locale = locale;
+	for (const std::string& spec : keyword_models) {
+		std::string model_file = spec, model_locale = locale;
+		std::vector<std::string> wake_words;
+		size_t colon = spec.find(':');
+		if (colon != std::string::npos) {
+			model_file = spec.substr(0, colon);
+			model_locale = spec.substr(colon + 1);
+			colon = model_locale.find(':');
+			if (colon != std::string::npos) {
+				std::stringstream keywords(model_locale.substr(colon + 1));
+				model_locale.resize(colon);
+				std::string keyword;
+				while (std::getline(keywords, keyword, ',')) {
+					if (!keyword.empty()) {
+						wake_words.push_back(keyword);
+					}
+				}
+			}
+			if (model_locale.empty()) {
+				model_locale = locale;
+			}
+		}
+		std::unique_ptr<KeywordSpotter> spotter = CreateKeywordSpotter(keyword_backend, model_file);
+		if (!spotter) {
+			LOG(ERROR) << "Unknown keyword backend " << keyword_backend;
+			return -1;
+		}
+		std::string name = model_file.empty() ? keyword_backend : model_file;
+		detect.AddModel(name, std::move(spotter));
+		KeywordRegistry::Handler wake =
+			[&dialog_locale, model_locale](const KeywordEvent&) {
+				dialog_locale = model_locale;
+				return true;
+			};
+		if (wake_words.empty()) {
+			detect.Handlers()->RegisterModel(name, wake);
+		}
+		for (const std::string& keyword : wake_words) {
+			detect.Handlers()->Register(name, keyword, wake);
+		}
+	}
+	if (!detect.Init()) {
+		LOG(ERROR) << "Cannot load keyword model";
+		return -1;
+	}
+
 	while(1){
                 mStateManager.changeState(AssistantStateManager::State::IDLE);
-		KeywordDetect detect;
-		detect.InitSNSR();
-		detect.Start();
+		if (!detect.Start()) {
+			LOG(ERROR) << "Cannot start keyword detection";
+			return -1;
+		}
 		detect.Loop();
 		detect.Stop();
 		b_cont = true;
 
+		std::unique_ptr<AssistStream> next_dialog;
 		while(b_cont) {
-			b_cont = StartDialog(locale, assistant, call_credentials, audio_output);
+			b_cont = StartDialog(&next_dialog, dialog_locale, assistant, audio_output,
+				device_actions, mic_channels, dialog_pipeline);
 		}
 	}
 	return 0;
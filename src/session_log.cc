@@ -0,0 +1,198 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "session_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "log.h"
+
+namespace {
+
+const char kMagic[8] = {'A', 'S', 'S', 'T', 'L', 'O', 'G', '1'};
+const uint32_t kVersion = 1;
+const size_t kFileHeaderSize = 16;
+
+size_t Aligned(size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+}  // namespace
+
+std::atomic<SessionRecorder*> SessionRecorder::active_{nullptr};
+
+int64_t SessionTimestampNs(const timespec& time) {
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+int64_t SessionNowNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return SessionTimestampNs(now);
+}
+
+std::unique_ptr<SessionRecorder> SessionRecorder::Create(
+    const std::string& path, size_t capacity_bytes) {
+  std::unique_ptr<SessionRecorder> recorder(new SessionRecorder());
+  recorder->fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (recorder->fd_ < 0) {
+    LOG(ERROR) << "Cannot create session log " << path << ": "
+               << strerror(errno);
+    return nullptr;
+  }
+  size_t size = kFileHeaderSize + Aligned(capacity_bytes);
+  // Allocate the blocks up front, so that a full disk shows now rather
+  // than as SIGBUS on a hot path.
+  int ret = posix_fallocate(recorder->fd_, 0, size);
+  if (ret != 0) {
+    LOG(ERROR) << "Cannot allocate " << size << " bytes for session log "
+               << path << ": " << strerror(ret);
+    return nullptr;
+  }
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    recorder->fd_, 0);
+  if (base == MAP_FAILED) {
+    LOG(ERROR) << "Cannot map session log " << path << ": " << strerror(errno);
+    return nullptr;
+  }
+  recorder->base_ = static_cast<char*>(base);
+  recorder->capacity_ = size;
+  memcpy(recorder->base_, kMagic, sizeof(kMagic));
+  memcpy(recorder->base_ + sizeof(kMagic), &kVersion, sizeof(kVersion));
+  recorder->next_ = kFileHeaderSize;
+  recorder->used_ = kFileHeaderSize;
+  return recorder;
+}
+
+SessionRecorder::~SessionRecorder() {
+  if (Active() == this) {
+    SetActive(nullptr);
+  }
+  if (base_ != nullptr) {
+    munmap(base_, capacity_);
+  }
+  if (fd_ >= 0) {
+    if (ftruncate(fd_, used_.load()) != 0) {
+      LOG(WARNING) << "Cannot truncate session log: " << strerror(errno);
+    }
+    close(fd_);
+  }
+  if (dropped_ > 0) {
+    LOG(WARNING) << "Session log full, dropped " << dropped_ << " records";
+  }
+}
+
+bool SessionRecorder::Begin(SessionRecordType type, uint64_t tag,
+                            int64_t timestamp_ns, size_t size, Slot* slot) {
+  size_t total = sizeof(SessionRecordHeader) + Aligned(size);
+  uint64_t offset = next_.fetch_add(total, std::memory_order_relaxed);
+  if (offset + total > capacity_) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  uint64_t end = offset + total;
+  uint64_t used = used_.load(std::memory_order_relaxed);
+  while (used < end &&
+         !used_.compare_exchange_weak(used, end, std::memory_order_relaxed)) {
+  }
+  slot->header = reinterpret_cast<SessionRecordHeader*>(base_ + offset);
+  slot->header->size = size;
+  slot->header->timestamp_ns = timestamp_ns;
+  slot->header->tag = tag;
+  slot->data = base_ + offset + sizeof(SessionRecordHeader);
+  slot->type = type;
+  return true;
+}
+
+void SessionRecorder::Commit(const Slot& slot) {
+  __atomic_store_n(&slot.header->type, static_cast<uint32_t>(slot.type),
+                   __ATOMIC_RELEASE);
+}
+
+bool SessionRecorder::Append(SessionRecordType type, uint64_t tag,
+                             int64_t timestamp_ns, const void* data,
+                             size_t size) {
+  Slot slot;
+  if (!Begin(type, tag, timestamp_ns, size, &slot)) {
+    return false;
+  }
+  if (size > 0) {
+    memcpy(slot.data, data, size);
+  }
+  Commit(slot);
+  return true;
+}
+
+std::unique_ptr<SessionLogReader> SessionLogReader::Open(
+    const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(kFileHeaderSize)) {
+    close(fd);
+    return nullptr;
+  }
+  void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+  std::unique_ptr<SessionLogReader> reader(new SessionLogReader());
+  reader->base_ = static_cast<const char*>(base);
+  reader->size_ = st.st_size;
+  uint32_t version;
+  memcpy(&version, reader->base_ + sizeof(kMagic), sizeof(version));
+  if (memcmp(reader->base_, kMagic, sizeof(kMagic)) != 0 ||
+      version != kVersion) {
+    return nullptr;
+  }
+  reader->Rewind();
+  return reader;
+}
+
+SessionLogReader::~SessionLogReader() {
+  if (base_ != nullptr) {
+    munmap(const_cast<char*>(base_), size_);
+  }
+}
+
+bool SessionLogReader::Next(SessionRecord* record) {
+  if (offset_ + sizeof(SessionRecordHeader) > size_) {
+    return false;
+  }
+  const SessionRecordHeader* header =
+      reinterpret_cast<const SessionRecordHeader*>(base_ + offset_);
+  uint32_t type = __atomic_load_n(&header->type, __ATOMIC_ACQUIRE);
+  size_t total = sizeof(SessionRecordHeader) + Aligned(header->size);
+  if (type == 0 || offset_ + total > size_) {
+    return false;
+  }
+  record->type = static_cast<SessionRecordType>(type);
+  record->tag = header->tag;
+  record->timestamp_ns = header->timestamp_ns;
+  record->data = base_ + offset_ + sizeof(SessionRecordHeader);
+  record->size = header->size;
+  offset_ += total;
+  return true;
+}
+
+void SessionLogReader::Rewind() { offset_ = kFileHeaderSize; }
@@ -0,0 +1,162 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include <time.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A session log is an append-only binary file of timestamped records,
+// written through a preallocated shared mapping so that it survives a
+// crash and can be read with mmap. The file starts with a 16 byte header,
+// "ASSTLOG1" and the format version, followed by records aligned to 8 bytes:
+//
+//   uint32_t type;          // SessionRecordType, 0 past the last record
+//   uint32_t size;          // payload bytes
+//   int64_t timestamp_ns;   // CLOCK_MONOTONIC
+//   uint64_t tag;           // see SessionRecordType
+//   payload, padded to 8 bytes
+enum class SessionRecordType : uint32_t {
+  // Captured PCM as published by an AudioInput. Tag: index of its first
+  // frame. Timestamped with the capture time.
+  CAPTURE = 1,
+  // Serialized AssistRequest, as written. Tag: stream number.
+  REQUEST = 2,
+  // Serialized AssistResponse, as read. Tag: stream number.
+  RESPONSE = 3,
+  // End of a stream: the client half-closed it. Tag: stream number.
+  WRITES_DONE = 4,
+  // Final status of a stream. Tag: stream number; payload: the gRPC code
+  // as an int32_t followed by the message.
+  STATUS = 5,
+  // AssistantStateManager state change. Tag: the new state.
+  STATE = 6,
+  // PCM written to the playback device. Tag: frames.
+  PLAYBACK = 7,
+};
+
+struct SessionRecordHeader {
+  uint32_t type;
+  uint32_t size;
+  int64_t timestamp_ns;
+  uint64_t tag;
+};
+
+struct SessionRecord {
+  SessionRecordType type;
+  uint64_t tag;
+  int64_t timestamp_ns;
+  // Points into the mapping of the reader.
+  const char* data;
+  size_t size;
+};
+
+int64_t SessionTimestampNs(const timespec& time);
+int64_t SessionNowNs();
+
+// Appends records to a session log. Safe to call from any thread: a record
+// takes one atomic add to reserve its space and a copy, no lock or system
+// call. Records that do not fit in the preallocated file are dropped and
+// counted.
+class SessionRecorder {
+ public:
+  // A reserved record, filled in place and then committed.
+  struct Slot {
+    SessionRecordHeader* header = nullptr;
+    char* data = nullptr;
+    SessionRecordType type;
+  };
+
+  // Creates |path| with room for |capacity_bytes| of records. Returns
+  // nullptr on failure.
+  static std::unique_ptr<SessionRecorder> Create(const std::string& path,
+                                                 size_t capacity_bytes);
+  // Cuts the file down to the records written.
+  ~SessionRecorder();
+
+  // The recorder the hooks in capture, streams, state changes and playback
+  // append to, or nullptr when not recording.
+  static SessionRecorder* Active() {
+    return active_.load(std::memory_order_acquire);
+  }
+  // The recorder must stay alive until it is replaced.
+  static void SetActive(SessionRecorder* recorder) {
+    active_.store(recorder, std::memory_order_release);
+  }
+
+  // Reserves a record of |size| payload bytes. Returns false if the log is
+  // full.
+  bool Begin(SessionRecordType type, uint64_t tag, int64_t timestamp_ns,
+             size_t size, Slot* slot);
+  // Publishes a record reserved with Begin(). Readers see records in the
+  // order they were reserved, and stop at one that is not committed.
+  void Commit(const Slot& slot);
+
+  bool Append(SessionRecordType type, uint64_t tag, int64_t timestamp_ns,
+              const void* data, size_t size);
+  bool Append(SessionRecordType type, uint64_t tag, const void* data,
+              size_t size) {
+    return Append(type, tag, SessionNowNs(), data, size);
+  }
+
+  // Numbers the streams of the session, for REQUEST and RESPONSE tags.
+  uint64_t NextStream() { return streams_.fetch_add(1) + 1; }
+
+  uint64_t Dropped() const { return dropped_.load(); }
+  size_t BytesUsed() const { return used_.load(); }
+
+ private:
+  SessionRecorder() {}
+
+  static std::atomic<SessionRecorder*> active_;
+
+  int fd_ = -1;
+  char* base_ = nullptr;
+  size_t capacity_ = 0;
+  // Next free offset; may run past |capacity_| once full.
+  std::atomic<uint64_t> next_{0};
+  // End of the last record that fit.
+  std::atomic<uint64_t> used_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> streams_{0};
+};
+
+// Reads a session log through a read-only mapping, without copying.
+class SessionLogReader {
+ public:
+  // Returns nullptr if |path| cannot be mapped or is not a session log.
+  static std::unique_ptr<SessionLogReader> Open(const std::string& path);
+  ~SessionLogReader();
+
+  // Returns false after the last complete record.
+  bool Next(SessionRecord* record);
+  void Rewind();
+
+ private:
+  SessionLogReader() {}
+
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+};
+
+#endif
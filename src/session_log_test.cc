@@ -0,0 +1,166 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "session_log.h"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kThreads = 4;
+const int kRecordsPerThread = 10000;
+
+std::string TempPath() {
+  char path[] = "/tmp/session_log_test.XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+  return path;
+}
+
+}  // namespace
+
+int main() {
+  std::string path = TempPath();
+
+  // Records appended concurrently all come back, each thread's in order
+  // and intact.
+  {
+    std::unique_ptr<SessionRecorder> recorder =
+        SessionRecorder::Create(path, 4 << 20);
+    if (!recorder) {
+      std::cerr << "Test failed, cannot create " << path << std::endl;
+      return 1;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+      threads.emplace_back([&recorder, t]() {
+        for (int i = 0; i < kRecordsPerThread; i++) {
+          // Odd sizes, to exercise the padding.
+          std::string payload(i % 13, static_cast<char>('a' + t));
+          recorder->Append(SessionRecordType::CAPTURE, (uint64_t(t) << 32) | i,
+                           i, payload.data(), payload.size());
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    if (recorder->Dropped() != 0) {
+      std::cerr << "Test failed, dropped " << recorder->Dropped() << std::endl;
+      return 1;
+    }
+  }
+  {
+    std::unique_ptr<SessionLogReader> reader = SessionLogReader::Open(path);
+    if (!reader) {
+      std::cerr << "Test failed, cannot read " << path << std::endl;
+      return 1;
+    }
+    std::map<int, int> next;
+    SessionRecord record;
+    int records = 0;
+    while (reader->Next(&record)) {
+      int t = record.tag >> 32;
+      int i = record.tag & 0xffffffff;
+      if (record.type != SessionRecordType::CAPTURE || t >= kThreads ||
+          i != next[t] || record.timestamp_ns != i ||
+          record.size != static_cast<size_t>(i % 13) ||
+          std::string(record.data, record.size) !=
+              std::string(i % 13, static_cast<char>('a' + t))) {
+        std::cerr << "Test failed, bad record " << records << " tag "
+                  << record.tag << std::endl;
+        return 1;
+      }
+      next[t]++;
+      records++;
+    }
+    if (records != kThreads * kRecordsPerThread) {
+      std::cerr << "Test failed, read " << records << " records" << std::endl;
+      return 1;
+    }
+  }
+
+  // A full log drops and counts what does not fit, and the reader stops at
+  // a record that was reserved but never committed.
+  {
+    std::unique_ptr<SessionRecorder> recorder =
+        SessionRecorder::Create(path, 1024);
+    char payload[100] = {};
+    int appended = 0;
+    while (recorder->Append(SessionRecordType::REQUEST, 1, payload,
+                            sizeof(payload))) {
+      appended++;
+    }
+    recorder->Append(SessionRecordType::REQUEST, 1, payload, sizeof(payload));
+    // 24 byte header plus 104 bytes of payload.
+    if (appended != 1024 / 128 || recorder->Dropped() != 2) {
+      std::cerr << "Test failed, appended " << appended << " dropped "
+                << recorder->Dropped() << std::endl;
+      return 1;
+    }
+
+    recorder.reset();
+    recorder = SessionRecorder::Create(path, 1024);
+    SessionRecorder::Slot slot;
+    recorder->Append(SessionRecordType::STATE, 1, nullptr, 0);
+    recorder->Begin(SessionRecordType::STATE, 2, SessionNowNs(), 0, &slot);
+    recorder->Append(SessionRecordType::STATE, 3, nullptr, 0);
+    std::unique_ptr<SessionLogReader> reader = SessionLogReader::Open(path);
+    SessionRecord record;
+    int records = 0;
+    while (reader->Next(&record)) {
+      records++;
+    }
+    recorder->Commit(slot);
+    reader->Rewind();
+    int committed = 0;
+    while (reader->Next(&record)) {
+      committed++;
+    }
+    if (records != 1 || committed != 3) {
+      std::cerr << "Test failed, read " << records << " then " << committed
+                << " records" << std::endl;
+      return 1;
+    }
+  }
+
+  // Closing the recorder cuts the file down to what was written.
+  {
+    std::unique_ptr<SessionRecorder> recorder =
+        SessionRecorder::Create(path, 1 << 20);
+    recorder->Append(SessionRecordType::STATE, 1, nullptr, 0);
+    recorder.reset();
+    FILE* file = fopen(path.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    if (size != 16 + 24) {
+      std::cerr << "Test failed, file is " << size << " bytes" << std::endl;
+      return 1;
+    }
+  }
+
+  unlink(path.c_str());
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,611 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+// Replays a session log recorded with run_assistant --record, to reproduce
+// a field report or to compare two builds on the same input. The recorded
+// responses are served by a stand-in for the Assistant service on a local
+// port, and the recorded microphone audio is fed through the same uplink
+// path as run_assistant, with the original timing or --speed times faster:
+//
+//   ./run_assistant --record session.log ...
+//   ./session_replay session.log
+//   ./session_replay --dump session.log
+//
+// The stand-in answers the n-th stream with the responses of the n-th
+// recorded stream. Each response waits until as much uplink audio has
+// arrived as had been sent before it was read, and then for as long as it
+// took to arrive in the recording. Dialogs are replayed one at a time, in
+// order. For every dialog the tool prints the wait from the end of speech
+// to the first response audio, recorded and replayed, and whether the
+// audio sent upstream matches the recording byte for byte. --record logs
+// the replay itself, so two runs can be compared with --dump.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpc++/grpc++.h>
+
+#include "assist_stream.h"
+#include "audio_input.h"
+#include "session_log.h"
+#include "uplink_packetizer.h"
+
+using google::assistant::embedded::v1alpha2::AssistRequest;
+using google::assistant::embedded::v1alpha2::AssistResponse;
+using google::assistant::embedded::v1alpha2::AssistResponse_EventType_END_OF_UTTERANCE;
+using google::assistant::embedded::v1alpha2::EmbeddedAssistant;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Capture {
+  int64_t timestamp_ns;
+  uint64_t sample_index;
+  const char* data;
+  size_t size;
+};
+
+// A response of a recorded stream, with what it waited for.
+struct ScheduledResponse {
+  AssistResponse response;
+  // Uplink audio bytes written before the response was read.
+  size_t audio_bytes = 0;
+  // Whether the client had half-closed the stream by then.
+  bool writes_done = false;
+  // From when the audio arrived, or the previous response was read if
+  // that was later.
+  int64_t delay_ns = 0;
+};
+
+struct RecordedStream {
+  uint64_t id = 0;
+  AssistRequest config;
+  int64_t config_ns = 0;
+  // 0 if the stream was never half-closed.
+  int64_t writes_done_ns = 0;
+  // 0 if no response carried audio.
+  int64_t first_audio_ns = 0;
+  std::string audio_in;
+  std::vector<ScheduledResponse> responses;
+  grpc::Status status;
+  std::vector<Capture> captures;
+};
+
+static double Ms(int64_t ns) { return ns / 1e6; }
+
+static double Ms(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Splits the log into streams, in the order they were opened, and hands
+// each the audio captured while it was open. Records point into |reader|.
+static std::vector<RecordedStream> LoadStreams(SessionLogReader* reader) {
+  std::map<uint64_t, RecordedStream> streams;
+  // Per stream: cumulative uplink bytes and when each request was written.
+  std::map<uint64_t, std::vector<std::pair<size_t, int64_t>>> writes;
+  std::map<uint64_t, int64_t> last_response_ns;
+  std::vector<Capture> captures;
+  SessionRecord record;
+  reader->Rewind();
+  while (reader->Next(&record)) {
+    if (record.type == SessionRecordType::CAPTURE) {
+      captures.push_back(
+          {record.timestamp_ns, record.tag, record.data, record.size});
+      continue;
+    }
+    if (record.type != SessionRecordType::REQUEST &&
+        record.type != SessionRecordType::RESPONSE &&
+        record.type != SessionRecordType::WRITES_DONE &&
+        record.type != SessionRecordType::STATUS) {
+      continue;
+    }
+    RecordedStream& stream = streams[record.tag];
+    stream.id = record.tag;
+    std::vector<std::pair<size_t, int64_t>>& written = writes[record.tag];
+    switch (record.type) {
+      case SessionRecordType::REQUEST: {
+        AssistRequest request;
+        request.ParseFromArray(record.data, record.size);
+        if (request.has_config() && stream.config_ns == 0) {
+          stream.config = request;
+          stream.config_ns = record.timestamp_ns;
+        }
+        stream.audio_in += request.audio_in();
+        written.emplace_back(stream.audio_in.size(), record.timestamp_ns);
+        break;
+      }
+      case SessionRecordType::WRITES_DONE:
+        stream.writes_done_ns = record.timestamp_ns;
+        break;
+      case SessionRecordType::RESPONSE: {
+        ScheduledResponse scheduled;
+        scheduled.response.ParseFromArray(record.data, record.size);
+        scheduled.audio_bytes = stream.audio_in.size();
+        scheduled.writes_done = stream.writes_done_ns != 0;
+        int64_t anchor_ns = stream.config_ns;
+        if (scheduled.writes_done) {
+          anchor_ns = stream.writes_done_ns;
+        } else {
+          for (const auto& write : written) {
+            if (write.first >= scheduled.audio_bytes) {
+              anchor_ns = write.second;
+              break;
+            }
+          }
+        }
+        anchor_ns = std::max(anchor_ns, last_response_ns[record.tag]);
+        scheduled.delay_ns = std::max<int64_t>(record.timestamp_ns - anchor_ns, 0);
+        last_response_ns[record.tag] = record.timestamp_ns;
+        if (scheduled.response.has_audio_out() && stream.first_audio_ns == 0) {
+          stream.first_audio_ns = record.timestamp_ns;
+        }
+        stream.responses.push_back(std::move(scheduled));
+        break;
+      }
+      case SessionRecordType::STATUS: {
+        int32_t code = 0;
+        if (record.size >= sizeof(code)) {
+          memcpy(&code, record.data, sizeof(code));
+          stream.status = grpc::Status(
+              static_cast<grpc::StatusCode>(code),
+              std::string(record.data + sizeof(code),
+                          record.size - sizeof(code)));
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  std::vector<RecordedStream> result;
+  for (auto& entry : streams) {
+    if (entry.second.config_ns != 0) {
+      result.push_back(std::move(entry.second));
+    }
+  }
+  // Audio captured between opening a stream and half-closing it is what
+  // its uplink listened to.
+  for (RecordedStream& stream : result) {
+    int64_t end_ns = stream.writes_done_ns;
+    for (const Capture& capture : captures) {
+      if (capture.timestamp_ns >= stream.config_ns &&
+          (end_ns == 0 || capture.timestamp_ns <= end_ns)) {
+        stream.captures.push_back(capture);
+      }
+    }
+  }
+  return result;
+}
+
+// Serves the recorded responses, the n-th stream answered from the n-th
+// recording.
+class ReplayAssistantService : public EmbeddedAssistant::Service {
+ public:
+  ReplayAssistantService(const std::vector<RecordedStream>* streams,
+                         double speed)
+      : streams_(streams), speed_(speed) {}
+
+  grpc::Status Assist(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<AssistResponse, AssistRequest>* stream) override {
+    size_t number = calls_++;
+    if (number >= streams_->size()) {
+      return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
+                          "No recorded stream left to replay");
+    }
+    const RecordedStream& recorded = (*streams_)[number];
+
+    std::mutex mutex;
+    std::condition_variable arrived;
+    // Cumulative audio bytes and when each request arrived.
+    std::vector<std::pair<size_t, Clock::time_point>> requests;
+    size_t audio_bytes = 0;
+    bool done = false;
+    Clock::time_point done_time;
+    std::thread reader([&]() {
+      AssistRequest request;
+      while (stream->Read(&request)) {
+        std::unique_lock<std::mutex> lock(mutex);
+        audio_bytes += request.audio_in().size();
+        requests.emplace_back(audio_bytes, Clock::now());
+        arrived.notify_all();
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      done = true;
+      done_time = Clock::now();
+      arrived.notify_all();
+    });
+
+    Clock::time_point previous;
+    for (const ScheduledResponse& scheduled : recorded.responses) {
+      Clock::time_point ready;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        arrived.wait(lock, [&]() {
+          return done || (!scheduled.writes_done && !requests.empty() &&
+                          audio_bytes >= scheduled.audio_bytes);
+        });
+        // A client that stopped early gets the rest right away.
+        ready = done ? done_time : Clock::now();
+        if (!scheduled.writes_done) {
+          for (const auto& request : requests) {
+            if (request.first >= scheduled.audio_bytes) {
+              ready = request.second;
+              break;
+            }
+          }
+        }
+      }
+      std::this_thread::sleep_until(
+          std::max(ready, previous) +
+          std::chrono::nanoseconds(
+              static_cast<int64_t>(scheduled.delay_ns / speed_)));
+      if (context->IsCancelled() || !stream->Write(scheduled.response)) {
+        break;
+      }
+      previous = Clock::now();
+    }
+    reader.join();
+    return recorded.status;
+  }
+
+ private:
+  const std::vector<RecordedStream>* streams_;
+  const double speed_;
+  std::atomic<size_t> calls_{0};
+};
+
+// Publishes the audio captured during a recorded dialog, spaced as it was
+// captured.
+class ReplayAudioInput : public AudioInput {
+ public:
+  ReplayAudioInput(const RecordedStream* stream, double speed)
+      : stream_(stream), speed_(speed) {}
+
+  std::unique_ptr<std::thread> GetBackgroundThread() override {
+    return std::unique_ptr<std::thread>(new std::thread([this]() {
+      Clock::time_point start = Clock::now();
+      AudioPacketPool pool(3200);
+      uint64_t sequence = 0;
+      for (const Capture& capture : stream_->captures) {
+        std::this_thread::sleep_until(
+            start + std::chrono::nanoseconds(static_cast<int64_t>(
+                        (capture.timestamp_ns - stream_->config_ns) / speed_)));
+        if (!is_running_) {
+          break;
+        }
+        AudioPacketPtr packet = pool.Acquire();
+        packet->data.assign(capture.data, capture.data + capture.size);
+        clock_gettime(CLOCK_MONOTONIC, &packet->timestamp);
+        packet->sample_index = capture.sample_index;
+        packet->sequence = sequence++;
+        Publish(packet);
+      }
+      OnStop();
+    }));
+  }
+
+ private:
+  const RecordedStream* stream_;
+  const double speed_;
+};
+
+struct ReplayResult {
+  grpc::StatusCode code = grpc::StatusCode::OK;
+  // From the end of speech to the first response audio, or from the last
+  // uplink write if the audio came first. Not measured without response
+  // audio or uplink writes.
+  bool response_measured = false;
+  double response_ms = 0;
+  std::string audio_in;
+};
+
+// Runs one recorded dialog the way run_assistant does: the recorded config
+// goes out verbatim, audio is sized into requests by an UplinkPacketizer on
+// the input's listener thread, and the input stops at END_OF_UTTERANCE.
+static ReplayResult ReplayDialog(AssistClient* client,
+                                 const RecordedStream& recorded,
+                                 double speed) {
+  ReplayResult result;
+  std::unique_ptr<AssistStream> stream = client->Open();
+  AssistStream* writer = stream.get();
+  writer->Write(recorded.config);
+
+  UplinkPacketizer packetizer;
+  std::atomic<Clock::rep> speech_end{0};
+  std::atomic<Clock::rep> last_write{0};
+  auto write_audio = [writer, &packetizer, &result, &last_write]() {
+    AssistRequest request;
+    request.set_audio_in(packetizer.Audio());
+    Clock::time_point write_start = Clock::now();
+    writer->Write(request);
+    Clock::time_point write_end = Clock::now();
+    last_write = write_end.time_since_epoch().count();
+    double write_seconds =
+        std::chrono::duration<double>(write_end - write_start).count();
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double lag_seconds =
+        (SessionTimestampNs(now) - SessionTimestampNs(packetizer.Timestamp())) /
+        1e9;
+    result.audio_in += packetizer.Audio();
+    packetizer.OnWritten(write_seconds, lag_seconds);
+  };
+  ReplayAudioInput input(&recorded, speed);
+  AudioBus::SubscriberOptions options;
+  options.name = "uplink";
+  options.policy = BusPolicy::COALESCE;
+  options.capacity = 16;
+  input.AddDataListener(
+      [&packetizer, &write_audio](const AudioPacketPtr& packet) {
+        if (packetizer.Add(*packet)) {
+          write_audio();
+        }
+      },
+      options);
+  input.AddStopListener([writer, &packetizer, &write_audio, &speech_end]() {
+    if (packetizer.HasPending()) {
+      write_audio();
+    }
+    speech_end = Clock::now().time_since_epoch().count();
+    writer->WritesDone();
+  });
+  input.Start();
+
+  std::shared_ptr<AssistResponse> response;
+  bool answered = false;
+  while (stream->Read(&response)) {
+    if (response->event_type() == AssistResponse_EventType_END_OF_UTTERANCE) {
+      input.Stop();
+    }
+    if (response->has_audio_out() && !answered) {
+      answered = true;
+      Clock::rep end = speech_end.load();
+      if (end == 0) {
+        end = last_write.load();
+      }
+      if (end != 0) {
+        result.response_measured = true;
+        Clock::time_point spoken{Clock::duration(end)};
+        result.response_ms = Ms(Clock::now() - spoken);
+      }
+    }
+  }
+  input.Stop();
+  result.code = stream->Finish().error_code();
+  return result;
+}
+
+static const char* RecordTypeName(SessionRecordType type) {
+  switch (type) {
+    case SessionRecordType::CAPTURE:
+      return "CAPTURE";
+    case SessionRecordType::REQUEST:
+      return "REQUEST";
+    case SessionRecordType::RESPONSE:
+      return "RESPONSE";
+    case SessionRecordType::WRITES_DONE:
+      return "WRITES_DONE";
+    case SessionRecordType::STATUS:
+      return "STATUS";
+    case SessionRecordType::STATE:
+      return "STATE";
+    case SessionRecordType::PLAYBACK:
+      return "PLAYBACK";
+  }
+  return "UNKNOWN";
+}
+
+// Prints one line per record, timed from the first one.
+static void Dump(SessionLogReader* reader) {
+  SessionRecord record;
+  int64_t start_ns = 0;
+  reader->Rewind();
+  while (reader->Next(&record)) {
+    if (start_ns == 0) {
+      start_ns = record.timestamp_ns;
+    }
+    std::cout << "+" << Ms(record.timestamp_ns - start_ns) << "ms "
+              << RecordTypeName(record.type) << " " << record.tag;
+    if (record.type == SessionRecordType::REQUEST) {
+      AssistRequest request;
+      request.ParseFromArray(record.data, record.size);
+      if (request.has_config()) {
+        std::cout << " config";
+      } else {
+        std::cout << " audio_in " << request.audio_in().size() << " bytes";
+      }
+    } else if (record.type == SessionRecordType::RESPONSE) {
+      AssistResponse response;
+      response.ParseFromArray(record.data, record.size);
+      if (response.event_type() == AssistResponse_EventType_END_OF_UTTERANCE) {
+        std::cout << " END_OF_UTTERANCE";
+      }
+      for (const auto& result : response.speech_results()) {
+        std::cout << " \"" << result.transcript() << "\"";
+      }
+      if (response.has_audio_out()) {
+        std::cout << " audio_out " << response.audio_out().audio_data().size()
+                  << " bytes";
+      }
+      if (response.has_dialog_state_out()) {
+        std::cout << " dialog_state_out";
+      }
+    } else if (record.type == SessionRecordType::STATUS &&
+               record.size >= sizeof(int32_t)) {
+      int32_t code;
+      memcpy(&code, record.data, sizeof(code));
+      std::cout << " code " << code << " "
+                << std::string(record.data + sizeof(code),
+                               record.size - sizeof(code));
+    } else if (record.size > 0) {
+      std::cout << " " << record.size << " bytes";
+    }
+    std::cout << std::endl;
+  }
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: ./session_replay [--speed <factor>] [--dump] "
+            << "[--record <file>] [--record_mb <mb>] <session_log>"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  double speed = 1;
+  bool dump = false;
+  std::string record_path;
+  int record_mb = 64;
+
+  const struct option long_options[] = {
+    {"speed",     required_argument, nullptr, 's'},
+    {"dump",      no_argument,       nullptr, 'd'},
+    {"record",    required_argument, nullptr, 'o'},
+    {"record_mb", required_argument, nullptr, 'q'},
+    {nullptr, 0, nullptr, 0}
+  };
+  while (true) {
+    int option_index;
+    int option_char =
+        getopt_long(argc, argv, "s:do:q:", long_options, &option_index);
+    if (option_char == -1) {
+      break;
+    }
+    switch (option_char) {
+      case 's':
+        speed = atof(optarg);
+        break;
+      case 'd':
+        dump = true;
+        break;
+      case 'o':
+        record_path = optarg;
+        break;
+      case 'q':
+        record_mb = atoi(optarg);
+        break;
+      default:
+        PrintUsage();
+        return 1;
+    }
+  }
+  if (optind + 1 != argc || speed <= 0 || record_mb <= 0) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::unique_ptr<SessionLogReader> reader = SessionLogReader::Open(argv[optind]);
+  if (!reader) {
+    std::cerr << argv[optind] << " is not a session log" << std::endl;
+    return 1;
+  }
+  if (dump) {
+    Dump(reader.get());
+    return 0;
+  }
+  std::vector<RecordedStream> streams = LoadStreams(reader.get());
+  if (streams.empty()) {
+    std::cerr << argv[optind] << " has no dialogs" << std::endl;
+    return 1;
+  }
+
+  ReplayAssistantService service(&streams, speed);
+  int port = 0;
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(),
+                           &port);
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+  if (!server) {
+    std::cerr << "Cannot start the replay server" << std::endl;
+    return 1;
+  }
+  AssistClient client(
+      grpc::CreateChannel("127.0.0.1:" + std::to_string(port),
+                          grpc::InsecureChannelCredentials()),
+      nullptr);
+
+  std::unique_ptr<SessionRecorder> recorder;
+  if (!record_path.empty()) {
+    recorder = SessionRecorder::Create(record_path, size_t(record_mb) << 20);
+    if (!recorder) {
+      return 1;
+    }
+    SessionRecorder::SetActive(recorder.get());
+  }
+
+  Clock::time_point start = Clock::now();
+  int identical = 0;
+  for (size_t i = 0; i < streams.size(); i++) {
+    const RecordedStream& recorded = streams[i];
+    // Dialogs keep their spacing, but one only starts after the previous
+    // has finished.
+    std::this_thread::sleep_until(
+        start + std::chrono::nanoseconds(static_cast<int64_t>(
+                    (recorded.config_ns - streams[0].config_ns) / speed)));
+    ReplayResult result = ReplayDialog(&client, recorded, speed);
+
+    std::cout << "dialog " << i + 1 << ": status " << result.code
+              << " (recorded " << recorded.status.error_code() << ")";
+    bool recorded_response =
+        recorded.writes_done_ns != 0 && recorded.first_audio_ns != 0;
+    if (result.response_measured) {
+      std::cout << ", response " << result.response_ms << "ms";
+    } else if (recorded_response) {
+      std::cout << ", no response measured";
+    }
+    if (recorded_response) {
+      std::cout << " (recorded "
+                << Ms(recorded.first_audio_ns - recorded.writes_done_ns)
+                << "ms)";
+    }
+    if (result.audio_in == recorded.audio_in) {
+      identical++;
+      std::cout << ", uplink audio identical (" << result.audio_in.size()
+                << " bytes)";
+    } else {
+      size_t common = std::min(result.audio_in.size(), recorded.audio_in.size());
+      size_t first_difference =
+          std::mismatch(result.audio_in.begin(),
+                        result.audio_in.begin() + common,
+                        recorded.audio_in.begin()).first -
+          result.audio_in.begin();
+      std::cout << ", uplink audio differs from byte " << first_difference
+                << " (" << result.audio_in.size() << " bytes, recorded "
+                << recorded.audio_in.size() << ")";
+    }
+    std::cout << std::endl;
+  }
+  std::cout << identical << " of " << streams.size()
+            << " dialogs sent identical uplink audio" << std::endl;
+
+  SessionRecorder::SetActive(nullptr);
+  server->Shutdown();
+  return 0;
+}
@@ -1,9 +1,11 @@
 #include "state_manager.h"
 #include <string>
 #include <map>
-#include <iostream>
 #include <thread>
 
+#include "log.h"
+#include "session_log.h"
+
 extern "C" {
 #include <unistd.h>
 
@@ -31,7 +33,7 @@ static void receive_call_result_data(struct ubus_request *req, int type, struct
                 return;
 
         str = blobmsg_format_json_indent(msg, true, -1);
-        std::cout << str << std::endl;
+        LOG(DEBUG) << str;
         free(str);
 }
 
@@ -43,7 +45,7 @@ static int ubus_call(struct ubus_context *ctx, const char *path, const char *met
     if (message && strlen(message)) {
         ret = blobmsg_add_json_from_string(&b, message);
         if (!ret) {
-            std::cerr << "failed to parse message data" << std::endl;
+            LOG(ERROR) << "failed to parse message data";
             return -1;
         }
     }
@@ -51,7 +53,7 @@ static int ubus_call(struct ubus_context *ctx, const char *path, const char *met
     ret = ubus_lookup_id(ctx, path, &id);
 
     if (ret) {
-        std::cerr << "failed to lookup id" << std::endl;
+        LOG(ERROR) << "failed to lookup id";
         return ret;
     }
     return ubus_invoke(ctx, id, method, b.head, receive_call_result_data, NULL, timeout*10000);
@@ -59,6 +61,9 @@ static int ubus_call(struct ubus_context *ctx, const char *path, const char *met
 }
 
 void AssistantStateManager::changeState(AssistantStateManager::State state){
+    if (SessionRecorder* recorder = SessionRecorder::Active()) {
+        recorder->Append(SessionRecordType::STATE, static_cast<uint64_t>(state), nullptr, 0);
+    }
     m_state = state;
     updateLED(state);
     
@@ -86,13 +91,15 @@ void AssistantStateManager::setLED(AssistantStateManager::State state){
 
     ctx = ubus_connect(m_ubus_sock.c_str());
     if (!ctx){
-        std::cerr << "Failed to connect to ubus" <<std::endl;
+        LOG(ERROR) << "Failed to connect to ubus";
         return;
     }
 
     sprintf(msg, "{\"name\":\"%s\"}", state_string.c_str());
     ret = ubus_call(ctx, "ledmgr", "set_condition", msg);
-    std::cout << "ubus_call ret " << ret << std::endl;
+    if (ret != 0) {
+        LOG(WARNING) << "ubus_call ret " << ret;
+    }
     ubus_free(ctx);    
         
 }
@@ -104,13 +111,15 @@ void AssistantStateManager::clearLED(AssistantStateManager::State state){
 
     ctx = ubus_connect(m_ubus_sock.c_str());
     if (!ctx){
-        std::cerr << "Failed to connect to ubus" << std::endl;
+        LOG(ERROR) << "Failed to connect to ubus";
         return;
     }
 
     sprintf(msg, "{\"name\":\"%s\"}", state_string.c_str());
     ret = ubus_call(ctx, "ledmgr", "clear_condition", msg);
-    std::cout << "ubus_call ret " << ret << std::endl;
+    if (ret != 0) {
+        LOG(WARNING) << "ubus_call ret " << ret;
+    }
     ubus_free(ctx);
 }
 void AssistantStateManager::updateLED(AssistantStateManager::State new_state) {
@@ -0,0 +1,298 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "thread_config.h"
+
+#include <alloca.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "log.h"
+
+namespace {
+
+const char* const kRoleNames[kThreadRoleCount] = {"capture", "keyword", "playback"};
+
+std::mutex configs_mutex;
+ThreadConfig configs[kThreadRoleCount];
+// Roles that already warned, so that threads started on every wake cycle do
+// not repeat the warning.
+bool warned[kThreadRoleCount];
+
+const char* PolicyName(int policy) {
+  switch (policy) {
+    case SCHED_FIFO:
+      return "fifo";
+    case SCHED_RR:
+      return "rr";
+    default:
+      return "other";
+  }
+}
+
+std::string CpusName(const std::vector<int>& cpus) {
+  if (cpus.empty()) {
+    return "all cpus";
+  }
+  std::ostringstream out;
+  out << "cpus ";
+  for (size_t i = 0; i < cpus.size(); i++) {
+    out << (i > 0 ? "+" : "") << cpus[i];
+  }
+  return out.str();
+}
+
+bool ParseCpus(const std::string& spec, std::vector<int>* cpus) {
+  std::stringstream stream(spec);
+  std::string item;
+  while (std::getline(stream, item, '+')) {
+    char* end;
+    long first = strtol(item.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    if (item.empty() || *end != '\0' || first < 0 || last < first
+        || last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      if (std::find(cpus->begin(), cpus->end(), cpu) == cpus->end()) {
+        cpus->push_back(cpu);
+      }
+    }
+  }
+  return !cpus->empty();
+}
+
+bool ParseOne(const std::string& item, std::string* error) {
+  size_t equals = item.find('=');
+  if (equals == std::string::npos) {
+    *error = "expected <role>=<policy> in \"" + item + "\"";
+    return false;
+  }
+  std::string role = item.substr(0, equals);
+  int index = 0;
+  while (index < kThreadRoleCount && role != kRoleNames[index]) {
+    index++;
+  }
+  if (index == kThreadRoleCount) {
+    *error = "unknown thread role \"" + role + "\"";
+    return false;
+  }
+
+  std::string rest = item.substr(equals + 1);
+  ThreadConfig config;
+  size_t at = rest.find('@');
+  if (at != std::string::npos) {
+    if (!ParseCpus(rest.substr(at + 1), &config.cpus)) {
+      *error = "invalid cpus in \"" + item + "\"";
+      return false;
+    }
+    rest = rest.substr(0, at);
+  }
+  size_t colon = rest.find(':');
+  std::string policy = rest.substr(0, colon);
+  if (policy == "fifo") {
+    config.policy = SCHED_FIFO;
+  } else if (policy == "rr") {
+    config.policy = SCHED_RR;
+  } else if (policy != "other") {
+    *error = "unknown scheduling policy \"" + policy + "\"";
+    return false;
+  }
+  if (colon != std::string::npos) {
+    config.priority = atoi(rest.c_str() + colon + 1);
+  }
+  if (config.policy != SCHED_OTHER
+      && (config.priority < sched_get_priority_min(config.policy)
+          || config.priority > sched_get_priority_max(config.policy))) {
+    *error = "priority out of range in \"" + item + "\"";
+    return false;
+  }
+  SetThreadConfig(static_cast<ThreadRole>(index), config);
+  return true;
+}
+
+// Applies |config| to the calling thread, and describes what did not take
+// effect in |problems|.
+bool Apply(const ThreadConfig& config, std::string* problems) {
+  std::ostringstream out;
+  pthread_t self = pthread_self();
+
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = config.policy == SCHED_OTHER ? 0 : config.priority;
+  int ret = pthread_setschedparam(self, config.policy, &param);
+  if (ret != 0) {
+    out << " sched_setscheduler(" << PolicyName(config.policy) << ":"
+        << config.priority << ") failed: " << strerror(ret) << ";";
+  }
+  if (!config.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : config.cpus) {
+      CPU_SET(cpu, &set);
+    }
+    ret = pthread_setaffinity_np(self, sizeof(set), &set);
+    if (ret != 0) {
+      out << " sched_setaffinity failed: " << strerror(ret) << ";";
+    }
+  }
+
+  // Read the settings back, the kernel may have clamped or ignored them.
+  int policy;
+  if (pthread_getschedparam(self, &policy, &param) == 0
+      && (policy != config.policy
+          || (policy != SCHED_OTHER && param.sched_priority != config.priority))) {
+    out << " running as " << PolicyName(policy) << ":" << param.sched_priority << ";";
+  }
+  if (!config.cpus.empty()) {
+    cpu_set_t set;
+    if (pthread_getaffinity_np(self, sizeof(set), &set) == 0) {
+      for (int cpu : config.cpus) {
+        if (!CPU_ISSET(cpu, &set)) {
+          out << " not allowed on cpu " << cpu << ";";
+        }
+      }
+    }
+  }
+  *problems = out.str();
+  return problems->empty();
+}
+
+}  // namespace
+
+bool ParseThreadConfigs(const std::string& spec, std::string* error) {
+  std::stringstream stream(spec);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty() && !ParseOne(item, error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SetThreadConfig(ThreadRole role, const ThreadConfig& config) {
+  std::unique_lock<std::mutex> lock(configs_mutex);
+  configs[static_cast<int>(role)] = config;
+}
+
+bool ApplyThreadConfig(ThreadRole role, const char* name, size_t stack_bytes) {
+  char short_name[16];
+  strncpy(short_name, name, sizeof(short_name) - 1);
+  short_name[sizeof(short_name) - 1] = '\0';
+  pthread_setname_np(pthread_self(), short_name);
+
+  // Fault the stack in now rather than in the middle of a period.
+  volatile char* stack = static_cast<volatile char*>(alloca(stack_bytes));
+  for (size_t i = 0; i < stack_bytes; i += 4096) {
+    stack[i] = 0;
+  }
+
+  int index = static_cast<int>(role);
+  ThreadConfig config;
+  {
+    std::unique_lock<std::mutex> lock(configs_mutex);
+    config = configs[index];
+  }
+  std::string problems;
+  if (Apply(config, &problems)) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(configs_mutex);
+  if (!warned[index]) {
+    warned[index] = true;
+    LOG(WARNING) << "Thread " << name << " (" << kRoleNames[index]
+                 << ") keeps default scheduling:" << problems;
+  }
+  return false;
+}
+
+bool VerifyThreadConfigs() {
+  bool ok = true;
+  for (int index = 0; index < kThreadRoleCount; index++) {
+    ThreadConfig config;
+    {
+      std::unique_lock<std::mutex> lock(configs_mutex);
+      config = configs[index];
+    }
+    std::string problems;
+    std::thread probe([&config, &problems, &ok]() {
+      ok = Apply(config, &problems) && ok;
+    });
+    probe.join();
+    if (problems.empty()) {
+      LOG(INFO) << "Thread role " << kRoleNames[index] << ": "
+                << PolicyName(config.policy) << ":" << config.priority
+                << " on " << CpusName(config.cpus);
+    } else {
+      LOG(WARNING) << "Thread role " << kRoleNames[index]
+                   << " cannot be configured as requested:" << problems;
+    }
+  }
+  if (!ok) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 && geteuid() != 0) {
+      LOG(WARNING) << "RLIMIT_RTPRIO is " << limit.rlim_cur
+                   << "; real-time priorities need root, CAP_SYS_NICE or a higher limit";
+    }
+  }
+  return ok;
+}
+
+bool LockMemory(size_t prefault_heap_bytes) {
+  // Keep freed memory in the heap instead of returning it to the kernel, and
+  // serve large allocations from the heap, so that locked pages stay used.
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  rlimit limit;
+  bool unlimited = geteuid() == 0
+      || (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY);
+  int flags = unlimited ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+  bool locked = mlockall(flags) == 0;
+  if (!locked) {
+    LOG(WARNING) << "mlockall failed: " << strerror(errno)
+                 << "; audio threads may take page faults";
+  } else if (!unlimited) {
+    LOG(INFO) << "mlockall locked current memory only, RLIMIT_MEMLOCK is limited";
+  }
+
+  if (prefault_heap_bytes > 0) {
+    void* heap = malloc(prefault_heap_bytes);
+    if (heap != nullptr) {
+      volatile char* pages = static_cast<volatile char*>(heap);
+      for (size_t i = 0; i < prefault_heap_bytes; i += 4096) {
+        pages[i] = 0;
+      }
+      free(heap);
+    }
+  }
+  return locked;
+}
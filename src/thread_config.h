@@ -0,0 +1,76 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef THREAD_CONFIG_H
+#define THREAD_CONFIG_H
+
+#include <sched.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Scheduling of the audio threads. Each audio thread calls
+// ApplyThreadConfig() with its role when it starts. Without a configuration
+// threads are only named. When the process lacks the privileges for a
+// setting, the thread keeps running with the default and a warning is
+// logged once per role.
+
+enum class ThreadRole {
+  // ALSA capture, for keyword detection and for the dialog uplink.
+  CAPTURE,
+  // Keyword model workers.
+  KEYWORD,
+  // ALSA playback.
+  PLAYBACK,
+};
+static const int kThreadRoleCount = 3;
+
+struct ThreadConfig {
+  // SCHED_OTHER, SCHED_FIFO or SCHED_RR.
+  int policy = SCHED_OTHER;
+  // 1-99 for SCHED_FIFO and SCHED_RR, ignored otherwise.
+  int priority = 0;
+  // CPUs the thread may run on; empty for all.
+  std::vector<int> cpus;
+};
+
+// Parses a comma-separated list of <role>=<policy>[:<priority>][@<cpus>],
+// e.g. "capture=fifo:70@1,keyword=other@2-3,playback=rr:60". Roles are
+// capture, keyword and playback; policies are other, fifo and rr; cpus is a
+// list of CPUs and ranges separated by '+', e.g. "0+2-3". Roles that are not
+// listed keep the default.
+bool ParseThreadConfigs(const std::string& spec, std::string* error);
+void SetThreadConfig(ThreadRole role, const ThreadConfig& config);
+
+// Names the calling thread (up to 15 characters), applies the configuration
+// of |role| to it and touches |stack_bytes| of stack so that it is resident.
+// Returns true if every setting took effect.
+bool ApplyThreadConfig(ThreadRole role, const char* name,
+                       size_t stack_bytes = 64 * 1024);
+
+// Tries the configuration of every role on a short-lived thread at startup
+// and logs what took effect. Returns false if anything did not.
+bool VerifyThreadConfigs();
+
+// Locks the process memory so that audio threads do not take page faults,
+// and keeps freed heap memory in the process. |prefault_heap_bytes| of heap
+// are touched up front. Memory allocated later is locked too when the
+// process may lock unlimited memory; otherwise only current memory is, as
+// locking future memory under a limit makes allocations fail.
+bool LockMemory(size_t prefault_heap_bytes);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "thread_config.h"
+
+#include <pthread.h>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "log.h"
+
+int main() {
+  std::string error;
+  const char* bad_specs[] = {
+    "capture", "mic=fifo:70", "capture=idle", "capture=fifo:0",
+    "capture=fifo:70@", "capture=fifo:70@3-1", "keyword=other@x",
+  };
+  for (const char* spec : bad_specs) {
+    if (ParseThreadConfigs(spec, &error)) {
+      std::cerr << "Test failed, accepted \"" << spec << "\"" << std::endl;
+      return 1;
+    }
+  }
+  if (!ParseThreadConfigs("capture=fifo:70@0,keyword=other@0+0-0,playback=rr:10", &error)) {
+    std::cerr << "Test failed, " << error << std::endl;
+    return 1;
+  }
+
+  // The thread is named whatever happens to the scheduling settings, and a
+  // missing privilege is not fatal.
+  std::thread thread([]() {
+    bool realtime = ApplyThreadConfig(ThreadRole::CAPTURE, "capture-thread-long-name");
+    char name[16];
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    if (strcmp(name, "capture-thread-") != 0) {
+      std::cerr << "Test failed, thread named " << name << std::endl;
+      exit(1);
+    }
+    int policy;
+    sched_param param;
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    if (realtime != (policy == SCHED_FIFO && param.sched_priority == 70)) {
+      std::cerr << "Test failed, ApplyThreadConfig returned " << realtime
+                << " for policy " << policy << std::endl;
+      exit(1);
+    }
+    if (!ApplyThreadConfig(ThreadRole::KEYWORD, "keyword")) {
+      std::cerr << "Test failed, SCHED_OTHER on cpu 0 not applied" << std::endl;
+      exit(1);
+    }
+  });
+  thread.join();
+  VerifyThreadConfigs();
+  LockMemory(1 << 20);
+  Logger::Flush();
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
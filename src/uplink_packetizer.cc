@@ -0,0 +1,58 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "uplink_packetizer.h"
+
+#include <algorithm>
+
+UplinkPacketizer::UplinkPacketizer(const Options& options)
+    : options_(options),
+      chunk_ms_(std::min(std::max(options.initial_ms, options.min_ms),
+                         options.max_ms)) {
+  pending_.reserve(options_.max_ms * options_.bytes_per_ms);
+}
+
+void UplinkPacketizer::Reset() {
+  pending_.clear();
+  fast_writes_ = 0;
+}
+
+bool UplinkPacketizer::Add(const AudioPacket& packet) {
+  if (pending_.empty()) {
+    timestamp_ = packet.timestamp;
+  }
+  pending_.append(reinterpret_cast<const char*>(packet.data.data()),
+                  packet.data.size());
+  return pending_.size() >=
+         static_cast<size_t>(chunk_ms_ * options_.bytes_per_ms);
+}
+
+void UplinkPacketizer::OnWritten(double write_seconds, double lag_seconds) {
+  pending_.clear();
+  double chunk_seconds = chunk_ms_ / 1000.0;
+  if (write_seconds > chunk_seconds / 2 || lag_seconds > 2 * chunk_seconds) {
+    chunk_ms_ = std::min(chunk_ms_ * 2, options_.max_ms);
+    fast_writes_ = 0;
+  } else if (write_seconds < chunk_seconds / 10) {
+    if (++fast_writes_ >= options_.fast_writes_to_shrink) {
+      chunk_ms_ = std::max(chunk_ms_ / 2, options_.min_ms);
+      fast_writes_ = 0;
+    }
+  } else {
+    fast_writes_ = 0;
+  }
+}
@@ -0,0 +1,80 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef UPLINK_PACKETIZER_H
+#define UPLINK_PACKETIZER_H
+
+#include <time.h>
+
+#include <cstddef>
+#include <string>
+
+#include "audio_packet.h"
+
+// Groups captured audio into audio_in requests whose size follows the
+// network. Small requests let the server endpoint sooner; large ones cost
+// fewer writes and HTTP/2 frames when the stream is backed up. After each
+// write the chunk doubles if the write blocked for more than half a chunk
+// or the audio waited more than two chunks to be sent, and halves after a
+// run of writes that took under a tenth of a chunk.
+//
+// Not thread-safe; the uplink listener owns it.
+class UplinkPacketizer {
+ public:
+  struct Options {
+    int min_ms = 20;
+    int max_ms = 200;
+    int initial_ms = 100;
+    // 16000Hz, 2 bytes per sample.
+    int bytes_per_ms = 32;
+    // Fast writes in a row before the chunk shrinks.
+    int fast_writes_to_shrink = 10;
+  };
+
+  UplinkPacketizer() : UplinkPacketizer(Options()) {}
+  explicit UplinkPacketizer(const Options& options);
+
+  // Drops pending audio for a new stream. The chunk size carries over, it
+  // is what the network allowed last time.
+  void Reset();
+
+  // Appends |packet|. Returns true once a chunk is ready in Audio(). A
+  // packet already merged by the bus is never split, so a backed-up stream
+  // sends everything queued in one request.
+  bool Add(const AudioPacket& packet);
+  // Whether audio is pending, to be sent at the end of the utterance.
+  bool HasPending() const { return !pending_.empty(); }
+
+  const std::string& Audio() const { return pending_; }
+  // Capture time of the first frame in Audio().
+  const timespec& Timestamp() const { return timestamp_; }
+
+  // Clears Audio() after it was written. |write_seconds| is how long the
+  // write blocked, |lag_seconds| the age of its first frame afterwards.
+  void OnWritten(double write_seconds, double lag_seconds);
+
+  int ChunkMs() const { return chunk_ms_; }
+
+ private:
+  const Options options_;
+  int chunk_ms_;
+  int fast_writes_ = 0;
+  std::string pending_;
+  timespec timestamp_ = {0, 0};
+};
+
+#endif
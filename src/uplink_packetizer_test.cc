@@ -0,0 +1,116 @@
+/*
+Copyright 2017 Google Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "uplink_packetizer.h"
+
+#include <iostream>
+
+namespace {
+
+const size_t kPacketBytes = 640;  // 20ms at 16kHz.
+
+// Sends |packets| 20ms packets through |packetizer|, with writes that block
+// for |write_seconds|. Returns the number of requests written.
+int Stream(UplinkPacketizer* packetizer, int packets, double write_seconds) {
+  AudioPacket packet;
+  packet.data.assign(kPacketBytes, 0);
+  int requests = 0;
+  for (int i = 0; i < packets; i++) {
+    if (packetizer->Add(packet)) {
+      packetizer->OnWritten(write_seconds, packetizer->ChunkMs() / 1000.0);
+      requests++;
+    }
+  }
+  return requests;
+}
+
+}  // namespace
+
+int main() {
+  // On a fast network the chunk shrinks to the minimum.
+  {
+    UplinkPacketizer packetizer;
+    Stream(&packetizer, 500, 0.001);
+    if (packetizer.ChunkMs() != 20) {
+      std::cerr << "Test failed, fast network chunk " << packetizer.ChunkMs()
+                << "ms" << std::endl;
+      return 1;
+    }
+  }
+
+  // When writes block for 60ms, the chunk grows until a write takes at most
+  // half of it, and stays there.
+  {
+    UplinkPacketizer::Options options;
+    options.initial_ms = 20;
+    UplinkPacketizer packetizer(options);
+    Stream(&packetizer, 50, 0.06);
+    int settled_ms = packetizer.ChunkMs();
+    int requests = Stream(&packetizer, 500, 0.06);
+    if (settled_ms < 120 || settled_ms > 200 ||
+        packetizer.ChunkMs() != settled_ms || requests > 500 / 6) {
+      std::cerr << "Test failed, slow network chunk " << settled_ms << "ms then "
+                << packetizer.ChunkMs() << "ms, " << requests << " requests"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // Audio that waited in the queue grows the chunk even if writes are fast.
+  {
+    UplinkPacketizer packetizer;
+    AudioPacket packet;
+    packet.data.assign(5 * kPacketBytes, 0);
+    packetizer.Add(packet);
+    packetizer.OnWritten(0.001, 0.5);
+    if (packetizer.ChunkMs() != 200) {
+      std::cerr << "Test failed, lagging chunk " << packetizer.ChunkMs()
+                << "ms" << std::endl;
+      return 1;
+    }
+  }
+
+  // A packet merged by the bus goes out whole, stamped with its capture time;
+  // Reset() drops pending audio but keeps the chunk size.
+  {
+    UplinkPacketizer packetizer;
+    AudioPacket small;
+    small.data.assign(kPacketBytes, 0);
+    small.timestamp = {7, 0};
+    AudioPacket merged;
+    merged.data.assign(20 * kPacketBytes, 0);
+    merged.timestamp = {8, 0};
+    bool ready = !packetizer.Add(small) && packetizer.Add(merged);
+    if (!ready || packetizer.Audio().size() != 21 * kPacketBytes ||
+        packetizer.Timestamp().tv_sec != 7) {
+      std::cerr << "Test failed, merged packet gave "
+                << packetizer.Audio().size() << " bytes" << std::endl;
+      return 1;
+    }
+    packetizer.OnWritten(0.2, 0.5);
+    packetizer.Add(small);
+    packetizer.Reset();
+    if (packetizer.HasPending() || packetizer.ChunkMs() != 200) {
+      std::cerr << "Test failed, Reset() kept " << packetizer.Audio().size()
+                << " bytes, chunk " << packetizer.ChunkMs() << "ms" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}